@@ -0,0 +1,982 @@
+// arith_client.c
+// Connection handles and the FIFO / shared-memory / socket transports behind
+// arith_client.h, one entry of transports[] per mode, the memfd arrays of
+// the socket's array operations, big integers and expressions. Every piece of
+// per-connection state lives in the handle, so independent handles (one per
+// thread) never interfere.
+
+#define _GNU_SOURCE
+#include <stdio.h>      // snprintf
+#include <stdlib.h>     // calloc, free
+#include <stdbool.h>    // bool
+#include <string.h>     // memcpy, memset, strlen, strcmp
+#include <errno.h>      // errno
+#include <unistd.h>     // read, write, close, unlink, getpid, sysconf
+#include <fcntl.h>      // open flags, F_ADD_SEALS
+#include <poll.h>       // poll
+#include <pthread.h>    // mutex and condition variable (autobatch_us)
+#include <signal.h>     // kill
+#include <stdatomic.h>  // atomic_uint
+#include <time.h>       // clock_gettime
+#include <sys/stat.h>   // mkfifo
+#include <sys/mman.h>   // shm_open, mmap, memfd_create, mlock
+#include <sys/socket.h> // socket, connect, send, recv
+#include <sys/un.h>     // struct sockaddr_un
+
+#include "arith_client.h"
+#include "shmchan.h"    // shared-memory channel layout (ARITH_MODE_SHM)
+#include "transport.h"  // socket path, recvmmsg batching (ARITH_MODE_SOCK)
+#include "busypoll.h"   // polling for answers before sleeping (busy_poll_us)
+#include "profile.h"    // stage timestamps (make profile)
+#include "bignum.h"     // decimal conversions (arith_big_parse/format)
+#include "expr.h"       // infix expressions (arith_expr_parse)
+
+typedef struct {
+    uint32_t   id;        // call in this slot
+    bool       used;      // outstanding (v1: answered, callback not run yet)
+    int32_t    status;    // v1: the answer
+    int64_t    result;
+    arith_cb_t cb;
+    void      *user;
+} pending_t;
+
+typedef struct transport transport_t; // per-mode operations (see "Transports")
+typedef struct ab_group ab_group_t;   // calls merged into one batch (see "Auto-batching")
+
+struct arith_conn {
+    enum arith_mode mode;
+    const transport_t *tp;              // &transports[mode]
+    int       req_fd, resp_fd;          // FIFO channels (-1 => closed)
+    int       sock;                     // socket mode: the connection (-1 => closed)
+    char      req_fifo[32];             // server request FIFO or one of its shards
+    char      resp_fifo[RESP_NAME_MAX]; // our response FIFO ("" in shm and socket modes)
+    uint16_t  session;                  // v2 session id (0 => not registered)
+    uint8_t   sched_class;              // enum arith_class declared to the server
+    uint32_t  next_id;                  // request ids
+    shm_chan_t *ch;                     // shm: our mapped channel
+    unsigned  spin, spin_max;           // shm: adaptive spin budget and its cap
+    uint64_t  busy_ns;                  // busy_poll_us in ns (0 => off)
+    unsigned  npending, cap;            // calls outstanding, and at most
+    uint32_t  v1_deliver;               // v1: next id whose callback is due
+    uint64_t  ab_window_ns;             // autobatch_us in ns (0 => off)
+    size_t    ab_max;                   // autobatch_max
+    pthread_mutex_t ab_lock;            // guards the ab_* fields below
+    pthread_cond_t  ab_cond;            // a group closed or got its answers
+    ab_group_t *ab_open;                // group taking calls (NULL => the next call opens one)
+    bool      ab_sending;               // a group is out: its leader owns the channels
+    size_t    ab_inside;                // threads in arith_call on this handle
+    size_t    rlen;                     // bytes of a partial answer in rbuf
+    char      rbuf[64*sizeof(v2_response_t)];
+    pending_t pend[ARITH_MAX_PENDING];  // by id % cap
+};
+
+static atomic_uint conn_seq; // tells the FIFOs / segments of one process's handles apart
+
+// ---- I/O helpers ----
+
+// Read exactly n bytes; returns bytes read (short only at EOF) or -1
+static ssize_t read_full(int fd, void *buf, size_t n){
+    PROF_BEGIN(t);
+    size_t off=0;
+    while(off<n){
+        ssize_t r=read(fd,(char*)buf+off,n-off);
+        if(r==0) break;                         // EOF: return bytes read so far
+        if(r<0){ if(errno==EINTR) continue; return -1; }
+        off+=(size_t)r;
+    }
+    PROF_END(PROF_READ,t);
+    return (ssize_t)off;
+}
+
+// Write exactly n bytes or return -1 on error
+static ssize_t write_full(int fd, const void *buf, size_t n){
+    PROF_BEGIN(t);
+    size_t off=0;
+    while(off<n){
+        ssize_t w=write(fd,(const char*)buf+off,n-off);
+        if(w<0){ if(errno==EINTR) continue; return -1; }
+        off+=(size_t)w;
+    }
+    PROF_END(PROF_WRITE,t);
+    return (ssize_t)off;
+}
+
+static uint64_t now_ms(void){
+    struct timespec ts; clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (uint64_t)ts.tv_sec*1000u+(uint64_t)ts.tv_nsec/1000000u;
+}
+
+// Milliseconds left until `deadline` for a wait of timeout_ms (-1 => forever)
+static int ms_left(int timeout_ms, uint64_t deadline){
+    if(timeout_ms<0) return -1;
+    uint64_t now=now_ms();
+    return now>=deadline ? 0 : (int)(deadline-now);
+}
+
+// Pick the request FIFO: a shard if the server publishes any (the one asked
+// for, or one by hashing PID and handle number), else the well-known FIFO
+static void pick_request_fifo(arith_conn_t *c, int shard, unsigned seq){
+    snprintf(c->req_fifo,sizeof(c->req_fifo),"%s",REQ_FIFO_PATH);
+    FILE *f=fopen(REQ_SHARDS_PATH,"r");
+    if(!f) return; // server runs without shards
+    int n=0;
+    if(fscanf(f,"%d",&n)!=1) n=0;
+    fclose(f);
+    if(n<1 || n>REQ_SHARDS_MAX) return;
+    unsigned h=((unsigned)getpid()*2654435761u)^(seq*40503u); // threads of one process spread too
+    int k= shard>=0 ? shard%n : (int)(h%(unsigned)n);
+    snprintf(c->req_fifo,sizeof(c->req_fifo),REQ_SHARD_FMT,k);
+}
+
+// Open the request FIFO (blocks until a server is reading it). A shard that
+// vanished (the server restarted with fewer) falls back to the well-known FIFO.
+static int open_request_fifo(arith_conn_t *c){
+    int fd=open(c->req_fifo,O_WRONLY|O_CLOEXEC);
+    if(fd<0 && errno==ENOENT && strcmp(c->req_fifo,REQ_FIFO_PATH)){
+        snprintf(c->req_fifo,sizeof(c->req_fifo),"%s",REQ_FIFO_PATH);
+        fd=open(c->req_fifo,O_WRONLY|O_CLOEXEC);
+    }
+    return fd;
+}
+
+// ---- Persistent FIFO channels (v1 session, v2) ----
+
+// Open the channels if needed and send one frame. On failure the request
+// channel is closed again so the next send reconnects (EPIPE means the
+// server went away or was restarted).
+static int fifo_send(arith_conn_t *c, const void *frame, size_t len){
+    if(c->resp_fd<0){
+        // O_RDWR: we are a writer of our own FIFO too, so this open never blocks
+        // and reads wait for data instead of seeing EOF between server writes.
+        c->resp_fd=open(c->resp_fifo,O_RDWR|O_CLOEXEC);
+        if(c->resp_fd<0) return -1;
+    }
+    if(c->req_fd<0){
+        c->req_fd=open_request_fifo(c);
+        if(c->req_fd<0) return -1;
+    }
+    if(write_full(c->req_fd,frame,len)<0){
+        int e=errno; close(c->req_fd); c->req_fd=-1; errno=e;
+        return -1;
+    }
+    return 0;
+}
+
+// ---- v1 ----
+
+// Status code of a v1 error string (the server sends arith_status_str() text)
+static int v1_status(const response_msg_t *rp){
+    if(rp->success) return ARITH_OK;
+    for(int s=1;s<ARITH_STATUS_COUNT;s++) if(!strcmp(rp->error,arith_status_str(s))) return s;
+    return ARITH_EINVALOP;
+}
+
+// Send one request over fresh channels (open/close per transaction)
+static ssize_t v1_oneshot(arith_conn_t *c, const request_msg_t *rq, response_msg_t *rp){
+    // This open blocks if the server isn't running and has no reader
+    int req_fd=open_request_fifo(c);
+    if(req_fd<0) return -1;
+    if(write_full(req_fd,rq,sizeof(*rq))<0){ int e=errno; close(req_fd); errno=e; return -1; }
+    close(req_fd);
+
+    ssize_t rr=0;
+    for(int attempt=0; attempt<3 && rr==0; attempt++){
+        int rfd=open(c->resp_fifo,O_RDONLY|O_CLOEXEC); // blocks until the server opens the writer
+        if(rfd<0) return -1;
+        rr=read_full(rfd,rp,sizeof(*rp));
+        close(rfd);
+        // rr==0: the open paired with the writer of our *previous* response,
+        // which then closed before our answer was written; just reopen.
+    }
+    return rr;
+}
+
+// One v1 call; returns its status or -1
+static int v1_call(arith_conn_t *c, uint8_t op, int64_t a, int64_t b, int64_t *res){
+    request_msg_t rq; memset(&rq,0,sizeof(rq));
+    if(op<ARITH_OP_COUNT) memcpy(rq.operation,arith_ops[op].name,strlen(arith_ops[op].name)); // names fit OP_MAX (ops.h)
+    rq.operand1=a; rq.operand2=b; rq.client_pid=getpid();
+    memcpy(rq.resp_fifo,c->resp_fifo,sizeof(rq.resp_fifo));
+
+    response_msg_t rp; ssize_t rr;
+    if(c->mode==ARITH_MODE_V1_ONESHOT) rr=v1_oneshot(c,&rq,&rp);
+    else {
+        for(int attempt=0;;attempt++){
+            if(fifo_send(c,&rq,sizeof(rq))==0) break;
+            if(errno!=EPIPE || attempt) return -1; // else: reconnect once
+        }
+        rr=read_full(c->resp_fd,&rp,sizeof(rp));
+    }
+    if(rr<0) return -1;
+    if((size_t)rr<sizeof(rp)){ errno=EPROTO; return -1; }
+    *res=rp.result;
+    return v1_status(&rp);
+}
+
+// ---- v2 over the FIFOs ----
+
+// Register our response FIFO (hello) and keep the session id
+static int v2_hello(arith_conn_t *c){
+    struct __attribute__((packed)) { v2_hello_t h; char path[RESP_NAME_MAX]; } f;
+    size_t plen=strlen(c->resp_fifo);
+    f.h.type=ARITH_FRAME_HELLO; f.h.version=ARITH_PROTO_VERSION; f.h.path_len=(uint8_t)plen;
+    f.h.sched_class=c->sched_class; f.h.client_pid=(int32_t)getpid(); f.h.req_id=c->next_id++;
+    memcpy(f.path,c->resp_fifo,plen);
+    if(fifo_send(c,&f,sizeof(f.h)+plen)<0) return -1;
+    v2_response_t ack;
+    do { // skip stale answers to calls an earlier server never finished
+        ssize_t rr=read_full(c->resp_fd,&ack,sizeof(ack));
+        if(rr<0) return -1;
+        if(rr!=(ssize_t)sizeof(ack)){ errno=EPROTO; return -1; }
+    } while(ack.req_id!=f.h.req_id);
+    if(ack.status!=ARITH_OK){ errno=ECONNREFUSED; return -1; }
+    c->session=(uint16_t)ack.result;
+    c->rlen=0;
+    return 0;
+}
+
+// Send a v2 frame whose session field is at `session_off`, (re)registering
+// first if needed; a restarted server is met by one re-registration
+static int v2_send(arith_conn_t *c, void *frame, size_t len, size_t session_off){
+    for(int attempt=0;;attempt++){
+        if(!c->session && v2_hello(c)<0) return -1;
+        memcpy((char*)frame+session_off,&c->session,sizeof(c->session));
+        if(fifo_send(c,frame,len)==0) return 0;
+        if(errno!=EPIPE || attempt) return -1;
+        c->session=0; // server restarted: register again
+    }
+}
+
+// ---- v2 over shared memory ----
+
+// Create our segment, ask the server to attach it and wait for its answer.
+// The name is unlinked once the server has it mapped (or refused it), so a
+// crash never leaves a stale segment behind.
+static int shm_attach(arith_conn_t *c, unsigned seq){
+    char name[SHM_NAME_MAX];
+    snprintf(name,sizeof(name),SHM_NAME_PREFIX "%d_%u",(int)getpid(),seq);
+    shm_unlink(name); // leftover of an earlier process with our PID
+    int fd=shm_open(name,O_RDWR|O_CREAT|O_EXCL,0600);
+    if(fd<0) return -1;
+    if(ftruncate(fd,sizeof(shm_chan_t))<0){ int e=errno; close(fd); shm_unlink(name); errno=e; return -1; }
+    shm_chan_t *ch=mmap(NULL,sizeof(*ch),PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+    close(fd);
+    if(ch==MAP_FAILED){ int e=errno; shm_unlink(name); errno=e; return -1; }
+    ch->magic=SHM_CHAN_MAGIC; ch->version=ARITH_PROTO_VERSION; ch->client_pid=(int32_t)getpid(); // rest zeroed by ftruncate
+
+    struct __attribute__((packed)) { v2_hello_t h; char name[SHM_NAME_MAX]; } f;
+    size_t nlen=strlen(name);
+    f.h.type=ARITH_FRAME_ATTACH; f.h.version=ARITH_PROTO_VERSION; f.h.path_len=(uint8_t)nlen;
+    f.h.sched_class=ARITH_CLASS_NORMAL; f.h.client_pid=(int32_t)getpid(); f.h.req_id=c->next_id++;
+    memcpy(f.name,name,nlen);
+    int rfd=open_request_fifo(c);
+    if(rfd<0 || write_full(rfd,&f,sizeof(f.h)+nlen)<0){
+        int e=errno; if(rfd>=0) close(rfd);
+        munmap(ch,sizeof(*ch)); shm_unlink(name); errno=e; return -1;
+    }
+    close(rfd);
+
+    unsigned st;
+    for(int waited=0; (st=atomic_load(&ch->state))==SHM_PENDING && waited<50; waited++) // up to ~5s
+        shm_futex_wait(&ch->state,SHM_PENDING,SHM_WAIT_MS);
+    shm_unlink(name);
+    if(st!=SHM_ATTACHED){
+        munmap(ch,sizeof(*ch));
+        errno= st==SHM_PENDING ? ETIMEDOUT : ECONNREFUSED; // refused: server lacks --transport shm
+        return -1;
+    }
+    c->ch=ch; c->spin=c->spin_max;
+    return 0;
+}
+
+// Wait for *w to move past `seen` for up to ms; -1 (ECONNRESET) once the
+// server has closed the channel or died
+static int shm_await(arith_conn_t *c, atomic_uint *w, atomic_uint *waiters, unsigned seen, int ms){
+    if(shm_wait(w,waiters,seen,&c->spin,c->spin_max,ms)) return 0;
+    if(atomic_load(&c->ch->state)==SHM_CLOSED || (kill(c->ch->server_pid,0)<0 && errno==ESRCH)){
+        errno=ECONNRESET; return -1;
+    }
+    return 0;
+}
+
+// Queue one call in the request ring (waits while the ring is full)
+static int shm_send(arith_conn_t *c, uint8_t op, int64_t a, int64_t b, uint32_t id){
+    shm_spsc_t *q=&c->ch->req;
+    unsigned head=atomic_load_explicit(&q->head,memory_order_relaxed);
+    while(shm_spsc_room(q)==0)
+        if(shm_await(c,&q->tail,&q->tail_waiters,head-SHM_CHAN_CAP,SHM_WAIT_MS)<0) return -1;
+    v2_request_t *rq=&c->ch->req_slot[head&(SHM_CHAN_CAP-1)];
+    rq->type=ARITH_FRAME_CALL; rq->opcode=op; rq->session=0; rq->req_id=id; rq->a=a; rq->b=b;
+    shm_advance(&q->head,&q->head_waiters,head+1);
+    return 0;
+}
+
+// ---- v2 over a Unix socket ----
+// One connected SOCK_SEQPACKET socket (transport.h) carries both directions
+// and keeps message boundaries: a call is one 24-byte message and its answer
+// one 16-byte message, with no session id and no FIFO file. A hello is sent
+// only to declare a class other than normal, and is not answered.
+
+static int sock_connect(arith_conn_t *c){
+    c->sock=socket(AF_UNIX,SOCK_SEQPACKET|SOCK_CLOEXEC,0);
+    if(c->sock<0) return -1;
+    struct sockaddr_un sa; memset(&sa,0,sizeof(sa));
+    sa.sun_family=AF_UNIX;
+    snprintf(sa.sun_path,sizeof(sa.sun_path),"%s",ARITH_SOCK_PATH);
+    return connect(c->sock,(const struct sockaddr*)&sa,sizeof(sa));
+}
+
+// Send one message (blocks while the socket buffer is full)
+static int sock_send(arith_conn_t *c, const void *msg, size_t len){
+    PROF_BEGIN(t);
+    ssize_t w;
+    while((w=send(c->sock,msg,len,MSG_NOSIGNAL))<0 && errno==EINTR){}
+    PROF_END(PROF_WRITE,t);
+    return w<0 ? -1 : 0;
+}
+
+// ---- Outstanding calls ----
+
+// Reserve the slot of the next id (EAGAIN if it is still taken)
+static pending_t *pending_reserve(arith_conn_t *c, arith_cb_t cb, void *user){
+    uint32_t id=c->next_id;
+    pending_t *p=&c->pend[id%c->cap];
+    if(p->used || c->npending>=c->cap){ errno=EAGAIN; return NULL; }
+    c->next_id++;
+    p->id=id; p->used=true; p->cb=cb; p->user=user;
+    c->npending++;
+    return p;
+}
+
+static void pending_release(arith_conn_t *c, pending_t *p){
+    p->used=false; c->npending--;
+}
+
+// Run the callback of call `id`; 0 if it is not (or no longer) outstanding
+static int complete(arith_conn_t *c, uint32_t id, int status, int64_t result){
+    pending_t *p=&c->pend[id%c->cap];
+    if(!p->used || p->id!=id) return 0; // stale answer
+    arith_cb_t cb=p->cb; void *user=p->user;
+    pending_release(c,p);                // before the callback: it may submit again
+    if(cb) cb(user,id,status,result);
+    return 1;
+}
+
+// v2: read what has arrived and complete those calls
+static int v2_drain(arith_conn_t *c){
+    PROF_BEGIN(t);
+    ssize_t n=read(c->resp_fd,c->rbuf+c->rlen,sizeof(c->rbuf)-c->rlen);
+    PROF_END(PROF_READ,t);
+    if(n<0) return errno==EINTR ? 0 : -1;
+    if(n==0){ errno=EPIPE; return -1; }
+    c->rlen+=(size_t)n;
+    // Take the whole records out first: callbacks may poll this handle again
+    v2_response_t got[sizeof(c->rbuf)/sizeof(v2_response_t)];
+    size_t k=c->rlen/sizeof(v2_response_t), used=k*sizeof(v2_response_t);
+    memcpy(got,c->rbuf,used);
+    memmove(c->rbuf,c->rbuf+used,c->rlen-used); c->rlen-=used;
+    int ran=0;
+    for(size_t i=0;i<k;i++) ran+=complete(c,got[i].req_id,got[i].status,got[i].result);
+    return ran;
+}
+
+// Socket: take up to TP_BATCH answers with one recvmmsg() and complete them
+static int sock_drain(arith_conn_t *c){
+    v2_response_t got[TP_BATCH]; tp_msg_t m[TP_BATCH];
+    for(unsigned i=0;i<TP_BATCH;i++){ m[i].buf=&got[i]; m[i].len=sizeof(got[i]); }
+    PROF_BEGIN(t);
+    int n=tp_recv_many(c->sock,m,TP_BATCH);
+    PROF_END(PROF_READ,t);
+    if(n<0) return errno==EAGAIN || errno==EINTR ? 0 : -1;
+    int ran=0;
+    for(int i=0;i<n;i++){
+        if(m[i].len==0){ if(ran) break; errno=EPIPE; return -1; } // the server closed the connection
+        if(m[i].len==sizeof(got[i])) ran+=complete(c,got[i].req_id,got[i].status,got[i].result);
+    }
+    return ran;
+}
+
+// Wait on fd for answers and complete them with drain() (v2, socket)
+static int fd_poll(arith_conn_t *c, int fd, int (*drain)(arith_conn_t*), int timeout_ms){
+    uint64_t deadline=now_ms()+(uint64_t)(timeout_ms>0 ? timeout_ms : 0);
+    uint64_t busy= timeout_ms>0 && (uint64_t)timeout_ms*1000000u<c->busy_ns ? (uint64_t)timeout_ms*1000000u : c->busy_ns;
+    for(;;){
+        struct pollfd pf={ .fd=fd, .events=POLLIN };
+        int r= busy && timeout_ms ? busy_poll_fd(fd,busy) : 0; // then sleep if nothing came
+        if(r==0) r=poll(&pf,1,ms_left(timeout_ms,deadline));
+        if(r<0 && errno!=EINTR) return -1;
+        if(r>0){
+            int ran=drain(c);
+            if(ran) return ran;           // or -1
+        }
+        if(!c->npending || ms_left(timeout_ms,deadline)==0) return 0;
+    }
+}
+
+static int v2_poll(arith_conn_t *c, int timeout_ms){ return fd_poll(c,c->resp_fd,v2_drain,timeout_ms); }
+static int sock_poll(arith_conn_t *c, int timeout_ms){ return fd_poll(c,c->sock,sock_drain,timeout_ms); }
+
+static int shm_poll(arith_conn_t *c, int timeout_ms){
+    uint64_t deadline=now_ms()+(uint64_t)(timeout_ms>0 ? timeout_ms : 0);
+    shm_spsc_t *q=&c->ch->resp;
+    for(;;){
+        int ran=0;
+        while(shm_spsc_ready(q)){
+            unsigned tail=atomic_load_explicit(&q->tail,memory_order_relaxed);
+            v2_response_t rp=c->ch->resp_slot[tail&(SHM_CHAN_CAP-1)];
+            shm_advance(&q->tail,&q->tail_waiters,tail+1);
+            ran+=complete(c,rp.req_id,rp.status,rp.result);
+        }
+        if(ran) return ran;
+        int left=ms_left(timeout_ms,deadline);
+        if(!c->npending || left==0) return 0;
+        unsigned tail=atomic_load_explicit(&q->tail,memory_order_relaxed);
+        if(c->busy_ns && busy_poll_word(&q->head,tail,c->busy_ns)) continue;
+        if(shm_await(c,&q->head,&q->head_waiters,tail,left<0 || left>SHM_WAIT_MS ? SHM_WAIT_MS : left)<0) return -1;
+    }
+}
+
+// v1: every call was answered at submit; run the callbacks in order
+static int v1_poll(arith_conn_t *c, int timeout_ms){
+    (void)timeout_ms;
+    int ran=0;
+    for(; c->v1_deliver!=c->next_id; c->v1_deliver++){
+        pending_t *p=&c->pend[c->v1_deliver%c->cap];
+        ran+=complete(c,c->v1_deliver,p->status,p->result); // skips calls that failed
+    }
+    return ran;
+}
+
+// ---- Batches ----
+
+typedef struct __attribute__((packed)) { v2_batch_hdr_t h; v2_batch_item_t it[ARITH_BATCH_MAX]; } batch_frame_t;
+typedef struct __attribute__((packed)) { v2_batch_resp_hdr_t h; v2_batch_result_t r[ARITH_BATCH_MAX]; } batch_answer_t;
+
+// Fill a batch frame of n <= ARITH_BATCH_MAX tuples (session 0); returns its size
+static size_t batch_pack(arith_conn_t *c, batch_frame_t *f, size_t n, const uint8_t *op, const int64_t *a, const int64_t *b){
+    f->h.type=ARITH_FRAME_BATCH; f->h.flags=0; f->h.session=0; f->h.req_id=c->next_id++; f->h.count=(uint16_t)n;
+    for(size_t i=0;i<n;i++){ f->it[i].opcode=op[i]; f->it[i].a=a[i]; f->it[i].b=b[i]; }
+    return sizeof(f->h)+n*sizeof(f->it[0]);
+}
+
+// Check that the `len` bytes of `r` answer all of `f`, and unpack them
+static int batch_unpack(const batch_frame_t *f, const batch_answer_t *r, size_t len, int64_t *res, int32_t *status){
+    size_t n=f->h.count;
+    if(len!=sizeof(r->h)+n*sizeof(r->r[0]) || r->h.req_id!=f->h.req_id || r->h.count!=n){ errno=EPROTO; return -1; }
+    for(size_t i=0;i<n;i++){ res[i]=r->r[i].result; status[i]=r->r[i].status; }
+    return 0;
+}
+
+// One v2 batch frame over the FIFOs
+static int v2_batch(arith_conn_t *c, size_t n, const uint8_t *op, const int64_t *a, const int64_t *b,
+                    int64_t *res, int32_t *status){
+    batch_frame_t f; batch_answer_t resp;
+    size_t len=batch_pack(c,&f,n,op,a,b);
+    if(v2_send(c,&f,len,offsetof(v2_batch_hdr_t,session))<0) return -1;
+    ssize_t rr=read_full(c->resp_fd,&resp.h,sizeof(resp.h));
+    if(rr<0) return -1;
+    size_t got=(size_t)rr;
+    if(got==sizeof(resp.h) && resp.h.count==n){
+        rr=read_full(c->resp_fd,resp.r,n*sizeof(resp.r[0]));
+        if(rr<0) return -1;
+        got+=(size_t)rr;
+    }
+    return batch_unpack(&f,&resp,got,res,status);
+}
+
+// One batch frame over the socket: one message each way
+static int sock_batch(arith_conn_t *c, size_t n, const uint8_t *op, const int64_t *a, const int64_t *b,
+                      int64_t *res, int32_t *status){
+    batch_frame_t f; batch_answer_t resp;
+    if(sock_send(c,&f,batch_pack(c,&f,n,op,a,b))<0) return -1;
+    PROF_BEGIN(t);
+    ssize_t rr;
+    while((rr=recv(c->sock,&resp,sizeof(resp),0))<0 && errno==EINTR){}
+    PROF_END(PROF_READ,t);
+    if(rr<0) return -1;
+    if(rr==0){ errno=EPIPE; return -1; }
+    return batch_unpack(&f,&resp,(size_t)rr,res,status);
+}
+
+typedef int (*batch_fn)(arith_conn_t *c, size_t n, const uint8_t *op, const int64_t *a, const int64_t *b,
+                        int64_t *res, int32_t *status);
+
+// n tuples as frames of up to ARITH_BATCH_MAX, one round trip each
+static int batch_frames(arith_conn_t *c, size_t n, const uint8_t *op, const int64_t *a, const int64_t *b,
+                        int64_t *res, int32_t *status, batch_fn one){
+    for(size_t i=0;i<n;i+=ARITH_BATCH_MAX){
+        size_t m= n-i<ARITH_BATCH_MAX ? n-i : ARITH_BATCH_MAX;
+        if(one(c,m,op+i,a+i,b+i,res+i,status+i)<0) return -1;
+    }
+    return 0;
+}
+
+static int v2_batch_all(arith_conn_t *c, size_t n, const uint8_t *op, const int64_t *a, const int64_t *b,
+                        int64_t *res, int32_t *status){
+    return batch_frames(c,n,op,a,b,res,status,v2_batch);
+}
+
+static int sock_batch_all(arith_conn_t *c, size_t n, const uint8_t *op, const int64_t *a, const int64_t *b,
+                          int64_t *res, int32_t *status){
+    return batch_frames(c,n,op,a,b,res,status,sock_batch);
+}
+
+// Completion target of a pipelined batch: ids are consecutive
+typedef struct { uint32_t first; int64_t *res; int32_t *status; } batch_target_t;
+static void batch_done(void *user, uint32_t id, int status, int64_t result){
+    batch_target_t *t=user;
+    t->res[id-t->first]=result; t->status[id-t->first]=status;
+}
+
+// shm: pipelined through the rings, one window at a time
+static int shm_batch(arith_conn_t *c, size_t n, const uint8_t *op, const int64_t *a, const int64_t *b,
+                     int64_t *res, int32_t *status){
+    batch_target_t t={ .first=c->next_id, .res=res, .status=status };
+    for(size_t i=0;i<n;){
+        if(arith_submit(c,op[i],a[i],b[i],batch_done,&t,NULL)==0){ i++; continue; }
+        if(errno!=EAGAIN || arith_poll(c,-1)<0) return -1;
+    }
+    while(c->npending) if(arith_poll(c,-1)<0) return -1;
+    return 0;
+}
+
+static int v1_batch(arith_conn_t *c, size_t n, const uint8_t *op, const int64_t *a, const int64_t *b,
+                    int64_t *res, int32_t *status){
+    for(size_t i=0;i<n;i++){
+        int st=v1_call(c,op[i],a[i],b[i],&res[i]);
+        if(st<0) return -1;
+        status[i]=st;
+    }
+    return 0;
+}
+
+// ---- Transports ----
+// Everything a handle does differently per mode goes through its entry in
+// transports[]; the public calls below only add the bookkeeping they share.
+
+// Response FIFO, plus the session hello for v2
+static int fifo_open(arith_conn_t *c, const arith_options_t *opt, unsigned seq){
+    (void)opt;
+    snprintf(c->resp_fifo,sizeof(c->resp_fifo),"/tmp/arith_resp_%d_%u.fifo",(int)getpid(),seq);
+    if(mkfifo(c->resp_fifo,0666)<0 && errno!=EEXIST) return -1;
+    return c->mode==ARITH_MODE_V2 ? v2_hello(c) : 0;
+}
+
+static int shm_open_chan(arith_conn_t *c, const arith_options_t *opt, unsigned seq){
+    // Spinning only pays when the server runs on another CPU at the same time
+    c->spin_max= opt->spin>=0 ? (unsigned)opt->spin : sysconf(_SC_NPROCESSORS_ONLN)>1 ? SHM_SPIN_DEFAULT : 0;
+    if(shm_attach(c,seq)<0) return -1;
+    if(c->busy_ns && mlock(c->ch,sizeof(*c->ch))<0){} // best effort: a polled ring should never fault
+    return 0;
+}
+
+static int sock_open(arith_conn_t *c, const arith_options_t *opt, unsigned seq){
+    (void)opt; (void)seq;
+    if(sock_connect(c)<0) return -1;
+    if(c->sched_class==ARITH_CLASS_NORMAL) return 0;
+    v2_hello_t h={ .type=ARITH_FRAME_HELLO, .version=ARITH_PROTO_VERSION, .sched_class=c->sched_class, .client_pid=(int32_t)getpid() };
+    return sock_send(c,&h,sizeof(h));
+}
+
+static int v1_submit(arith_conn_t *c, pending_t *p, uint8_t op, int64_t a, int64_t b){
+    int rc=v1_call(c,op,a,b,&p->result);
+    if(rc<0) return -1;
+    p->status=rc;
+    return 0;
+}
+
+static int v2_submit(arith_conn_t *c, pending_t *p, uint8_t op, int64_t a, int64_t b){
+    v2_request_t rq={ .type=ARITH_FRAME_CALL, .opcode=op, .req_id=p->id, .a=a, .b=b };
+    return v2_send(c,&rq,sizeof(rq),offsetof(v2_request_t,session));
+}
+
+static int shm_submit(arith_conn_t *c, pending_t *p, uint8_t op, int64_t a, int64_t b){
+    return shm_send(c,op,a,b,p->id);
+}
+
+static int sock_submit(arith_conn_t *c, pending_t *p, uint8_t op, int64_t a, int64_t b){
+    v2_request_t rq={ .type=ARITH_FRAME_CALL, .opcode=op, .session=0, .req_id=p->id, .a=a, .b=b };
+    return sock_send(c,&rq,sizeof(rq));
+}
+
+static int v2_fd(const arith_conn_t *c){ return c->resp_fd; }
+static int sock_fd(const arith_conn_t *c){ return c->sock; }
+static int no_fd(const arith_conn_t *c){ (void)c; return -1; }
+
+struct transport {
+    int (*open)(arith_conn_t *c, const arith_options_t *opt, unsigned seq);
+    int (*submit)(arith_conn_t *c, pending_t *p, uint8_t op, int64_t a, int64_t b);
+    int (*poll)(arith_conn_t *c, int timeout_ms);
+    batch_fn batch;
+    int (*fd)(const arith_conn_t *c);
+    int (*call)(arith_conn_t *c, uint8_t op, int64_t a, int64_t b, int64_t *res); // NULL => submit + poll
+    unsigned cap;       // most calls outstanding
+};
+
+static const transport_t transports[] = {
+    [ARITH_MODE_V2]         = { fifo_open,     v2_submit,   v2_poll,   v2_batch_all,   v2_fd,   NULL,    ARITH_MAX_PENDING },
+    [ARITH_MODE_SHM]        = { shm_open_chan, shm_submit,  shm_poll,  shm_batch,      no_fd,   NULL,    SHM_CHAN_CAP },
+    [ARITH_MODE_V1]         = { fifo_open,     v1_submit,   v1_poll,   v1_batch,       no_fd,   v1_call, ARITH_MAX_PENDING },
+    [ARITH_MODE_V1_ONESHOT] = { fifo_open,     v1_submit,   v1_poll,   v1_batch,       no_fd,   v1_call, ARITH_MAX_PENDING },
+    [ARITH_MODE_SOCK]       = { sock_open,     sock_submit, sock_poll, sock_batch_all, sock_fd, NULL,    ARITH_MAX_PENDING },
+};
+
+// ---- Auto-batching (autobatch_us) ----
+// Combining without a thread of our own: the call that finds no open group
+// opens one and becomes its leader. Calls from other threads join it until
+// it is full or the leader's window is over; the leader then waits for the
+// group before it to be answered, sends its own with the mode's batch
+// function and hands every member its answer. The window keeps running
+// while another group is out, so under load groups fill up by themselves.
+// It is also cut short once every thread inside arith_call() on the handle
+// is in the group: nobody else could join, so a single-threaded user never
+// waits for its window at all.
+
+struct ab_group {
+    size_t   n, left;      // calls in the group; those not collected yet
+    bool     done;         // answered (or failed with err)
+    int      err;          // errno of a transport failure (0 => answered)
+    uint8_t  op[ARITH_BATCH_MAX];
+    int64_t  a[ARITH_BATCH_MAX], b[ARITH_BATCH_MAX], res[ARITH_BATCH_MAX];
+    int32_t  status[ARITH_BATCH_MAX];
+};
+
+static int sync_call(arith_conn_t *c, uint8_t op, int64_t a, int64_t b, int64_t *res); // see "Public API"
+
+static int autobatch_init(arith_conn_t *c, const arith_options_t *opt){
+    pthread_condattr_t ca;
+    int rc=pthread_condattr_init(&ca);
+    if(rc==0){
+        pthread_condattr_setclock(&ca,CLOCK_MONOTONIC);
+        rc=pthread_cond_init(&c->ab_cond,&ca);
+        pthread_condattr_destroy(&ca);
+    }
+    if(rc!=0){ errno=rc; return -1; }
+    pthread_mutex_init(&c->ab_lock,NULL);
+    c->ab_window_ns=(uint64_t)opt->autobatch_us*1000;
+    c->ab_max= opt->autobatch_max>0 ? (size_t)opt->autobatch_max : ARITH_BATCH_MAX;
+    return 0;
+}
+
+// Leader: wait until the group is full or its window is over (and the
+// channels are free), then send it; called and returns with ab_lock held
+static void autobatch_send(arith_conn_t *c, ab_group_t *g){
+    struct timespec dl; clock_gettime(CLOCK_MONOTONIC,&dl);
+    uint64_t ns=(uint64_t)dl.tv_nsec+c->ab_window_ns;
+    dl.tv_sec+=(time_t)(ns/1000000000u); dl.tv_nsec=(long)(ns%1000000000u);
+    bool over=false;
+    while(c->ab_open==g && (c->ab_sending || (!over && g->n<c->ab_inside))){
+        if(c->ab_sending) pthread_cond_wait(&c->ab_cond,&c->ab_lock);
+        else over= pthread_cond_timedwait(&c->ab_cond,&c->ab_lock,&dl)==ETIMEDOUT;
+    }
+    if(c->ab_open==g) c->ab_open=NULL;
+    while(c->ab_sending) pthread_cond_wait(&c->ab_cond,&c->ab_lock);
+    c->ab_sending=true;
+    pthread_mutex_unlock(&c->ab_lock);
+    int rc;
+    if(g->n==1){ // nobody joined: a plain call is smaller than a batch of one
+        rc=sync_call(c,g->op[0],g->a[0],g->b[0],&g->res[0]);
+        if(rc>=0){ g->status[0]=rc; rc=0; }
+    } else rc=c->tp->batch(c,g->n,g->op,g->a,g->b,g->res,g->status);
+    int err=errno;
+    pthread_mutex_lock(&c->ab_lock);
+    g->err= rc<0 ? err : 0; g->done=true;
+    c->ab_sending=false;
+    pthread_cond_broadcast(&c->ab_cond);
+}
+
+static int autobatch_call(arith_conn_t *c, uint8_t op, int64_t a, int64_t b, int64_t *res){
+    pthread_mutex_lock(&c->ab_lock);
+    ab_group_t *g=c->ab_open;
+    bool leader= !g;
+    if(leader){
+        if(!(g=malloc(sizeof(*g)))){ pthread_mutex_unlock(&c->ab_lock); return -1; }
+        g->n=g->left=0; g->done=false; g->err=0;
+        c->ab_open=g;
+    }
+    c->ab_inside++;
+    size_t i=g->n++;
+    g->left++;
+    g->op[i]=op; g->a[i]=a; g->b[i]=b;
+    if(g->n==c->ab_max) c->ab_open=NULL; // full: its leader stops waiting
+    if(!leader && (!c->ab_open || g->n==c->ab_inside)) pthread_cond_broadcast(&c->ab_cond);
+    if(leader) autobatch_send(c,g);
+    else while(!g->done) pthread_cond_wait(&c->ab_cond,&c->ab_lock);
+    int err=g->err, st= err ? -1 : g->status[i];
+    if(!err) *res=g->res[i];
+    bool last= --g->left==0;
+    c->ab_inside--;
+    if(c->ab_open && c->ab_open->n==c->ab_inside) pthread_cond_broadcast(&c->ab_cond); // all that is left is waiting to be sent
+    pthread_mutex_unlock(&c->ab_lock);
+    if(last) free(g);
+    if(err) errno=err;
+    return st;
+}
+
+// ---- Public API ----
+
+arith_conn_t *arith_connect(const arith_options_t *opt){
+    arith_options_t def={ .mode=ARITH_MODE_V2, .spin=-1, .shard=-1 };
+    if(!opt) opt=&def;
+    if(opt->mode<ARITH_MODE_V2 || opt->mode>ARITH_MODE_SOCK
+       || opt->sched_class<0 || opt->sched_class>=ARITH_CLASS_COUNT
+       || opt->autobatch_us<0 || opt->autobatch_us>1000000 || opt->autobatch_max<0 || opt->autobatch_max>(int)ARITH_BATCH_MAX
+       || (opt->autobatch_us && (opt->mode==ARITH_MODE_V1 || opt->mode==ARITH_MODE_V1_ONESHOT))){ errno=EINVAL; return NULL; }
+    arith_conn_t *c=calloc(1,sizeof(*c));
+    if(!c) return NULL;
+    c->mode=opt->mode; c->tp=&transports[c->mode];
+    c->req_fd=c->resp_fd=c->sock=-1; c->next_id=c->v1_deliver=1;
+    c->cap=c->tp->cap; c->sched_class=(uint8_t)opt->sched_class;
+    c->busy_ns= opt->busy_poll_us>0 ? (uint64_t)opt->busy_poll_us*1000 : 0;
+    if(opt->autobatch_us && autobatch_init(c,opt)<0){ free(c); return NULL; }
+    unsigned seq=atomic_fetch_add(&conn_seq,1);
+    pick_request_fifo(c,opt->shard,seq);
+    if(c->tp->open(c,opt,seq)<0){
+        int e=errno; arith_disconnect(c); errno=e;
+        return NULL;
+    }
+    return c;
+}
+
+void arith_disconnect(arith_conn_t *c){
+    if(!c) return;
+    if(c->req_fd>=0) close(c->req_fd);
+    if(c->resp_fd>=0) close(c->resp_fd);
+    if(c->sock>=0) close(c->sock);
+    if(c->resp_fifo[0]) unlink(c->resp_fifo);
+    if(c->ch){
+        atomic_store(&c->ch->state,SHM_CLOSED);
+        shm_futex_wake(&c->ch->req.head); // the server's thread may be asleep waiting for requests
+        munmap(c->ch,sizeof(*c->ch));
+    }
+    if(c->ab_window_ns){ pthread_cond_destroy(&c->ab_cond); pthread_mutex_destroy(&c->ab_lock); }
+    free(c);
+}
+
+int arith_submit(arith_conn_t *c, uint8_t op, int64_t a, int64_t b,
+                 arith_cb_t cb, void *user, uint32_t *id){
+    pending_t *p=pending_reserve(c,cb,user);
+    if(!p) return -1;
+    if(c->tp->submit(c,p,op,a,b)<0){ int e=errno; pending_release(c,p); errno=e; return -1; }
+    if(id) *id=p->id;
+    return 0;
+}
+
+int arith_poll(arith_conn_t *c, int timeout_ms){
+    return c->npending ? c->tp->poll(c,timeout_ms) : 0;
+}
+
+unsigned arith_pending(const arith_conn_t *c){ return c->npending; }
+
+int arith_fd(const arith_conn_t *c){ return c->tp->fd(c); }
+
+// Completion target of arith_call()
+typedef struct { bool done; int status; int64_t result; } sync_result_t;
+static void sync_done(void *user, uint32_t id, int status, int64_t result){
+    (void)id; sync_result_t *r=user;
+    r->done=true; r->status=status; r->result=result;
+}
+
+static int sync_call(arith_conn_t *c, uint8_t op, int64_t a, int64_t b, int64_t *res){
+    if(c->tp->call) return c->tp->call(c,op,a,b,res);
+    sync_result_t r={ .done=false };
+    while(arith_submit(c,op,a,b,sync_done,&r,NULL)<0){
+        if(errno!=EAGAIN || arith_poll(c,-1)<0) return -1; // full: let older calls finish
+    }
+    while(!r.done) if(arith_poll(c,-1)<0) return -1;
+    *res=r.result;
+    return r.status;
+}
+
+int arith_call(arith_conn_t *c, uint8_t op, int64_t a, int64_t b, int64_t *res){
+    return c->ab_window_ns ? autobatch_call(c,op,a,b,res) : sync_call(c,op,a,b,res);
+}
+
+int arith_batch(arith_conn_t *c, size_t n, const uint8_t *op, const int64_t *a, const int64_t *b,
+                int64_t *res, int32_t *status){
+    if(c->npending){ errno=EBUSY; return -1; }
+    return c->tp->batch(c,n,op,a,b,res,status);
+}
+
+// ---- Array operations ----
+
+int arith_array_alloc(arith_array_t *arr, size_t n){
+    arr->fd=-1; arr->data=NULL; arr->n=0;
+#ifdef MFD_ALLOW_SEALING
+    if(n>SIZE_MAX/sizeof(int64_t)){ errno=ENOMEM; return -1; }
+    size_t bytes=n*sizeof(int64_t);
+    int fd=memfd_create("arith_array",MFD_CLOEXEC|MFD_ALLOW_SEALING);
+    if(fd<0) return -1;
+    // No shrinking (the server maps it) and no more seals (nobody can block our writes)
+    if(ftruncate(fd,(off_t)bytes)<0 || fcntl(fd,F_ADD_SEALS,F_SEAL_SHRINK|F_SEAL_SEAL)<0){
+        int e=errno; close(fd); errno=e; return -1;
+    }
+    void *p=NULL;
+    if(bytes && (p=mmap(NULL,bytes,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0))==MAP_FAILED){
+        int e=errno; close(fd); errno=e; return -1;
+    }
+    arr->fd=fd; arr->data=p; arr->n=n;
+    return 0;
+#else
+    (void)n; errno=ENOSYS; return -1;
+#endif
+}
+
+void arith_array_free(arith_array_t *arr){
+    if(arr->data) munmap(arr->data,arr->n*sizeof(int64_t));
+    if(arr->fd>=0) close(arr->fd);
+    arr->fd=-1; arr->data=NULL; arr->n=0;
+}
+
+// Send one array frame with the descriptors of its arrays and wait for its
+// answer (other outstanding calls complete meanwhile, as in arith_call())
+static int array_call(arith_conn_t *c, uint8_t kind, uint8_t op, const arith_array_t *const *arr, int64_t *res){
+    if(c->mode!=ARITH_MODE_SOCK){ errno=EOPNOTSUPP; return -1; }
+    unsigned k=arith_array_count(kind);
+    int fds[3];
+    for(unsigned i=0;i<k;i++){
+        if(arr[i]->n!=arr[0]->n){ errno=EINVAL; return -1; }
+        fds[i]=arr[i]->fd;
+    }
+    sync_result_t r={ .done=false };
+    pending_t *p;
+    while(!(p=pending_reserve(c,sync_done,&r))){
+        if(errno!=EAGAIN || arith_poll(c,-1)<0) return -1; // full: let older calls finish
+    }
+    v2_array_t f={ .type=ARITH_FRAME_ARRAY, .kind=kind, .opcode=op, .req_id=p->id, .n=arr[0]->n };
+    PROF_BEGIN(t);
+    int rc=tp_send_fds(c->sock,&f,sizeof(f),fds,k);
+    PROF_END(PROF_WRITE,t);
+    if(rc<0){ int e=errno; pending_release(c,p); errno=e; return -1; }
+    while(!r.done) if(arith_poll(c,-1)<0) return -1;
+    *res=r.result;
+    return r.status;
+}
+
+int arith_array_sum(arith_conn_t *c, const arith_array_t *a, int64_t *res){
+    const arith_array_t *arr[]={ a };
+    return array_call(c,ARITH_ARRAY_SUM,0,arr,res);
+}
+
+int arith_array_dot(arith_conn_t *c, const arith_array_t *a, const arith_array_t *b, int64_t *res){
+    const arith_array_t *arr[]={ a, b };
+    return array_call(c,ARITH_ARRAY_DOT,0,arr,res);
+}
+
+int arith_array_map(arith_conn_t *c, uint8_t op, const arith_array_t *a, const arith_array_t *b,
+                    const arith_array_t *out, size_t *failed){
+    const arith_array_t *arr[]={ a, b, out };
+    int64_t res;
+    int st=array_call(c,ARITH_ARRAY_MAP,op,arr,&res);
+    if(st>0 && failed) *failed=(size_t)res;
+    return st;
+}
+
+// ---- Big integers ----
+
+typedef struct __attribute__((packed)) { v2_big_hdr_t h; unsigned char limbs[2*ARITH_BIG_LIMBS_MAX*sizeof(uint64_t)]; } big_frame_t;
+typedef struct __attribute__((packed)) { v2_big_resp_hdr_t h; unsigned char limbs[ARITH_BIG_RESULT_MAX*sizeof(uint64_t)]; } big_answer_t;
+
+// Fill a big-integer frame (session 0); returns its size
+static size_t big_pack(arith_conn_t *c, big_frame_t *f, uint8_t op, const arith_big_t *a, const arith_big_t *b){
+    memset(&f->h,0,sizeof(f->h));
+    f->h.type=ARITH_FRAME_BIG; f->h.opcode=op; f->h.req_id=c->next_id++;
+    f->h.sign=(uint8_t)((a->neg ? ARITH_BIG_NEG_A : 0) | (b->neg ? ARITH_BIG_NEG_B : 0));
+    f->h.na=(uint16_t)a->n; f->h.nb=(uint16_t)b->n;
+    memcpy(f->limbs,a->limb,a->n*sizeof(uint64_t));
+    memcpy(f->limbs+a->n*sizeof(uint64_t),b->limb,b->n*sizeof(uint64_t));
+    return sizeof(f->h)+(a->n+b->n)*sizeof(uint64_t);
+}
+
+// Check that the `len` bytes of `ans` answer `f`, and unpack the result
+static int big_unpack(const big_frame_t *f, const big_answer_t *ans, size_t len, arith_big_t *r){
+    if(len<sizeof(ans->h) || ans->h.req_id!=f->h.req_id || ans->h.n>ARITH_BIG_RESULT_MAX
+       || len!=sizeof(ans->h)+ans->h.n*sizeof(uint64_t)){ errno=EPROTO; return -1; }
+    if(ans->h.status==ARITH_OK){
+        r->n=ans->h.n; r->neg= (ans->h.sign&ARITH_BIG_NEG_A) && r->n;
+        memcpy(r->limb,ans->limbs,r->n*sizeof(uint64_t));
+    }
+    return ans->h.status;
+}
+
+int arith_big_call(arith_conn_t *c, uint8_t op, const arith_big_t *a, const arith_big_t *b, arith_big_t *r){
+    if(c->mode!=ARITH_MODE_V2 && c->mode!=ARITH_MODE_SOCK){ errno=EOPNOTSUPP; return -1; }
+    if(c->npending){ errno=EBUSY; return -1; }
+    if(a->n>ARITH_BIG_LIMBS_MAX || b->n>ARITH_BIG_LIMBS_MAX){ errno=EINVAL; return -1; }
+    big_frame_t f; big_answer_t ans;
+    size_t len=big_pack(c,&f,op,a,b);
+    ssize_t rr;
+    if(c->mode==ARITH_MODE_SOCK){ // one message each way
+        if(sock_send(c,&f,len)<0) return -1;
+        PROF_BEGIN(t);
+        while((rr=recv(c->sock,&ans,sizeof(ans),0))<0 && errno==EINTR){}
+        PROF_END(PROF_READ,t);
+        if(rr<0) return -1;
+        if(rr==0){ errno=EPIPE; return -1; }
+        return big_unpack(&f,&ans,(size_t)rr,r);
+    }
+    if(v2_send(c,&f,len,offsetof(v2_big_hdr_t,session))<0) return -1;
+    if((rr=read_full(c->resp_fd,&ans.h,sizeof(ans.h)))<0) return -1;
+    size_t got=(size_t)rr;
+    if(got==sizeof(ans.h) && ans.h.n && ans.h.n<=ARITH_BIG_RESULT_MAX){
+        if((rr=read_full(c->resp_fd,ans.limbs,ans.h.n*sizeof(uint64_t)))<0) return -1;
+        got+=(size_t)rr;
+    }
+    return big_unpack(&f,&ans,got,r);
+}
+
+int arith_big_parse(const char *s, arith_big_t *x){
+    bn_t v;
+    if(bn_from_dec(s,x->limb,ARITH_BIG_RESULT_MAX,&v)<0) return -1;
+    x->n=v.n; x->neg=v.neg;
+    return 0;
+}
+
+int arith_big_format(const arith_big_t *x, char *buf, size_t size){
+    uint64_t tmp[ARITH_BIG_RESULT_MAX];
+    bn_t v={ .d=(bn_limb_t*)x->limb, .n= x->n<ARITH_BIG_RESULT_MAX ? x->n : ARITH_BIG_RESULT_MAX, .neg=x->neg && x->n };
+    return bn_to_dec(&v,tmp,buf,size);
+}
+
+// ---- Expressions ----
+
+typedef struct __attribute__((packed)) {
+    v2_expr_hdr_t  h;
+    v2_expr_insn_t insn[ARITH_EXPR_MAX];
+    int64_t        args[ARITH_EXPR_ARGS_MAX]; // really right after the h.len instructions
+} expr_frame_t;
+
+int arith_expr_parse(const char *text, arith_expr_t *e, size_t *err_at){
+    int n=expr_parse(text,e->code,e->val,&e->nargs,err_at);
+    if(n<0) return -1;
+    e->len=(size_t)n;
+    return 0;
+}
+
+int arith_expr_call(arith_conn_t *c, const arith_expr_t *e, const int64_t *args, size_t nargs, int64_t *res){
+    if(c->mode!=ARITH_MODE_V2 && c->mode!=ARITH_MODE_SOCK){ errno=EOPNOTSUPP; return -1; }
+    if(c->npending){ errno=EBUSY; return -1; }
+    if(!e->len || e->len>ARITH_EXPR_MAX || nargs<e->nargs || nargs>ARITH_EXPR_ARGS_MAX){ errno=EINVAL; return -1; }
+    expr_frame_t f;
+    memset(&f.h,0,sizeof(f.h));
+    f.h.type=ARITH_FRAME_EXPR; f.h.req_id=c->next_id++; f.h.len=(uint8_t)e->len; f.h.nargs=(uint8_t)nargs;
+    for(size_t i=0;i<e->len;i++){ f.insn[i].code=e->code[i]; f.insn[i].val=e->val[i]; }
+    memcpy(&f.insn[e->len],args,nargs*sizeof(int64_t));
+    size_t len=sizeof(f.h)+e->len*sizeof(f.insn[0])+nargs*sizeof(int64_t);
+    v2_response_t rp;
+    ssize_t rr;
+    if(c->mode==ARITH_MODE_SOCK){
+        if(sock_send(c,&f,len)<0) return -1;
+        PROF_BEGIN(t);
+        while((rr=recv(c->sock,&rp,sizeof(rp),0))<0 && errno==EINTR){}
+        PROF_END(PROF_READ,t);
+        if(rr==0){ errno=EPIPE; return -1; }
+    } else {
+        if(v2_send(c,&f,len,offsetof(v2_expr_hdr_t,session))<0) return -1;
+        rr=read_full(c->resp_fd,&rp,sizeof(rp));
+    }
+    if(rr<0) return -1;
+    if(rr!=(ssize_t)sizeof(rp) || rp.req_id!=f.h.req_id){ errno=EPROTO; return -1; }
+    if(rp.status==ARITH_OK) *res=rp.result;
+    return rp.status;
+}
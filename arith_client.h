@@ -0,0 +1,194 @@
+// arith_client.h
+// Client library for the arithmetic server (libarith.a / libarith.so).
+//
+// A connection handle owns the channels to the server and keeps them open
+// for its whole lifetime, so a call costs one write and one read (FIFO and
+// socket transports) or a ring store plus a wake-up (shm transport), with no
+// process spawn and no FIFO creation per call. Calls can be made
+// synchronously with arith_call(), asynchronously with arith_submit() +
+// arith_poll() (many outstanding, completed through callbacks in any order),
+// or in bulk with arith_batch(). Over the socket, arith_array_*() run
+// reductions and element-wise operations over whole arrays that the server
+// maps from the client's memory (arith_array_alloc()) instead of receiving.
+// arith_big_call() computes exactly on integers of thousands of digits.
+// arith_expr_call() has the server evaluate a whole expression over several
+// operations in one round trip.
+//
+// A handle is not thread-safe: use one handle per thread, except for
+// arith_call() on a handle opened with autobatch_us, which any number of
+// threads may call at once: calls that arrive within that window are sent
+// together as one batch frame and each caller gets its own answer back, so
+// unmodified synchronous callers get batch throughput. Writing to a
+// server that went away raises SIGPIPE; ignore that signal (the client
+// binary does) to get EPIPE from the call instead.
+
+#ifndef ARITH_CLIENT_H
+#define ARITH_CLIENT_H
+
+#include <stddef.h>     // size_t
+#include <stdint.h>     // int64_t, int32_t, uint32_t
+
+#include "proto.h"      // enum arith_op (ops.h), enum arith_status, ARITH_BATCH_MAX
+
+// How a handle talks to the server
+enum arith_mode {
+    ARITH_MODE_V2 = 0,      // compact v2 frames on a registered session (default)
+    ARITH_MODE_SHM,         // v2 records through shared-memory rings (server --transport shm)
+    ARITH_MODE_V1,          // v1 frames, channels kept open
+    ARITH_MODE_V1_ONESHOT,  // v1 frames, channels opened per call (the original protocol)
+    ARITH_MODE_SOCK,        // v2 frames over a SOCK_SEQPACKET Unix socket (server --transport sock)
+};
+
+typedef struct {
+    enum arith_mode mode;
+    int spin;               // shm: max polls before sleeping (-1 => default for this CPU count)
+    int shard;              // request FIFO shard of a server run with --shards
+                            // (-1 => hash the PID; ignored when it has none)
+    int busy_poll_us;       // v2, shm, socket: poll for answers this long before
+                            // sleeping (busypoll.h; 0 => sleep at once); shm
+                            // also locks its channel in RAM
+    int sched_class;        // v2, socket: enum arith_class to declare (server
+                            // --fair; 0 => ARITH_CLASS_NORMAL)
+    int autobatch_us;       // v2, shm, socket: merge concurrent arith_call()s
+                            // into batches, waiting up to this long for more
+                            // after the first (1..1000000; 0 => off)
+    int autobatch_max;      // ... and sending a batch as soon as it has this
+                            // many calls (0 => ARITH_BATCH_MAX)
+} arith_options_t;
+
+typedef struct arith_conn arith_conn_t;
+
+// Completion of an asynchronous call: `status` is an enum arith_status and
+// `result` is valid when it is ARITH_OK
+typedef void (*arith_cb_t)(void *user, uint32_t id, int status, int64_t result);
+
+// Most calls a handle keeps outstanding (shm: SHM_CHAN_CAP, see shmchan.h)
+#define ARITH_MAX_PENDING 4096
+
+// Open a handle (opt NULL => defaults); blocks until a server is reading the
+// request FIFO. A server's shards are discovered here: the handle sends all
+// its frames to one of them. The socket mode connects at once instead
+// (ECONNREFUSED or ENOENT: no server serves the socket). NULL on failure
+// with errno set.
+arith_conn_t *arith_connect(const arith_options_t *opt);
+// Close the channels and remove the handle's response FIFO or segment.
+// Outstanding asynchronous calls are dropped without their callbacks.
+void arith_disconnect(arith_conn_t *c);
+
+// One call: returns its enum arith_status (result in *res when ARITH_OK),
+// or -1 with errno set if no answer arrived. With autobatch_us the first of
+// a group of calls waits up to that window (less if the group reaches
+// autobatch_max or holds every thread inside arith_call() on the handle,
+// more while the group before it is still out) and then
+// sends them all as one arith_batch(); a lone call goes out as a plain one.
+// Only one group is out at a time. Do not mix these calls with other
+// functions of the handle while other threads use it.
+int arith_call(arith_conn_t *c, uint8_t op, int64_t a, int64_t b, int64_t *res);
+
+// Queue one call; `cb` runs from a later arith_poll() once it is answered.
+// Returns 0 and stores the call's id in *id (may be NULL), or -1 with errno
+// EAGAIN when the handle already has as many calls outstanding as it can
+// take (poll, then retry). v1 modes have no request ids: each call is
+// completed at submit time and only its callback is deferred.
+int arith_submit(arith_conn_t *c, uint8_t op, int64_t a, int64_t b,
+                 arith_cb_t cb, void *user, uint32_t *id);
+// Wait up to timeout_ms (-1 => until at least one completes, 0 => just
+// check) and run the callbacks of answered calls; returns how many ran,
+// -1 with errno set on a transport error
+int arith_poll(arith_conn_t *c, int timeout_ms);
+// Calls submitted but not completed yet
+unsigned arith_pending(const arith_conn_t *c);
+// Descriptor that turns readable when answers arrive (to poll() it together
+// with others), or -1 if the mode has none (shm, v1)
+int arith_fd(const arith_conn_t *c);
+
+// n calls op[i](a[i], b[i]) into res[i] with a per-element status[i]; v2 and
+// the socket send them as batch frames of up to ARITH_BATCH_MAX tuples, shm
+// pipelines them through the rings. Returns 0, or -1 with errno set (EBUSY
+// while asynchronous calls are outstanding).
+int arith_batch(arith_conn_t *c, size_t n, const uint8_t *op, const int64_t *a, const int64_t *b,
+                int64_t *res, int32_t *status);
+
+// ---- Array operations (ARITH_MODE_SOCK) ----
+// An array lives in a memfd, sealed so it can no longer shrink. A call sends
+// only the descriptors: the server maps the inputs read-only and writes map
+// results straight into the output array, so no element is copied through
+// the socket. Other modes fail with EOPNOTSUPP.
+
+typedef struct {
+    int      fd;            // the memfd (-1 => none)
+    int64_t *data;          // its n elements, mapped read-write
+    size_t   n;
+} arith_array_t;
+
+// Create a zero-filled array of n elements; 0, or -1 with errno set
+int arith_array_alloc(arith_array_t *arr, size_t n);
+void arith_array_free(arith_array_t *arr);
+
+// Sum of a's elements, and dot product of a and b (same length); both wrap
+// on overflow like add and mul. Return an enum arith_status with the result
+// in *res, or -1 with errno set (EINVAL: lengths differ).
+int arith_array_sum(arith_conn_t *c, const arith_array_t *a, int64_t *res);
+int arith_array_dot(arith_conn_t *c, const arith_array_t *a, const arith_array_t *b, int64_t *res);
+// out[i] = op(a[i], b[i]) for all elements (out may be a or b). Returns
+// ARITH_OK, or the status of the first element that failed with its index
+// in *failed (NULL => not wanted); failed elements are 0, the rest are still
+// computed. -1 with errno set as above.
+int arith_array_map(arith_conn_t *c, uint8_t op, const arith_array_t *a, const arith_array_t *b,
+                    const arith_array_t *out, size_t *failed);
+
+// ---- Big integers (ARITH_MODE_V2, ARITH_MODE_SOCK) ----
+// Integers of up to ARITH_BIG_LIMBS_MAX 64-bit limbs as operands and
+// ARITH_BIG_RESULT_MAX limbs as results (one frame each way, see proto.h).
+// Other modes fail with EOPNOTSUPP.
+
+typedef struct {
+    int      neg;                         // 1 => negative (never for zero)
+    size_t   n;                           // limbs used (0 => zero)
+    uint64_t limb[ARITH_BIG_RESULT_MAX];  // magnitude, least significant first
+} arith_big_t;
+
+// Room for the decimal text of any arith_big_t (sign and NUL included)
+#define ARITH_BIG_DEC_MAX (ARITH_BIG_RESULT_MAX*20+2)
+
+// *r = op(a, b) without wrapping: div truncates toward zero, mod takes the
+// sign of a, pow with a negative exponent truncates like div. Returns an
+// enum arith_status (ARITH_EOVERFLOW: the result needs more than
+// ARITH_BIG_RESULT_MAX limbs), or -1 with errno set (EINVAL: an operand has
+// more than ARITH_BIG_LIMBS_MAX limbs; EBUSY while asynchronous calls are
+// outstanding). r may be a or b.
+int arith_big_call(arith_conn_t *c, uint8_t op, const arith_big_t *a, const arith_big_t *b, arith_big_t *r);
+// Parse an optionally signed decimal number; 0, or -1 with errno EINVAL
+// (not a number) or ERANGE (more than ARITH_BIG_RESULT_MAX limbs)
+int arith_big_parse(const char *s, arith_big_t *x);
+// Decimal text of x into buf; its length, or -1 with errno ERANGE if buf is
+// too small (ARITH_BIG_DEC_MAX always suffices)
+int arith_big_format(const arith_big_t *x, char *buf, size_t size);
+
+// ---- Expressions (ARITH_MODE_V2, ARITH_MODE_SOCK) ----
+// A program of up to ARITH_EXPR_MAX postfix instructions over arguments
+// (see proto.h), parsed once from infix text and then called with any
+// arguments; the server caches what it compiled it into. Other modes fail
+// with EOPNOTSUPP.
+
+typedef struct {
+    size_t  len;                    // instructions
+    size_t  nargs;                  // arguments it reads
+    uint8_t code[ARITH_EXPR_MAX];   // enum arith_op or enum arith_expr_code
+    int64_t val[ARITH_EXPR_MAX];
+} arith_expr_t;
+
+// Parse infix text: integers, arguments a..z (a is args[0]), + - * / % and
+// ^ (pow), unary minus, parentheses and name(x, y) for any operation
+// (cadd(a, b), min(a, b), ...). A repeated subexpression is evaluated once.
+// 0, or -1 with errno EINVAL (bad syntax at text offset *err_at; may be
+// NULL), ERANGE (a literal does not fit int64_t) or E2BIG (too long).
+int arith_expr_parse(const char *text, arith_expr_t *e, size_t *err_at);
+// Evaluate e over args[0..nargs-1] (at least e->nargs of them, at most
+// ARITH_EXPR_ARGS_MAX): returns an enum arith_status with the value in *res
+// when ARITH_OK, else that of the first operation that failed; -1 with
+// errno set (EINVAL: too few or too many arguments; EBUSY while
+// asynchronous calls are outstanding)
+int arith_expr_call(arith_conn_t *c, const arith_expr_t *e, const int64_t *args, size_t nargs, int64_t *res);
+
+#endif // ARITH_CLIENT_H
@@ -0,0 +1,358 @@
+// bignum.c
+// Arbitrary-precision integer arithmetic (see bignum.h). The limb-level
+// helpers work on magnitudes (non-negative limb vectors); bn_compute() adds
+// the signs and the per-operation semantics on top.
+
+#include <stdlib.h>     // malloc, free
+#include <string.h>     // memcpy, memset, memmove
+#include <errno.h>      // errno
+
+#include "bignum.h"
+#include "proto.h"      // enum arith_op, enum arith_status
+
+typedef bn_limb_t limb_t;
+typedef unsigned __int128 dlimb_t; // two limbs: products and two-limb quotients
+
+// ---- Arena ----
+
+int bn_arena_init(bn_arena_t *ar, size_t bytes){
+    ar->base=malloc(bytes);
+    if(!ar->base) return -1;
+    ar->size=bytes; ar->used=0;
+    return 0;
+}
+
+void bn_arena_free(bn_arena_t *ar){
+    free(ar->base);
+    ar->base=NULL; ar->size=ar->used=0;
+}
+
+bn_limb_t *bn_alloc(bn_arena_t *ar, size_t n){
+    if(n>(ar->size-ar->used)/sizeof(limb_t)) return NULL;
+    limb_t *p=(limb_t*)(ar->base+ar->used);
+    ar->used+=n*sizeof(limb_t);
+    return p;
+}
+
+// ---- Magnitudes ----
+
+static size_t mpn_norm(const limb_t *d, size_t n){
+    while(n && !d[n-1]) n--;
+    return n;
+}
+
+static int mpn_cmp(const limb_t *a, size_t na, const limb_t *b, size_t nb){
+    if(na!=nb) return na<nb ? -1 : 1;
+    for(size_t i=na;i-->0;) if(a[i]!=b[i]) return a[i]<b[i] ? -1 : 1;
+    return 0;
+}
+
+// r[0..na) = a + b for na >= nb; returns the carry out (r may be a)
+static limb_t mpn_add(limb_t *r, const limb_t *a, size_t na, const limb_t *b, size_t nb){
+    limb_t c=0; size_t i=0;
+    for(;i<nb;i++){ dlimb_t s=(dlimb_t)a[i]+b[i]+c; r[i]=(limb_t)s; c=(limb_t)(s>>64); }
+    for(;i<na;i++){ dlimb_t s=(dlimb_t)a[i]+c; r[i]=(limb_t)s; c=(limb_t)(s>>64); }
+    return c;
+}
+
+// r[0..na) = a - b for na >= nb; returns the borrow out (r may be a)
+static limb_t mpn_sub(limb_t *r, const limb_t *a, size_t na, const limb_t *b, size_t nb){
+    limb_t br=0; size_t i=0;
+    for(;i<nb;i++){
+        limb_t ai=a[i], bi=b[i], d=ai-bi;
+        limb_t nbr=(ai<bi)|(d<br);
+        r[i]=d-br; br=nbr;
+    }
+    for(;i<na;i++){ limb_t ai=a[i]; r[i]=ai-br; br= ai<br; }
+    return br;
+}
+
+// Schoolbook r[0..na+nb) = a * b (r must not overlap a or b)
+static void mpn_mul_base(limb_t *r, const limb_t *a, size_t na, const limb_t *b, size_t nb){
+    memset(r,0,(na+nb)*sizeof(limb_t));
+    for(size_t j=0;j<nb;j++){
+        limb_t bj=b[j], c=0;
+        if(!bj) continue;
+        for(size_t i=0;i<na;i++){
+            dlimb_t t=(dlimb_t)a[i]*bj+r[i+j]+c;
+            r[i+j]=(limb_t)t; c=(limb_t)(t>>64);
+        }
+        r[j+na]=c; // not yet written by any earlier row
+    }
+}
+
+static int mpn_mul(bn_arena_t *ar, limb_t *r, const limb_t *a, size_t na, const limb_t *b, size_t nb);
+
+// Karatsuba for two n-limb operands: with a = a1*B^h + a0 and b likewise,
+// a*b = z2*B^2h + (z1-z2-z0)*B^h + z0 for z0 = a0*b0, z2 = a1*b1 and
+// z1 = (a0+a1)*(b0+b1): three half-size products instead of four. Scratch
+// comes from the arena and is given back on return.
+static int mpn_karatsuba(bn_arena_t *ar, limb_t *r, const limb_t *a, const limb_t *b, size_t n){
+    size_t h=n/2, hi=n-h, mark=ar->used;
+    limb_t *sa=bn_alloc(ar,hi+1), *sb=bn_alloc(ar,hi+1), *z1=bn_alloc(ar,2*hi+2);
+    int rc=-1;
+    if(!sa || !sb || !z1) goto out;
+    sa[hi]=mpn_add(sa,a+h,hi,a,h);
+    sb[hi]=mpn_add(sb,b+h,hi,b,h);
+    if(mpn_mul(ar,r,a,h,b,h)<0 || mpn_mul(ar,r+2*h,a+h,hi,b+h,hi)<0
+       || mpn_mul(ar,z1,sa,hi+1,sb,hi+1)<0) goto out;
+    mpn_sub(z1,z1,2*hi+2,r,2*h);       // z1 - z0
+    mpn_sub(z1,z1,2*hi+2,r+2*h,2*hi);  // ... - z2, never negative
+    // The middle term fits the 2n-h limbs above B^h: limbs of z1 past them are zero
+    size_t nz=mpn_norm(z1,2*hi+2);
+    mpn_add(r+h,r+h,2*n-h,z1,nz);
+    rc=0;
+out:
+    ar->used=mark;
+    return rc;
+}
+
+// r[0..na+nb) = a * b (r must not overlap a or b); -1 if the arena ran out
+static int mpn_mul(bn_arena_t *ar, limb_t *r, const limb_t *a, size_t na, const limb_t *b, size_t nb){
+    if(na<nb){ const limb_t *t=a; a=b; b=t; size_t tn=na; na=nb; nb=tn; }
+    if(!nb){ memset(r,0,na*sizeof(limb_t)); return 0; }
+    if(nb<BN_KARATSUBA_LIMBS){ mpn_mul_base(r,a,na,b,nb); return 0; }
+    if(na==nb) return mpn_karatsuba(ar,r,a,b,na);
+    // Unbalanced: a in nb-limb slices, each multiplied by b and added in place
+    size_t mark=ar->used;
+    limb_t *t=bn_alloc(ar,2*nb);
+    if(!t) return -1;
+    memset(r,0,(na+nb)*sizeof(limb_t));
+    for(size_t i=0;i<na;i+=nb){
+        size_t k= na-i<nb ? na-i : nb;
+        if(mpn_mul(ar,t,a+i,k,b,nb)<0){ ar->used=mark; return -1; }
+        mpn_add(r+i,r+i,na+nb-i,t,k+nb);
+    }
+    ar->used=mark;
+    return 0;
+}
+
+// r[0..n) = a << s and returns the bits shifted out (0 < s < 64)
+static limb_t mpn_shl(limb_t *r, const limb_t *a, size_t n, unsigned s){
+    limb_t out=a[n-1]>>(64-s);
+    for(size_t i=n-1;i>0;i--) r[i]=(a[i]<<s)|(a[i-1]>>(64-s));
+    r[0]=a[0]<<s;
+    return out;
+}
+
+// r[0..n) = a >> s (0 < s < 64)
+static void mpn_shr(limb_t *r, const limb_t *a, size_t n, unsigned s){
+    for(size_t i=0;i+1<n;i++) r[i]=(a[i]>>s)|(a[i+1]<<(64-s));
+    r[n-1]=a[n-1]>>s;
+}
+
+// q[0..na-nb] = a / b and rem[0..nb) = a % b for na >= nb >= 1 and b
+// normalized (top limb non-zero): Knuth's algorithm D (TAOCP 4.3.1), with the
+// operands shifted so the divisor's top bit is set and each quotient digit
+// estimated from the top two limbs, corrected at most twice
+static int mpn_divmod(bn_arena_t *ar, limb_t *q, limb_t *rem, const limb_t *a, size_t na, const limb_t *b, size_t nb){
+    if(nb==1){
+        limb_t d=b[0]; dlimb_t rr=0;
+        for(size_t i=na;i-->0;){ rr=(rr<<64)|a[i]; q[i]=(limb_t)(rr/d); rr%=d; }
+        rem[0]=(limb_t)rr;
+        return 0;
+    }
+    size_t mark=ar->used;
+    limb_t *v=bn_alloc(ar,nb), *u=bn_alloc(ar,na+1);
+    if(!v || !u){ ar->used=mark; return -1; }
+    unsigned s=(unsigned)__builtin_clzll(b[nb-1]);
+    if(s){ mpn_shl(v,b,nb,s); u[na]=mpn_shl(u,a,na,s); }
+    else { memcpy(v,b,nb*sizeof(limb_t)); memcpy(u,a,na*sizeof(limb_t)); u[na]=0; }
+    limb_t vt=v[nb-1], vs=v[nb-2];
+    for(size_t j=na-nb+1;j-->0;){
+        dlimb_t num=((dlimb_t)u[j+nb]<<64)|u[j+nb-1];
+        dlimb_t qhat=num/vt, rhat=num%vt;
+        while((qhat>>64) || qhat*vs>((rhat<<64)|u[j+nb-2])){
+            qhat--; rhat+=vt;
+            if(rhat>>64) break;
+        }
+        // u[j..j+nb] -= qhat * v
+        limb_t carry=0, br=0;
+        for(size_t i=0;i<nb;i++){
+            dlimb_t p=(dlimb_t)(limb_t)qhat*v[i]+carry;
+            carry=(limb_t)(p>>64);
+            limb_t pl=(limb_t)p, ui=u[i+j], d=ui-pl;
+            limb_t nbr=(ui<pl)|(d<br);
+            u[i+j]=d-br; br=nbr;
+        }
+        limb_t ui=u[j+nb], d=ui-carry;
+        limb_t neg=(ui<carry)|(d<br);
+        u[j+nb]=d-br;
+        if(neg){ // qhat was one too large: add v back
+            qhat--;
+            u[j+nb]+=mpn_add(u+j,u+j,nb,v,nb);
+        }
+        q[j]=(limb_t)qhat;
+    }
+    if(s) mpn_shr(rem,u,nb,s); else memcpy(rem,u,nb*sizeof(limb_t));
+    ar->used=mark;
+    return 0;
+}
+
+// ---- Signed operations ----
+
+#define BN_NOMEM (-1) // internal: arena exhausted (reported as ARITH_EOVERFLOW)
+
+static void bn_fix(bn_t *r){
+    r->n=mpn_norm(r->d,r->n);
+    if(!r->n) r->neg=false;
+}
+
+// r = a + (b_neg ? -|b| : |b|)
+static int bn_add(bn_arena_t *ar, const bn_t *a, const bn_t *b, bool b_neg, bn_t *r){
+    if(a->neg==b_neg){
+        const bn_t *x=a, *y=b;
+        if(x->n<y->n){ x=b; y=a; }
+        if(!(r->d=bn_alloc(ar,x->n+1))) return BN_NOMEM;
+        r->d[x->n]=mpn_add(r->d,x->d,x->n,y->d,y->n);
+        r->n=x->n+1; r->neg=a->neg;
+    } else { // signs differ: the larger magnitude minus the smaller one, with its sign
+        int c=mpn_cmp(a->d,a->n,b->d,b->n);
+        const bn_t *x= c>=0 ? a : b, *y= c>=0 ? b : a;
+        if(!(r->d=bn_alloc(ar,x->n))) return BN_NOMEM;
+        mpn_sub(r->d,x->d,x->n,y->d,y->n);
+        r->n=x->n; r->neg= c>=0 ? a->neg : b_neg;
+    }
+    bn_fix(r);
+    return ARITH_OK;
+}
+
+static int bn_mul(bn_arena_t *ar, const bn_t *a, const bn_t *b, bn_t *r){
+    if(!(r->d=bn_alloc(ar,a->n+b->n))) return BN_NOMEM;
+    if(mpn_mul(ar,r->d,a->d,a->n,b->d,b->n)<0) return BN_NOMEM;
+    r->n=a->n+b->n; r->neg=a->neg!=b->neg;
+    bn_fix(r);
+    return ARITH_OK;
+}
+
+// Truncating division: quotient toward zero, remainder with the sign of a
+static int bn_divmod(bn_arena_t *ar, const bn_t *a, const bn_t *b, bn_t *quot, bn_t *rem){
+    if(!b->n) return ARITH_EDIVZERO;
+    if(mpn_cmp(a->d,a->n,b->d,b->n)<0){ // |a| < |b|
+        quot->n=0; quot->neg=false; quot->d=NULL;
+        *rem=*a;
+        return ARITH_OK;
+    }
+    quot->d=bn_alloc(ar,a->n-b->n+1); rem->d=bn_alloc(ar,b->n);
+    if(!quot->d || !rem->d || mpn_divmod(ar,quot->d,rem->d,a->d,a->n,b->d,b->n)<0) return BN_NOMEM;
+    quot->n=a->n-b->n+1; quot->neg=a->neg!=b->neg;
+    rem->n=b->n; rem->neg=a->neg;
+    bn_fix(quot); bn_fix(rem);
+    return ARITH_OK;
+}
+
+static bool bn_is_one(const bn_t *x){ return x->n==1 && x->d[0]==1; }
+
+// a**b by squaring. Every square is a factor of the result when another
+// exponent bit follows, so the first intermediate above `max` limbs already
+// means the result is too large.
+static int bn_pow(bn_arena_t *ar, const bn_t *a, const bn_t *b, bn_t *r, size_t max){
+    static limb_t one=1;
+    bool odd= b->n && (b->d[0]&1);
+    if(b->neg){ // truncates toward zero like div
+        if(!a->n) return ARITH_EDIVZERO;
+        if(!bn_is_one(a)){ r->n=0; r->neg=false; return ARITH_OK; }
+        r->d=&one; r->n=1; r->neg= a->neg && odd;
+        return ARITH_OK;
+    }
+    if(!b->n || bn_is_one(a)){ r->d=&one; r->n=1; r->neg= b->n && a->neg && odd; return ARITH_OK; }
+    if(!a->n){ r->n=0; r->neg=false; return ARITH_OK; }
+    // |a| >= 2: the result has at least e bits
+    if(b->n>1 || b->d[0]>(uint64_t)max*64) return ARITH_EOVERFLOW;
+    uint64_t e=b->d[0];
+    bn_t acc={ .d=&one, .n=1, .neg=false }, base=*a;
+    base.neg=false;
+    for(;;){
+        if(e&1){
+            bn_t t; int st=bn_mul(ar,&acc,&base,&t);
+            if(st!=ARITH_OK) return st;
+            if(t.n>max) return ARITH_EOVERFLOW;
+            acc=t;
+        }
+        e>>=1;
+        if(!e) break;
+        bn_t t; int st=bn_mul(ar,&base,&base,&t);
+        if(st!=ARITH_OK) return st;
+        if(t.n>max) return ARITH_EOVERFLOW;
+        base=t;
+    }
+    *r=acc; r->neg= a->neg && odd;
+    return ARITH_OK;
+}
+
+// Signed comparison
+static int bn_cmp(const bn_t *a, const bn_t *b){
+    if(a->neg!=b->neg) return a->neg ? -1 : 1;
+    int c=mpn_cmp(a->d,a->n,b->d,b->n);
+    return a->neg ? -c : c;
+}
+
+int bn_compute(bn_arena_t *ar, uint8_t op, const bn_t *a, const bn_t *b, bn_t *r, size_t max){
+    r->d=NULL; r->n=0; r->neg=false;
+    bn_t other;
+    int st;
+    switch(op){
+    case ARITH_OP_ADD: case ARITH_OP_CADD: st=bn_add(ar,a,b,b->neg,r); break;
+    case ARITH_OP_SUB: st=bn_add(ar,a,b,b->n && !b->neg,r); break;
+    case ARITH_OP_MUL: case ARITH_OP_CMUL: st=bn_mul(ar,a,b,r); break;
+    case ARITH_OP_DIV: st=bn_divmod(ar,a,b,r,&other); break;
+    case ARITH_OP_MOD: st=bn_divmod(ar,a,b,&other,r); break;
+    case ARITH_OP_POW: st=bn_pow(ar,a,b,r,max); break;
+    case ARITH_OP_MIN: *r= bn_cmp(a,b)<=0 ? *a : *b; st=ARITH_OK; break;
+    case ARITH_OP_MAX: *r= bn_cmp(a,b)>=0 ? *a : *b; st=ARITH_OK; break;
+    default: return ARITH_EINVALOP;
+    }
+    if(st==BN_NOMEM || (st==ARITH_OK && r->n>max)) st=ARITH_EOVERFLOW;
+    if(st!=ARITH_OK){ r->d=NULL; r->n=0; r->neg=false; }
+    return st;
+}
+
+// ---- Decimal conversion ----
+
+#define DEC_CHUNK  19                          // decimal digits per limb step
+#define DEC_RADIX  UINT64_C(10000000000000000000) // 10^19
+
+int bn_from_dec(const char *s, bn_limb_t *d, size_t max, bn_t *out){
+    bool neg=false;
+    if(*s=='-' || *s=='+') neg= *s++=='-';
+    if(*s<'0' || *s>'9'){ errno=EINVAL; return -1; }
+    size_t n=0;
+    while(*s>='0' && *s<='9'){
+        // Next chunk of up to 19 digits: x = x*10^k + chunk
+        limb_t chunk=0, mul=1;
+        for(int k=0;k<DEC_CHUNK && *s>='0' && *s<='9';k++,s++){ chunk=chunk*10+(limb_t)(*s-'0'); mul*=10; }
+        limb_t c=chunk;
+        for(size_t i=0;i<n;i++){ dlimb_t t=(dlimb_t)d[i]*mul+c; d[i]=(limb_t)t; c=(limb_t)(t>>64); }
+        if(c){
+            if(n==max){ errno=ERANGE; return -1; }
+            d[n++]=c;
+        }
+    }
+    if(*s){ errno=EINVAL; return -1; }
+    out->d=d; out->n=n; out->neg=neg && n;
+    return 0;
+}
+
+int bn_to_dec(const bn_t *x, bn_limb_t *tmp, char *buf, size_t size){
+    if(!size){ errno=ERANGE; return -1; }
+    size_t pos=size-1, n=x->n;
+    buf[pos]='\0';
+    memcpy(tmp,x->d,n*sizeof(limb_t));
+    do { // digits come out least significant first, filled in from the end of buf
+        dlimb_t rr=0;
+        for(size_t i=n;i-->0;){ rr=(rr<<64)|tmp[i]; tmp[i]=(limb_t)(rr/DEC_RADIX); rr%=DEC_RADIX; }
+        n=mpn_norm(tmp,n);
+        limb_t chunk=(limb_t)rr;
+        for(int k=0;k<DEC_CHUNK && (n || chunk || k==0);k++){ // the top chunk has no leading zeros
+            if(!pos){ errno=ERANGE; return -1; }
+            buf[--pos]=(char)('0'+chunk%10); chunk/=10;
+        }
+    } while(n);
+    if(x->neg){
+        if(!pos){ errno=ERANGE; return -1; }
+        buf[--pos]='-';
+    }
+    size_t len=size-1-pos;
+    memmove(buf,buf+pos,len+1);
+    return (int)len;
+}
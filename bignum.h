@@ -0,0 +1,58 @@
+// bignum.h
+// Arbitrary-precision integers behind big-integer frames (ARITH_FRAME_BIG):
+// sign and magnitude, the magnitude in little-endian 64-bit limbs with no
+// leading zero limb (zero is n = 0 and never negative). The server computes
+// them with every result and temporary taken from a bump arena (bn_arena_t)
+// that each worker or thread resets once the response is written, so a
+// request costs no malloc()/free() however many intermediates it needs.
+// Multiplication switches from the schoolbook method to Karatsuba above
+// BN_KARATSUBA_LIMBS limbs; division is Knuth's algorithm D. The client
+// library uses the decimal conversions.
+
+#ifndef ARITH_BIGNUM_H
+#define ARITH_BIGNUM_H
+
+#include <stdbool.h>    // bool
+#include <stddef.h>     // size_t
+#include <stdint.h>     // uint64_t, uint8_t
+
+// Operands of at least this many limbs (each) are multiplied by Karatsuba
+#define BN_KARATSUBA_LIMBS 24
+
+typedef uint64_t bn_limb_t;
+
+typedef struct {
+    bn_limb_t *d;         // n limbs, least significant first
+    size_t     n;
+    bool       neg;
+} bn_t;
+
+// Bump allocator: allocation is a pointer add, reset frees everything
+typedef struct {
+    unsigned char *base;
+    size_t size, used;
+} bn_arena_t;
+
+// Reserve `bytes` for the arena; 0, or -1 with errno
+int  bn_arena_init(bn_arena_t *ar, size_t bytes);
+void bn_arena_free(bn_arena_t *ar);
+static inline void bn_arena_reset(bn_arena_t *ar){ ar->used=0; }
+// n limbs (uninitialized) from the arena, NULL once it is exhausted
+bn_limb_t *bn_alloc(bn_arena_t *ar, size_t n);
+
+// r = op(a, b) for an enum arith_op, with the semantics of compute() except
+// that nothing wraps: div truncates toward zero, mod takes the sign of a,
+// pow with a negative exponent truncates like div, and min/max/cadd/cmul
+// are exact. Returns an ARITH_* status; ARITH_EOVERFLOW if the result would
+// need more than `max` limbs (or the arena ran out). r->d points into ar
+// (or at a's or b's limbs, or a constant), so it is valid until the reset.
+int bn_compute(bn_arena_t *ar, uint8_t op, const bn_t *a, const bn_t *b, bn_t *r, size_t max);
+
+// Parse an optionally signed decimal string into at most `max` limbs of d;
+// 0, or -1 with errno EINVAL (not a number) or ERANGE (too long)
+int bn_from_dec(const char *s, bn_limb_t *d, size_t max, bn_t *out);
+// Decimal text of x into buf; `tmp` holds x->n limbs of scratch. Returns
+// the length, or -1 with errno ERANGE if buf is too small.
+int bn_to_dec(const bn_t *x, bn_limb_t *tmp, char *buf, size_t size);
+
+#endif // ARITH_BIGNUM_H
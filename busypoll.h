@@ -0,0 +1,68 @@
+// busypoll.h
+// Busy-poll mode (server --busy-poll, arith_options_t.busy_poll_us): a side
+// that runs out of work keeps polling for a fixed wall-clock budget before it
+// falls back to its usual blocking wait (poll(), epoll_wait(), sem_wait() or
+// a futex). That trades a CPU for the wake-up latency of the sleep: an answer
+// or request arriving within the budget is picked up at once, without the
+// scheduler having to run the sleeper again. The budget is wall time rather
+// than a poll count so that it means the same on any CPU; the clock is read
+// every BUSY_POLL_STRIDE polls. Each of those strides ends in sched_yield():
+// free when the poller has its CPU to itself, but on a shared CPU it lets
+// the peer it waits for run instead of spinning out the whole budget.
+
+#ifndef ARITH_BUSYPOLL_H
+#define ARITH_BUSYPOLL_H
+
+#include <stdint.h>     // uint64_t
+#include <stdbool.h>    // bool
+#include <stdatomic.h>  // atomic_uint
+#include <time.h>       // clock_gettime
+#include <poll.h>       // poll
+#include <errno.h>      // EINTR
+#include <sched.h>      // sched_yield
+
+#include "shmchan.h"    // shm_cpu_relax
+
+#define BUSY_POLL_STRIDE 64
+
+// Pause between the failed polls of a loop of the caller's own (every
+// BUSY_POLL_STRIDE-th pause yields)
+static inline void busy_poll_pause(unsigned *polls){
+    if(++*polls%BUSY_POLL_STRIDE==0) sched_yield();
+    else shm_cpu_relax();
+}
+
+static inline uint64_t busy_poll_now(void){
+    struct timespec ts; clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (uint64_t)ts.tv_sec*1000000000u+(uint64_t)ts.tv_nsec;
+}
+
+// Spin until *w != seen, for up to budget_ns; true if it moved
+static inline bool busy_poll_word(atomic_uint *w, unsigned seen, uint64_t budget_ns){
+    uint64_t end=busy_poll_now()+budget_ns;
+    do {
+        for(unsigned i=0;i<BUSY_POLL_STRIDE;i++){
+            if(atomic_load_explicit(w,memory_order_acquire)!=seen) return true;
+            shm_cpu_relax();
+        }
+        sched_yield();
+    } while(busy_poll_now()<end);
+    return false;
+}
+
+// Poll fd for input without blocking, for up to budget_ns (one system call
+// per poll, but no sleep); 1 once it is readable (or has an error to
+// report), 0 if the budget ran out, -1 with errno on failure
+static inline int busy_poll_fd(int fd, uint64_t budget_ns){
+    uint64_t end=busy_poll_now()+budget_ns;
+    struct pollfd pf={ .fd=fd, .events=POLLIN };
+    do {
+        int r=poll(&pf,1,0);
+        if(r>0) return 1;
+        if(r<0 && errno!=EINTR) return -1;
+        sched_yield();
+    } while(busy_poll_now()<end);
+    return 0;
+}
+
+#endif // ARITH_BUSYPOLL_H
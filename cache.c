@@ -0,0 +1,88 @@
+// cache.c
+// Shared result cache (see cache.h). Bucket fields are relaxed atomics: a
+// reader may load them while a writer stores them, and the sequence word
+// tells it afterwards whether that happened.
+
+#define _GNU_SOURCE
+#include <stdatomic.h>  // atomic_uint, atomic_load_explicit, ...
+#include <sys/mman.h>   // mmap
+
+#include "cache.h"
+#include "ops.h"        // ARITH_OP_INVALID
+
+typedef struct {
+    _Alignas(64) atomic_uint seq;      // odd while a writer fills the bucket
+    atomic_uchar     op[CACHE_WAYS];   // ARITH_OP_INVALID => free way
+    atomic_schar     status[CACHE_WAYS];
+    atomic_uchar     mru;              // way hit or filled last (the other one goes first)
+    _Atomic int64_t  a[CACHE_WAYS], b[CACHE_WAYS], res[CACHE_WAYS];
+} cache_bucket_t;
+_Static_assert(sizeof(cache_bucket_t)==64, "a bucket is one cache line");
+
+static cache_bucket_t *table = NULL;
+static size_t mask = 0; // buckets-1
+
+int cache_init(size_t entries){
+    size_t buckets=1;
+    while(buckets*CACHE_WAYS<entries) buckets<<=1;
+    void *p=mmap(NULL,buckets*sizeof(cache_bucket_t),PROT_READ|PROT_WRITE,MAP_SHARED|MAP_ANONYMOUS,-1,0);
+    if(p==MAP_FAILED) return -1;
+    table=p; mask=buckets-1;
+    for(size_t i=0;i<buckets;i++)
+        for(int w=0;w<CACHE_WAYS;w++) atomic_init(&table[i].op[w],ARITH_OP_INVALID);
+    return 0;
+}
+
+size_t cache_capacity(void){ return table ? (mask+1)*CACHE_WAYS : 0; }
+
+// splitmix64 finalizer over both operands and the opcode
+static inline uint64_t mix(uint64_t x){
+    x^=x>>30; x*=UINT64_C(0xbf58476d1ce4e5b9);
+    x^=x>>27; x*=UINT64_C(0x94d049bb133111eb);
+    return x^(x>>31);
+}
+static inline cache_bucket_t *bucket_of(uint8_t op, int64_t a, int64_t b){
+    uint64_t h=mix((uint64_t)a ^ mix((uint64_t)b+((uint64_t)op<<56)));
+    return &table[h&mask];
+}
+
+#define LD(p)    atomic_load_explicit(p,memory_order_relaxed)
+#define ST(p,v)  atomic_store_explicit(p,v,memory_order_relaxed)
+
+bool cache_get(uint8_t op, int64_t a, int64_t b, int64_t *res, int *status){
+    cache_bucket_t *bk=bucket_of(op,a,b);
+    unsigned s=atomic_load_explicit(&bk->seq,memory_order_acquire);
+    if(s&1) return false;
+    for(int w=0;w<CACHE_WAYS;w++){
+        if(LD(&bk->op[w])!=op || LD(&bk->a[w])!=a || LD(&bk->b[w])!=b) continue;
+        int64_t r=LD(&bk->res[w]); int st=LD(&bk->status[w]);
+        atomic_thread_fence(memory_order_acquire); // the loads above before the recheck
+        if(atomic_load_explicit(&bk->seq,memory_order_relaxed)!=s) return false;
+        if(LD(&bk->mru)!=w) ST(&bk->mru,(unsigned char)w); // a hint: a lost update only misplaces one eviction
+        *res=r; *status=st;
+        return true;
+    }
+    return false;
+}
+
+int cache_put(uint8_t op, int64_t a, int64_t b, int64_t res, int status){
+    cache_bucket_t *bk=bucket_of(op,a,b);
+    unsigned s=atomic_load_explicit(&bk->seq,memory_order_relaxed);
+    if((s&1) || !atomic_compare_exchange_strong_explicit(&bk->seq,&s,s+1,memory_order_relaxed,memory_order_relaxed)) return -1;
+    atomic_thread_fence(memory_order_release); // readers see the odd word before any half-written field
+    // Its own entry (another handler got there first), else a free way, else the LRU one
+    int w=-1, way_free=-1;
+    for(int i=0;i<CACHE_WAYS;i++){
+        unsigned char o=LD(&bk->op[i]);
+        if(o==op && LD(&bk->a[i])==a && LD(&bk->b[i])==b){ w=i; break; }
+        if(o==ARITH_OP_INVALID && way_free<0) way_free=i;
+    }
+    int evicted=0;
+    if(w<0 && way_free>=0) w=way_free;
+    if(w<0){ w=(LD(&bk->mru)+1)%CACHE_WAYS; evicted=1; }
+    ST(&bk->op[w],op); ST(&bk->a[w],a); ST(&bk->b[w],b);
+    ST(&bk->res[w],res); ST(&bk->status[w],(signed char)status);
+    ST(&bk->mru,(unsigned char)w);
+    atomic_store_explicit(&bk->seq,s+2,memory_order_release);
+    return evicted;
+}
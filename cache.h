@@ -0,0 +1,35 @@
+// cache.h
+// Result cache (server --cache OPS): (op, a, b) -> (status, result) pairs in a
+// fixed-size open-addressing hash table in shared memory, mapped before
+// anything is forked, so fork()ed children, pool workers and pool threads all
+// hit what any of them computed. The table is set-associative: a key hashes
+// to one bucket of CACHE_WAYS entries that fills exactly one cache line, so a
+// lookup touches one line and a full bucket evicts its least recently used
+// entry. Buckets take no lock: each has a sequence word that is odd while a
+// writer fills it. A reader that sees it odd or changed counts a miss
+// instead of waiting, and a writer that finds another one inside skips its
+// insert. The server only looks up the operations it was told to (cheap ones
+// such as add would pay more for the lookup than for the computation).
+
+#ifndef ARITH_CACHE_H
+#define ARITH_CACHE_H
+
+#include <stdbool.h>    // bool
+#include <stddef.h>     // size_t
+#include <stdint.h>     // int64_t, uint8_t
+
+#define CACHE_WAYS 2 // entries per bucket (one cache line)
+
+// Map a table of at least `entries` entries (rounded up to a power of two)
+// in shared memory; 0, or -1 with errno
+int cache_init(size_t entries);
+// Entries the table holds (0 => no cache)
+size_t cache_capacity(void);
+
+// Look up op(a, b): true with its status and result if cached
+bool cache_get(uint8_t op, int64_t a, int64_t b, int64_t *res, int *status);
+// Remember op(a, b); 1 if that evicted another entry, 0 if it took a free or
+// its own entry, -1 if the bucket was being written (nothing stored)
+int  cache_put(uint8_t op, int64_t a, int64_t b, int64_t res, int status);
+
+#endif // ARITH_CACHE_H
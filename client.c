@@ -1,63 +1,58 @@
 // client.c (fixed)
-// Interactive client for the FIFO-based arithmetic server. The client creates
-// a per-process response FIFO, sends a fixed-size request struct to the
-// server's well-known request FIFO, then opens its response FIFO to receive
-// exactly one fixed-size response struct.
+// Interactive client for the FIFO-based arithmetic server, a thin front-end
+// over the client library (arith_client.h). By default every call opens the
+// channels afresh and exchanges one fixed-size v1 request / response struct.
+// With `--session` both channels are opened once and kept for the client's
+// whole lifetime, so a round trip is a single write plus a single read.
+// With `--v2` (implies --session) the client registers its response FIFO once
+// and then exchanges compact 24-byte requests / 16-byte responses (proto.h).
+// With `--batch [K]` it reads "op a b" lines from stdin, sends them as v2
+// batch frames of up to K tuples and prints one result line per input line.
+// With `--stream [K]` it sends each line as its own asynchronous call, keeps
+// up to K of them in flight and prints the answers in input order, whatever
+// order they arrive in.
+// With `--transport shm` requests and responses travel through rings in a
+// shared-memory segment (shmchan.h) instead; the FIFO only carries the attach.
+// With `--transport sock` they are v2 messages on a connected Unix socket
+// (transport.h), and no FIFO is involved at all.
+// With `--array OP N` (socket transport) it runs one array operation over N
+// elements in memfds the server maps (sum, dot, or any operation applied
+// element-wise), times it and checks the answer.
+// With `--big` it reads "op a b" lines of decimal integers of any length (up
+// to about 4600 digits) from stdin and prints each exact result (v2 FIFO or
+// socket transport).
+// With `--expr TEXT` it parses an infix expression over arguments a, b, ...
+// once, then reads lines of argument values from stdin and prints the
+// expression's value for each, the server evaluating it in one round trip;
+// `--expr-calls` makes one dependent call per operation instead.
+// With `--busy-poll US` it polls for each answer that long before sleeping.
+// With `--autobatch US[,MAX]` concurrent calls on one handle are merged into
+// batch frames (arith_options_t.autobatch_us); the --bench threads of one
+// process then share a single handle.
+// With `--bench` it is a load generator over any of those modes and prints a
+// JSON summary of throughput and latency percentiles.
 
 #define _GNU_SOURCE
 #include <stdio.h>      // printf, fprintf, fgets
 #include <stdlib.h>     // exit
 #include <stdint.h>     // int64_t
 #include <stdbool.h>    // bool
-#include <string.h>     // memset, strncpy, strlen
+#include <string.h>     // memchr, strlen
 #include <errno.h>      // errno
-#include <unistd.h>     // getpid, unlink, read, write, close
+#include <unistd.h>     // read, close, dup2
 #include <fcntl.h>      // open flags
-#include <sys/stat.h>   // mkfifo, stat
 #include <sys/types.h>  // pid_t
+#include <signal.h>     // signal, SIGPIPE
+#include <sys/mman.h>   // mmap (--bench slots)
+#include <sys/wait.h>   // waitpid (--bench client processes)
+#include <pthread.h>    // pthread_create (--bench threads)
+#include <time.h>       // clock_gettime, clock_nanosleep
+#include <poll.h>       // poll (--stream)
 
-#define REQ_FIFO_PATH "/tmp/arith_req_fifo" // server request FIFO path
-#define RESP_NAME_MAX 128
-#define OP_MAX 4
-
-// Request struct mirrors the server's expectation
-typedef struct __attribute__((packed)) {
-    char   operation[OP_MAX];
-    int64_t operand1;
-    int64_t operand2;
-    pid_t  client_pid;
-    char   resp_fifo[RESP_NAME_MAX];
-} request_msg_t;
-
-// Response struct mirrors the server's response
-typedef struct __attribute__((packed)) {
-    int64_t result;
-    int32_t success;
-    char    error[128];
-} response_msg_t;
-
-// Read exactly n bytes or return -1 on error / short read (EOF)
-static ssize_t read_full(int fd, void *buf, size_t n){
-    size_t off=0;
-    while(off<n){
-        ssize_t r=read(fd,(char*)buf+off,n-off);
-        if(r==0) return (ssize_t)off;           // EOF: return bytes read so far
-        if(r<0){ if(errno==EINTR) continue; return -1; }
-        off+=(size_t)r;
-    }
-    return (ssize_t)off; // success: exactly n bytes read
-}
-
-// Write exactly n bytes or return -1 on error
-static ssize_t write_full(int fd, const void *buf, size_t n){
-    size_t off=0;
-    while(off<n){
-        ssize_t w=write(fd,(const char*)buf+off,n-off);
-        if(w<0){ if(errno==EINTR) continue; return -1; }
-        off+=(size_t)w;
-    }
-    return (ssize_t)off; // success
-}
+#include "arith_client.h" // connection handles, sync / async / batch calls
+#include "transport.h"  // --transport names
+#include "hist.h"       // latency histograms (--bench)
+#include "profile.h"    // stage timestamps (make profile)
 
 // Remove trailing LF/CR from a string read by fgets
 static void trim_newline(char *s){
@@ -67,26 +62,611 @@ static void trim_newline(char *s){
 
 // Validate the textual operation the user typed
 static bool is_valid_op(const char *op){
-    return !strcmp(op,"add")||!strcmp(op,"sub")||!strcmp(op,"mul")||!strcmp(op,"div");
+    return arith_op_from_name(op)!=ARITH_OP_INVALID;
+}
+
+// Names of every registered operation joined by sep ("add/sub/...")
+static const char *op_list(const char *sep){
+    static char buf[ARITH_OP_COUNT*8];
+    size_t n=0;
+    for(int i=0;i<ARITH_OP_COUNT;i++)
+        n+=(size_t)snprintf(buf+n,sizeof(buf)-n,"%s%s",i?sep:"",arith_ops[i].name);
+    return buf;
+}
+
+static bool session = false; // --session
+static bool use_v2 = false;  // --v2
+static int  transport = ARITH_TRANSPORT_FIFO; // --transport fifo|shm|sock
+static arith_options_t opts; // the handle every call goes through (set in main)
+
+// Parse one "op a b" input line; 0 for a blank line (skipped), -1 if malformed.
+// Unknown operations become ARITH_OP_INVALID and get a per-line error back.
+static int parse_line(const char *line, uint8_t *op, int64_t *a, int64_t *b){
+    char name[16]; long long x,y; char extra;
+    int got=sscanf(line,"%15s %lld %lld %c",name,&x,&y,&extra);
+    if(got==EOF) return 0;
+    if(got!=3) return -1;
+    *op=arith_op_from_name(name); *a=x; *b=y;
+    return 1;
+}
+
+static void print_answer(int status, int64_t result){
+    PROF_BEGIN(t);
+    if(status==ARITH_OK) printf("%lld\n",(long long)result);
+    else                 printf("ERROR: %s\n",arith_status_str(status));
+    PROF_END(PROF_PRINT,t);
+}
+
+// --batch: stream "op a b" lines from stdin, K tuples per arith_batch() (v2
+// batch frames over a FIFO or the socket, or pipelined through the rings with
+// --transport shm);
+// prints "<result>" or "ERROR: <reason>" per tuple in input order
+static int run_batch(arith_conn_t *c, size_t k){
+    static uint8_t op[ARITH_BATCH_MAX];
+    static int64_t a[ARITH_BATCH_MAX], b[ARITH_BATCH_MAX], res[ARITH_BATCH_MAX];
+    static int32_t status[ARITH_BATCH_MAX];
+    char line[256]; size_t n=0; long lineno=0; int rc=0;
+    for(;;){
+        bool eof=!fgets(line,sizeof(line),stdin);
+        if(!eof){
+            lineno++;
+            int got=parse_line(line,&op[n],&a[n],&b[n]);
+            if(got==0) continue;
+            if(got<0){ fprintf(stderr,"line %ld: expected 'op a b'\n",lineno); rc=1; continue; }
+            n++;
+        }
+        if(n==k || (eof && n)){
+            PROF_BEGIN(tc);
+            if(arith_batch(c,n,op,a,b,res,status)<0){ perror("batch"); return 1; }
+            PROF_END(PROF_CALL,tc);
+            for(size_t i=0;i<n;i++) print_answer(status[i],res[i]);
+            n=0;
+        }
+        if(eof) break;
+    }
+    return rc;
 }
 
-int main(void){
-    // Construct a per-process response FIFO path in /tmp using PID
-    char resp_fifo[RESP_NAME_MAX];
-    snprintf(resp_fifo,sizeof(resp_fifo),"/tmp/arith_resp_%d.fifo",(int)getpid());
+// ---- --stream ----
+// Every input line becomes one asynchronous call (arith_submit). Up to K are
+// outstanding at a time; answers may arrive in any order (pool workers race)
+// and are parked in a window of K slots until every earlier line has been
+// printed. Input is read with read(2) rather than stdio so the loop always
+// knows whether a whole line is already buffered, and over FIFOs it waits in
+// poll() on both input and answers: the pipe never sits idle for a round
+// trip, and answers are printed while input is still arriving.
+#define STREAM_MAX 4096 // answers that fit the response FIFO's 64 KiB buffer
+
+typedef struct {
+    bool     done;          // its answer is in
+    int32_t  status;
+    int64_t  result;
+} stream_slot_t;
+
+typedef struct {
+    char   buf[65536];
+    size_t start, end;      // unconsumed bytes
+    bool   eof;
+} line_reader_t;
+
+// Next whole line (NUL-terminated, newline stripped), or NULL if none is
+// buffered yet; after EOF a final unterminated line is returned too
+static char *reader_line(line_reader_t *r){
+    char *p=memchr(r->buf+r->start,'\n',r->end-r->start);
+    if(!p){
+        if(!r->eof || r->start==r->end) return NULL;
+        if(r->end==sizeof(r->buf)) r->end--;               // overlong last line: cut it
+        p=r->buf+r->end++;
+    }
+    *p='\0';
+    char *line=r->buf+r->start;
+    r->start=(size_t)(p-r->buf)+1;
+    return line;
+}
+
+// Read more input; false on error
+static bool reader_fill(line_reader_t *r, int fd){
+    if(r->start){ memmove(r->buf,r->buf+r->start,r->end-r->start); r->end-=r->start; r->start=0; }
+    if(r->end==sizeof(r->buf)) r->end=0;                     // a single line filled the buffer: drop it
+    ssize_t n=read(fd,r->buf+r->end,sizeof(r->buf)-r->end);
+    if(n<0) return errno==EINTR;
+    if(n==0) r->eof=true;
+    r->end+=(size_t)n;
+    return true;
+}
+
+// Completion callback: the slot is the call's user pointer
+static void stream_done(void *user, uint32_t id, int status, int64_t result){
+    (void)id; stream_slot_t *s=user;
+    s->done=true; s->status=status; s->result=result;
+}
+
+static int run_stream(arith_conn_t *c, size_t k){
+    static line_reader_t in;
+    static stream_slot_t win[STREAM_MAX];
+    long lineno=0; int rc=0;
+    size_t first=0, next=0;                       // window: lines [first, next)
+    int fd=arith_fd(c);                           // -1: answers are only seen by arith_poll()
+
+    for(;;){
+        // Turn buffered lines into calls while the window has room
+        char *line;
+        while(next-first<k && (line=reader_line(&in))){
+            lineno++;
+            uint8_t op; int64_t a,b;
+            int got=parse_line(line,&op,&a,&b);
+            if(got==0) continue;
+            if(got<0){ fprintf(stderr,"line %ld: expected 'op a b'\n",lineno); rc=1; continue; }
+            stream_slot_t *s=&win[next%k]; s->done=false;
+            while(arith_submit(c,op,a,b,stream_done,s,NULL)<0){
+                if(errno!=EAGAIN || arith_poll(c,-1)<0){ perror("submit"); return 1; }
+            }
+            next++;
+        }
+        if(in.eof && in.start==in.end && first==next) break; // all answered and printed
+
+        fflush(stdout); // about to wait
+        bool want_input= !in.eof && next-first<k; // window has room but no whole line is buffered
+        if(fd>=0){
+            struct pollfd pf[2]={ { .fd=fd, .events=POLLIN }, { .fd=STDIN_FILENO, .events=POLLIN } };
+            if(poll(pf, want_input ? 2 : 1, -1)<0){
+                if(errno==EINTR) continue;
+                perror("poll"); return 1;
+            }
+            if(want_input && (pf[1].revents&(POLLIN|POLLHUP|POLLERR)) && !reader_fill(&in,STDIN_FILENO)){
+                perror("read input"); return 1;
+            }
+            if((pf[0].revents&POLLIN) && arith_poll(c,0)<0){ perror("read response"); return 1; }
+        } else if(want_input){
+            // No descriptor to wait on: take what is answered, then block on input
+            if(arith_poll(c,0)<0 || !reader_fill(&in,STDIN_FILENO)){ perror("stream"); return 1; }
+        } else if(arith_poll(c,-1)<0){ perror("poll"); return 1; }
+
+        // Print the in-order prefix that is complete
+        for(stream_slot_t *s; first!=next && (s=&win[first%k])->done; first++) print_answer(s->status,s->result);
+    }
+    fflush(stdout);
+    return rc;
+}
+
+// ---- --array ----
+// Operands follow the same pattern as the bench's (b is never 0, so div and
+// mod succeed); reductions are checked against a local loop, element-wise
+// results against single calls for a few elements.
+static int run_array(arith_conn_t *c, const char *what, size_t n){
+    bool sum=!strcmp(what,"sum"), dot=!strcmp(what,"dot");
+    uint8_t op=arith_op_from_name(what);
+    if(!sum && !dot && op==ARITH_OP_INVALID){ fprintf(stderr,"--array: sum, dot or one of %s\n",op_list(", ")); return 2; }
+    arith_array_t a, b, out={ .fd=-1 };
+    if(arith_array_alloc(&a,n)<0 || arith_array_alloc(&b,n)<0 || (!sum && !dot && arith_array_alloc(&out,n)<0)){
+        perror("array"); return 1;
+    }
+    uint64_t want=0;
+    for(size_t i=0;i<n;i++){
+        a.data[i]=(int64_t)(i%2001)-1000; b.data[i]=(int64_t)(i%16)+1;
+        want+= sum ? (uint64_t)a.data[i] : (uint64_t)a.data[i]*(uint64_t)b.data[i];
+    }
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC,&t0);
+    int64_t res=0; size_t failed=0;
+    PROF_BEGIN(tc);
+    int st= sum ? arith_array_sum(c,&a,&res) : dot ? arith_array_dot(c,&a,&b,&res) : arith_array_map(c,op,&a,&b,&out,&failed);
+    PROF_END(PROF_CALL,tc);
+    clock_gettime(CLOCK_MONOTONIC,&t1);
+    double ms=(double)(t1.tv_sec-t0.tv_sec)*1e3+(double)(t1.tv_nsec-t0.tv_nsec)/1e6;
+    if(st<0){ perror("array call"); return 1; }
+
+    int rc=0;
+    size_t bytes=n*sizeof(int64_t)*(sum ? 1 : dot ? 2 : 3);
+    if(st!=ARITH_OK) printf("%s[%zu] -> ERROR: %s at element %zu\n", what, n, arith_status_str(st), failed);
+    else if(sum || dot){
+        printf("%s[%zu] = %lld\n", what, n, (long long)res);
+        if(res!=(int64_t)want){ fprintf(stderr,"mismatch: expected %lld\n",(long long)want); rc=1; }
+    } else {
+        printf("%s[%zu] done\n", what, n);
+        for(size_t k=0;k<5 && n;k++){ // first, last and a few in between
+            size_t i= k*(n-1)/4; int64_t r;
+            if(arith_call(c,op,a.data[i],b.data[i],&r)!=ARITH_OK || r!=out.data[i]){
+                fprintf(stderr,"mismatch at %zu: %lld, single call gives %lld\n",i,(long long)out.data[i],(long long)r); rc=1;
+            }
+        }
+    }
+    printf("%.3f ms, %.2f GB/s of operands and results\n", ms, ms>0 ? (double)bytes/ms/1e6 : 0.0);
+    arith_array_free(&a); arith_array_free(&b); arith_array_free(&out);
+    return rc;
+}
+
+// ---- --big ----
+// One arith_big_call() per "op a b" line; prints "<result>" or
+// "ERROR: <reason>" per line like --batch
+static int run_big(arith_conn_t *c){
+    static arith_big_t a, b, r;
+    static char out[ARITH_BIG_DEC_MAX];
+    char *line=NULL; size_t cap=0; long lineno=0; int rc=0;
+    while(getline(&line,&cap,stdin)>=0){
+        lineno++;
+        char *save, *name=strtok_r(line," \t\r\n",&save);
+        if(!name) continue;
+        char *x=strtok_r(NULL," \t\r\n",&save), *y=strtok_r(NULL," \t\r\n",&save);
+        if(!x || !y || strtok_r(NULL," \t\r\n",&save) || arith_big_parse(x,&a)<0 || arith_big_parse(y,&b)<0){
+            fprintf(stderr,"line %ld: expected 'op a b' with decimal integers\n",lineno); rc=1; continue;
+        }
+        PROF_BEGIN(tc);
+        int st=arith_big_call(c,arith_op_from_name(name),&a,&b,&r);
+        PROF_END(PROF_CALL,tc);
+        if(st<0){
+            if(errno!=EINVAL){ perror("big call"); rc=1; break; }
+            fprintf(stderr,"line %ld: operands are limited to %d limbs\n",lineno,ARITH_BIG_LIMBS_MAX); rc=1; continue;
+        }
+        PROF_BEGIN(tp);
+        if(st==ARITH_OK && arith_big_format(&r,out,sizeof(out))>=0) printf("%s\n",out);
+        else printf("ERROR: %s\n",arith_status_str(st));
+        PROF_END(PROF_PRINT,tp);
+    }
+    free(line);
+    return rc;
+}
+
+// ---- --expr ----
+// One arith_expr_call() per line of arguments ("1 2 3" binds a=1, b=2, c=3);
+// prints "<result>" or "ERROR: <reason>" per line like --batch. With `calls`
+// the client walks the program itself instead, one arith_call() per
+// operation, each waiting for the ones before it: what callers did before
+// expressions, kept for comparison.
+static int expr_by_calls(arith_conn_t *c, const arith_expr_t *e, const int64_t *args, int64_t *res){
+    int64_t pushed[ARITH_EXPR_MAX], stack[ARITH_EXPR_MAX]; size_t sp=0;
+    for(size_t i=0;i<e->len;i++){
+        uint8_t code=e->code[i];
+        if(code==ARITH_EXPR_ARG) stack[sp++]=args[e->val[i]];
+        else if(code==ARITH_EXPR_CONST) stack[sp++]=e->val[i];
+        else if(code==ARITH_EXPR_REF) stack[sp++]=pushed[e->val[i]];
+        else {
+            int64_t b= arith_ops[code].arity>1 ? stack[--sp] : 0, a= arith_ops[code].arity>0 ? stack[--sp] : 0;
+            int st=arith_call(c,code,a,b,&stack[sp]);
+            if(st!=ARITH_OK) return st;
+            sp++;
+        }
+        pushed[i]=stack[sp-1];
+    }
+    *res=stack[0];
+    return ARITH_OK;
+}
+
+static int run_expr(arith_conn_t *c, const char *text, bool calls){
+    static arith_expr_t e;
+    size_t at;
+    if(arith_expr_parse(text,&e,&at)<0){
+        if(errno==EINVAL) fprintf(stderr,"--expr: syntax error at '%s'\n",text+at);
+        else if(errno==ERANGE) fprintf(stderr,"--expr: number out of range\n");
+        else fprintf(stderr,"--expr: longer than %d instructions\n",ARITH_EXPR_MAX);
+        return 2;
+    }
+    char line[1024]; long lineno=0; int rc=0;
+    while(fgets(line,sizeof(line),stdin)){
+        lineno++;
+        int64_t args[ARITH_EXPR_ARGS_MAX]; size_t n=0;
+        char *p=line, *end;
+        for(;;){
+            while(*p==' ' || *p=='\t') p++;
+            if(*p=='\n' || *p=='\r' || !*p) break;
+            errno=0;
+            long long v=strtoll(p,&end,10);
+            if(end==p || errno || n==ARITH_EXPR_ARGS_MAX){ n=SIZE_MAX; break; }
+            args[n++]=v; p=end;
+        }
+        if(n==0 && e.nargs) continue; // blank line
+        if(n==SIZE_MAX || n<e.nargs){ fprintf(stderr,"line %ld: expected %zu integer arguments\n",lineno,e.nargs); rc=1; continue; }
+        int64_t res;
+        PROF_BEGIN(tc);
+        int st= calls ? expr_by_calls(c,&e,args,&res) : arith_expr_call(c,&e,args,n,&res);
+        PROF_END(PROF_CALL,tc);
+        if(st<0){ perror("expression call"); return 1; }
+        print_answer(st,res);
+    }
+    return rc;
+}
 
-    // Create the FIFO if it does not exist. If it exists, mkfifo returns -1
-    // with errno==EEXIST; we allow that case but we should verify the path
-    // is indeed a FIFO (see notes in review).
-    if (mkfifo(resp_fifo,0666)<0 && errno!=EEXIST){ perror("mkfifo resp"); return 1; }
+// ---- --bench ----
+// Load generator: --clients N processes with --threads T threads each make
+// --requests R calls apiece over the mode the other flags select (one-shot
+// v1, --session, --v2, --transport shm or sock), drawing opcodes from --mix and
+// small random operands. Closed loop by default: the next call goes out as
+// soon as the answer is in. --rate R makes it open loop: the calls of all
+// threads are scheduled at R per second in total and each latency is taken
+// from the call's scheduled start, so a server that falls behind is charged
+// for the queueing it causes instead of the generator slowing down with it.
+// Each thread records into its own histogram in shared memory; the parent
+// merges them and prints one JSON line. With --autobatch the threads of a
+// process make their calls through one shared handle, which merges them.
+typedef struct {
+    hist_t   lat;            // round-trip latency, ns
+    uint64_t calls;          // calls answered
+    uint64_t errors;         // ... with a non-OK status
+    uint64_t busy;           // ... of which ARITH_EBUSY (turned away by admission control)
+    uint64_t failed;         // calls that got no answer (the thread stops there)
+    uint64_t t_start, t_end; // CLOCK_MONOTONIC ns: first call scheduled, last answer
+} bench_slot_t;
+
+static bool   bench = false;        // --bench
+static int    bench_clients = 1;    // --clients N: processes
+static int    bench_threads = 1;    // --threads T: threads per process
+static long   bench_requests = 10000; // --requests R: calls per thread
+static double bench_rate = 0;       // --rate R: total calls/s (0 => closed loop)
+static const char *bench_mix = "add"; // --mix op[=weight],...
+static const char *bench_label = "";  // --label S: copied into the JSON
+static const char *bench_hgrm = NULL; // --hgrm FILE: percentile distribution
+static unsigned mix_weight[ARITH_OP_COUNT], mix_total = 0;
+static bench_slot_t *bench_slots = NULL; // clients*threads, shared with the processes
+static uint64_t bench_t0;           // common start time of every thread
+static arith_conn_t *bench_shared = NULL; // --autobatch: the handle of this process's threads
+
+static uint64_t now_ns(void){
+    struct timespec ts; clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (uint64_t)ts.tv_sec*1000000000u+(uint64_t)ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t t){
+    struct timespec ts={ .tv_sec=(time_t)(t/1000000000u), .tv_nsec=(long)(t%1000000000u) };
+    while(clock_nanosleep(CLOCK_MONOTONIC,TIMER_ABSTIME,&ts,NULL)==EINTR){}
+}
+
+// "add=4,mul=2,div" -> mix_weight[]; -1 on an unknown op or bad weight
+static int parse_mix(const char *spec){
+    char buf[256]; snprintf(buf,sizeof(buf),"%s",spec);
+    for(char *save=NULL, *tok=strtok_r(buf,",",&save); tok; tok=strtok_r(NULL,",",&save)){
+        char *eq=strchr(tok,'=');
+        long w=1;
+        if(eq){ *eq='\0'; w=atol(eq+1); }
+        uint8_t op=arith_op_from_name(tok);
+        if(op==ARITH_OP_INVALID || w<1 || w>1000){ fprintf(stderr,"--mix: bad entry '%s'\n",tok); return -1; }
+        mix_weight[op]+=(unsigned)w; mix_total+=(unsigned)w;
+    }
+    return mix_total ? 0 : -1;
+}
+
+// xorshift64*: cheap per-thread operand and opcode draws
+static uint64_t rng_next(uint64_t *s){
+    *s^=*s>>12; *s^=*s<<25; *s^=*s>>27;
+    return *s*UINT64_C(2685821657736338717);
+}
+
+static void *bench_thread(void *arg){
+    bench_slot_t *s=arg;
+    size_t idx=(size_t)(s-bench_slots), total=(size_t)bench_clients*(size_t)bench_threads;
+    arith_conn_t *c= bench_shared ? bench_shared : arith_connect(&opts); // else a handle per thread: every thread is a client of its own
+    if(!c){ perror("connect"); s->failed=1; return NULL; }
+
+    // Open loop: this thread's calls are `interval` apart, phase-shifted so
+    // that together the threads send at an even rate
+    uint64_t interval= bench_rate>0 ? (uint64_t)(1e9*(double)total/bench_rate) : 0;
+    uint64_t start=bench_t0+(interval ? interval*idx/total : 0);
+    uint64_t seed=UINT64_C(0x9E3779B97F4A7C15)*(idx+1);
+    s->t_start=start;
+    sleep_until(start);
+    for(long i=0;i<bench_requests;i++){
+        uint64_t t0=interval ? start+(uint64_t)i*interval : now_ns();
+        if(interval) sleep_until(t0);
+        unsigned pick=(unsigned)(rng_next(&seed)%mix_total);
+        uint8_t op=0;
+        while(pick>=mix_weight[op]) pick-=mix_weight[op++];
+        int64_t a=(int64_t)(rng_next(&seed)%2001)-1000, b=(int64_t)(rng_next(&seed)%16)+1, res;
+        PROF_BEGIN(tc);
+        int st=arith_call(c,op,a,b,&res);
+        PROF_END(PROF_CALL,tc);
+        if(st<0){ s->failed++; break; }
+        uint64_t t1=now_ns();
+        hist_record(&s->lat,t1-t0);
+        s->calls++; if(st!=ARITH_OK) s->errors++; if(st==ARITH_EBUSY) s->busy++;
+        s->t_end=t1;
+    }
+    if(c!=bench_shared) arith_disconnect(c);
+    return NULL;
+}
+
+// One client process: its threads, each on its own slot
+static void bench_process(int p){
+    pthread_t tid[bench_threads];
+    int started=0;
+    if(opts.autobatch_us && !(bench_shared=arith_connect(&opts))){
+        perror("connect");
+        for(int t=0;t<bench_threads;t++) bench_slots[(size_t)p*(size_t)bench_threads+(size_t)t].failed=1;
+        return;
+    }
+    for(int t=0;t<bench_threads;t++){
+        bench_slot_t *s=&bench_slots[(size_t)p*(size_t)bench_threads+(size_t)t];
+        if(pthread_create(&tid[t],NULL,bench_thread,s)!=0){ s->failed=1; break; }
+        started++;
+    }
+    for(int t=0;t<started;t++) pthread_join(tid[t],NULL);
+    arith_disconnect(bench_shared);
+}
+
+static int run_bench(void){
+    size_t total=(size_t)bench_clients*(size_t)bench_threads;
+    bench_slots=mmap(NULL,total*sizeof(bench_slot_t),PROT_READ|PROT_WRITE,MAP_SHARED|MAP_ANONYMOUS,-1,0);
+    if(bench_slots==MAP_FAILED){ perror("mmap bench slots"); return 1; }
+    for(size_t i=0;i<total;i++) hist_init(&bench_slots[i].lat);
+
+    bench_t0=now_ns()+100000000u; // every thread starts 100 ms from now, set up or not
+    pid_t kids[bench_clients];
+    for(int p=0;p<bench_clients;p++){
+        kids[p]=fork();
+        if(kids[p]<0){ perror("fork"); return 1; }
+        if(kids[p]==0){ bench_process(p); _exit(0); }
+    }
+    for(int p=0;p<bench_clients;p++) while(waitpid(kids[p],NULL,0)<0 && errno==EINTR){}
+
+    hist_t *all=malloc(sizeof(*all));
+    if(!all){ perror("malloc"); return 1; }
+    hist_init(all);
+    uint64_t calls=0, errors=0, busy=0, failed=0, t_start=UINT64_MAX, t_end=0;
+    for(size_t i=0;i<total;i++){
+        const bench_slot_t *s=&bench_slots[i];
+        hist_merge(all,&s->lat);
+        calls+=s->calls; errors+=s->errors; busy+=s->busy; failed+=s->failed;
+        if(s->calls){
+            if(s->t_start<t_start) t_start=s->t_start;
+            if(s->t_end>t_end) t_end=s->t_end;
+        }
+    }
+    double secs= calls ? (double)(t_end-t_start)/1e9 : 0.0;
+
+    const char *mode= transport!=ARITH_TRANSPORT_FIFO || use_v2 ? "v2" : session ? "session" : "v1";
+    printf("{\"label\":\"%s\",\"mode\":\"%s\",\"transport\":\"%s\",\"clients\":%d,\"threads\":%d,"
+           "\"autobatch_us\":%d,\"requests\":%ld,\"mix\":\"%s\",\"target_rate\":%.0f,\"calls\":%llu,\"errors\":%llu,\"busy\":%llu,\"failed\":%llu,"
+           "\"duration_s\":%.3f,\"throughput_rps\":%.0f,\"latency_us\":{\"min\":%.3f,\"mean\":%.3f,"
+           "\"p50\":%.3f,\"p90\":%.3f,\"p99\":%.3f,\"p99.9\":%.3f,\"max\":%.3f}}\n",
+           bench_label, mode, arith_transport_names[transport], bench_clients, bench_threads,
+           opts.autobatch_us, bench_requests, bench_mix, bench_rate, (unsigned long long)calls, (unsigned long long)errors,
+           (unsigned long long)busy, (unsigned long long)failed, secs, secs>0 ? (double)calls/secs : 0.0,
+           calls ? (double)all->min/1e3 : 0.0, hist_mean(all)/1e3,
+           (double)hist_percentile(all,50.0)/1e3, (double)hist_percentile(all,90.0)/1e3,
+           (double)hist_percentile(all,99.0)/1e3, (double)hist_percentile(all,99.9)/1e3, (double)all->max/1e3);
+    if(bench_hgrm){
+        FILE *f=fopen(bench_hgrm,"w");
+        if(!f) perror(bench_hgrm);
+        else { hist_write_hgrm(all,f,1000.0); fclose(f); } // microseconds
+    }
+    free(all);
+    munmap(bench_slots,total*sizeof(bench_slot_t));
+    return failed ? 1 : 0;
+}
+
+int main(int argc, char **argv){
+    size_t batch_k=0; // --batch K (0 => interactive)
+    size_t stream_k=0; // --stream K (0 => off)
+    const char *input=NULL; // --input FILE instead of stdin
+    int spin=-1;      // --spin N (-1 => pick from the CPU count)
+    int shard=-1;     // --shard N (-1 => hashed from the PID)
+    int busy_poll=0;  // --busy-poll US (0 => sleep for answers at once)
+    int sched_class=ARITH_CLASS_NORMAL; // --class C (server --fair)
+    int autobatch=0, autobatch_max=0; // --autobatch US[,MAX]
+    const char *array_op=NULL; size_t array_n=0; // --array OP N
+    bool big=false;   // --big
+    const char *expr=NULL; bool expr_calls=false; // --expr TEXT, --expr-calls
+    for(int i=1;i<argc;i++){
+        if(!strcmp(argv[i],"--session")) session=true;
+        else if(!strcmp(argv[i],"--v2")) use_v2=session=true;
+        else if(!strcmp(argv[i],"--batch")){
+            use_v2=session=true; batch_k=ARITH_BATCH_MAX;
+            if(i+1<argc && argv[i+1][0]!='-') batch_k=(size_t)atol(argv[++i]);
+            if(batch_k<1 || batch_k>ARITH_BATCH_MAX){ fprintf(stderr,"--batch K needs 1 <= K <= %zu\n",(size_t)ARITH_BATCH_MAX); return 2; }
+        }
+        else if(!strcmp(argv[i],"--stream")){
+            use_v2=session=true; stream_k=64;
+            if(i+1<argc && argv[i+1][0]!='-') stream_k=(size_t)atol(argv[++i]);
+            if(stream_k<1 || stream_k>STREAM_MAX){ fprintf(stderr,"--stream K needs 1 <= K <= %d\n",STREAM_MAX); return 2; }
+        }
+        else if(!strcmp(argv[i],"--array") && i+2<argc){
+            array_op=argv[++i]; array_n=(size_t)atoll(argv[++i]);
+        }
+        else if(!strcmp(argv[i],"--big")) big=use_v2=session=true;
+        else if(!strcmp(argv[i],"--expr") && i+1<argc){ expr=argv[++i]; use_v2=session=true; }
+        else if(!strcmp(argv[i],"--expr-calls")) expr_calls=true;
+        else if(!strcmp(argv[i],"--input") && i+1<argc) input=argv[++i];
+        else if(!strcmp(argv[i],"--transport") && i+1<argc){
+            transport=arith_transport_from_name(argv[++i]);
+            if(transport<0){ fprintf(stderr,"--transport is fifo, shm or sock\n"); return 2; }
+        }
+        else if(!strcmp(argv[i],"--spin") && i+1<argc){
+            int n=atoi(argv[++i]);
+            if(n<0){ fprintf(stderr,"--spin needs a count >= 0\n"); return 2; }
+            spin=n;
+        }
+        else if(!strcmp(argv[i],"--busy-poll") && i+1<argc){
+            busy_poll=atoi(argv[++i]);
+            if(busy_poll<1 || busy_poll>1000000){ fprintf(stderr,"--busy-poll needs 1..1000000 us\n"); return 2; }
+        }
+        else if(!strcmp(argv[i],"--autobatch") && i+1<argc){
+            char *end; autobatch=(int)strtol(argv[++i],&end,10);
+            if(*end==',') autobatch_max=(int)strtol(end+1,&end,10); else if(*end) autobatch=0;
+            if(*end || autobatch<1 || autobatch>1000000 || autobatch_max<0 || autobatch_max>(int)ARITH_BATCH_MAX){
+                fprintf(stderr,"--autobatch needs 1..1000000 us, optionally ,MAX with MAX <= %zu\n",(size_t)ARITH_BATCH_MAX); return 2;
+            }
+        }
+        else if(!strcmp(argv[i],"--class") && i+1<argc){
+            const char *v=argv[++i];
+            if(!strcmp(v,"high")) sched_class=ARITH_CLASS_HIGH;
+            else if(!strcmp(v,"bulk")) sched_class=ARITH_CLASS_BULK;
+            else if(strcmp(v,"normal")){ fprintf(stderr,"--class is high, normal or bulk\n"); return 2; }
+        }
+        else if(!strcmp(argv[i],"--shard") && i+1<argc){
+            shard=atoi(argv[++i]);
+            if(shard<0){ fprintf(stderr,"--shard needs an index >= 0\n"); return 2; }
+        }
+        else if(!strcmp(argv[i],"--bench")) bench=true;
+        else if(!strcmp(argv[i],"--clients") && i+1<argc){
+            bench_clients=atoi(argv[++i]);
+            if(bench_clients<1 || bench_clients>256){ fprintf(stderr,"--clients needs 1..256\n"); return 2; }
+        }
+        else if(!strcmp(argv[i],"--threads") && i+1<argc){
+            bench_threads=atoi(argv[++i]);
+            if(bench_threads<1 || bench_threads>64){ fprintf(stderr,"--threads needs 1..64\n"); return 2; }
+        }
+        else if(!strcmp(argv[i],"--requests") && i+1<argc){
+            bench_requests=atol(argv[++i]);
+            if(bench_requests<1){ fprintf(stderr,"--requests needs a positive count\n"); return 2; }
+        }
+        else if(!strcmp(argv[i],"--rate") && i+1<argc){
+            bench_rate=atof(argv[++i]);
+            if(bench_rate<0){ fprintf(stderr,"--rate needs a rate >= 0\n"); return 2; }
+        }
+        else if(!strcmp(argv[i],"--mix") && i+1<argc) bench_mix=argv[++i];
+        else if(!strcmp(argv[i],"--label") && i+1<argc) bench_label=argv[++i];
+        else if(!strcmp(argv[i],"--hgrm") && i+1<argc) bench_hgrm=argv[++i];
+        else {
+            fprintf(stderr,"usage: %s [--session] [--v2] [--batch [K] | --stream [K]] [--input FILE] [--transport fifo|shm|sock [--spin N]] [--busy-poll US] [--shard N] [--class high|normal|bulk]\n"
+                           "              [--autobatch US[,MAX]]\n",argv[0]);
+            fprintf(stderr,"       %s --transport sock --array sum|dot|OP N\n",argv[0]);
+            fprintf(stderr,"       %s --big [--transport fifo|sock] [--input FILE]\n",argv[0]);
+            fprintf(stderr,"       %s --expr TEXT [--expr-calls] [--transport fifo|sock] [--input FILE]\n",argv[0]);
+            fprintf(stderr,"       %s --bench [mode flags] [--clients N] [--threads T] [--requests R] [--mix op[=w],...]\n"
+                           "              [--rate R] [--label S] [--hgrm FILE]\n",argv[0]);
+            return 2;
+        }
+    }
+    if((bench>0)+(batch_k>0)+(stream_k>0)+(array_op!=NULL)+big+(expr!=NULL)>1){ fprintf(stderr,"--bench, --batch, --stream, --array, --big and --expr are exclusive\n"); return 2; }
+    if(big && transport==ARITH_TRANSPORT_SHM){ fprintf(stderr,"--big needs --transport fifo or sock\n"); return 2; }
+    if(expr && transport==ARITH_TRANSPORT_SHM && !expr_calls){ fprintf(stderr,"--expr needs --transport fifo or sock\n"); return 2; }
+    if(expr_calls && !expr){ fprintf(stderr,"--expr-calls needs --expr\n"); return 2; }
+    if(array_op && transport!=ARITH_TRANSPORT_SOCK){ fprintf(stderr,"--array needs --transport sock\n"); return 2; }
+    if(input){ // read the expressions from a file instead of stdin
+        int fd=open(input,O_RDONLY);
+        if(fd<0 || dup2(fd,STDIN_FILENO)<0){ perror(input); return 1; }
+        close(fd);
+    }
+    if(bench && parse_mix(bench_mix)<0) return 2;
+    signal(SIGPIPE,SIG_IGN); // a server that went away shows up as EPIPE
+    opts.mode= transport==ARITH_TRANSPORT_SHM ? ARITH_MODE_SHM : transport==ARITH_TRANSPORT_SOCK ? ARITH_MODE_SOCK
+             : use_v2 ? ARITH_MODE_V2 : session ? ARITH_MODE_V1 : ARITH_MODE_V1_ONESHOT;
+    opts.spin=spin; opts.shard=shard; opts.busy_poll_us=busy_poll; opts.sched_class=sched_class;
+    opts.autobatch_us=autobatch; opts.autobatch_max=autobatch_max;
+
+    if(bench) return run_bench();
+
+    arith_conn_t *c=arith_connect(&opts); // blocks until a server is reading the request FIFO
+    if(!c){
+        perror("connect");
+        if(transport==ARITH_TRANSPORT_SHM && errno==ECONNREFUSED) fprintf(stderr,"(server not started with --transport shm?)\n");
+        if(transport==ARITH_TRANSPORT_SOCK && (errno==ECONNREFUSED || errno==ENOENT)) fprintf(stderr,"(server not started with --transport sock?)\n");
+        return 1;
+    }
+
+    if(batch_k || stream_k || array_op || big || expr){
+        int rc= batch_k ? run_batch(c,batch_k) : stream_k ? run_stream(c,stream_k)
+              : big ? run_big(c) : expr ? run_expr(c,expr,expr_calls) : run_array(c,array_op,array_n);
+        arith_disconnect(c);
+        return rc;
+    }
 
     printf("Client ready. Type 'exit' to quit.\n");
-    printf("Allowed operations: add, sub, mul, div\n\n");
+    printf("Allowed operations: %s\n\n", op_list(", "));
 
     char line[64];
     for(;;){
         // Read operation from user
-        printf("Enter operation (add/sub/mul/div or exit): "); fflush(stdout);
+        printf("Enter operation (%s or exit): ", op_list("/")); fflush(stdout);
         if(!fgets(line,sizeof(line),stdin)) break; // EOF on stdin -> exit
         trim_newline(line);
         if(!strcmp(line,"exit")) break;
@@ -102,38 +682,18 @@ int main(void){
         }
         int ch; while((ch=getchar())!='\n' && ch!=EOF){} // consume trailing input on the line
 
-        // Build the request struct to send to the server
-        request_msg_t rq; memset(&rq,0,sizeof(rq)); // zero to ensure fields are clean
-        // copy operation (OP_MAX bytes). rq.operation is zeroed so NUL termination is ensured
-        memcpy(rq.operation,line, OP_MAX < (int)strlen(line) ? OP_MAX : strlen(line));
-        rq.operand1=(int64_t)a; rq.operand2=(int64_t)b; rq.client_pid=getpid();
-        strncpy(rq.resp_fifo, resp_fifo, RESP_NAME_MAX-1); // ensure NUL-termination
-
-        // Send request to server by opening the request FIFO in write-only mode.
-        // This open will block if the server isn't running and has no reader.
-        int req_fd=open(REQ_FIFO_PATH,O_WRONLY);
-        if(req_fd<0){ perror("open request fifo"); continue; }
-        if(write_full(req_fd,&rq,sizeof(rq))<0){ perror("write request"); close(req_fd); continue; }
-        close(req_fd); // close the write end after sending the request
-
-        // Now open our response FIFO and block until the server opens it for writing
-        int rfd = open(resp_fifo, O_RDONLY);      // blocks until server opens writer & writes/close
-        if(rfd<0){ perror("open resp fifo"); continue; }
-
-        response_msg_t rp; memset(&rp,0,sizeof(rp));
-        ssize_t rr = read_full(rfd,&rp,sizeof(rp));  // read exactly one response struct
-        close(rfd);                                  // close after each transaction
-
-        if(rr<0 || (size_t)rr<sizeof(rp)){
-            fprintf(stderr,"Failed to read full response. Got %zd bytes.\n", rr);
-            continue;
-        }
-
-        if(rp.success) printf("Result from server: %lld\n\n",(long long)rp.result);
-        else           printf("Server error: %s\n\n", rp.error);
+        int64_t res;
+        PROF_BEGIN(tc);
+        int st=arith_call(c,arith_op_from_name(line),(int64_t)a,(int64_t)b,&res);
+        PROF_END(PROF_CALL,tc);
+        if(st<0){ perror("call"); continue; }
+        PROF_BEGIN(tp);
+        if(st==ARITH_OK) printf("Result from server: %lld\n\n",(long long)res);
+        else             printf("Server error: %s\n\n", arith_status_str(st));
+        PROF_END(PROF_PRINT,tp);
     }
 
-    unlink(resp_fifo); // remove our response FIFO before exiting
+    arith_disconnect(c); // also removes our response FIFO
     printf("Client exiting. Goodbye!\n");
     return 0;
 }
@@ -0,0 +1,386 @@
+// compute.c
+// Scalar and batch arithmetic kernels (see compute.h).
+// The batch path regroups tuples by opcode into contiguous (SoA) arrays and
+// runs add/sub/mul over them with AVX2 or SSE2 on x86-64 (picked at runtime)
+// and NEON on ARM, with a portable scalar fallback. Integer division has no
+// vector instruction on any of these, so div stays scalar per element.
+// Both paths dispatch through tables generated from ARITH_OP_LIST (ops.h).
+// Array frames reuse the same vector kernels for element-wise operations and
+// add sum and dot-product reductions with the same per-CPU choice.
+
+#include <stdbool.h>    // bool
+#include <pthread.h>    // pthread_once (kernels picked on first use)
+
+#include "compute.h"
+#include "proto.h"      // enum arith_op, enum arith_status
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>  // SSE2 / AVX2 intrinsics
+#define HAVE_X86_SIMD 1
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+#include <arm_neon.h>   // NEON intrinsics
+#define HAVE_NEON 1
+#endif
+
+// ---- Scalar operations: one per ARITH_OP_LIST entry, named op_<name> ----
+typedef int (*scalar_fn_t)(int64_t a, int64_t b, int64_t *res);
+
+static int op_add(int64_t a, int64_t b, int64_t *res){ *res=(int64_t)((uint64_t)a+(uint64_t)b); return ARITH_OK; }
+static int op_sub(int64_t a, int64_t b, int64_t *res){ *res=(int64_t)((uint64_t)a-(uint64_t)b); return ARITH_OK; }
+static int op_mul(int64_t a, int64_t b, int64_t *res){ *res=(int64_t)((uint64_t)a*(uint64_t)b); return ARITH_OK; }
+static int op_min(int64_t a, int64_t b, int64_t *res){ *res= a<b ? a : b; return ARITH_OK; }
+static int op_max(int64_t a, int64_t b, int64_t *res){ *res= a>b ? a : b; return ARITH_OK; }
+
+static int op_div(int64_t a, int64_t b, int64_t *res){
+    if(b==0) return ARITH_EDIVZERO;
+    *res = b==-1 ? (int64_t)(0-(uint64_t)a) : a/b; // a/-1 would trap for INT64_MIN
+    return ARITH_OK;
+}
+static int op_mod(int64_t a, int64_t b, int64_t *res){
+    if(b==0) return ARITH_EDIVZERO;
+    *res = b==-1 ? 0 : a%b; // sign follows a, like C; INT64_MIN % -1 would trap
+    return ARITH_OK;
+}
+
+// a**b by squaring, overflow-checked. A negative exponent truncates toward
+// zero like div: only a = 1 or -1 give a non-zero result, and 0 has no inverse.
+static int op_pow(int64_t a, int64_t b, int64_t *res){
+    if(b<0){
+        if(a==0) return ARITH_EDIVZERO;
+        *res = a==1 ? 1 : a==-1 ? ((b&1) ? -1 : 1) : 0;
+        return ARITH_OK;
+    }
+    int64_t r=1, base=a;
+    for(;;){
+        if((b&1) && __builtin_mul_overflow(r,base,&r)) return ARITH_EOVERFLOW;
+        b>>=1;
+        if(!b) break;
+        if(__builtin_mul_overflow(base,base,&base)) return ARITH_EOVERFLOW;
+    }
+    *res=r;
+    return ARITH_OK;
+}
+
+static int op_cadd(int64_t a, int64_t b, int64_t *res){
+    return __builtin_add_overflow(a,b,res) ? ARITH_EOVERFLOW : ARITH_OK;
+}
+static int op_cmul(int64_t a, int64_t b, int64_t *res){
+    return __builtin_mul_overflow(a,b,res) ? ARITH_EOVERFLOW : ARITH_OK;
+}
+
+// Jump table indexed by opcode
+static const scalar_fn_t scalar_fns[ARITH_OP_COUNT] = {
+#define SCALAR_FN(id, name, arity, vector) [ARITH_OP_##id] = op_##name,
+    ARITH_OP_LIST(SCALAR_FN)
+#undef SCALAR_FN
+};
+
+int compute(uint8_t op, int64_t a, int64_t b, int64_t *res){
+    *res=0;
+    if(op>=ARITH_OP_COUNT) return ARITH_EINVALOP;
+    return scalar_fns[op](a,b,res);
+}
+
+// ---- Vector kernels over contiguous arrays: r[i] = a[i] op b[i] ----
+typedef void (*vec_kernel_t)(const int64_t *a, const int64_t *b, int64_t *r, size_t n);
+
+static void add_scalar(const int64_t *a, const int64_t *b, int64_t *r, size_t n){
+    for(size_t i=0;i<n;i++) r[i]=(int64_t)((uint64_t)a[i]+(uint64_t)b[i]);
+}
+static void sub_scalar(const int64_t *a, const int64_t *b, int64_t *r, size_t n){
+    for(size_t i=0;i<n;i++) r[i]=(int64_t)((uint64_t)a[i]-(uint64_t)b[i]);
+}
+static void mul_scalar(const int64_t *a, const int64_t *b, int64_t *r, size_t n){
+    for(size_t i=0;i<n;i++) r[i]=(int64_t)((uint64_t)a[i]*(uint64_t)b[i]);
+}
+static void min_scalar(const int64_t *a, const int64_t *b, int64_t *r, size_t n){
+    for(size_t i=0;i<n;i++) r[i]= a[i]<b[i] ? a[i] : b[i];
+}
+static void max_scalar(const int64_t *a, const int64_t *b, int64_t *r, size_t n){
+    for(size_t i=0;i<n;i++) r[i]= a[i]>b[i] ? a[i] : b[i];
+}
+
+// ---- Reductions over contiguous arrays (wrapping) ----
+typedef int64_t (*sum_kernel_t)(const int64_t *a, size_t n);
+typedef int64_t (*dot_kernel_t)(const int64_t *a, const int64_t *b, size_t n);
+
+static int64_t sum_scalar(const int64_t *a, size_t n){
+    uint64_t s=0;
+    for(size_t i=0;i<n;i++) s+=(uint64_t)a[i];
+    return (int64_t)s;
+}
+static int64_t dot_scalar(const int64_t *a, const int64_t *b, size_t n){
+    uint64_t s=0;
+    for(size_t i=0;i<n;i++) s+=(uint64_t)a[i]*(uint64_t)b[i];
+    return (int64_t)s;
+}
+
+#ifdef HAVE_X86_SIMD
+// 64x64->64 multiply from 32-bit partial products (no native epi64 mullo
+// before AVX-512): lo(a)*lo(b) + ((hi(a)*lo(b) + lo(a)*hi(b)) << 32)
+#define MUL64_PARTS(mul32, add64, srli, slli, va, vb) \
+    add64(mul32(va,vb), slli(add64(mul32(srli(va,32),vb), mul32(va,srli(vb,32))),32))
+
+static void add_sse2(const int64_t *a, const int64_t *b, int64_t *r, size_t n){
+    size_t i=0;
+    for(;i+2<=n;i+=2) _mm_storeu_si128((__m128i*)(r+i),_mm_add_epi64(_mm_loadu_si128((const __m128i*)(a+i)),_mm_loadu_si128((const __m128i*)(b+i))));
+    add_scalar(a+i,b+i,r+i,n-i);
+}
+static void sub_sse2(const int64_t *a, const int64_t *b, int64_t *r, size_t n){
+    size_t i=0;
+    for(;i+2<=n;i+=2) _mm_storeu_si128((__m128i*)(r+i),_mm_sub_epi64(_mm_loadu_si128((const __m128i*)(a+i)),_mm_loadu_si128((const __m128i*)(b+i))));
+    sub_scalar(a+i,b+i,r+i,n-i);
+}
+static void mul_sse2(const int64_t *a, const int64_t *b, int64_t *r, size_t n){
+    size_t i=0;
+    for(;i+2<=n;i+=2){
+        __m128i va=_mm_loadu_si128((const __m128i*)(a+i)), vb=_mm_loadu_si128((const __m128i*)(b+i));
+        _mm_storeu_si128((__m128i*)(r+i),MUL64_PARTS(_mm_mul_epu32,_mm_add_epi64,_mm_srli_epi64,_mm_slli_epi64,va,vb));
+    }
+    mul_scalar(a+i,b+i,r+i,n-i);
+}
+
+__attribute__((target("avx2")))
+static void add_avx2(const int64_t *a, const int64_t *b, int64_t *r, size_t n){
+    size_t i=0;
+    for(;i+4<=n;i+=4) _mm256_storeu_si256((__m256i*)(r+i),_mm256_add_epi64(_mm256_loadu_si256((const __m256i*)(a+i)),_mm256_loadu_si256((const __m256i*)(b+i))));
+    add_scalar(a+i,b+i,r+i,n-i);
+}
+__attribute__((target("avx2")))
+static void sub_avx2(const int64_t *a, const int64_t *b, int64_t *r, size_t n){
+    size_t i=0;
+    for(;i+4<=n;i+=4) _mm256_storeu_si256((__m256i*)(r+i),_mm256_sub_epi64(_mm256_loadu_si256((const __m256i*)(a+i)),_mm256_loadu_si256((const __m256i*)(b+i))));
+    sub_scalar(a+i,b+i,r+i,n-i);
+}
+__attribute__((target("avx2")))
+static void mul_avx2(const int64_t *a, const int64_t *b, int64_t *r, size_t n){
+    size_t i=0;
+    for(;i+4<=n;i+=4){
+        __m256i va=_mm256_loadu_si256((const __m256i*)(a+i)), vb=_mm256_loadu_si256((const __m256i*)(b+i));
+        _mm256_storeu_si256((__m256i*)(r+i),MUL64_PARTS(_mm256_mul_epu32,_mm256_add_epi64,_mm256_srli_epi64,_mm256_slli_epi64,va,vb));
+    }
+    mul_scalar(a+i,b+i,r+i,n-i);
+}
+// Two accumulators per reduction so consecutive adds do not wait on each other
+static int64_t sum_sse2(const int64_t *a, size_t n){
+    __m128i s0=_mm_setzero_si128(), s1=_mm_setzero_si128();
+    size_t i=0;
+    for(;i+4<=n;i+=4){
+        s0=_mm_add_epi64(s0,_mm_loadu_si128((const __m128i*)(a+i)));
+        s1=_mm_add_epi64(s1,_mm_loadu_si128((const __m128i*)(a+i+2)));
+    }
+    int64_t l[2]; _mm_storeu_si128((__m128i*)l,_mm_add_epi64(s0,s1));
+    return (int64_t)((uint64_t)l[0]+(uint64_t)l[1]+(uint64_t)sum_scalar(a+i,n-i));
+}
+static int64_t dot_sse2(const int64_t *a, const int64_t *b, size_t n){
+    __m128i s0=_mm_setzero_si128(), s1=_mm_setzero_si128();
+    size_t i=0;
+    for(;i+4<=n;i+=4){
+        __m128i va=_mm_loadu_si128((const __m128i*)(a+i)), vb=_mm_loadu_si128((const __m128i*)(b+i));
+        __m128i vc=_mm_loadu_si128((const __m128i*)(a+i+2)), vd=_mm_loadu_si128((const __m128i*)(b+i+2));
+        s0=_mm_add_epi64(s0,MUL64_PARTS(_mm_mul_epu32,_mm_add_epi64,_mm_srli_epi64,_mm_slli_epi64,va,vb));
+        s1=_mm_add_epi64(s1,MUL64_PARTS(_mm_mul_epu32,_mm_add_epi64,_mm_srli_epi64,_mm_slli_epi64,vc,vd));
+    }
+    int64_t l[2]; _mm_storeu_si128((__m128i*)l,_mm_add_epi64(s0,s1));
+    return (int64_t)((uint64_t)l[0]+(uint64_t)l[1]+(uint64_t)dot_scalar(a+i,b+i,n-i));
+}
+__attribute__((target("avx2")))
+static int64_t sum_avx2(const int64_t *a, size_t n){
+    __m256i s0=_mm256_setzero_si256(), s1=_mm256_setzero_si256();
+    size_t i=0;
+    for(;i+8<=n;i+=8){
+        s0=_mm256_add_epi64(s0,_mm256_loadu_si256((const __m256i*)(a+i)));
+        s1=_mm256_add_epi64(s1,_mm256_loadu_si256((const __m256i*)(a+i+4)));
+    }
+    int64_t l[4]; _mm256_storeu_si256((__m256i*)l,_mm256_add_epi64(s0,s1));
+    return (int64_t)((uint64_t)l[0]+(uint64_t)l[1]+(uint64_t)l[2]+(uint64_t)l[3]+(uint64_t)sum_scalar(a+i,n-i));
+}
+__attribute__((target("avx2")))
+static int64_t dot_avx2(const int64_t *a, const int64_t *b, size_t n){
+    __m256i s0=_mm256_setzero_si256(), s1=_mm256_setzero_si256();
+    size_t i=0;
+    for(;i+8<=n;i+=8){
+        __m256i va=_mm256_loadu_si256((const __m256i*)(a+i)), vb=_mm256_loadu_si256((const __m256i*)(b+i));
+        __m256i vc=_mm256_loadu_si256((const __m256i*)(a+i+4)), vd=_mm256_loadu_si256((const __m256i*)(b+i+4));
+        s0=_mm256_add_epi64(s0,MUL64_PARTS(_mm256_mul_epu32,_mm256_add_epi64,_mm256_srli_epi64,_mm256_slli_epi64,va,vb));
+        s1=_mm256_add_epi64(s1,MUL64_PARTS(_mm256_mul_epu32,_mm256_add_epi64,_mm256_srli_epi64,_mm256_slli_epi64,vc,vd));
+    }
+    int64_t l[4]; _mm256_storeu_si256((__m256i*)l,_mm256_add_epi64(s0,s1));
+    return (int64_t)((uint64_t)l[0]+(uint64_t)l[1]+(uint64_t)l[2]+(uint64_t)l[3]+(uint64_t)dot_scalar(a+i,b+i,n-i));
+}
+// min/max select with a 64-bit signed compare (AVX2 has cmpgt_epi64, SSE2 does not)
+__attribute__((target("avx2")))
+static void min_avx2(const int64_t *a, const int64_t *b, int64_t *r, size_t n){
+    size_t i=0;
+    for(;i+4<=n;i+=4){
+        __m256i va=_mm256_loadu_si256((const __m256i*)(a+i)), vb=_mm256_loadu_si256((const __m256i*)(b+i));
+        _mm256_storeu_si256((__m256i*)(r+i),_mm256_blendv_epi8(va,vb,_mm256_cmpgt_epi64(va,vb)));
+    }
+    min_scalar(a+i,b+i,r+i,n-i);
+}
+__attribute__((target("avx2")))
+static void max_avx2(const int64_t *a, const int64_t *b, int64_t *r, size_t n){
+    size_t i=0;
+    for(;i+4<=n;i+=4){
+        __m256i va=_mm256_loadu_si256((const __m256i*)(a+i)), vb=_mm256_loadu_si256((const __m256i*)(b+i));
+        _mm256_storeu_si256((__m256i*)(r+i),_mm256_blendv_epi8(vb,va,_mm256_cmpgt_epi64(va,vb)));
+    }
+    max_scalar(a+i,b+i,r+i,n-i);
+}
+#endif
+
+#ifdef HAVE_NEON
+static void add_neon(const int64_t *a, const int64_t *b, int64_t *r, size_t n){
+    size_t i=0;
+    for(;i+2<=n;i+=2) vst1q_s64(r+i,vaddq_s64(vld1q_s64(a+i),vld1q_s64(b+i)));
+    add_scalar(a+i,b+i,r+i,n-i);
+}
+static void sub_neon(const int64_t *a, const int64_t *b, int64_t *r, size_t n){
+    size_t i=0;
+    for(;i+2<=n;i+=2) vst1q_s64(r+i,vsubq_s64(vld1q_s64(a+i),vld1q_s64(b+i)));
+    sub_scalar(a+i,b+i,r+i,n-i);
+}
+static int64_t sum_neon(const int64_t *a, size_t n){
+    int64x2_t s0=vdupq_n_s64(0), s1=vdupq_n_s64(0);
+    size_t i=0;
+    for(;i+4<=n;i+=4){ s0=vaddq_s64(s0,vld1q_s64(a+i)); s1=vaddq_s64(s1,vld1q_s64(a+i+2)); }
+    int64x2_t s=vaddq_s64(s0,s1);
+    return (int64_t)((uint64_t)vgetq_lane_s64(s,0)+(uint64_t)vgetq_lane_s64(s,1)+(uint64_t)sum_scalar(a+i,n-i));
+}
+#ifdef __aarch64__
+static void min_neon(const int64_t *a, const int64_t *b, int64_t *r, size_t n){
+    size_t i=0;
+    for(;i+2<=n;i+=2){ int64x2_t va=vld1q_s64(a+i), vb=vld1q_s64(b+i); vst1q_s64(r+i,vbslq_s64(vcgtq_s64(va,vb),vb,va)); }
+    min_scalar(a+i,b+i,r+i,n-i);
+}
+static void max_neon(const int64_t *a, const int64_t *b, int64_t *r, size_t n){
+    size_t i=0;
+    for(;i+2<=n;i+=2){ int64x2_t va=vld1q_s64(a+i), vb=vld1q_s64(b+i); vst1q_s64(r+i,vbslq_s64(vcgtq_s64(va,vb),va,vb)); }
+    max_scalar(a+i,b+i,r+i,n-i);
+}
+#endif
+#endif
+
+// Portable kernel of every `vector` operation in the registry (NULL => per element)
+#define PORTABLE_true(name)  name##_scalar
+#define PORTABLE_false(name) NULL
+static const vec_kernel_t portable_kernels[ARITH_OP_COUNT] = {
+#define PORTABLE_KERNEL(id, name, arity, vector) [ARITH_OP_##id] = PORTABLE_##vector(name),
+    ARITH_OP_LIST(PORTABLE_KERNEL)
+#undef PORTABLE_KERNEL
+};
+
+// Kernels chosen once for this CPU (indexed by opcode; NULL => per element),
+// on first use by whichever handler thread gets there first: pthread_once
+// makes the others wait for the whole table, not just see simd_name set
+static vec_kernel_t vec_kernels[ARITH_OP_COUNT];
+static sum_kernel_t sum_kernel = sum_scalar;
+static dot_kernel_t dot_kernel = dot_scalar;
+static const char *simd_name = NULL;
+
+static void pick_kernels(void){
+    for(int k=0;k<ARITH_OP_COUNT;k++) vec_kernels[k]=portable_kernels[k];
+    simd_name="scalar";
+#if defined(HAVE_X86_SIMD)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")){
+        vec_kernels[ARITH_OP_ADD]=add_avx2; vec_kernels[ARITH_OP_SUB]=sub_avx2; vec_kernels[ARITH_OP_MUL]=mul_avx2;
+        vec_kernels[ARITH_OP_MIN]=min_avx2; vec_kernels[ARITH_OP_MAX]=max_avx2;
+        sum_kernel=sum_avx2; dot_kernel=dot_avx2;
+        simd_name="avx2";
+    } else if(__builtin_cpu_supports("sse2")){
+        vec_kernels[ARITH_OP_ADD]=add_sse2; vec_kernels[ARITH_OP_SUB]=sub_sse2; vec_kernels[ARITH_OP_MUL]=mul_sse2;
+        sum_kernel=sum_sse2; dot_kernel=dot_sse2;
+        simd_name="sse2";
+    }
+#elif defined(HAVE_NEON)
+    // NEON has no 64-bit lane multiply; mul and dot keep the (auto-vectorisable) scalar loop
+    vec_kernels[ARITH_OP_ADD]=add_neon; vec_kernels[ARITH_OP_SUB]=sub_neon;
+    sum_kernel=sum_neon;
+#ifdef __aarch64__
+    vec_kernels[ARITH_OP_MIN]=min_neon; vec_kernels[ARITH_OP_MAX]=max_neon;
+#endif
+    simd_name="neon";
+#endif
+}
+
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+static inline void kernels_ready(void){ pthread_once(&kernels_once,pick_kernels); }
+
+const char *compute_simd_name(void){
+    kernels_ready();
+    return simd_name;
+}
+
+// Tuples handled per grouping pass (bounds the stack scratch space)
+#define BATCH_CHUNK 256
+
+void compute_batch(const uint8_t *op, const int64_t *a, const int64_t *b, size_t n,
+                   int64_t *res, int32_t *status, compute_fn scalar){
+    kernels_ready();
+
+    for(size_t base=0; base<n; base+=BATCH_CHUNK){
+        size_t m = n-base<BATCH_CHUNK ? n-base : BATCH_CHUNK;
+        const uint8_t *cop=op+base; const int64_t *ca=a+base, *cb=b+base;
+        int64_t *cr=res+base; int32_t *cs=status+base;
+
+        // Fast path: the whole chunk is one vectorisable op -> no regrouping
+        bool uniform=true;
+        for(size_t i=1;i<m && uniform;i++) uniform = cop[i]==cop[0];
+        if(uniform && cop[0]<ARITH_OP_COUNT && vec_kernels[cop[0]]){
+            vec_kernels[cop[0]](ca,cb,cr,m);
+            for(size_t i=0;i<m;i++) cs[i]=ARITH_OK;
+            continue;
+        }
+
+        // Count tuples per vectorisable opcode, then lay each group out contiguously
+        size_t cnt[ARITH_OP_COUNT]={0}, start[ARITH_OP_COUNT], fill[ARITH_OP_COUNT];
+        for(size_t i=0;i<m;i++) if(cop[i]<ARITH_OP_COUNT && vec_kernels[cop[i]]) cnt[cop[i]]++;
+        size_t off=0;
+        for(int k=0;k<ARITH_OP_COUNT;k++){ start[k]=fill[k]=off; off+=cnt[k]; }
+
+        int64_t ga[BATCH_CHUNK], gb[BATCH_CHUNK], gr[BATCH_CHUNK];
+        uint16_t where[BATCH_CHUNK]; // source index of each grouped tuple
+        for(size_t i=0;i<m;i++){
+            uint8_t o=cop[i];
+            if(o<ARITH_OP_COUNT && vec_kernels[o]){
+                size_t j=fill[o]++;
+                ga[j]=ca[i]; gb[j]=cb[i]; where[j]=(uint16_t)i;
+            } else {
+                cs[i]=scalar(o,ca[i],cb[i],&cr[i]); // div, checked ops, invalid: per-element status
+            }
+        }
+        for(int k=0;k<ARITH_OP_COUNT;k++){
+            if(!cnt[k]) continue;
+            vec_kernels[k](ga+start[k],gb+start[k],gr+start[k],cnt[k]);
+            for(size_t j=start[k];j<start[k]+cnt[k];j++){ cr[where[j]]=gr[j]; cs[where[j]]=ARITH_OK; }
+        }
+    }
+}
+
+// ---- Array frames ----
+
+int64_t compute_sum(const int64_t *a, size_t n){
+    kernels_ready();
+    return sum_kernel(a,n);
+}
+
+int64_t compute_dot(const int64_t *a, const int64_t *b, size_t n){
+    kernels_ready();
+    return dot_kernel(a,b,n);
+}
+
+size_t compute_map(uint8_t op, const int64_t *a, const int64_t *b, int64_t *r, size_t n, int *status){
+    kernels_ready();
+    *status=ARITH_OK;
+    if(op>=ARITH_OP_COUNT){ *status=ARITH_EINVALOP; return 0; }
+    if(vec_kernels[op]){ vec_kernels[op](a,b,r,n); return n; }
+    size_t failed=n;
+    for(size_t i=0;i<n;i++){
+        int st=scalar_fns[op](a[i],b[i],&r[i]);
+        if(st==ARITH_OK) continue;
+        r[i]=0;
+        if(failed==n){ failed=i; *status=st; }
+    }
+    return failed;
+}
@@ -0,0 +1,42 @@
+// compute.h
+// Arithmetic kernels used by the server: the scalar compute() behind every
+// single request, compute_batch() behind v2 batch frames and the array
+// kernels behind array frames.
+
+#ifndef ARITH_COMPUTE_H
+#define ARITH_COMPUTE_H
+
+#include <stddef.h>     // size_t
+#include <stdint.h>     // int64_t, int32_t, uint8_t
+
+// Compute one operation (enum arith_op): returns an ARITH_* status with the
+// result in *res. add/sub/mul wrap on overflow (two's complement), as does
+// INT64_MIN / -1; cadd, cmul and pow report ARITH_EOVERFLOW instead.
+int compute(uint8_t op, int64_t a, int64_t b, int64_t *res);
+typedef int (*compute_fn)(uint8_t op, int64_t a, int64_t b, int64_t *res);
+
+// Compute n tuples given as SoA arrays op[i](a[i], b[i]) into res[i] with a
+// per-element status[i]. Tuples are grouped by opcode and the registry's
+// `vector` operations run as SIMD over contiguous arrays; the others and
+// invalid opcodes are handled per element by `scalar` (compute(), or the
+// server's wrapper that goes through its result cache).
+void compute_batch(const uint8_t *op, const int64_t *a, const int64_t *b, size_t n,
+                   int64_t *res, int32_t *status, compute_fn scalar);
+
+// Array kernels behind array frames, over one slice of the arrays (the
+// server runs the slices of an operation on several threads). compute_sum()
+// and compute_dot() wrap on overflow like add and mul, so partial results of
+// slices add up to the exact (wrapped) total in any order.
+int64_t compute_sum(const int64_t *a, size_t n);
+int64_t compute_dot(const int64_t *a, const int64_t *b, size_t n);
+// r[i] = op(a[i], b[i]): the registry's `vector` operations run as SIMD, the
+// others per element through compute() (a failed element is set to 0).
+// Returns the index of the first failed element with its status in
+// *status, or n with ARITH_OK if none failed (0 with ARITH_EINVALOP for an
+// unknown opcode). r may be a or b.
+size_t compute_map(uint8_t op, const int64_t *a, const int64_t *b, int64_t *r, size_t n, int *status);
+
+// Name of the vector unit the batch kernels use ("avx2", "sse2", "neon", "scalar")
+const char *compute_simd_name(void);
+
+#endif // ARITH_COMPUTE_H
@@ -0,0 +1,116 @@
+// drr.c
+// Deficit round-robin fair queue (see drr.h). Behind the header: the hash
+// buckets (client PID -> flow), `cap` flows and `cap` record slots. A flow
+// exists only while it has records queued, so `cap` flows always suffice.
+
+#include <string.h>     // memcpy
+
+#include "drr.h"
+
+#define NIL UINT32_MAX
+
+typedef struct {
+    int32_t  pid;          // the client
+    uint32_t head, tail;   // its queued slots, oldest first
+    uint32_t hnext;        // next flow in its bucket (or on the free list)
+    uint32_t anext;        // next flow in its class's round
+    uint32_t deficit;      // cost it may still spend this turn
+    uint32_t cls;
+} drr_flow_t;
+
+typedef struct {
+    uint32_t next;         // next slot of its flow (or on the free list)
+    uint32_t cost;
+} drr_slot_t;              // the record follows
+
+static size_t buckets_for(size_t cap){ size_t n=1; while(n<cap) n<<=1; return n; }
+
+static uint32_t   *buckets(drr_t *q){ return (uint32_t*)(q+1); }
+static drr_flow_t *flows(drr_t *q){ return (drr_flow_t*)(buckets(q)+q->mask+1); }
+static drr_slot_t *slot(drr_t *q, uint32_t i){
+    return (drr_slot_t*)((char*)(flows(q)+q->cap)+(size_t)i*q->slot_size);
+}
+
+size_t drr_bytes(size_t cap, size_t elem_size){
+    size_t slot_size=(sizeof(drr_slot_t)+elem_size+7)&~(size_t)7;
+    return sizeof(drr_t)+buckets_for(cap)*sizeof(uint32_t)+cap*(sizeof(drr_flow_t)+slot_size);
+}
+
+void drr_init(drr_t *q, size_t cap, size_t elem_size, unsigned quantum){
+    q->cap=cap; q->elem_size=elem_size; q->slot_size=(sizeof(drr_slot_t)+elem_size+7)&~(size_t)7;
+    q->len=0; q->quantum= quantum ? quantum : 1;
+    q->mask=(uint32_t)(buckets_for(cap)-1);
+    for(uint32_t b=0;b<=q->mask;b++) buckets(q)[b]=NIL;
+    for(uint32_t i=0;i<cap;i++){ slot(q,i)->next= i+1<cap ? i+1 : NIL; flows(q)[i].hnext= i+1<cap ? i+1 : NIL; }
+    q->free_slot=q->free_flow=0;
+    for(int c=0;c<DRR_CLASSES;c++) q->active[c][0]=q->active[c][1]=NIL;
+}
+
+static uint32_t bucket_of(const drr_t *q, int32_t pid){ return ((uint32_t)pid*2654435761u)&q->mask; }
+
+// Append flow f to the end of its class's round
+static void round_append(drr_t *q, uint32_t f){
+    uint32_t *r=q->active[flows(q)[f].cls];
+    flows(q)[f].anext=NIL;
+    if(r[1]==NIL) r[0]=f; else flows(q)[r[1]].anext=f;
+    r[1]=f;
+}
+
+bool drr_push(drr_t *q, int32_t pid, unsigned cls, unsigned cost, const void *elem){
+    if(q->free_slot==NIL) return false;
+    uint32_t *b=&buckets(q)[bucket_of(q,pid)], f=*b;
+    while(f!=NIL && flows(q)[f].pid!=pid) f=flows(q)[f].hnext;
+    if(f==NIL){ // newly active: its first turn starts with a full quantum, at the end of the round
+        f=q->free_flow; q->free_flow=flows(q)[f].hnext;
+        drr_flow_t *fl=&flows(q)[f];
+        fl->pid=pid; fl->head=fl->tail=NIL; fl->deficit=q->quantum;
+        fl->cls= cls<DRR_CLASSES ? cls : DRR_CLASSES-1;
+        fl->hnext=*b; *b=f;
+        round_append(q,f);
+    }
+    uint32_t s=q->free_slot; drr_slot_t *sl=slot(q,s);
+    q->free_slot=sl->next;
+    sl->next=NIL; sl->cost= cost ? cost : 1;
+    memcpy(sl+1,elem,q->elem_size);
+    drr_flow_t *fl=&flows(q)[f];
+    if(fl->tail==NIL) fl->head=s; else slot(q,fl->tail)->next=s;
+    fl->tail=s;
+    q->len++;
+    return true;
+}
+
+// Flow f (first in its round) has nothing queued any more: forget it
+static void flow_free(drr_t *q, uint32_t f){
+    drr_flow_t *fl=&flows(q)[f];
+    uint32_t *r=q->active[fl->cls];
+    r[0]=fl->anext; if(r[0]==NIL) r[1]=NIL;
+    uint32_t *p=&buckets(q)[bucket_of(q,fl->pid)];
+    while(*p!=f) p=&flows(q)[*p].hnext;
+    *p=fl->hnext;
+    fl->hnext=q->free_flow; q->free_flow=f;
+}
+
+bool drr_pop(drr_t *q, void *elem){
+    if(!q->len) return false;
+    for(int c=0;c<DRR_CLASSES;c++){
+        uint32_t *r=q->active[c];
+        while(r[0]!=NIL){
+            uint32_t f=r[0]; drr_flow_t *fl=&flows(q)[f];
+            drr_slot_t *sl=slot(q,fl->head);
+            if(fl->deficit<sl->cost){ // turn over: the next one starts with another quantum
+                fl->deficit+=q->quantum;
+                if(fl->anext!=NIL){ r[0]=fl->anext; round_append(q,f); }
+                continue;
+            }
+            fl->deficit-=sl->cost;
+            memcpy(elem,sl+1,q->elem_size);
+            uint32_t s=fl->head;
+            fl->head=sl->next; if(fl->head==NIL) fl->tail=NIL;
+            sl->next=q->free_slot; q->free_slot=s;
+            q->len--;
+            if(fl->head==NIL) flow_free(q,f);
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,50 @@
+// drr.h
+// Fair queue (server --fair): admitted requests wait in one FIFO per client
+// instead of one shared FIFO, and are taken out by deficit round-robin. Each
+// active client ("flow") has a deficit: its turn comes around, a quantum is
+// added, and its requests are served while their cost (tuples) fits in what
+// it has; then the next flow's turn begins. A client with one call queued
+// thus waits for at most one quantum of every other active client, however
+// deep their backlog of batches is, while a single busy client still gets
+// the whole server. Flows belong to one of DRR_CLASSES priority classes:
+// class 0 is served whenever it has anything queued, then class 1, then
+// class 2, each with its own round.
+//
+// Like ring.h it copies fixed-size records and links them by index, never
+// by pointer, so a queue can live in memory shared by fork()ed processes.
+// Unlike the ring it takes no lock of its own: the caller serializes every
+// call. Records and flows come from free lists sized for `cap` requests, so
+// a push only fails when `cap` are queued.
+
+#ifndef ARITH_DRR_H
+#define ARITH_DRR_H
+
+#include <stdbool.h>    // bool
+#include <stddef.h>     // size_t
+#include <stdint.h>     // uint32_t, int32_t
+
+#define DRR_CLASSES 3 // priority classes (0 first)
+
+// Queue header; its buckets, flows and record slots follow in the same block
+typedef struct {
+    size_t   cap, elem_size, slot_size;
+    uint32_t len;                  // records queued
+    uint32_t quantum;              // cost added to a flow's deficit per turn
+    uint32_t mask;                 // hash buckets - 1
+    uint32_t free_slot, free_flow; // free lists
+    uint32_t active[DRR_CLASSES][2]; // each class's round: first and last flow
+} drr_t;
+
+// Bytes needed for a queue of `cap` records of `elem_size` bytes
+size_t drr_bytes(size_t cap, size_t elem_size);
+// Initialise a queue in a block of at least drr_bytes(cap, elem_size) bytes
+void   drr_init(drr_t *q, size_t cap, size_t elem_size, unsigned quantum);
+// Copy one record in at the tail of client `flow`'s FIFO, costing `cost`
+// (at least 1); `cls` is the flow's class if it has nothing queued yet.
+// False if the queue is full.
+bool   drr_push(drr_t *q, int32_t flow, unsigned cls, unsigned cost, const void *elem);
+// Copy the next record out in fair order; false if the queue is empty
+bool   drr_pop(drr_t *q, void *elem);
+static inline size_t drr_len(const drr_t *q){ return q->len; }
+
+#endif // ARITH_DRR_H
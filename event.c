@@ -0,0 +1,181 @@
+// event.c
+// Readiness loop and signal fd behind event.h.
+
+#define _GNU_SOURCE
+#include <stdlib.h>     // calloc, free, realloc
+#include <string.h>     // memset
+#include <errno.h>      // errno
+#include <unistd.h>     // read, write, close, pipe
+#include <fcntl.h>      // fcntl, O_NONBLOCK
+#include <signal.h>     // sigset_t, sigaction, pthread_sigmask
+#include <pthread.h>    // pthread_sigmask
+
+#include "event.h"
+
+#ifdef __linux__
+#include <sys/epoll.h>    // epoll_create1, epoll_ctl, epoll_wait
+#include <sys/signalfd.h> // signalfd
+
+struct ev_loop { int epfd; };
+
+ev_loop_t *ev_create(void){
+    ev_loop_t *l=calloc(1,sizeof(*l));
+    if(!l) return NULL;
+    l->epfd=epoll_create1(EPOLL_CLOEXEC);
+    if(l->epfd<0){ free(l); return NULL; }
+    return l;
+}
+
+void ev_destroy(ev_loop_t *l){
+    if(!l) return;
+    close(l->epfd); free(l);
+}
+
+static int ev_ctl(ev_loop_t *l, int op, int fd, uint32_t events, void *ptr){
+    struct epoll_event e; memset(&e,0,sizeof(e));
+    e.events=(events&EV_IN ? EPOLLIN : 0)|(events&EV_OUT ? EPOLLOUT : 0);
+    e.data.ptr=ptr;
+    return epoll_ctl(l->epfd,op,fd,&e);
+}
+int ev_add(ev_loop_t *l, int fd, uint32_t events, void *ptr){ return ev_ctl(l,EPOLL_CTL_ADD,fd,events,ptr); }
+int ev_mod(ev_loop_t *l, int fd, uint32_t events, void *ptr){ return ev_ctl(l,EPOLL_CTL_MOD,fd,events,ptr); }
+int ev_del(ev_loop_t *l, int fd){ return epoll_ctl(l->epfd,EPOLL_CTL_DEL,fd,NULL); }
+int ev_fd(const ev_loop_t *l){ return l->epfd; }
+
+int ev_wait(ev_loop_t *l, ev_event_t *out, int max, int timeout_ms){
+    struct epoll_event evs[64];
+    if(max>64) max=64;
+    int n=epoll_wait(l->epfd,evs,max,timeout_ms);
+    if(n<0) return errno==EINTR ? 0 : -1;
+    for(int i=0;i<n;i++){
+        out[i].ptr=evs[i].data.ptr;
+        out[i].events=(evs[i].events&EPOLLIN ? EV_IN : 0)|(evs[i].events&EPOLLOUT ? EV_OUT : 0)
+                     |(evs[i].events&(EPOLLERR|EPOLLHUP) ? EV_ERR : 0);
+    }
+    return n;
+}
+
+static sigset_t sig_set; // signals routed to the fd
+
+int ev_signal_open(const int *sigs, int n){
+    sigemptyset(&sig_set);
+    for(int i=0;i<n;i++) sigaddset(&sig_set,sigs[i]);
+    if(pthread_sigmask(SIG_BLOCK,&sig_set,NULL)!=0) return -1; // queued for the fd instead of delivered
+    return signalfd(-1,&sig_set,SFD_NONBLOCK|SFD_CLOEXEC);
+}
+
+int ev_signal_next(int fd){
+    struct signalfd_siginfo si;
+    ssize_t r;
+    while((r=read(fd,&si,sizeof(si)))<0 && errno==EINTR){}
+    return r==(ssize_t)sizeof(si) ? (int)si.ssi_signo : 0;
+}
+
+void ev_signal_reset(int fd){
+    pthread_sigmask(SIG_UNBLOCK,&sig_set,NULL);
+    if(fd>=0) close(fd);
+}
+
+#else // ---- portable fallback: poll() and a self-pipe ----
+#include <poll.h>       // poll
+
+struct ev_loop {
+    struct pollfd *fds;
+    void         **ptrs;
+    int            n, cap;
+};
+
+ev_loop_t *ev_create(void){ return calloc(1,sizeof(ev_loop_t)); }
+
+void ev_destroy(ev_loop_t *l){
+    if(!l) return;
+    free(l->fds); free(l->ptrs); free(l);
+}
+
+static short ev_poll_bits(uint32_t events){
+    return (short)((events&EV_IN ? POLLIN : 0)|(events&EV_OUT ? POLLOUT : 0));
+}
+
+static int ev_find(ev_loop_t *l, int fd){
+    for(int i=0;i<l->n;i++) if(l->fds[i].fd==fd) return i;
+    return -1;
+}
+
+int ev_add(ev_loop_t *l, int fd, uint32_t events, void *ptr){
+    if(ev_find(l,fd)>=0){ errno=EEXIST; return -1; }
+    if(l->n==l->cap){
+        int cap=l->cap ? l->cap*2 : 16;
+        struct pollfd *f=realloc(l->fds,(size_t)cap*sizeof(*f));
+        if(!f) return -1;
+        l->fds=f;
+        void **p=realloc(l->ptrs,(size_t)cap*sizeof(*p));
+        if(!p) return -1;
+        l->ptrs=p; l->cap=cap;
+    }
+    l->fds[l->n].fd=fd; l->fds[l->n].events=ev_poll_bits(events); l->fds[l->n].revents=0;
+    l->ptrs[l->n++]=ptr;
+    return 0;
+}
+
+int ev_mod(ev_loop_t *l, int fd, uint32_t events, void *ptr){
+    int i=ev_find(l,fd);
+    if(i<0){ errno=ENOENT; return -1; }
+    l->fds[i].events=ev_poll_bits(events); l->ptrs[i]=ptr;
+    return 0;
+}
+
+int ev_del(ev_loop_t *l, int fd){
+    int i=ev_find(l,fd);
+    if(i<0){ errno=ENOENT; return -1; }
+    l->fds[i]=l->fds[l->n-1]; l->ptrs[i]=l->ptrs[l->n-1]; l->n--;
+    return 0;
+}
+
+int ev_fd(const ev_loop_t *l){ (void)l; return -1; }
+
+int ev_wait(ev_loop_t *l, ev_event_t *out, int max, int timeout_ms){
+    int n=poll(l->fds,(nfds_t)l->n,timeout_ms);
+    if(n<0) return errno==EINTR ? 0 : -1;
+    int k=0;
+    for(int i=0;i<l->n && k<max;i++){
+        short r=l->fds[i].revents;
+        if(!r) continue;
+        out[k].ptr=l->ptrs[i];
+        out[k].events=(r&POLLIN ? EV_IN : 0)|(r&POLLOUT ? EV_OUT : 0)|(r&(POLLERR|POLLHUP|POLLNVAL) ? EV_ERR : 0);
+        k++;
+    }
+    return k;
+}
+
+static int sig_pipe[2] = { -1, -1 };
+static int sig_list[16], sig_count = 0;
+
+static void on_signal(int sig){
+    int e=errno; unsigned char b=(unsigned char)sig;
+    if(write(sig_pipe[1],&b,1)<0){} // pipe full: a wake-up is already pending
+    errno=e;
+}
+
+int ev_signal_open(const int *sigs, int n){
+    if(pipe(sig_pipe)<0) return -1;
+    for(int i=0;i<2;i++){
+        fcntl(sig_pipe[i],F_SETFL,fcntl(sig_pipe[i],F_GETFL)|O_NONBLOCK);
+        fcntl(sig_pipe[i],F_SETFD,FD_CLOEXEC);
+    }
+    struct sigaction sa; memset(&sa,0,sizeof(sa));
+    sa.sa_handler=on_signal; // no SA_RESTART: a blocking call in the reader returns EINTR
+    for(int i=0;i<n && i<16;i++){ sigaction(sigs[i],&sa,NULL); sig_list[sig_count++]=sigs[i]; }
+    return sig_pipe[0];
+}
+
+int ev_signal_next(int fd){
+    unsigned char b;
+    return read(fd,&b,1)==1 ? b : 0;
+}
+
+void ev_signal_reset(int fd){
+    for(int i=0;i<sig_count;i++) signal(sig_list[i],SIG_DFL);
+    if(fd>=0) close(fd);
+    if(sig_pipe[1]>=0) close(sig_pipe[1]);
+}
+#endif
@@ -0,0 +1,49 @@
+// event.h
+// Minimal readiness event loop used by the server's reader: epoll on Linux,
+// poll() elsewhere. Signals the reader handles are delivered through a file
+// descriptor as well (signalfd on Linux, a self-pipe fed by handlers
+// elsewhere), so one wait covers requests, writable clients and signals.
+
+#ifndef ARITH_EVENT_H
+#define ARITH_EVENT_H
+
+#include <stdint.h>     // uint32_t
+
+// Readiness bits (EV_ERR is always reported, like EPOLLERR/EPOLLHUP)
+#define EV_IN  0x1u
+#define EV_OUT 0x2u
+#define EV_ERR 0x4u
+
+typedef struct ev_loop ev_loop_t;
+
+typedef struct {
+    void    *ptr;     // as registered
+    uint32_t events;  // EV_* bits that are ready
+} ev_event_t;
+
+// Create a loop; NULL on failure (errno set)
+ev_loop_t *ev_create(void);
+void ev_destroy(ev_loop_t *l);
+
+// Watch fd for `events` (0 => errors/hangup only), reporting `ptr`; -1 on failure
+int ev_add(ev_loop_t *l, int fd, uint32_t events, void *ptr);
+int ev_mod(ev_loop_t *l, int fd, uint32_t events, void *ptr);
+int ev_del(ev_loop_t *l, int fd);
+
+// The loop's own descriptor, readable while a watched fd is ready (to wait
+// for the loop from another poller); -1 for the poll() fallback
+int ev_fd(const ev_loop_t *l);
+
+// Wait up to timeout_ms (-1 => forever) for ready fds; returns how many were
+// stored in out[], 0 on timeout or an interrupting signal, -1 on error
+int ev_wait(ev_loop_t *l, ev_event_t *out, int max, int timeout_ms);
+
+// Route `sigs` to a non-blocking fd that turns readable when one arrives
+// (call before creating threads: they inherit the blocked mask); -1 on failure
+int ev_signal_open(const int *sigs, int n);
+// Next pending signal number from that fd, 0 when none is left
+int ev_signal_next(int fd);
+// In a fork()ed child: drop the signal fd and restore default delivery
+void ev_signal_reset(int fd);
+
+#endif // ARITH_EVENT_H
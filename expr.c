@@ -0,0 +1,300 @@
+// expr.c
+// Expression programs (see expr.h): compiling, evaluating and caching them
+// on the server side, and the infix parser behind arith_expr_parse().
+
+#include <ctype.h>      // isdigit, isalpha, isalnum, islower, isspace
+#include <errno.h>      // errno
+#include <stdlib.h>     // calloc, free
+#include <string.h>     // memcpy, memcmp
+
+#include "expr.h"
+
+// ---- Compiling and evaluating ----
+
+static bool is_const(const expr_node_t *node, uint16_t i){ return i==EXPR_NONE || node[i].code==ARITH_EXPR_CONST; }
+static int64_t const_of(const expr_node_t *node, uint16_t i){ return i==EXPR_NONE ? 0 : node[i].val; }
+
+int expr_compile(const uint8_t *code, const int64_t *val, size_t len, size_t nargs,
+                 compute_fn fold, expr_prog_t *p){
+    if(len==0 || len>ARITH_EXPR_MAX || nargs>ARITH_EXPR_ARGS_MAX) return ARITH_EBADEXPR;
+    expr_node_t node[ARITH_EXPR_MAX];
+    uint16_t at[ARITH_EXPR_MAX];    // instruction -> node holding what it pushed
+    uint16_t stack[ARITH_EXPR_MAX];
+    size_t sp=0, n=0;
+    unsigned folded=0;
+    for(size_t i=0;i<len;i++){
+        uint8_t c=code[i];
+        if(c==ARITH_EXPR_REF){
+            if(val[i]<0 || (uint64_t)val[i]>=i) return ARITH_EBADEXPR;
+            stack[sp++]=at[i]=at[val[i]];
+            continue;
+        }
+        expr_node_t *e=&node[n];
+        e->code=c; e->l=e->r=EXPR_NONE; e->val=0;
+        if(c==ARITH_EXPR_ARG){
+            if(val[i]<0 || (uint64_t)val[i]>=nargs) return ARITH_EBADEXPR;
+            e->val=val[i];
+        } else if(c==ARITH_EXPR_CONST){
+            e->val=val[i];
+        } else if(c<ARITH_OP_COUNT){
+            unsigned arity=arith_ops[c].arity;
+            if(sp<arity) return ARITH_EBADEXPR;
+            if(arity>1) e->r=stack[--sp];
+            if(arity>0) e->l=stack[--sp];
+            int64_t r;
+            if(fold && is_const(node,e->l) && is_const(node,e->r)
+               && fold(c,const_of(node,e->l),const_of(node,e->r),&r)==ARITH_OK){
+                e->code=ARITH_EXPR_CONST; e->val=r; e->l=e->r=EXPR_NONE; folded++;
+            }
+        } else return ARITH_EINVALOP;
+        stack[sp++]=at[i]=(uint16_t)n++;
+    }
+    // Every instruction pushes a new node except a REF, and a REF cannot be
+    // the only value left: the result is the last node
+    if(sp!=1) return ARITH_EBADEXPR;
+
+    // Keep what the result depends on (folding leaves its operands unused)
+    bool live[ARITH_EXPR_MAX]={ false };
+    live[n-1]=true;
+    for(size_t i=n;i-->0;){
+        if(!live[i]) continue;
+        if(node[i].l!=EXPR_NONE) live[node[i].l]=true;
+        if(node[i].r!=EXPR_NONE) live[node[i].r]=true;
+    }
+    uint16_t to[ARITH_EXPR_MAX];
+    p->n=p->ops=0; p->folded=(uint16_t)folded; p->nargs=(uint8_t)nargs;
+    for(size_t i=0;i<n;i++){
+        if(!live[i]) continue;
+        expr_node_t *e=&p->node[p->n];
+        *e=node[i];
+        if(e->l!=EXPR_NONE) e->l=to[e->l];
+        if(e->r!=EXPR_NONE) e->r=to[e->r];
+        if(e->code<ARITH_OP_COUNT) p->ops++;
+        to[i]=p->n++;
+    }
+    return ARITH_OK;
+}
+
+int expr_eval(const expr_prog_t *p, const int64_t *args, compute_fn fn, int64_t *res){
+    int64_t v[ARITH_EXPR_MAX];
+    for(size_t i=0;i<p->n;i++){
+        const expr_node_t *e=&p->node[i];
+        switch(e->code){
+        case ARITH_EXPR_ARG:   v[i]=args[e->val]; break;
+        case ARITH_EXPR_CONST: v[i]=e->val; break;
+        default: {
+            int st=fn(e->code, e->l==EXPR_NONE ? 0 : v[e->l], e->r==EXPR_NONE ? 0 : v[e->r], &v[i]);
+            if(st!=ARITH_OK) return st;
+        }
+        }
+    }
+    *res=v[p->n-1];
+    return ARITH_OK;
+}
+
+// ---- Compiled-program cache ----
+
+typedef struct {
+    uint64_t    hash;
+    uint8_t     len, nargs;           // len 0 => free slot
+    uint8_t     code[ARITH_EXPR_MAX]; // the program, to tell collisions apart
+    int64_t     val[ARITH_EXPR_MAX];
+    expr_prog_t prog;
+} expr_entry_t;
+
+struct expr_cache { expr_entry_t slot[EXPR_CACHE_SLOTS]; };
+
+expr_cache_t *expr_cache_new(void){ return calloc(1,sizeof(expr_cache_t)); }
+void expr_cache_free(expr_cache_t *c){ free(c); }
+
+// splitmix64 finalizer (as in cache.c), folded over every instruction
+static inline uint64_t mix(uint64_t x){
+    x^=x>>30; x*=UINT64_C(0xbf58476d1ce4e5b9);
+    x^=x>>27; x*=UINT64_C(0x94d049bb133111eb);
+    return x^(x>>31);
+}
+static uint64_t prog_hash(const uint8_t *code, const int64_t *val, size_t len, size_t nargs){
+    uint64_t h=mix(len<<8|nargs);
+    for(size_t i=0;i<len;i++) h=mix(h^(uint64_t)val[i]^((uint64_t)code[i]<<56));
+    return h;
+}
+
+const expr_prog_t *expr_cache_get(expr_cache_t *c, const uint8_t *code, const int64_t *val,
+                                  size_t len, size_t nargs, compute_fn fold, bool *hit, int *status){
+    uint64_t h=prog_hash(code,val,len,nargs);
+    expr_entry_t *e=&c->slot[h%EXPR_CACHE_SLOTS];
+    *status=ARITH_OK;
+    if(e->len && e->hash==h && e->len==len && e->nargs==nargs
+       && !memcmp(e->code,code,len) && !memcmp(e->val,val,len*sizeof(*val))){
+        *hit=true;
+        return &e->prog;
+    }
+    *hit=false;
+    e->len=0; // a failed compile leaves the slot empty
+    if((*status=expr_compile(code,val,len,nargs,fold,&e->prog))!=ARITH_OK) return NULL;
+    e->hash=h; e->len=(uint8_t)len; e->nargs=(uint8_t)nargs;
+    memcpy(e->code,code,len); memcpy(e->val,val,len*sizeof(*val));
+    return &e->prog;
+}
+
+// ---- Infix text ----
+// Recursive descent that emits postfix as it goes. Each instruction also
+// records the first instruction that pushes the same value (`same`) and, for
+// an operation, the `same` of its operands, so an operation whose operands
+// match an earlier one's is recognised: its own instructions (the tail of
+// the program) are taken back and a REF to the earlier one takes their place.
+
+typedef struct {
+    const char *text, *p;
+    uint8_t    *code;
+    int64_t    *val;
+    size_t      n, nargs;
+    unsigned    depth;
+    int         err;                       // errno to fail with (0 => none yet)
+    uint16_t    same[ARITH_EXPR_MAX];
+    uint16_t    l[ARITH_EXPR_MAX], r[ARITH_EXPR_MAX];
+} parser_t;
+
+static void skip_space(parser_t *ps){ while(isspace((unsigned char)*ps->p)) ps->p++; }
+static bool fail(parser_t *ps, int err){ if(!ps->err) ps->err=err; return false; }
+static bool accept(parser_t *ps, char ch){
+    skip_space(ps);
+    if(*ps->p!=ch) return false;
+    ps->p++; return true;
+}
+
+static bool emit(parser_t *ps, uint8_t code, int64_t val){
+    if(ps->n==ARITH_EXPR_MAX) return fail(ps,E2BIG);
+    size_t i=ps->n++;
+    ps->code[i]=code; ps->val[i]=val; ps->same[i]=(uint16_t)i;
+    if(code==ARITH_EXPR_REF) ps->same[i]=(uint16_t)val;
+    else if(code==ARITH_EXPR_ARG || code==ARITH_EXPR_CONST)
+        for(size_t j=0;j<i;j++) if(ps->code[j]==code && ps->val[j]==val){ ps->same[i]=ps->same[j]; break; }
+    return true;
+}
+
+// Emit operation op over the subexpressions at the end of the program:
+// operand a is the value of instruction ia, b (if any) the last one, and
+// the first of them all starts at `start`
+static bool emit_op(parser_t *ps, uint8_t op, size_t start, size_t ia){
+    unsigned arity=arith_ops[op].arity;
+    uint16_t l= arity>0 ? ps->same[arity>1 ? ia : ps->n-1] : EXPR_NONE;
+    uint16_t r= arity>1 ? ps->same[ps->n-1] : EXPR_NONE;
+    for(size_t j=0;j<start;j++){
+        if(ps->code[j]!=op || ps->same[j]!=j || ps->l[j]!=l || ps->r[j]!=r) continue;
+        ps->n=start;
+        return emit(ps,ARITH_EXPR_REF,(int64_t)j);
+    }
+    if(!emit(ps,op,0)) return false;
+    ps->l[ps->n-1]=l; ps->r[ps->n-1]=r;
+    return true;
+}
+
+static bool parse_sum(parser_t *ps);
+static bool parse_unary(parser_t *ps);
+
+static bool parse_primary(parser_t *ps){
+    skip_space(ps);
+    const char *s=ps->p;
+    if(isdigit((unsigned char)*s)){
+        uint64_t v=0;
+        for(;isdigit((unsigned char)*ps->p);ps->p++){
+            unsigned d=(unsigned)(*ps->p-'0');
+            if(v>((uint64_t)INT64_MAX-d)/10) return fail(ps,ERANGE);
+            v=v*10+d;
+        }
+        return emit(ps,ARITH_EXPR_CONST,(int64_t)v);
+    }
+    if(isalpha((unsigned char)*s)){
+        char name[8]; size_t k=0;
+        while(isalnum((unsigned char)*ps->p)){ if(k<sizeof(name)-1) name[k]=*ps->p; k++; ps->p++; }
+        if(k<sizeof(name)) name[k]='\0'; else name[0]='\0';
+        if(accept(ps,'(')){ // name(x, y)
+            uint8_t op=arith_op_from_name(name);
+            if(op==ARITH_OP_INVALID){ ps->p=s; return fail(ps,EINVAL); }
+            size_t start=ps->n, ia=0;
+            for(unsigned i=0;i<arith_ops[op].arity;i++){
+                if(i && !accept(ps,',')) return fail(ps,EINVAL);
+                if(!parse_sum(ps)) return false;
+                if(i==0) ia=ps->n-1;
+            }
+            if(!accept(ps,')')) return fail(ps,EINVAL);
+            return emit_op(ps,op,start,ia);
+        }
+        if(k!=1 || !islower((unsigned char)name[0])){ ps->p=s; return fail(ps,EINVAL); }
+        size_t arg=(size_t)(name[0]-'a');
+        if(arg>=ps->nargs) ps->nargs=arg+1;
+        return emit(ps,ARITH_EXPR_ARG,(int64_t)arg);
+    }
+    if(accept(ps,'(')){
+        if(!parse_sum(ps)) return false;
+        return accept(ps,')') || fail(ps,EINVAL);
+    }
+    return fail(ps,EINVAL);
+}
+
+// primary [^ unary]: right-associative, and -a^b is -(a^b)
+static bool parse_power(parser_t *ps){
+    size_t start=ps->n;
+    if(!parse_primary(ps)) return false;
+    if(!accept(ps,'^')) return true;
+    size_t ia=ps->n-1;
+    return parse_unary(ps) && emit_op(ps,ARITH_OP_POW,start,ia);
+}
+
+// [-] power: a negated literal is a constant, anything else a mul by -1
+// (which wraps exactly like 0 - x)
+static bool parse_unary(parser_t *ps){
+    if(++ps->depth>ARITH_EXPR_MAX) return fail(ps,E2BIG);
+    bool ok;
+    if(accept(ps,'-')){
+        size_t start=ps->n;
+        ok=parse_unary(ps);
+        if(ok && ps->n==start+1 && ps->code[start]==ARITH_EXPR_CONST){
+            int64_t v=(int64_t)(0-(uint64_t)ps->val[start]);
+            ps->n=start; ok=emit(ps,ARITH_EXPR_CONST,v);
+        } else if(ok){
+            size_t ia=ps->n-1;
+            ok=emit(ps,ARITH_EXPR_CONST,-1) && emit_op(ps,ARITH_OP_MUL,start,ia);
+        }
+    } else ok=parse_power(ps);
+    ps->depth--;
+    return ok;
+}
+
+static bool parse_product(parser_t *ps){
+    size_t start=ps->n;
+    if(!parse_unary(ps)) return false;
+    for(;;){
+        uint8_t op= accept(ps,'*') ? ARITH_OP_MUL : accept(ps,'/') ? ARITH_OP_DIV
+                  : accept(ps,'%') ? ARITH_OP_MOD : ARITH_OP_INVALID;
+        if(op==ARITH_OP_INVALID) return true;
+        size_t ia=ps->n-1;
+        if(!parse_unary(ps) || !emit_op(ps,op,start,ia)) return false;
+    }
+}
+
+static bool parse_sum(parser_t *ps){
+    size_t start=ps->n;
+    if(!parse_product(ps)) return false;
+    for(;;){
+        uint8_t op= accept(ps,'+') ? ARITH_OP_ADD : accept(ps,'-') ? ARITH_OP_SUB : ARITH_OP_INVALID;
+        if(op==ARITH_OP_INVALID) return true;
+        size_t ia=ps->n-1;
+        if(!parse_product(ps) || !emit_op(ps,op,start,ia)) return false;
+    }
+}
+
+int expr_parse(const char *text, uint8_t *code, int64_t *val, size_t *nargs, size_t *err_at){
+    parser_t ps={ .text=text, .p=text, .code=code, .val=val };
+    bool ok=parse_sum(&ps);
+    skip_space(&ps);
+    if(ok && *ps.p) ok=fail(&ps,EINVAL); // trailing text
+    if(!ok){
+        if(err_at) *err_at=(size_t)(ps.p-text);
+        errno=ps.err;
+        return -1;
+    }
+    *nargs=ps.nargs;
+    return (int)ps.n;
+}
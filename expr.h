@@ -0,0 +1,78 @@
+// expr.h
+// Expression programs (ARITH_FRAME_EXPR, see proto.h): the server compiles
+// and evaluates them, clients parse infix text into them.
+//
+// expr_compile() checks a postfix program once and turns it into nodes in
+// single-assignment form, in program order: an operation node names the
+// nodes of its operands, so evaluating it needs no stack and a REF costs
+// nothing at all. An operation on two constants is folded into a constant
+// when it succeeds (one that fails, such as a division by zero, is left in
+// place so that evaluation reports it in program order like any other), and
+// nodes that nothing uses any more are dropped. The compiled form only
+// depends on the program, never on the arguments, so a client that sends
+// the same program over and over with new arguments is compiled once per
+// expr_cache_t it reaches.
+
+#ifndef ARITH_EXPR_H
+#define ARITH_EXPR_H
+
+#include <stdbool.h>    // bool
+#include <stddef.h>     // size_t
+#include <stdint.h>     // int64_t, uint8_t, uint16_t
+
+#include "compute.h"    // compute_fn
+#include "proto.h"      // enum arith_expr_code, ARITH_EXPR_MAX
+
+#define EXPR_NONE 0xFFFF // operand of an operation that reads fewer than two
+
+typedef struct {
+    uint8_t  code;      // enum arith_op, ARITH_EXPR_ARG or ARITH_EXPR_CONST
+    uint16_t l, r;      // operation: nodes of a and b (earlier ones, or EXPR_NONE)
+    int64_t  val;       // argument number or constant
+} expr_node_t;
+
+typedef struct {
+    uint16_t    n;         // nodes; the last one is the result
+    uint16_t    ops;       // operation nodes among them
+    uint16_t    folded;    // operations folded into constants
+    uint8_t     nargs;     // arguments the program reads
+    expr_node_t node[ARITH_EXPR_MAX];
+} expr_prog_t;
+
+// Compile the program code[i] / val[i] (i < len) over nargs arguments into
+// *p, folding constant operations with `fold` (NULL => no folding). Returns
+// ARITH_OK, ARITH_EBADEXPR or ARITH_EINVALOP (see proto.h).
+int expr_compile(const uint8_t *code, const int64_t *val, size_t len, size_t nargs,
+                 compute_fn fold, expr_prog_t *p);
+// Evaluate a compiled program over its p->nargs arguments with fn (compute()
+// or a wrapper of it): ARITH_OK with the value in *res, or the status of
+// the first operation that failed
+int expr_eval(const expr_prog_t *p, const int64_t *args, compute_fn fn, int64_t *res);
+
+// ---- Compiled-program cache ----
+// A direct-mapped table of EXPR_CACHE_SLOTS compiled programs, keyed by a
+// hash of the program and checked against a copy of it, so a collision
+// only costs a compile. It takes no lock: give every handler its own.
+#define EXPR_CACHE_SLOTS 64
+
+typedef struct expr_cache expr_cache_t;
+
+expr_cache_t *expr_cache_new(void);  // NULL with errno on failure
+void          expr_cache_free(expr_cache_t *c);
+// The compiled form of a program: the cached one (*hit true), or a fresh
+// compile that replaces whatever held its slot. NULL with the status in
+// *status if the program does not compile (nothing is cached then).
+const expr_prog_t *expr_cache_get(expr_cache_t *c, const uint8_t *code, const int64_t *val,
+                                  size_t len, size_t nargs, compute_fn fold, bool *hit, int *status);
+
+// ---- Infix text (clients) ----
+// Integers, arguments a..z (a is argument 0), + - * / % with the usual
+// precedence, ^ for pow (right-associative, above unary minus), parentheses
+// and name(x, y) for any operation of the registry. A subexpression that
+// occurs again is sent once and REFed. Returns the instruction count with
+// the arguments the program reads in *nargs, or -1 with errno EINVAL (bad
+// syntax, at text offset *err_at), ERANGE (a literal does not fit int64_t)
+// or E2BIG (more than ARITH_EXPR_MAX instructions).
+int expr_parse(const char *text, uint8_t *code, int64_t *val, size_t *nargs, size_t *err_at);
+
+#endif // ARITH_EXPR_H
@@ -0,0 +1,93 @@
+// hist.c
+// Log-linear latency histogram (see hist.h).
+
+#include <string.h>     // memset
+
+#include "hist.h"
+
+#define SUB_COUNT  (1u<<HIST_SUB_BITS)    // linear buckets below 2^HIST_SUB_BITS
+#define HALF_COUNT (SUB_COUNT/2)          // buckets per power of two above that
+
+static unsigned bucket_of(uint64_t v){
+    if(v<SUB_COUNT) return (unsigned)v;
+    unsigned k=63u-(unsigned)__builtin_clzll(v);           // v is in [2^k, 2^(k+1))
+    unsigned shift=k-(HIST_SUB_BITS-1);
+    return SUB_COUNT+(k-HIST_SUB_BITS)*HALF_COUNT+(unsigned)((v>>shift)-HALF_COUNT);
+}
+
+// Largest value that lands in bucket i (HdrHistogram's "highest equivalent value")
+static uint64_t bucket_high(unsigned i){
+    if(i<SUB_COUNT) return i;
+    unsigned j=i-SUB_COUNT, k=HIST_SUB_BITS+j/HALF_COUNT;
+    uint64_t m=HALF_COUNT+j%HALF_COUNT;
+    unsigned shift=k-(HIST_SUB_BITS-1);
+    return ((m+1)<<shift)-1;
+}
+
+void hist_init(hist_t *h){
+    memset(h,0,sizeof(*h));
+    h->min=UINT64_MAX;
+}
+
+void hist_record(hist_t *h, uint64_t v){
+    if(v>HIST_MAX) v=HIST_MAX;
+    h->counts[bucket_of(v)]++;
+    h->count++; h->sum+=(double)v;
+    if(v<h->min) h->min=v;
+    if(v>h->max) h->max=v;
+}
+
+void hist_merge(hist_t *dst, const hist_t *src){
+    for(unsigned i=0;i<HIST_BUCKETS;i++) dst->counts[i]+=src->counts[i];
+    dst->count+=src->count; dst->sum+=src->sum;
+    if(src->min<dst->min) dst->min=src->min;
+    if(src->max>dst->max) dst->max=src->max;
+}
+
+// Value at percentile p and how many values are at or below it
+static uint64_t percentile_at(const hist_t *h, double p, uint64_t *below){
+    *below=0;
+    if(!h->count) return 0;
+    uint64_t want=(uint64_t)(p/100.0*(double)h->count+0.5);
+    if(want<1) want=1;
+    if(want>h->count) want=h->count;
+    uint64_t seen=0;
+    for(unsigned i=0;i<HIST_BUCKETS;i++){
+        seen+=h->counts[i];
+        if(seen>=want){
+            *below=seen;
+            uint64_t v=bucket_high(i);
+            if(v>h->max) v=h->max;          // exact extremes beat bucket bounds
+            if(v<h->min) v=h->min;
+            return v;
+        }
+    }
+    *below=h->count;
+    return h->max;
+}
+
+uint64_t hist_percentile(const hist_t *h, double p){
+    uint64_t below;
+    return percentile_at(h,p,&below);
+}
+
+double hist_mean(const hist_t *h){
+    return h->count ? h->sum/(double)h->count : 0.0;
+}
+
+void hist_write_hgrm(const hist_t *h, FILE *f, double scale){
+    fprintf(f,"%12s %14s %10s %14s\n\n","Value","Percentile","TotalCount","1/(1-Percentile)");
+    // Five lines per halving of the distance to 100%, as HdrHistogram prints it
+    double p=0.0;
+    for(;;){
+        uint64_t below, v=percentile_at(h,p,&below);
+        if(below>=h->count) break;
+        fprintf(f,"%12.3f %14.12f %10llu %14.2f\n",(double)v/scale,p/100.0,(unsigned long long)below,100.0/(100.0-p));
+        double r=100.0/(100.0-p), half=1.0;
+        while(half*2.0<=r) half*=2.0;
+        p+=100.0/(5.0*half*2.0);
+    }
+    fprintf(f,"%12.3f %14.12f %10llu %14s\n",(double)h->max/scale,1.0,(unsigned long long)h->count,"inf");
+    fprintf(f,"#[Mean    = %12.3f, Max         = %12.3f]\n",hist_mean(h)/scale,(double)h->max/scale);
+    fprintf(f,"#[Count   = %12llu, SubBuckets  = %12u]\n",(unsigned long long)h->count,SUB_COUNT);
+}
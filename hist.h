@@ -0,0 +1,40 @@
+// hist.h
+// Fixed-size latency histogram in the style of HdrHistogram: values below
+// 2048 get one bucket each, and every power-of-two range above that is split
+// into 1024 equal buckets. Relative error therefore stays below 0.1% (three
+// significant digits) from 1 ns up to HIST_MAX (about 68 s). The histogram is
+// one flat struct with no pointers, so it can live in shared memory and be
+// filled by a forked process, and merging two histograms is a plain sum.
+
+#ifndef ARITH_HIST_H
+#define ARITH_HIST_H
+
+#include <stdint.h>     // uint64_t
+#include <stdio.h>      // FILE
+
+#define HIST_SUB_BITS 11                           // 2048 linear buckets
+#define HIST_MAX_BITS 36                           // values up to 2^36-1
+#define HIST_MAX      ((UINT64_C(1)<<HIST_MAX_BITS)-1)
+#define HIST_BUCKETS  ((1u<<HIST_SUB_BITS) + (HIST_MAX_BITS-HIST_SUB_BITS)*(1u<<(HIST_SUB_BITS-1)))
+
+typedef struct {
+    uint64_t count;                 // values recorded
+    uint64_t min, max;              // exact extremes (min is UINT64_MAX while empty)
+    double   sum;                   // for the mean
+    uint64_t counts[HIST_BUCKETS];
+} hist_t;
+
+void hist_init(hist_t *h);
+// Record one value (clamped to HIST_MAX)
+void hist_record(hist_t *h, uint64_t v);
+// dst += src
+void hist_merge(hist_t *dst, const hist_t *src);
+// Smallest recorded value v such that p percent of the values are <= v
+// (up to bucket precision); 0 when empty
+uint64_t hist_percentile(const hist_t *h, double p);
+double hist_mean(const hist_t *h);
+// Percentile distribution in HdrHistogram's .hgrm text format, values
+// divided by `scale` (e.g. 1000.0 to print microseconds from nanoseconds)
+void hist_write_hgrm(const hist_t *h, FILE *f, double scale);
+
+#endif // ARITH_HIST_H
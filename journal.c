@@ -0,0 +1,101 @@
+// journal.c
+// Request journal file: preallocation and slot claims for the server, the
+// read-only mapping for replay (see journal.h).
+
+#define _GNU_SOURCE
+#include <string.h>     // memset
+#include <errno.h>      // errno
+#include <unistd.h>     // ftruncate, close, getpid
+#include <fcntl.h>      // open, posix_fallocate
+#include <time.h>       // time, clock_gettime
+#include <sys/mman.h>   // mmap, munmap
+#include <sys/stat.h>   // fstat
+
+#include "journal.h"
+
+static journal_hdr_t *jhdr = NULL;  // the mapped file (NULL => not recording)
+static journal_rec_t *jrecs = NULL;
+static size_t  jmap_len = 0;
+static int     jfd = -1;
+static uint64_t jstart = 0;         // CLOCK_MONOTONIC ns when recording started
+
+static uint64_t mono_ns(void){
+    struct timespec ts; clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (uint64_t)ts.tv_sec*1000000000u+(uint64_t)ts.tv_nsec;
+}
+
+int journal_open(const char *path, size_t bytes){
+    uint64_t cap= bytes>sizeof(journal_hdr_t) ? (bytes-sizeof(journal_hdr_t))/sizeof(journal_rec_t) : 0;
+    if(!cap){ errno=EINVAL; return -1; }
+    size_t len=sizeof(journal_hdr_t)+(size_t)cap*sizeof(journal_rec_t);
+    int fd=open(path,O_RDWR|O_CREAT|O_TRUNC|O_CLOEXEC,0644);
+    if(fd<0) return -1;
+    // Allocate every block now: a full disk fails here, not as SIGBUS on a store
+    int err=posix_fallocate(fd,0,(off_t)len);
+    if(err==EOPNOTSUPP || err==EINVAL) err= ftruncate(fd,(off_t)len)<0 ? errno : 0; // e.g. tmpfs without fallocate
+    void *p=MAP_FAILED;
+    if(!err){
+        // Populated up front so the readers never take a page fault on a record
+        p=mmap(NULL,len,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,fd,0);
+        if(p==MAP_FAILED) err=errno;
+    }
+    if(err){ close(fd); unlink(path); errno=err; return -1; }
+    jhdr=p; jrecs=(journal_rec_t*)(jhdr+1); jmap_len=len; jfd=fd;
+    jstart=mono_ns();
+    jhdr->version=JOURNAL_VERSION; jhdr->rec_size=sizeof(journal_rec_t);
+    jhdr->server_pid=(int32_t)getpid(); jhdr->capacity=cap; jhdr->started=(int64_t)time(NULL);
+    atomic_thread_fence(memory_order_release); // a reader that sees the magic sees the header
+    jhdr->magic=JOURNAL_MAGIC;
+    return 0;
+}
+
+journal_rec_t *journal_claim(unsigned n){
+    if(!jhdr) return NULL;
+    uint64_t first=atomic_fetch_add_explicit(&jhdr->next,n,memory_order_relaxed);
+    if(first+n>jhdr->capacity){
+        atomic_fetch_add_explicit(&jhdr->dropped,n,memory_order_relaxed);
+        return NULL;
+    }
+    journal_rec_t *r=&jrecs[first];
+    memset(r,0,n*sizeof(*r));
+    return r;
+}
+
+uint64_t journal_time(uint64_t t){
+    return t>jstart ? t-jstart : 0;
+}
+
+void journal_close(uint64_t *written, uint64_t *dropped){
+    if(!jhdr) return;
+    uint64_t next=atomic_load(&jhdr->next), cap=jhdr->capacity;
+    uint64_t used= next<cap ? next : cap;
+    uint64_t lost=atomic_load(&jhdr->dropped);
+    if(written) *written=used;
+    if(dropped) *dropped=lost;
+    jhdr->capacity=used; // what the truncated file holds
+    munmap(jhdr,jmap_len);
+    if(ftruncate(jfd,(off_t)(sizeof(journal_hdr_t)+used*sizeof(journal_rec_t)))<0){} // keep the full file then
+    close(jfd);
+    jhdr=NULL; jrecs=NULL; jfd=-1;
+}
+
+const journal_rec_t *journal_map(const char *path, const journal_hdr_t **hdr, size_t *n){
+    int fd=open(path,O_RDONLY|O_CLOEXEC);
+    if(fd<0) return NULL;
+    struct stat st; void *p=MAP_FAILED;
+    if(fstat(fd,&st)==0 && (size_t)st.st_size>=sizeof(journal_hdr_t))
+        p=mmap(NULL,(size_t)st.st_size,PROT_READ,MAP_SHARED,fd,0);
+    else errno=EPROTO;
+    int e=errno; close(fd); errno=e;
+    if(p==MAP_FAILED) return NULL;
+    const journal_hdr_t *h=p;
+    if(h->magic!=JOURNAL_MAGIC || h->version!=JOURNAL_VERSION || h->rec_size!=sizeof(journal_rec_t)){
+        munmap(p,(size_t)st.st_size); errno=EPROTO; return NULL;
+    }
+    // A journal still being written (or cut short by a crash) holds what was claimed so far
+    uint64_t fits=((uint64_t)st.st_size-sizeof(*h))/sizeof(journal_rec_t), claimed=atomic_load(&((journal_hdr_t*)h)->next);
+    uint64_t cnt= h->capacity<fits ? h->capacity : fits;
+    if(claimed<cnt) cnt=claimed;
+    *hdr=h; *n=(size_t)cnt;
+    return (const journal_rec_t*)(h+1);
+}
@@ -0,0 +1,80 @@
+// journal.h
+// Binary request journal: `server --journal FILE` appends one fixed-size
+// record per received call (and per tuple of a batch frame) to a file it
+// preallocates and maps, so recording a request is an atomic add to claim
+// its slot plus a 40-byte store, with no formatting and no system call.
+// Readers, threads of one process, claim disjoint slots and never wait on
+// each other. The `replay` tool maps a journal read-only and sends its calls
+// to a server again, at the recorded pace or as fast as possible.
+//
+// File layout: a journal_hdr_t, then `capacity` journal_rec_t. A record
+// whose version byte is still 0 was claimed but not completely written (the
+// server died in between) and is skipped by readers. A server that stops
+// normally truncates the file after the last claimed record.
+
+#ifndef ARITH_JOURNAL_H
+#define ARITH_JOURNAL_H
+
+#include <stddef.h>     // size_t
+#include <stdint.h>     // uint64_t, int64_t, int32_t, uint*_t
+#include <stdatomic.h>  // atomic_ullong
+
+#define JOURNAL_MAGIC   0x4c4a5241u // "ARJL"
+#define JOURNAL_VERSION 1
+
+#define JOURNAL_BATCH 0x1 // record is tuple `index` of a batch frame of `batch` tuples
+
+typedef struct {
+    uint32_t magic, version;  // JOURNAL_MAGIC, JOURNAL_VERSION (magic set last)
+    uint32_t rec_size;        // sizeof(journal_rec_t)
+    int32_t  server_pid;
+    uint64_t capacity;        // records the file has room for
+    atomic_ullong next;       // records claimed (the file is full once it reaches capacity)
+    atomic_ullong dropped;    // records not written because the file was full
+    int64_t  started;         // time(NULL) when recording started
+    uint64_t reserved[2];
+} journal_hdr_t;
+
+typedef struct {
+    uint64_t t_ns;            // arrival, ns after recording started
+    int32_t  client_pid;
+    uint32_t req_id;          // v2 request or batch id (0 for v1)
+    int64_t  a, b;            // operands
+    uint8_t  opcode;          // enum arith_op (ARITH_OP_INVALID if unknown)
+    uint8_t  transport;       // enum arith_transport it came over
+    uint8_t  version;         // protocol, 1 or 2; written last (0 => incomplete)
+    uint8_t  flags;           // JOURNAL_BATCH
+    uint16_t batch;           // tuples in its batch frame (0 for a single call)
+    uint16_t index;           // position in that frame
+} journal_rec_t;
+
+_Static_assert(sizeof(journal_hdr_t)==64, "journal header layout");
+_Static_assert(sizeof(journal_rec_t)==40, "journal record layout");
+
+// ---- Server ----
+
+// Create (or replace) FILE with room for `bytes` of records and map it;
+// -1 with errno set on failure
+int journal_open(const char *path, size_t bytes);
+// Claim n consecutive records (one call, or the tuples of one batch frame)
+// and return the first, or NULL if no journal is open or it is full. The
+// caller fills them and completes each with journal_commit().
+journal_rec_t *journal_claim(unsigned n);
+// Complete a filled record: its version is stored last, after the rest
+static inline void journal_commit(journal_rec_t *r, uint8_t version){
+    atomic_thread_fence(memory_order_release);
+    r->version=version;
+}
+// Arrival time of a request received at metrics_now() time t
+uint64_t journal_time(uint64_t t);
+// Truncate the file to what was claimed and unmap it; stores the records
+// written and dropped (either may be NULL)
+void journal_close(uint64_t *written, uint64_t *dropped);
+
+// ---- Readers ----
+
+// Map FILE read-only; NULL (errno set, EPROTO: not a journal of this
+// version) on failure. *n gets the number of records in it.
+const journal_rec_t *journal_map(const char *path, const journal_hdr_t **hdr, size_t *n);
+
+#endif // ARITH_JOURNAL_H
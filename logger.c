@@ -0,0 +1,183 @@
+// logger.c
+// Asynchronous server.log writer (see logger.h).
+
+#define _GNU_SOURCE
+#include <stdio.h>      // vsnprintf, snprintf
+#include <string.h>     // memcpy
+#include <errno.h>      // errno
+#include <unistd.h>     // write, close
+#include <fcntl.h>      // open flags
+#include <time.h>       // time, localtime_r, strftime, nanosleep
+#include <stdarg.h>     // va_list
+#include <stdatomic.h>  // atomic_bool, atomic_uint_fast64_t
+#include <pthread.h>    // pthread_create, pthread_sigmask
+#include <semaphore.h>  // sem_t (flusher wake-up)
+#include <signal.h>     // sigset_t
+#include <sys/mman.h>   // mmap (ring shared with children)
+
+#include "logger.h"
+#include "ring.h"       // lock-free MPMC ring
+#include "profile.h"    // PROF_BEGIN/PROF_END (make profile)
+
+#define LOG_MSG_MAX   240          // message bytes per record (longer lines are truncated)
+#define LOG_RING_CAP  4096         // records queued before the full-ring policy applies
+#define LOG_FLUSH_MS  50           // flusher wakes at least this often
+#define LOG_BATCH_MAX (64*1024)    // bytes of formatted lines per write(2)
+
+// One queued line: the flusher adds the timestamp
+typedef struct {
+    int64_t  sec;                  // time() when logged
+    uint16_t len;                  // bytes used in msg
+    char     msg[LOG_MSG_MAX];
+} log_rec_t;
+
+typedef struct {
+    sem_t       kick;              // producers wake the flusher when the ring fills up
+    atomic_bool kicked;            // a kick is already pending
+    atomic_bool running;           // flusher alive: queue, else write synchronously
+    atomic_uint_fast64_t dropped;  // LOG_DROP discards not yet reported in the log
+    atomic_uint_fast64_t dropped_total; // LOG_DROP discards since log_open
+    ring_t      ring;              // must be last: slots follow it
+} log_shared_t;
+
+static log_shared_t *lg = NULL;
+static int  log_fd = -1;
+static enum log_policy log_pol = LOG_BLOCK;
+static pthread_t flusher;
+static atomic_bool stopping;
+
+static void write_all(int fd, const char *buf, size_t n){
+    while(n){
+        ssize_t w=write(fd,buf,n);
+        if(w<0){ if(errno==EINTR) continue; return; }
+        buf+=w; n-=(size_t)w;
+    }
+}
+
+// "[YYYY-mm-dd HH:MM:SS] " for `sec`, reformatted only when the second changes
+static size_t stamp(int64_t sec, char *out){
+    static _Thread_local int64_t cached_sec = -1;
+    static _Thread_local char    cached[32];
+    static _Thread_local size_t  cached_len;
+    if(sec!=cached_sec){
+        time_t t=(time_t)sec; struct tm tmv;
+        localtime_r(&t,&tmv);
+        cached_len=strftime(cached,sizeof(cached),"[%Y-%m-%d %H:%M:%S] ",&tmv);
+        cached_sec=sec;
+    }
+    memcpy(out,cached,cached_len);
+    return cached_len;
+}
+
+// Append one formatted line to buf at *n (the caller leaves room for it)
+static void format_rec(const log_rec_t *r, char *buf, size_t *n){
+    *n+=stamp(r->sec,buf+*n);
+    memcpy(buf+*n,r->msg,r->len); *n+=r->len;
+    buf[(*n)++]='\n';
+}
+
+// Pop and write everything queued; returns the number of records written
+static size_t drain(void){
+    static char buf[LOG_BATCH_MAX];
+    size_t n=0, count=0;
+    log_rec_t r;
+    while(ring_pop(&lg->ring,&r)){
+        if(n+sizeof(r.msg)+40>sizeof(buf)){ write_all(log_fd,buf,n); n=0; }
+        format_rec(&r,buf,&n);
+        count++;
+    }
+    uint64_t d=atomic_exchange(&lg->dropped,0);
+    if(d){
+        log_rec_t note={ .sec=time(NULL) };
+        note.len=(uint16_t)snprintf(note.msg,sizeof(note.msg),"logger: %llu records dropped (ring full)",(unsigned long long)d);
+        format_rec(&note,buf,&n);
+    }
+    if(n) write_all(log_fd,buf,n);
+    return count;
+}
+
+static void *flusher_main(void *arg){
+    (void)arg;
+    while(!atomic_load(&stopping)){
+#ifdef __linux__
+        struct timespec ts; clock_gettime(CLOCK_REALTIME,&ts);
+        ts.tv_nsec+=LOG_FLUSH_MS*1000000L;
+        if(ts.tv_nsec>=1000000000L){ ts.tv_sec++; ts.tv_nsec-=1000000000L; }
+        sem_timedwait(&lg->kick,&ts);
+#else
+        struct timespec ts={0,LOG_FLUSH_MS*1000000L}; nanosleep(&ts,NULL);
+#endif
+        atomic_store(&lg->kicked,false);
+        drain();
+    }
+    return NULL;
+}
+
+int log_open(const char *path, enum log_policy policy){
+    log_fd=open(path,O_WRONLY|O_CREAT|O_APPEND,0644);
+    if(log_fd<0) return -1;
+    log_pol=policy;
+    size_t cap=ring_capacity(LOG_RING_CAP);
+    void *p=mmap(NULL,sizeof(log_shared_t)+cap*ring_slot_size(sizeof(log_rec_t)),
+                 PROT_READ|PROT_WRITE,MAP_SHARED|MAP_ANONYMOUS,-1,0);
+    if(p==MAP_FAILED) return 0; // no ring: every line is written synchronously
+    lg=p;
+    ring_init(&lg->ring,cap,sizeof(log_rec_t));
+    if(sem_init(&lg->kick,1,0)<0){ lg=NULL; return 0; }
+    atomic_init(&lg->kicked,false); atomic_init(&lg->dropped,0); atomic_init(&lg->dropped_total,0);
+
+    // The flusher never takes the signals the server's reader handles
+    sigset_t all, old; sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK,&all,&old);
+    int e=pthread_create(&flusher,NULL,flusher_main,NULL);
+    pthread_sigmask(SIG_SETMASK,&old,NULL);
+    atomic_init(&lg->running,e==0);
+    return 0;
+}
+
+static void log_vline(const char *fmt, va_list ap){
+    log_rec_t r;
+    r.sec=(int64_t)time(NULL);           // vDSO: no system call
+    int m=vsnprintf(r.msg,sizeof(r.msg),fmt,ap);
+    if(m<0) return;
+    r.len=(uint16_t)((size_t)m<sizeof(r.msg) ? (size_t)m : sizeof(r.msg)-1);
+
+    if(!lg || !atomic_load(&lg->running)){ // synchronous: one write per line
+        char buf[LOG_MSG_MAX+40]; size_t n=0;
+        format_rec(&r,buf,&n);
+        write_all(log_fd,buf,n);
+        return;
+    }
+    while(!ring_push(&lg->ring,&r)){
+        if(log_pol==LOG_DROP){ atomic_fetch_add(&lg->dropped,1); atomic_fetch_add(&lg->dropped_total,1); return; }
+        sem_post(&lg->kick);             // LOG_BLOCK: make sure the flusher drains, wait for room
+        struct timespec ts={0,50*1000}; nanosleep(&ts,NULL);
+        if(!atomic_load(&lg->running)){ char buf[LOG_MSG_MAX+40]; size_t n=0; format_rec(&r,buf,&n); write_all(log_fd,buf,n); return; }
+    }
+    // Past half full: wake the flusher now instead of at its next tick
+    if(ring_count(&lg->ring)>=LOG_RING_CAP/2 && !atomic_exchange(&lg->kicked,true)) sem_post(&lg->kick);
+}
+
+void log_line(const char *fmt, ...){
+    if(log_fd<0) return;                 // no-op if log not available
+    PROF_BEGIN(t);
+    va_list ap; va_start(ap, fmt);
+    log_vline(fmt,ap);
+    va_end(ap);
+    PROF_END(PROF_LOG,t);
+}
+
+void log_close(void){
+    if(lg && atomic_load(&lg->running)){
+        atomic_store(&stopping,true);
+        sem_post(&lg->kick);
+        pthread_join(flusher,NULL);
+        atomic_store(&lg->running,false); // later lines go straight to the file
+        drain();                          // whatever raced in before the switch
+    }
+    if(log_fd>=0){ close(log_fd); log_fd=-1; }
+}
+
+uint64_t log_dropped(void){
+    return lg ? (uint64_t)atomic_load(&lg->dropped_total) : 0;
+}
@@ -0,0 +1,35 @@
+// logger.h
+// Asynchronous server.log writer. log_line() only formats the message into a
+// fixed-size binary record (seconds + text) and pushes it into a lock-free
+// ring (ring.h) in shared memory, so fork()ed children and pool workers log
+// through the same ring as the server's own threads. A background flusher
+// thread in the server process drains the ring in batches, prefixes each
+// record with a timestamp it formats once per second, and writes whole
+// batches of lines with one write(2).
+
+#ifndef ARITH_LOGGER_H
+#define ARITH_LOGGER_H
+
+#include <stdint.h>     // uint64_t
+
+// What log_line() does when the ring is full
+enum log_policy {
+    LOG_BLOCK = 0, // wait for the flusher to make room (nothing is lost)
+    LOG_DROP,      // discard the record and count it (never waits)
+};
+
+// Open (append) the log file and start the flusher; -1 on failure (errno set).
+// Call before fork()ing children or workers so they share the ring.
+int  log_open(const char *path, enum log_policy policy);
+
+// Queue one line (printf-style, no trailing newline needed). Before
+// log_open() and after log_close() the line is written synchronously.
+void log_line(const char *fmt, ...) __attribute__((format(printf,1,2)));
+
+// Flush everything queued, stop the flusher and close the file
+void log_close(void);
+
+// Records discarded under LOG_DROP so far
+uint64_t log_dropped(void);
+
+#endif // ARITH_LOGGER_H
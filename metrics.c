@@ -0,0 +1,276 @@
+// metrics.c
+// Metrics segment: creation by the server and the `server --stats` reader
+// (see metrics.h).
+
+#define _GNU_SOURCE
+#include <stdio.h>      // printf, fprintf
+#include <string.h>     // memset, snprintf
+#include <errno.h>      // errno
+#include <unistd.h>     // ftruncate, close, sleep, isatty, getpid
+#include <fcntl.h>      // O_* flags
+#include <signal.h>     // kill
+#include <time.h>       // time
+#include <sys/mman.h>   // shm_open, mmap
+#include <sys/stat.h>   // fstat
+
+#include "metrics.h"
+
+static bool created = false; // this process owns the segment's name
+
+arith_metrics_t *metrics_create(const char *executor, int shards, bool *published){
+    arith_metrics_t *m=MAP_FAILED;
+    shm_unlink(METRICS_SHM_NAME); // left behind by a server that crashed
+    int fd=shm_open(METRICS_SHM_NAME,O_RDWR|O_CREAT|O_EXCL,0644);
+    if(fd>=0){
+        if(ftruncate(fd,sizeof(*m))==0) m=mmap(NULL,sizeof(*m),PROT_READ|PROT_WRITE,MAP_SHARED,fd,0); // zero-filled
+        close(fd);
+        if(m==MAP_FAILED) shm_unlink(METRICS_SHM_NAME);
+    }
+    created=*published= m!=MAP_FAILED;
+    if(m==MAP_FAILED) m=mmap(NULL,sizeof(*m),PROT_READ|PROT_WRITE,MAP_SHARED|MAP_ANONYMOUS,-1,0);
+    if(m==MAP_FAILED) return NULL;
+    m->server_pid=(int32_t)getpid(); m->shards=shards; m->started=(int64_t)time(NULL);
+    snprintf(m->executor,sizeof(m->executor),"%s",executor);
+    m->version=METRICS_VERSION;
+    atomic_thread_fence(memory_order_release); // a reader that sees the magic sees the header
+    m->magic=METRICS_MAGIC;
+    return m;
+}
+
+void metrics_unlink(void){
+    if(created) shm_unlink(METRICS_SHM_NAME);
+    created=false;
+}
+
+// ---- server --stats ----
+// The reader only loads from a read-only mapping: it never takes a lock the
+// server takes nor sends it anything. A report is a snapshot of relaxed
+// loads, so counters read a moment apart may disagree by the requests that
+// completed in between.
+
+typedef struct { uint64_t count, sum_ns, bucket[METRICS_LAT_BUCKETS]; } hist_snap_t;
+typedef struct {
+    uint64_t requests[ARITH_OP_COUNT+1], status[ARITH_STATUS_COUNT];
+    uint64_t batches, exprs, expr_compiles, arrays, array_elems, partial, bad_frames, open_failed, write_failed, hellos, attaches, accepts;
+    uint64_t admitted, busy_full, busy_client;
+    uint64_t cache_hits, cache_misses, cache_evictions;
+    int      running, queued, queued_max, shm_channels, sock_conns;
+    hist_snap_t stage[STAGE_COUNT];
+} snap_t;
+
+// Prometheus label values, indexed by enum arith_status
+static const char *const status_labels[] = {
+    "ok", "divide_by_zero", "invalid_op", "no_session", "overflow", "busy", "bad_array", "bad_expr",
+};
+_Static_assert(sizeof(status_labels)/sizeof(status_labels[0])==ARITH_STATUS_COUNT, "one label per status");
+
+static uint64_t ld(const atomic_ullong *p){ return atomic_load_explicit((atomic_ullong*)p,memory_order_relaxed); }
+static int ldi(const atomic_int *p){ return atomic_load_explicit((atomic_int*)p,memory_order_relaxed); }
+
+static void snapshot(const arith_metrics_t *m, snap_t *s){
+    for(int i=0;i<=ARITH_OP_COUNT;i++) s->requests[i]=ld(&m->requests[i]);
+    for(int i=0;i<ARITH_STATUS_COUNT;i++) s->status[i]=ld(&m->status[i]);
+    s->batches=ld(&m->batches); s->exprs=ld(&m->exprs); s->expr_compiles=ld(&m->expr_compiles);
+    s->arrays=ld(&m->arrays); s->array_elems=ld(&m->array_elems);
+    s->partial=ld(&m->partial); s->bad_frames=ld(&m->bad_frames);
+    s->open_failed=ld(&m->open_failed); s->write_failed=ld(&m->write_failed);
+    s->hellos=ld(&m->hellos); s->attaches=ld(&m->attaches); s->accepts=ld(&m->accepts);
+    s->admitted=ld(&m->admit.admitted); s->busy_full=ld(&m->admit.busy_full); s->busy_client=ld(&m->admit.busy_client);
+    s->running=ldi(&m->admit.running); s->queued=ldi(&m->admit.queued);
+    s->queued_max=ldi(&m->admit.queued_max); s->shm_channels=ldi(&m->shm_channels);
+    s->sock_conns=ldi(&m->sock_conns);
+    s->cache_hits=ld(&m->cache_hits); s->cache_misses=ld(&m->cache_misses); s->cache_evictions=ld(&m->cache_evictions);
+    for(int k=0;k<STAGE_COUNT;k++){
+        const metrics_hist_t *h=&m->stage[k];
+        for(int i=0;i<METRICS_LAT_BUCKETS;i++) s->stage[k].bucket[i]=ld(&h->bucket[i]);
+        s->stage[k].sum_ns=ld(&h->sum_ns); s->stage[k].count=ld(&h->count);
+    }
+}
+
+// Map the server's segment read-only; NULL (after saying why) if there is none
+static const arith_metrics_t *attach(void){
+    int fd=shm_open(METRICS_SHM_NAME,O_RDONLY,0);
+    if(fd<0){ fprintf(stderr,"no server metrics (%s): %s\n",METRICS_SHM_NAME,strerror(errno)); return NULL; }
+    struct stat st; const arith_metrics_t *m=MAP_FAILED;
+    if(fstat(fd,&st)==0 && (size_t)st.st_size>=sizeof(*m))
+        m=mmap(NULL,sizeof(*m),PROT_READ,MAP_SHARED,fd,0);
+    close(fd);
+    if(m==MAP_FAILED){ fprintf(stderr,"%s: cannot map it\n",METRICS_SHM_NAME); return NULL; }
+    if(m->magic!=METRICS_MAGIC || m->version!=METRICS_VERSION){
+        fprintf(stderr,"%s: not a metrics segment of this server version\n",METRICS_SHM_NAME);
+        munmap((void*)m,sizeof(*m)); return NULL;
+    }
+    return m;
+}
+
+static uint64_t total_requests(const snap_t *s){
+    uint64_t n=0;
+    for(int i=0;i<=ARITH_OP_COUNT;i++) n+=s->requests[i];
+    return n;
+}
+
+// Upper bound (ns) of the bucket holding percentile p
+static uint64_t percentile_ns(const hist_snap_t *h, double p){
+    if(!h->count) return 0;
+    uint64_t want=(uint64_t)(p/100.0*(double)h->count+0.5), seen=0;
+    if(want<1) want=1;
+    for(int i=0;i<METRICS_LAT_BUCKETS;i++){
+        seen+=h->bucket[i];
+        if(seen>=want) return UINT64_C(2)<<i;
+    }
+    return UINT64_C(2)<<(METRICS_LAT_BUCKETS-1);
+}
+
+// Difference of two snapshots (counters only; gauges are taken from `now`)
+static void snap_delta(const snap_t *now, const snap_t *prev, snap_t *d){
+    *d=*now;
+    for(int i=0;i<=ARITH_OP_COUNT;i++) d->requests[i]-=prev->requests[i];
+    for(int k=0;k<STAGE_COUNT;k++){
+        d->stage[k].count-=prev->stage[k].count; d->stage[k].sum_ns-=prev->stage[k].sum_ns;
+        for(int i=0;i<METRICS_LAT_BUCKETS;i++) d->stage[k].bucket[i]-=prev->stage[k].bucket[i];
+    }
+}
+
+// Human-readable report. `lat` holds the latency to show: everything since
+// startup, or only the last interval when watching (then `rate` is its
+// request rate, else negative).
+static void print_text(const arith_metrics_t *m, const snap_t *s, const snap_t *lat, double rate){
+    long up=(long)(time(NULL)-m->started);
+    bool alive= kill(m->server_pid,0)==0 || errno==EPERM;
+    printf("arith server PID %d%s: %s, %d shards, up %ldh%02ldm%02lds\n", (int)m->server_pid,
+           alive ? "" : " (not running)", m->executor, (int)m->shards, up/3600, up/60%60, up%60);
+    printf("requests   %llu computed, %llu batch frames", (unsigned long long)total_requests(s), (unsigned long long)s->batches);
+    if(rate>=0) printf(", %.0f/s", rate);
+    printf("\n          ");
+    for(int i=0;i<ARITH_OP_COUNT;i++) printf(" %s %llu", arith_ops[i].name, (unsigned long long)s->requests[i]);
+    if(s->requests[ARITH_OP_COUNT]) printf("  unknown %llu", (unsigned long long)s->requests[ARITH_OP_COUNT]);
+    if(s->exprs) printf("\nexprs      %llu evaluated, %llu compiled", (unsigned long long)s->exprs, (unsigned long long)s->expr_compiles);
+    if(s->arrays) printf("\narrays     %llu operations over %llu elements", (unsigned long long)s->arrays, (unsigned long long)s->array_elems);
+    printf("\nanswers   ");
+    for(int i=0;i<ARITH_STATUS_COUNT;i++) printf(" %s %llu%s", arith_status_str(i), (unsigned long long)s->status[i], i+1<ARITH_STATUS_COUNT ? "," : "");
+    printf("\nerrors     partial request %llu, bad frame %llu, open failed %llu, write failed %llu\n",
+           (unsigned long long)s->partial, (unsigned long long)s->bad_frames,
+           (unsigned long long)s->open_failed, (unsigned long long)s->write_failed);
+    printf("admission  %d computing, %d queued (max %d), %llu admitted, busy %llu (queue) %llu (client cap)\n",
+           s->running, s->queued, s->queued_max, (unsigned long long)s->admitted,
+           (unsigned long long)s->busy_full, (unsigned long long)s->busy_client);
+    printf("sessions   %llu hellos, %llu attaches, %d shm channels, %llu socket accepts, %d sockets open\n",
+           (unsigned long long)s->hellos, (unsigned long long)s->attaches, s->shm_channels,
+           (unsigned long long)s->accepts, s->sock_conns);
+    if(m->cache_entries){
+        uint64_t looked=s->cache_hits+s->cache_misses;
+        printf("cache      %llu hits, %llu misses (%.1f%% hit), %llu evictions, %llu entries for",
+               (unsigned long long)s->cache_hits, (unsigned long long)s->cache_misses,
+               looked ? 100.0*(double)s->cache_hits/(double)looked : 0.0,
+               (unsigned long long)s->cache_evictions, (unsigned long long)m->cache_entries);
+        for(int i=0;i<ARITH_OP_COUNT;i++) if(m->cache_ops>>i&1) printf(" %s", arith_ops[i].name);
+        printf("\n");
+    }
+    printf("latency%s (us, percentiles to within 2x)\n", rate>=0 ? " this interval" : "");
+    printf("  %-8s %12s %10s %10s %10s %10s\n", "stage", "count", "mean", "p50<=", "p99<=", "p99.9<=");
+    for(int k=0;k<STAGE_COUNT;k++){
+        const hist_snap_t *h=&lat->stage[k];
+        printf("  %-8s %12llu %10.1f %10.1f %10.1f %10.1f\n", metrics_stage_names[k], (unsigned long long)h->count,
+               h->count ? (double)h->sum_ns/(double)h->count/1e3 : 0.0,
+               (double)percentile_ns(h,50)/1e3, (double)percentile_ns(h,99)/1e3, (double)percentile_ns(h,99.9)/1e3);
+    }
+}
+
+static void prom_header(const char *name, const char *type, const char *help){
+    printf("# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+// Prometheus text exposition format (version 0.0.4)
+static void print_prometheus(const arith_metrics_t *m, const snap_t *s){
+    prom_header("arith_start_time_seconds","gauge","Server start time (Unix seconds).");
+    printf("arith_start_time_seconds{executor=\"%s\"} %lld\n", m->executor, (long long)m->started);
+    prom_header("arith_requests_total","counter","Calls computed, by operation (batch tuples included).");
+    for(int i=0;i<ARITH_OP_COUNT;i++) printf("arith_requests_total{op=\"%s\"} %llu\n", arith_ops[i].name, (unsigned long long)s->requests[i]);
+    printf("arith_requests_total{op=\"unknown\"} %llu\n", (unsigned long long)s->requests[ARITH_OP_COUNT]);
+    prom_header("arith_batches_total","counter","Batch frames received.");
+    printf("arith_batches_total %llu\n", (unsigned long long)s->batches);
+    prom_header("arith_expressions_total","counter","Expression frames evaluated.");
+    printf("arith_expressions_total %llu\n", (unsigned long long)s->exprs);
+    prom_header("arith_expression_compiles_total","counter","Expression frames compiled (not in their handler's program cache).");
+    printf("arith_expression_compiles_total %llu\n", (unsigned long long)s->expr_compiles);
+    prom_header("arith_array_ops_total","counter","Array operations computed.");
+    printf("arith_array_ops_total %llu\n", (unsigned long long)s->arrays);
+    prom_header("arith_array_elements_total","counter","Elements covered by array operations.");
+    printf("arith_array_elements_total %llu\n", (unsigned long long)s->array_elems);
+    prom_header("arith_answers_total","counter","Answers sent, by status.");
+    for(int i=0;i<ARITH_STATUS_COUNT;i++) printf("arith_answers_total{status=\"%s\"} %llu\n", status_labels[i], (unsigned long long)s->status[i]);
+    prom_header("arith_errors_total","counter","Failed requests, by cause.");
+    printf("arith_errors_total{type=\"divide_by_zero\"} %llu\n", (unsigned long long)s->status[ARITH_EDIVZERO]);
+    printf("arith_errors_total{type=\"invalid_op\"} %llu\n", (unsigned long long)s->status[ARITH_EINVALOP]);
+    printf("arith_errors_total{type=\"partial_request\"} %llu\n", (unsigned long long)s->partial);
+    printf("arith_errors_total{type=\"bad_frame\"} %llu\n", (unsigned long long)s->bad_frames);
+    printf("arith_errors_total{type=\"open_failed\"} %llu\n", (unsigned long long)s->open_failed);
+    printf("arith_errors_total{type=\"write_failed\"} %llu\n", (unsigned long long)s->write_failed);
+    prom_header("arith_inflight","gauge","Requests being computed.");
+    printf("arith_inflight %d\n", s->running);
+    prom_header("arith_queue_depth","gauge","Admitted requests waiting for a child, worker or thread.");
+    printf("arith_queue_depth %d\n", s->queued);
+    prom_header("arith_queue_depth_max","gauge","High-water mark of arith_queue_depth.");
+    printf("arith_queue_depth_max %d\n", s->queued_max);
+    prom_header("arith_admitted_total","counter","Requests admitted.");
+    printf("arith_admitted_total %llu\n", (unsigned long long)s->admitted);
+    prom_header("arith_busy_total","counter","Requests answered 'Server busy', by cause.");
+    printf("arith_busy_total{cause=\"queue\"} %llu\n", (unsigned long long)s->busy_full);
+    printf("arith_busy_total{cause=\"client_cap\"} %llu\n", (unsigned long long)s->busy_client);
+    prom_header("arith_sessions_total","counter","Sessions registered (hello), shm channels attached and sockets accepted.");
+    printf("arith_sessions_total{kind=\"hello\"} %llu\n", (unsigned long long)s->hellos);
+    printf("arith_sessions_total{kind=\"attach\"} %llu\n", (unsigned long long)s->attaches);
+    printf("arith_sessions_total{kind=\"accept\"} %llu\n", (unsigned long long)s->accepts);
+    prom_header("arith_shm_channels","gauge","Attached shm channels.");
+    printf("arith_shm_channels %d\n", s->shm_channels);
+    prom_header("arith_sock_conns","gauge","Open socket connections.");
+    printf("arith_sock_conns %d\n", s->sock_conns);
+    if(m->cache_entries){
+        prom_header("arith_cache_lookups_total","counter","Result cache lookups, by outcome.");
+        printf("arith_cache_lookups_total{result=\"hit\"} %llu\n", (unsigned long long)s->cache_hits);
+        printf("arith_cache_lookups_total{result=\"miss\"} %llu\n", (unsigned long long)s->cache_misses);
+        prom_header("arith_cache_evictions_total","counter","Result cache entries replaced by newer ones.");
+        printf("arith_cache_evictions_total %llu\n", (unsigned long long)s->cache_evictions);
+        prom_header("arith_cache_entries","gauge","Result cache capacity.");
+        printf("arith_cache_entries %llu\n", (unsigned long long)m->cache_entries);
+    }
+    prom_header("arith_stage_latency_seconds","histogram","Time per request stage: queue (recv to compute), compute, open, write, total.");
+    for(int k=0;k<STAGE_COUNT;k++){
+        const hist_snap_t *h=&s->stage[k];
+        uint64_t cum=0;
+        for(int i=0;i<METRICS_LAT_BUCKETS-1;i++){
+            cum+=h->bucket[i];
+            printf("arith_stage_latency_seconds_bucket{stage=\"%s\",le=\"%.9g\"} %llu\n",
+                   metrics_stage_names[k], (double)(UINT64_C(2)<<i)/1e9, (unsigned long long)cum);
+        }
+        printf("arith_stage_latency_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %llu\n", metrics_stage_names[k], (unsigned long long)h->count);
+        printf("arith_stage_latency_seconds_sum{stage=\"%s\"} %.9f\n", metrics_stage_names[k], (double)h->sum_ns/1e9);
+        printf("arith_stage_latency_seconds_count{stage=\"%s\"} %llu\n", metrics_stage_names[k], (unsigned long long)h->count);
+    }
+}
+
+int metrics_report(bool watch, int interval, bool prometheus){
+    const arith_metrics_t *m=attach();
+    if(!m) return 1;
+    bool clear= watch && !prometheus && isatty(STDOUT_FILENO);
+    snap_t prev, now, d;
+    snapshot(m,&prev);
+    if(!watch){
+        if(prometheus) print_prometheus(m,&prev); else print_text(m,&prev,&prev,-1);
+        return 0;
+    }
+    for(;;){
+        sleep((unsigned)interval);
+        snapshot(m,&now);
+        if(prometheus) print_prometheus(m,&now);
+        else {
+            snap_delta(&now,&prev,&d);
+            if(clear) printf("\033[H\033[J");
+            print_text(m,&now,&d,(double)total_requests(&d)/interval);
+            if(!clear) printf("\n");
+        }
+        fflush(stdout);
+        prev=now;
+        if(kill(m->server_pid,0)<0 && errno==ESRCH){ fprintf(stderr,"server PID %d exited\n",(int)m->server_pid); return 0; }
+    }
+}
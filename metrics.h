@@ -0,0 +1,108 @@
+// metrics.h
+// Server metrics published in a named shared-memory segment. The server maps
+// it before forking anything, so children, workers and threads all update
+// the same counters with relaxed atomic adds (no locks, no system calls on
+// the hot path). `server --stats` maps it read-only from another process and
+// reports it, in text or in the Prometheus exposition format; the server
+// never does any work for a reader.
+
+#ifndef ARITH_METRICS_H
+#define ARITH_METRICS_H
+
+#include <stdbool.h>    // bool
+#include <stdint.h>     // uint64_t
+#include <stdatomic.h>  // atomic_ullong
+#include <time.h>       // clock_gettime
+
+#include "proto.h"      // ARITH_OP_COUNT, ARITH_STATUS_COUNT
+
+#define METRICS_SHM_NAME "/arith_metrics"
+#define METRICS_MAGIC    0x4d545241u // "ARTM"
+#define METRICS_VERSION  5
+
+// Latency histogram: bucket i counts values in [2^i, 2^(i+1)) ns (0 lands in
+// bucket 0), so percentiles are known to within a factor of two
+#define METRICS_LAT_BUCKETS 40 // up to 2^40 ns, about 18 minutes
+typedef struct {
+    atomic_ullong count, sum_ns;
+    atomic_ullong bucket[METRICS_LAT_BUCKETS];
+} metrics_hist_t;
+
+// Where a request spends its time, from the reader decoding it to the last
+// byte of its answer written (STAGE_TOTAL spans them all)
+enum metrics_stage {
+    STAGE_QUEUE,    // recv -> compute: queued for a child / worker / thread
+    STAGE_COMPUTE,  // compute
+    STAGE_OPEN,     // response-open (a cache hit costs nothing)
+    STAGE_WRITE,    // write
+    STAGE_TOTAL,
+    STAGE_COUNT
+};
+static const char *const metrics_stage_names[STAGE_COUNT] = { "queue", "compute", "open", "write", "total" };
+
+// Admission control (server.c): gauges and counters, plus the per-client
+// charges it enforces --client-cap with
+#define ADMIT_BUCKETS 4096 // per-client counts by PID hash (PIDs sharing a bucket share its cap)
+typedef struct {
+    atomic_int    running;      // requests being computed (fork mode: children alive)
+    atomic_int    queued;       // admitted, waiting for a child / worker / thread
+    atomic_int    queued_max;   // high-water mark of queued
+    atomic_ullong admitted;     // requests let in
+    atomic_ullong busy_full;    // turned away: queue full or fork() failed
+    atomic_ullong busy_client;  // turned away: client at --client-cap
+    atomic_ushort client[ADMIT_BUCKETS]; // admitted and unanswered, per client
+} admit_t;
+
+typedef struct {
+    uint32_t magic, version;     // METRICS_MAGIC, METRICS_VERSION (set last)
+    int32_t  server_pid;
+    int32_t  shards;             // --shards N
+    int64_t  started;            // time(NULL) at startup
+    char     executor[24];       // "fork", "workers 4", ...
+    atomic_ullong requests[ARITH_OP_COUNT+1]; // calls by opcode ([ARITH_OP_COUNT]: unknown), batch tuples included
+    atomic_ullong batches;       // batch frames
+    atomic_ullong exprs, expr_compiles; // expression frames, and those not in their handler's cache
+    atomic_ullong arrays, array_elems; // array operations and the elements they covered
+    atomic_ullong status[ARITH_STATUS_COUNT]; // answers by status
+    atomic_ullong partial;       // partial requests dropped when their writer went away
+    atomic_ullong bad_frames;    // unknown types, bad lengths, unknown sessions
+    atomic_ullong open_failed;   // response FIFO could not be opened
+    atomic_ullong write_failed;  // response could not be written
+    atomic_ullong hellos, attaches;
+    atomic_ullong accepts;       // socket connections accepted
+    uint64_t      cache_entries; // --cache: result cache size (0 => no cache)
+    uint32_t      cache_ops;     // --cache: opcodes looked up (bit per enum arith_op)
+    atomic_ullong cache_hits, cache_misses, cache_evictions;
+    atomic_int    shm_channels;  // attached shm channels
+    atomic_int    sock_conns;    // open socket connections
+    admit_t       admit;
+    metrics_hist_t stage[STAGE_COUNT];
+} arith_metrics_t;
+
+static inline uint64_t metrics_now(void){
+    struct timespec ts; clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (uint64_t)ts.tv_sec*1000000000u+(uint64_t)ts.tv_nsec;
+}
+
+static inline void metrics_inc(atomic_ullong *c){ atomic_fetch_add_explicit(c,1,memory_order_relaxed); }
+
+static inline void metrics_observe(metrics_hist_t *h, uint64_t ns){
+    unsigned i= ns ? 63u-(unsigned)__builtin_clzll(ns) : 0;
+    if(i>=METRICS_LAT_BUCKETS) i=METRICS_LAT_BUCKETS-1;
+    atomic_fetch_add_explicit(&h->bucket[i],1,memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->sum_ns,ns,memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->count,1,memory_order_relaxed);
+}
+
+// Server: create (or replace) the segment; never NULL (falls back to
+// private shared memory nobody else can read, and says so in *published)
+arith_metrics_t *metrics_create(const char *executor, int shards, bool *published);
+// Server: remove the segment's name (the mapping stays valid)
+void metrics_unlink(void);
+
+// server --stats: print the server's metrics once, or every `interval`
+// seconds with `watch`; `prometheus` selects the exposition format.
+// Returns the process exit status.
+int metrics_report(bool watch, int interval, bool prometheus);
+
+#endif // ARITH_METRICS_H
@@ -0,0 +1,68 @@
+// ops.h
+// Operation registry shared by server.c, client.c and compute.c. Every
+// operation is one line of ARITH_OP_LIST; the dense opcode enum, the name
+// table and the metadata below are all generated from it, as are the jump
+// tables in compute.c. Adding an operation is one line here plus its scalar
+// function (and optionally a vector kernel) in compute.c.
+//
+// Opcodes are wire values (v2 requests and batch tuples): append new
+// operations at the end, never reorder.
+
+#ifndef ARITH_OPS_H
+#define ARITH_OPS_H
+
+#include <stdbool.h>    // bool
+#include <stdint.h>     // uint8_t
+#include <string.h>     // strcmp
+
+// X(ID, name, arity, vector), in opcode order:
+//   name    wire name, at most OP_MAX (4) characters so v1 requests carry it
+//   arity   operands the operation reads (v1/v2 frames always carry two)
+//   vector  true if batches run it over whole arrays (it cannot fail per
+//           element); otherwise every tuple is evaluated with its own status
+#define ARITH_OP_LIST(X)      \
+    X(ADD,  add,  2, true)    \
+    X(SUB,  sub,  2, true)    \
+    X(MUL,  mul,  2, true)    \
+    X(DIV,  div,  2, false)   \
+    X(MOD,  mod,  2, false)   \
+    X(POW,  pow,  2, false)   \
+    X(MIN,  min,  2, true)    \
+    X(MAX,  max,  2, true)    \
+    X(CADD, cadd, 2, false)   \
+    X(CMUL, cmul, 2, false)
+
+// Dense opcodes carried by v2 requests
+enum arith_op {
+#define ARITH_OP_ENUM(id, name, arity, vector) ARITH_OP_##id,
+    ARITH_OP_LIST(ARITH_OP_ENUM)
+#undef ARITH_OP_ENUM
+    ARITH_OP_COUNT,
+    ARITH_OP_INVALID = 0xFF
+};
+
+// Per-operation metadata, indexed by enum arith_op
+typedef struct {
+    const char *name;      // wire name ("add", ...)
+    uint8_t     arity;     // operands read
+    bool        vector;    // batch kernel over whole arrays
+} arith_op_info_t;
+
+static const arith_op_info_t arith_ops[ARITH_OP_COUNT] = {
+#define ARITH_OP_INFO(id, name, arity, vector) { #name, arity, vector },
+    ARITH_OP_LIST(ARITH_OP_INFO)
+#undef ARITH_OP_INFO
+};
+
+#define ARITH_OP_NAME_CHECK(id, name, arity, vector) \
+    _Static_assert(sizeof(#name)-1<=4, "operation name fits a v1 request: " #name);
+ARITH_OP_LIST(ARITH_OP_NAME_CHECK)
+#undef ARITH_OP_NAME_CHECK
+
+// Map an operation name to its opcode (ARITH_OP_INVALID if unknown)
+static inline uint8_t arith_op_from_name(const char *name){
+    for(int i=0;i<ARITH_OP_COUNT;i++) if(!strcmp(name,arith_ops[i].name)) return (uint8_t)i;
+    return ARITH_OP_INVALID;
+}
+
+#endif // ARITH_OPS_H
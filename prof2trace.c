@@ -0,0 +1,143 @@
+// prof2trace.c
+// Convert the trace file of a profiling build (profile.h) for viewing:
+//   prof2trace [FILE]           Chrome trace JSON (chrome://tracing, Perfetto)
+//   prof2trace --folded [FILE]  folded stacks for flamegraph.pl: one line
+//                               "server;request;compute <self ns>" per stack
+// FILE defaults to arith.prof. A process is labelled "server" if it has
+// server-only stages (dispatch, request, compute, fork, log_line), else
+// "client"; stages nest by time within each thread.
+
+#define _GNU_SOURCE
+#include <stdio.h>      // FILE, printf
+#include <stdlib.h>     // malloc, realloc, qsort
+#include <stdbool.h>    // bool
+#include <string.h>     // strcmp, strlen
+
+#include "profile.h"
+
+#define MAX_DEPTH 16
+
+static prof_rec_t *recs = NULL;
+static size_t      n_recs = 0;
+
+static int by_thread_time(const void *x, const void *y){
+    const prof_rec_t *a=x, *b=y;
+    if(a->pid!=b->pid) return a->pid<b->pid ? -1 : 1;
+    if(a->tid!=b->tid) return a->tid<b->tid ? -1 : 1;
+    if(a->t0_ns!=b->t0_ns) return a->t0_ns<b->t0_ns ? -1 : 1;
+    return a->dur_ns>b->dur_ns ? -1 : a->dur_ns<b->dur_ns; // enclosing bracket first
+}
+
+// Whether the process of recs[first] is a client (records are sorted by pid)
+static bool is_client(size_t first){
+    for(size_t i=first;i<n_recs && recs[i].pid==recs[first].pid;i++){
+        switch(recs[i].stage){
+        case PROF_DISPATCH: case PROF_REQUEST: case PROF_COMPUTE: case PROF_FORK: case PROF_LOG: return false;
+        default: break;
+        }
+    }
+    return true;
+}
+
+static int load(const char *path){
+    FILE *f=fopen(path,"rb");
+    if(!f){ perror(path); return -1; }
+    size_t cap=0; prof_rec_t r; unsigned long long bad=0;
+    while(fread(&r,sizeof(r),1,f)==1){
+        if(r.magic!=PROF_MAGIC || r.stage>=PROF_STAGE_COUNT){ bad++; continue; }
+        if(n_recs==cap){
+            cap= cap ? cap*2 : 4096;
+            prof_rec_t *p=realloc(recs,cap*sizeof(*recs));
+            if(!p){ perror("realloc"); fclose(f); return -1; }
+            recs=p;
+        }
+        recs[n_recs++]=r;
+    }
+    fclose(f);
+    if(bad) fprintf(stderr,"%s: %llu bad records skipped\n",path,bad);
+    qsort(recs,n_recs,sizeof(*recs),by_thread_time);
+    return 0;
+}
+
+static void write_chrome(void){
+    uint64_t base=UINT64_MAX;
+    for(size_t i=0;i<n_recs;i++) if(recs[i].t0_ns<base) base=recs[i].t0_ns;
+    printf("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    const char *sep="";
+    for(size_t i=0;i<n_recs;i++){
+        const prof_rec_t *r=&recs[i];
+        if(i==0 || r->pid!=recs[i-1].pid){
+            printf("%s{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"%s %d\"}}",
+                   sep, (int)r->pid, is_client(i) ? "client" : "server", (int)r->pid);
+            sep=",\n";
+        }
+        printf("%s{\"name\":\"%s\",\"cat\":\"arith\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d}",
+               sep, prof_stage_names[r->stage], (double)(r->t0_ns-base)/1e3, (double)r->dur_ns/1e3, (int)r->pid, (int)r->tid);
+        sep=",\n";
+    }
+    printf("\n]}\n");
+}
+
+// Folded stacks, summed over every process of the same kind
+typedef struct { char *stack; uint64_t ns; } folded_t;
+static folded_t *folds = NULL;
+static size_t    n_folds = 0, cap_folds = 0;
+
+static void fold_add(const char *stack, uint64_t ns){
+    for(size_t i=0;i<n_folds;i++) if(!strcmp(folds[i].stack,stack)){ folds[i].ns+=ns; return; }
+    if(n_folds==cap_folds){
+        cap_folds= cap_folds ? cap_folds*2 : 64;
+        folded_t *p=realloc(folds,cap_folds*sizeof(*folds));
+        if(!p){ perror("realloc"); exit(1); }
+        folds=p;
+    }
+    size_t len=strlen(stack)+1;
+    folds[n_folds].stack=malloc(len);
+    if(!folds[n_folds].stack){ perror("malloc"); exit(1); }
+    memcpy(folds[n_folds].stack,stack,len);
+    folds[n_folds++].ns=ns;
+}
+
+typedef struct { const prof_rec_t *r; uint64_t children_ns; } frame_t;
+
+// Pop the innermost open bracket and account its self time
+static void fold_pop(const char *root, frame_t *st, int *depth){
+    char stack[MAX_DEPTH*16+32];
+    int n=snprintf(stack,sizeof(stack),"%s",root);
+    for(int i=0;i<*depth;i++) n+=snprintf(stack+n,sizeof(stack)-(size_t)n,";%s",prof_stage_names[st[i].r->stage]);
+    const frame_t *f=&st[*depth-1];
+    fold_add(stack, f->r->dur_ns>f->children_ns ? f->r->dur_ns-f->children_ns : 0);
+    (*depth)--;
+}
+
+static void write_folded(void){
+    frame_t st[MAX_DEPTH]; int depth=0;
+    const char *root="server";
+    for(size_t i=0;i<n_recs;i++){
+        const prof_rec_t *r=&recs[i];
+        bool new_thread= i==0 || r->pid!=recs[i-1].pid || r->tid!=recs[i-1].tid;
+        if(new_thread){
+            while(depth) fold_pop(root,st,&depth);
+            if(i==0 || r->pid!=recs[i-1].pid) root= is_client(i) ? "client" : "server";
+        }
+        // Close the brackets this one is not inside of
+        while(depth && r->t0_ns+r->dur_ns > st[depth-1].r->t0_ns+st[depth-1].r->dur_ns) fold_pop(root,st,&depth);
+        if(depth==MAX_DEPTH) fold_pop(root,st,&depth);
+        if(depth) st[depth-1].children_ns+=r->dur_ns;
+        st[depth].r=r; st[depth].children_ns=0; depth++;
+    }
+    while(depth) fold_pop(root,st,&depth);
+    for(size_t i=0;i<n_folds;i++) printf("%s %llu\n", folds[i].stack, (unsigned long long)folds[i].ns);
+}
+
+int main(int argc, char **argv){
+    bool folded=false; const char *path="arith.prof";
+    for(int i=1;i<argc;i++){
+        if(!strcmp(argv[i],"--folded")) folded=true;
+        else if(argv[i][0]=='-'){ fprintf(stderr,"usage: %s [--folded] [FILE]\n",argv[0]); return 2; }
+        else path=argv[i];
+    }
+    if(load(path)<0) return 1;
+    if(folded) write_folded(); else write_chrome();
+    return 0;
+}
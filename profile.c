@@ -0,0 +1,53 @@
+// profile.c
+// Trace buffers of profiling builds (see profile.h); empty otherwise.
+
+#ifdef ARITH_PROFILE
+#define _GNU_SOURCE
+#include <stdlib.h>     // getenv, atexit
+#include <stdbool.h>    // bool
+#include <unistd.h>     // write, getpid, gettid
+#include <fcntl.h>      // open flags
+#include <pthread.h>    // pthread_once, pthread_key_create, pthread_atfork
+
+#include "profile.h"
+
+#define PROF_BUF 128 // records per thread between writes (4 KiB)
+
+static _Thread_local prof_rec_t buf[PROF_BUF];
+static _Thread_local unsigned   n_buf;
+static _Thread_local bool       registered; // thread-exit flush armed
+static int            prof_fd = -1;
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static pthread_key_t  key;
+
+static void flush_at_thread_exit(void *unused){ (void)unused; prof_flush(); }
+
+// A fork()ed child starts with the parent's unwritten records: drop them
+static void drop_inherited(void){ n_buf=0; }
+
+static void prof_init(void){
+    const char *path=getenv("ARITH_PROF_FILE");
+    prof_fd=open(path ? path : "arith.prof",O_WRONLY|O_CREAT|O_APPEND|O_CLOEXEC,0644);
+    pthread_key_create(&key,flush_at_thread_exit);
+    pthread_atfork(NULL,NULL,drop_inherited);
+    atexit(prof_flush); // main thread
+}
+
+void prof_flush(void){
+    if(n_buf && prof_fd>=0 && write(prof_fd,buf,n_buf*sizeof(buf[0]))<0){} // best effort
+    n_buf=0;
+}
+
+void prof_record(enum prof_stage stage, uint64_t t0){
+    uint64_t t1=prof_now();
+    pthread_once(&once,prof_init);
+    if(!registered){ registered=true; pthread_setspecific(key,&registered); }
+    prof_rec_t *r=&buf[n_buf++];
+    r->t0_ns=t0; r->dur_ns=t1-t0;
+    r->pid=(int32_t)getpid(); r->tid=(int32_t)gettid();
+    r->stage=(uint16_t)stage; r->magic=PROF_MAGIC; r->pad=0;
+    if(n_buf==PROF_BUF) prof_flush();
+}
+#else
+typedef int prof_unused_t; // ISO C wants a translation unit to declare something
+#endif
@@ -0,0 +1,67 @@
+// profile.h
+// Stage timestamps for profiling builds (`make profile`, -DARITH_PROFILE).
+// Instrumented code brackets a stage with PROF_BEGIN(t) ... PROF_END(stage,t);
+// each bracket becomes one fixed-size record (start, duration, pid, tid,
+// stage) in a per-thread buffer, appended to one binary trace file
+// ($ARITH_PROF_FILE, default arith.prof) with a single write(2) when the
+// buffer fills up and when its thread or process ends. O_APPEND keeps the
+// records of the server, its children and every client whole in that one
+// file, and CLOCK_MONOTONIC puts them all on one timeline. prof2trace turns
+// the file into a Chrome trace or folded stacks for a flame graph. Without
+// ARITH_PROFILE the macros compile to nothing.
+
+#ifndef ARITH_PROFILE_H
+#define ARITH_PROFILE_H
+
+#include <stdint.h>     // uint64_t
+#include <time.h>       // clock_gettime
+
+// What a record times; brackets nest (a request contains its compute, ...)
+enum prof_stage {
+    PROF_READ,      // request intake (server readv) / answer read (client)
+    PROF_LOG,       // log_line()
+    PROF_PRINT,     // trace line or answer printed
+    PROF_FORK,      // fork() of a request child (parent side)
+    PROF_COMPUTE,   // compute
+    PROF_OPEN,      // response FIFO open (or fd cache lookup)
+    PROF_WRITE,     // response write (server) / request write (client)
+    PROF_DISPATCH,  // reader: one decoded request handed to the executor
+    PROF_REQUEST,   // handler: one request from compute to its answer written
+    PROF_CALL,      // client: one arith_call() round trip
+    PROF_STAGE_COUNT
+};
+static const char *const prof_stage_names[PROF_STAGE_COUNT] = {
+    "read", "log_line", "print", "fork", "compute", "open", "write", "dispatch", "request", "call",
+};
+
+#define PROF_MAGIC 0xa7f1u
+typedef struct {
+    uint64_t t0_ns;     // CLOCK_MONOTONIC at PROF_BEGIN
+    uint64_t dur_ns;
+    int32_t  pid, tid;
+    uint16_t stage;     // enum prof_stage
+    uint16_t magic;     // PROF_MAGIC
+    uint32_t pad;
+} prof_rec_t;           // 32 bytes, the file is an array of them
+
+static inline uint64_t prof_now(void){
+    struct timespec ts; clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (uint64_t)ts.tv_sec*1000000000u+(uint64_t)ts.tv_nsec;
+}
+
+#ifdef ARITH_PROFILE
+// Record [t0, now) as `stage` for the calling thread
+void prof_record(enum prof_stage stage, uint64_t t0);
+// Write out the calling thread's buffer (before _exit(); threads, the main
+// thread at exit() and fork() children are handled automatically)
+void prof_flush(void);
+#define PROF_BEGIN(t)     uint64_t t=prof_now()
+#define PROF_END(stage,t) prof_record((stage),(t))
+#define PROF_FLUSH()      prof_flush()
+#else
+#define PROF_BEGIN(t)     ((void)0)
+#define PROF_END(stage,t) ((void)0)
+#define PROF_FLUSH()      ((void)0)
+#endif
+
+#endif // ARITH_PROFILE_H
@@ -0,0 +1,285 @@
+// proto.h
+// Wire protocol shared by server.c and client.c.
+//
+// v1: one fixed 152-byte request_msg_t per call carrying the response FIFO
+//     path, answered by a 140-byte response_msg_t with an error string.
+// v2: the client registers its response FIFO once with a hello frame and gets
+//     a small session id back; after that a call is a 24-byte v2_request_t
+//     answered by a 16-byte v2_response_t with a numeric status. A batch
+//     frame carries up to ARITH_BATCH_MAX (op, a, b) tuples in one write and
+//     is answered by one frame of per-element results.
+//     An attach frame (same layout as a hello) instead names a shared-memory
+//     segment the client created (shmchan.h); calls then travel through rings
+//     in that segment and never touch the FIFOs.
+//     An array frame (socket transport only) passes whole int64 arrays as
+//     memfds attached to the message; the server computes over them in place.
+//     A big-integer frame carries two arbitrary-precision operands (up to
+//     ARITH_BIG_LIMBS_MAX 64-bit limbs each) and is answered by a frame
+//     holding the exact result (FIFO and socket transports).
+//     An expression frame carries a small postfix program over the registry's
+//     operations and its arguments; the server evaluates all of it and
+//     answers with the final value, one round trip for a chain of dependent
+//     calls (FIFO and socket transports).
+//
+// Both versions share the well-known request FIFO (and its shards). A v1 request starts with
+// its ASCII operation name, every v2 frame starts with a type byte >= 0x80,
+// so the server tells them apart from the first byte.
+
+#ifndef ARITH_PROTO_H
+#define ARITH_PROTO_H
+
+#include <stdint.h>     // int64_t, int32_t, uint*_t
+#include <sys/types.h>  // pid_t
+
+#include "ops.h"        // enum arith_op, arith_ops[]: the operation registry
+
+// Path for the server's well-known request FIFO
+#define REQ_FIFO_PATH "/tmp/arith_req_fifo"
+// With server --shards N: request FIFOs REQ_FIFO_PATH ".0" to ".N-1" (same
+// protocol, any of them reaches the same server) and a text file holding N,
+// so clients can spread themselves over the shards
+#define REQ_SHARD_FMT   REQ_FIFO_PATH ".%d"
+#define REQ_SHARDS_PATH REQ_FIFO_PATH ".shards"
+#define REQ_SHARDS_MAX  64
+// Maximum sizes used in request/response structures
+#define RESP_NAME_MAX 128
+#define OP_MAX 4
+
+// ---- v1 ----
+
+// Request message the client writes into REQ_FIFO_PATH
+typedef struct __attribute__((packed)) {
+    char   operation[OP_MAX];         // arith_ops[].name (not NUL-terminated necessarily)
+    int64_t operand1;                // first operand
+    int64_t operand2;                // second operand
+    pid_t  client_pid;               // client's PID (informational)
+    char   resp_fifo[RESP_NAME_MAX]; // path to client's response FIFO
+} request_msg_t;
+
+// Response message server writes back to client's FIFO
+typedef struct __attribute__((packed)) {
+    int64_t result;                  // arithmetic result
+    int32_t success;                 // 1 => ok, 0 => error
+    char    error[128];              // error message if success==0
+} response_msg_t;
+
+// ---- v2 ----
+
+#define ARITH_PROTO_VERSION 2
+
+// Frame type: first byte of every v2 frame (never a v1 operation character)
+enum arith_frame {
+    ARITH_FRAME_HELLO  = 0xA1, // v2_hello_t + path: register a response FIFO
+    ARITH_FRAME_CALL   = 0xA2, // v2_request_t: one operation
+    ARITH_FRAME_BATCH  = 0xA3, // v2_batch_hdr_t + count v2_batch_item_t
+    ARITH_FRAME_ATTACH = 0xA4, // v2_hello_t + shm name: serve a shm channel
+    ARITH_FRAME_ARRAY  = 0xA5, // v2_array_t + memfds (SCM_RIGHTS): array operation
+    ARITH_FRAME_BIG    = 0xA6, // v2_big_hdr_t + limbs: big-integer operation
+    ARITH_FRAME_EXPR   = 0xA7, // v2_expr_hdr_t + program + arguments: expression
+};
+
+// Status codes carried by v2 responses
+enum arith_status {
+    ARITH_OK = 0,
+    ARITH_EDIVZERO,   // divide by zero
+    ARITH_EINVALOP,   // unknown opcode
+    ARITH_ENOSESSION, // hello: no free session slot
+    ARITH_EOVERFLOW,  // checked operation (cadd, cmul, pow) overflowed
+    ARITH_EBUSY,      // not admitted: server queue or the client's in-flight cap is full; retry later
+    ARITH_EBADARRAY,  // array frame: missing, unsealed or too short memfd, or misaligned offset
+    ARITH_EBADEXPR,   // expression frame: the program does not leave exactly one value
+    ARITH_STATUS_COUNT // number of codes (not a status)
+};
+
+// Scheduling class a client declares in its hello (server --fair): the
+// server's queue serves every high client before any normal one and every
+// normal one before any bulk one, and clients of one class fairly
+enum arith_class {
+    ARITH_CLASS_NORMAL = 0, // default (also v1 clients and older hellos)
+    ARITH_CLASS_HIGH,       // interactive: a few calls at a time
+    ARITH_CLASS_BULK,       // batch backlogs: only what the others leave
+    ARITH_CLASS_COUNT
+};
+
+// Registration: header followed by path_len bytes of FIFO path (no NUL).
+// Answered with a v2_response_t whose result is the session id. An attach
+// frame carries a shm segment name instead and is answered in the segment.
+// On a socket a hello has no path and no answer: it only declares the class.
+typedef struct __attribute__((packed)) {
+    uint8_t  type;        // ARITH_FRAME_HELLO or ARITH_FRAME_ATTACH
+    uint8_t  version;     // ARITH_PROTO_VERSION
+    uint8_t  path_len;    // bytes of path that follow (< RESP_NAME_MAX)
+    uint8_t  sched_class; // enum arith_class (hello only; 0 from clients that predate it)
+    int32_t  client_pid;  // client's PID
+    uint32_t req_id;      // echoed in the ack
+} v2_hello_t;
+
+// One operation on a registered session (24 bytes)
+typedef struct __attribute__((packed)) {
+    uint8_t  type;        // ARITH_FRAME_CALL
+    uint8_t  opcode;      // enum arith_op
+    uint16_t session;     // id returned by the hello ack
+    uint32_t req_id;      // echoed in the response
+    int64_t  a;           // first operand
+    int64_t  b;           // second operand
+} v2_request_t;
+
+// Answer to a hello or a call (16 bytes)
+typedef struct __attribute__((packed)) {
+    uint32_t req_id;      // request id being answered
+    int32_t  status;      // enum arith_status
+    int64_t  result;      // result (hello ack: session id)
+} v2_response_t;
+
+// Batch call: header followed by `count` tuples. Answered by a
+// v2_batch_resp_hdr_t followed by `count` v2_batch_result_t in tuple order.
+typedef struct __attribute__((packed)) {
+    uint8_t  type;        // ARITH_FRAME_BATCH
+    uint8_t  flags;       // reserved, 0
+    uint16_t session;     // id returned by the hello ack
+    uint32_t req_id;      // echoed in the response
+    uint16_t count;       // tuples that follow (1..ARITH_BATCH_MAX)
+} v2_batch_hdr_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t  opcode;      // enum arith_op
+    int64_t  a;           // first operand
+    int64_t  b;           // second operand
+} v2_batch_item_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t req_id;      // batch request id being answered
+    uint16_t count;       // results that follow
+} v2_batch_resp_hdr_t;
+
+typedef struct __attribute__((packed)) {
+    int32_t  status;      // enum arith_status for this tuple
+    int64_t  result;      // its result
+} v2_batch_result_t;
+
+// Array operation over the memfds attached to the frame, in order: a (sum),
+// a and b (dot), a, b and out (map). Each array is n int64_t at byte off[i]
+// (a multiple of 8) of its memfd, which must be sealed against shrinking
+// (F_SEAL_SHRINK) so it cannot be cut short under the server. Inputs are
+// mapped read-only, out read-write. Answered by a v2_response_t: sum and
+// dot give their (wrapping) result; map gives ARITH_OK with result n, or the
+// status of the first element that failed with its index as the result
+// (failed elements are 0, every other one is still computed).
+enum arith_array_kind {
+    ARITH_ARRAY_SUM,      // sum of a[i]
+    ARITH_ARRAY_DOT,      // sum of a[i]*b[i]
+    ARITH_ARRAY_MAP,      // out[i] = opcode(a[i], b[i])
+    ARITH_ARRAY_KINDS
+};
+
+// Arrays (and memfds) an operation of `kind` takes
+static inline unsigned arith_array_count(uint8_t kind){
+    return kind==ARITH_ARRAY_SUM ? 1 : kind==ARITH_ARRAY_DOT ? 2 : 3;
+}
+
+typedef struct __attribute__((packed)) {
+    uint8_t  type;        // ARITH_FRAME_ARRAY
+    uint8_t  kind;        // enum arith_array_kind
+    uint8_t  opcode;      // map: enum arith_op
+    uint8_t  flags;       // reserved, 0
+    uint32_t req_id;      // echoed in the response
+    uint64_t n;           // elements in each array
+    uint64_t off[3];      // byte offset of a, b, out in their memfd
+} v2_array_t;
+
+// Big-integer operation: header followed by na limbs of |a| then nb limbs
+// of |b|, each little-endian (least significant limb first) with no leading
+// zero limb; zero is no limbs. Answered by a v2_big_resp_hdr_t followed by
+// n limbs of |result| (none unless the status is ARITH_OK). Nothing wraps:
+// a result too large for one response frame is ARITH_EOVERFLOW.
+#define ARITH_BIG_NEG_A 0x01  // sign bits
+#define ARITH_BIG_NEG_B 0x02
+typedef struct __attribute__((packed)) {
+    uint8_t  type;        // ARITH_FRAME_BIG
+    uint8_t  opcode;      // enum arith_op
+    uint16_t session;     // id returned by the hello ack (0 on a socket)
+    uint32_t req_id;      // echoed in the response
+    uint8_t  sign;        // ARITH_BIG_NEG_A | ARITH_BIG_NEG_B
+    uint8_t  flags;       // reserved, 0
+    uint16_t na;          // limbs of a (0..ARITH_BIG_LIMBS_MAX)
+    uint16_t nb;          // limbs of b (0..ARITH_BIG_LIMBS_MAX)
+    uint16_t reserved;    // 0
+} v2_big_hdr_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t req_id;      // request id being answered
+    int32_t  status;      // enum arith_status
+    uint8_t  sign;        // ARITH_BIG_NEG_A: the result is negative
+    uint8_t  flags;       // reserved, 0
+    uint16_t n;           // limbs that follow (0..ARITH_BIG_RESULT_MAX)
+} v2_big_resp_hdr_t;
+
+// Expression: header followed by `len` instructions, then `nargs` int64_t
+// arguments. The program is postfix over a stack: every instruction pushes
+// one value, an operation first popping its operands (a below b). REF
+// pushes again what an earlier instruction pushed, so a subexpression used
+// twice is computed once and the program is a DAG rather than a tree. The
+// program must end with exactly one value on the stack. Answered by a
+// v2_response_t: ARITH_OK with that value, else the status of the first
+// operation that failed (ARITH_EINVALOP for an unknown code, ARITH_EBADEXPR
+// for a stack underflow, leftover values or an out-of-range arg or ref).
+enum arith_expr_code {
+    // 0 .. ARITH_OP_COUNT-1: enum arith_op (val unused)
+    ARITH_EXPR_ARG   = 0xF0, // push argument number val
+    ARITH_EXPR_CONST = 0xF1, // push val
+    ARITH_EXPR_REF   = 0xF2, // push the value instruction number val (< this one) pushed
+};
+#define ARITH_EXPR_MAX      128 // instructions per program
+#define ARITH_EXPR_ARGS_MAX 32  // arguments per call
+
+typedef struct __attribute__((packed)) {
+    uint8_t  code;        // enum arith_op or enum arith_expr_code
+    int64_t  val;         // its argument, constant or instruction number
+} v2_expr_insn_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t  type;        // ARITH_FRAME_EXPR
+    uint8_t  flags;       // reserved, 0
+    uint16_t session;     // id returned by the hello ack (0 on a socket)
+    uint32_t req_id;      // echoed in the response
+    uint8_t  len;         // instructions (1..ARITH_EXPR_MAX)
+    uint8_t  nargs;       // arguments (0..ARITH_EXPR_ARGS_MAX)
+    uint16_t reserved;    // 0
+} v2_expr_hdr_t;
+
+// Largest batch whose request and response frames both stay within PIPE_BUF
+// (4096 on Linux), so each is written atomically into a shared FIFO
+#define ARITH_PIPE_BUF  4096
+#define ARITH_BATCH_MAX ((ARITH_PIPE_BUF-sizeof(v2_batch_hdr_t))/sizeof(v2_batch_item_t))
+
+// Operand and result sizes that keep big-integer frames within PIPE_BUF too:
+// 240 limbs is 15360 bits (about 4600 decimal digits) per operand
+#define ARITH_BIG_LIMBS_MAX  240
+#define ARITH_BIG_RESULT_MAX ((ARITH_PIPE_BUF-sizeof(v2_big_resp_hdr_t))/sizeof(uint64_t))
+
+_Static_assert(sizeof(request_msg_t)==152, "v1 request layout");
+_Static_assert(sizeof(v2_request_t)==24, "v2 request layout");
+_Static_assert(sizeof(v2_response_t)==16, "v2 response layout");
+_Static_assert(sizeof(v2_array_t)==40, "array frame layout");
+_Static_assert(sizeof(v2_big_hdr_t)==16 && sizeof(v2_big_resp_hdr_t)==12, "big-integer frame layout");
+_Static_assert(sizeof(v2_big_hdr_t)+2*ARITH_BIG_LIMBS_MAX*sizeof(uint64_t)<=ARITH_PIPE_BUF, "big-integer request fits PIPE_BUF");
+_Static_assert(sizeof(v2_expr_hdr_t)==12 && sizeof(v2_expr_insn_t)==9, "expression frame layout");
+_Static_assert(sizeof(v2_expr_hdr_t)+ARITH_EXPR_MAX*sizeof(v2_expr_insn_t)+ARITH_EXPR_ARGS_MAX*sizeof(int64_t)<=ARITH_PIPE_BUF, "expression request fits PIPE_BUF");
+_Static_assert(sizeof(v2_batch_resp_hdr_t)+ARITH_BATCH_MAX*sizeof(v2_batch_result_t)<=ARITH_PIPE_BUF, "batch response fits PIPE_BUF");
+
+// Human-readable text for a status code (also the v1 error string)
+static inline const char *arith_status_str(int status){
+    switch(status){
+    case ARITH_OK:         return "OK";
+    case ARITH_EDIVZERO:   return "Divide by zero";
+    case ARITH_EINVALOP:   return "Invalid operation";
+    case ARITH_ENOSESSION: return "No free session";
+    case ARITH_EOVERFLOW:  return "Integer overflow";
+    case ARITH_EBUSY:      return "Server busy";
+    case ARITH_EBADARRAY:  return "Bad array";
+    case ARITH_EBADEXPR:   return "Bad expression";
+    default:               return "Unknown error";
+    }
+}
+
+#endif // ARITH_PROTO_H
@@ -0,0 +1,267 @@
+// replay.c
+// Send the requests of a journal (server --journal, journal.h) to a server
+// again, through the client library:
+//   replay JOURNAL [--fast [--window W] | --speed X] [--transport fifo|shm|sock]
+//                  [--v1] [--clients N] [--label S]
+// Each recorded client PID becomes one replay stream, and the streams are
+// spread over N threads (default: one per recorded client, at most 64), a
+// handle each. By default a stream sends every call at its recorded arrival
+// time (--speed X divides the gaps by X) without waiting for earlier answers,
+// so a server slower than the recording queues up just as it would have, and
+// latency counts from the scheduled time. --fast sends as fast as the server
+// answers, up to W calls in flight per thread. Tuples recorded from one batch
+// frame go out as one arith_batch() again. Prints a JSON summary like
+// `client --bench`.
+
+#define _GNU_SOURCE
+#include <stdio.h>      // printf, fprintf
+#include <stdlib.h>     // calloc, malloc, atof
+#include <stdint.h>     // int64_t, uint64_t
+#include <stdbool.h>    // bool
+#include <string.h>     // strcmp
+#include <errno.h>      // errno
+#include <signal.h>     // signal, SIGPIPE
+#include <pthread.h>    // pthread_create
+#include <time.h>       // clock_gettime, clock_nanosleep
+#include <poll.h>       // ppoll (answers while waiting for the next call)
+
+#include "arith_client.h" // connection handles, async and batch calls
+#include "transport.h"  // --transport names
+#include "journal.h"    // journal file layout, journal_map()
+#include "hist.h"       // latency histogram
+
+#define MAX_THREADS 64
+
+typedef struct {
+    pthread_t tid;
+    unsigned  idx;
+    hist_t   *lat;           // latency, ns
+    uint64_t  calls, batches, errors, busy, failed;
+    uint64_t  t_end;         // CLOCK_MONOTONIC ns of the last answer
+} replay_thread_t;
+
+static const journal_rec_t *recs = NULL; // the mapped journal
+static size_t    n_recs = 0;
+static uint32_t *stream = NULL;  // per record: its client's stream (UINT32_MAX => incomplete record)
+static unsigned  threads = 1;
+static uint64_t *sent = NULL;    // per record: when its latency starts
+static uint64_t  t_first = 0;    // t_ns of the first record
+static uint64_t  t0 = 0;         // replay start (CLOCK_MONOTONIC ns)
+static bool      fast = false;   // --fast
+static double    speed = 1.0;    // --speed X
+static unsigned  window = 64;    // --window W
+static arith_options_t opts;
+static _Thread_local replay_thread_t *self; // for the completion callback
+
+static uint64_t now_ns(void){
+    struct timespec ts; clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (uint64_t)ts.tv_sec*1000000000u+(uint64_t)ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t t){
+    struct timespec ts={ .tv_sec=(time_t)(t/1000000000u), .tv_nsec=(long)(t%1000000000u) };
+    while(clock_nanosleep(CLOCK_MONOTONIC,TIMER_ABSTIME,&ts,NULL)==EINTR){}
+}
+
+// When record r is due: its offset from the first record, scaled by --speed
+static uint64_t due(const journal_rec_t *r){
+    return t0+(uint64_t)((double)(r->t_ns-t_first)/speed);
+}
+
+static void answered(replay_thread_t *s, int status, uint64_t since, uint64_t n){
+    uint64_t t=now_ns();
+    hist_record(s->lat,t-since);
+    s->calls+=n; s->t_end=t;
+    if(status!=ARITH_OK) s->errors+=n;
+    if(status==ARITH_EBUSY) s->busy+=n;
+}
+
+static void on_answer(void *user, uint32_t id, int status, int64_t result){
+    (void)id; (void)result;
+    answered(self,status,*(const uint64_t*)user,1);
+}
+
+// Poll until at most `left` calls are outstanding; false on a transport error
+static bool drain(arith_conn_t *c, unsigned left){
+    while(arith_pending(c)>left)
+        if(arith_poll(c,-1)<0) return false;
+    return true;
+}
+
+// Paced: wait until t, taking the answers that arrive meanwhile so their
+// latency is not stretched to the next call. Without a descriptor to wait on
+// (shm) this polls in whole milliseconds and sleeps the rest.
+static bool wait_until(arith_conn_t *c, uint64_t t){
+    for(uint64_t now;(now=now_ns())<t;){
+        if(!arith_pending(c)){ sleep_until(t); break; }
+        int fd=arith_fd(c);
+        if(fd>=0){
+            struct timespec ts={ .tv_sec=(time_t)((t-now)/1000000000u), .tv_nsec=(long)((t-now)%1000000000u) };
+            struct pollfd p={ .fd=fd, .events=POLLIN };
+            if(ppoll(&p,1,&ts,NULL)>0 && arith_poll(c,0)<0) return false;
+        } else {
+            int ms=(int)((t-now)/1000000u);
+            if(!ms){ sleep_until(t); break; }
+            if(arith_poll(c,ms)<0) return false;
+        }
+    }
+    return true;
+}
+
+// Tuples i.. of a recorded batch frame, if all of them made it into the journal
+static size_t batch_len(size_t i){
+    const journal_rec_t *r=&recs[i];
+    size_t n=r->batch;
+    if(!(r->flags&JOURNAL_BATCH) || r->index!=0 || n<1 || n>ARITH_BATCH_MAX || i+n>n_recs) return 0;
+    for(size_t k=1;k<n;k++)
+        if(!recs[i+k].version || recs[i+k].req_id!=r->req_id || recs[i+k].index!=k) return 0;
+    return n;
+}
+
+static void *replay_thread(void *arg){
+    replay_thread_t *s=arg; self=s;
+    arith_conn_t *c=arith_connect(&opts);
+    if(!c){ perror("connect"); s->failed=1; return NULL; }
+    sleep_until(t0);
+    uint8_t op[ARITH_BATCH_MAX]; int64_t a[ARITH_BATCH_MAX], b[ARITH_BATCH_MAX], res[ARITH_BATCH_MAX]; int32_t st[ARITH_BATCH_MAX];
+    for(size_t i=0;i<n_recs;i++){
+        const journal_rec_t *r=&recs[i];
+        if(stream[i]==UINT32_MAX || stream[i]%threads!=s->idx) continue;
+        size_t bn= r->flags&JOURNAL_BATCH ? batch_len(i) : 0;
+        if(r->flags&JOURNAL_BATCH && !bn) continue; // a tuple of a frame the journal lost part of
+        if(!fast && !wait_until(c,due(r))) goto fail;
+        sent[i]= fast ? now_ns() : due(r);
+        if(bn){ // batches wait for the calls before them (arith_batch() needs an idle handle)
+            if(!drain(c,0)) goto fail;
+            for(size_t k=0;k<bn;k++){ op[k]=recs[i+k].opcode; a[k]=recs[i+k].a; b[k]=recs[i+k].b; }
+            if(arith_batch(c,bn,op,a,b,res,st)<0) goto fail;
+            for(size_t k=0;k<bn;k++) answered(s,st[k],sent[i],1);
+            s->batches++;
+            i+=bn-1;
+            continue;
+        }
+        while(arith_submit(c,r->opcode,r->a,r->b,on_answer,&sent[i],NULL)<0){
+            if(errno!=EAGAIN || arith_poll(c,-1)<0) goto fail;
+        }
+        if(fast ? !drain(c,window-1) : arith_poll(c,0)<0) goto fail;
+    }
+    if(!drain(c,0)) goto fail;
+    arith_disconnect(c);
+    return NULL;
+fail:
+    perror("replay");
+    s->failed+=arith_pending(c)+1;
+    arith_disconnect(c);
+    return NULL;
+}
+
+static void usage(const char *prog){
+    fprintf(stderr,"usage: %s JOURNAL [--fast [--window W] | --speed X] [--transport fifo|shm|sock] [--v1] [--clients N] [--label S]\n", prog);
+    fprintf(stderr,"  --fast        send as fast as the server answers instead of at the recorded times\n");
+    fprintf(stderr,"  --window W    with --fast: calls in flight per thread (default 64)\n");
+    fprintf(stderr,"  --speed X     recorded pace times X (default 1)\n");
+    fprintf(stderr,"  --transport T how to reach the server (default fifo)\n");
+    fprintf(stderr,"  --v1          fifo: v1 frames instead of a v2 session\n");
+    fprintf(stderr,"  --clients N   replay threads (default one per recorded client, at most %d)\n", MAX_THREADS);
+    fprintf(stderr,"  --label S     copied into the JSON summary\n");
+}
+
+int main(int argc, char **argv){
+    const char *path=NULL, *label="";
+    int transport=ARITH_TRANSPORT_FIFO, clients=0; bool v1=false;
+    for(int i=1;i<argc;i++){
+        if(!strcmp(argv[i],"--fast")) fast=true;
+        else if(!strcmp(argv[i],"--window") && i+1<argc){
+            int w=atoi(argv[++i]);
+            if(w<1 || w>ARITH_MAX_PENDING){ fprintf(stderr,"--window needs 1..%d\n",ARITH_MAX_PENDING); return 2; }
+            window=(unsigned)w;
+        } else if(!strcmp(argv[i],"--speed") && i+1<argc){
+            speed=atof(argv[++i]);
+            if(!(speed>0)){ fprintf(stderr,"--speed needs a positive factor\n"); return 2; }
+        } else if(!strcmp(argv[i],"--transport") && i+1<argc){
+            transport=arith_transport_from_name(argv[++i]);
+            if(transport<0){ fprintf(stderr,"--transport is fifo, shm or sock\n"); return 2; }
+        } else if(!strcmp(argv[i],"--v1")) v1=true;
+        else if(!strcmp(argv[i],"--clients") && i+1<argc){
+            clients=atoi(argv[++i]);
+            if(clients<1 || clients>MAX_THREADS){ fprintf(stderr,"--clients needs 1..%d\n",MAX_THREADS); return 2; }
+        } else if(!strcmp(argv[i],"--label") && i+1<argc) label=argv[++i];
+        else if(argv[i][0]!='-' && !path) path=argv[i];
+        else { usage(argv[0]); return 2; }
+    }
+    if(!path){ usage(argv[0]); return 2; }
+    if(v1 && transport!=ARITH_TRANSPORT_FIFO){ fprintf(stderr,"--v1 goes with --transport fifo\n"); return 2; }
+    opts.mode= transport==ARITH_TRANSPORT_SHM ? ARITH_MODE_SHM : transport==ARITH_TRANSPORT_SOCK ? ARITH_MODE_SOCK
+             : v1 ? ARITH_MODE_V1 : ARITH_MODE_V2;
+    opts.spin=-1; opts.shard=-1;
+    signal(SIGPIPE,SIG_IGN); // a server that went away is EPIPE, not death
+
+    const journal_hdr_t *hdr;
+    recs=journal_map(path,&hdr,&n_recs);
+    if(!recs){ fprintf(stderr,"%s: %s\n", path, errno==EPROTO ? "not a journal of this version" : strerror(errno)); return 1; }
+
+    // Streams: one per recorded client PID, dealt out to the threads in order of appearance
+    stream=malloc((n_recs ? n_recs : 1)*sizeof(*stream)); sent=calloc(n_recs ? n_recs : 1,sizeof(*sent));
+    if(!stream || !sent){ perror("malloc"); return 1; }
+    int32_t *pids=NULL; size_t n_pids=0, cap=0;
+    uint64_t t_last=0, valid=0;
+    for(size_t i=0;i<n_recs;i++){
+        const journal_rec_t *r=&recs[i];
+        if(!r->version){ stream[i]=UINT32_MAX; continue; } // claimed, never completed
+        if(!valid++ || r->t_ns<t_first) t_first=r->t_ns;
+        if(r->t_ns>t_last) t_last=r->t_ns;
+        size_t k=n_pids;
+        for(size_t j=n_pids;j-->0;) if(pids[j]==r->client_pid){ k=j; break; } // recent clients are at the end
+        if(k==n_pids){
+            if(n_pids==cap){
+                cap= cap ? 2*cap : 64;
+                int32_t *p=realloc(pids,cap*sizeof(*pids));
+                if(!p){ perror("realloc"); return 1; }
+                pids=p;
+            }
+            pids[n_pids++]=r->client_pid;
+        }
+        stream[i]=(uint32_t)k;
+    }
+    free(pids);
+    threads= clients ? (unsigned)clients : n_pids<1 ? 1 : n_pids>MAX_THREADS ? MAX_THREADS : (unsigned)n_pids;
+
+    replay_thread_t th[MAX_THREADS]; memset(th,0,sizeof(th));
+    t0=now_ns()+100000000u; // every stream starts 100 ms from now, connected or not
+    unsigned started=0;
+    for(unsigned t=0;t<threads;t++){
+        th[t].idx=t; th[t].lat=malloc(sizeof(hist_t));
+        if(!th[t].lat){ perror("malloc"); return 1; }
+        hist_init(th[t].lat);
+        if(pthread_create(&th[t].tid,NULL,replay_thread,&th[t])!=0){ th[t].failed=1; break; }
+        started++;
+    }
+    for(unsigned t=0;t<started;t++) pthread_join(th[t].tid,NULL);
+
+    hist_t *all=malloc(sizeof(*all));
+    if(!all){ perror("malloc"); return 1; }
+    hist_init(all);
+    uint64_t calls=0, batches=0, errors=0, busy=0, failed=0, t_end=t0;
+    for(unsigned t=0;t<threads;t++){
+        hist_merge(all,th[t].lat); free(th[t].lat);
+        calls+=th[t].calls; batches+=th[t].batches; errors+=th[t].errors; busy+=th[t].busy; failed+=th[t].failed;
+        if(th[t].t_end>t_end) t_end=th[t].t_end;
+    }
+    double secs=(double)(t_end-t0)/1e9, recorded=(double)(t_last-t_first)/1e9;
+    const char *mode= transport!=ARITH_TRANSPORT_FIFO ? "v2" : v1 ? "v1" : "v2";
+    char pace[32];
+    if(fast) snprintf(pace,sizeof(pace),"fast");
+    else     snprintf(pace,sizeof(pace),"x%g",speed);
+    printf("{\"label\":\"%s\",\"journal\":\"%s\",\"mode\":\"%s\",\"transport\":\"%s\",\"pace\":\"%s\",\"clients\":%zu,\"threads\":%u,"
+           "\"records\":%llu,\"calls\":%llu,\"batches\":%llu,\"errors\":%llu,\"busy\":%llu,\"failed\":%llu,"
+           "\"recorded_s\":%.3f,\"duration_s\":%.3f,\"throughput_rps\":%.0f,\"latency_us\":{\"min\":%.3f,\"mean\":%.3f,"
+           "\"p50\":%.3f,\"p90\":%.3f,\"p99\":%.3f,\"p99.9\":%.3f,\"max\":%.3f}}\n",
+           label, path, mode, arith_transport_names[transport], pace, n_pids, threads,
+           (unsigned long long)valid, (unsigned long long)calls, (unsigned long long)batches, (unsigned long long)errors,
+           (unsigned long long)busy, (unsigned long long)failed, recorded, secs, secs>0 ? (double)calls/secs : 0.0,
+           calls ? (double)all->min/1e3 : 0.0, hist_mean(all)/1e3,
+           (double)hist_percentile(all,50.0)/1e3, (double)hist_percentile(all,90.0)/1e3,
+           (double)hist_percentile(all,99.0)/1e3, (double)hist_percentile(all,99.9)/1e3, (double)all->max/1e3);
+    free(all);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,102 @@
+// ring.h
+// Bounded lock-free multi-producer/multi-consumer ring (Vyukov's sequence
+// number scheme). Elements are fixed-size byte records copied in and out, so
+// the ring holds no pointers and can live in memory shared between threads or
+// between fork()ed processes alike. Push/pop never block: callers that need to
+// sleep while the ring is full/empty pair it with semaphores of their own.
+
+#ifndef ARITH_RING_H
+#define ARITH_RING_H
+
+#include <stddef.h>     // size_t
+#include <stdint.h>     // intptr_t
+#include <stdbool.h>    // bool
+#include <string.h>     // memcpy
+#include <stdatomic.h>  // atomic_size_t, atomic_load_explicit, ...
+
+#define RING_CACHELINE 64
+
+// Ring header; `cap` slots of `slot_size` bytes follow it in the same block
+typedef struct {
+    _Alignas(RING_CACHELINE) atomic_size_t head; // next slot to push (producers)
+    _Alignas(RING_CACHELINE) atomic_size_t tail; // next slot to pop (consumers)
+    _Alignas(RING_CACHELINE) size_t mask;        // cap-1; cap is a power of two
+    size_t elem_size;                            // payload bytes per element
+    size_t slot_size;                            // sequence word + payload, cache line rounded
+} ring_t;
+
+// Each slot starts with its sequence number, payload follows
+typedef struct { atomic_size_t seq; } ring_slot_t;
+
+// Round a requested capacity up to the power of two the ring actually uses
+static inline size_t ring_capacity(size_t want){
+    size_t cap=2; while(cap<want) cap<<=1;
+    return cap;
+}
+
+// Slot footprint for elements of `elem_size` bytes
+static inline size_t ring_slot_size(size_t elem_size){
+    size_t s=sizeof(ring_slot_t)+elem_size;
+    return (s+RING_CACHELINE-1)&~(size_t)(RING_CACHELINE-1);
+}
+
+// Bytes needed for a ring of `cap` (power of two) elements of `elem_size`
+static inline size_t ring_bytes(size_t cap, size_t elem_size){
+    return sizeof(ring_t)+cap*ring_slot_size(elem_size);
+}
+
+static inline ring_slot_t *ring_slot(ring_t *r, size_t pos){
+    return (ring_slot_t*)((char*)(r+1)+(pos&r->mask)*r->slot_size);
+}
+
+// Initialise a ring in a block of at least ring_bytes(cap, elem_size) bytes
+static inline void ring_init(ring_t *r, size_t cap, size_t elem_size){
+    r->mask=cap-1; r->elem_size=elem_size; r->slot_size=ring_slot_size(elem_size);
+    atomic_init(&r->head,0); atomic_init(&r->tail,0);
+    for(size_t i=0;i<cap;i++) atomic_init(&ring_slot(r,i)->seq,i);
+}
+
+// Copy one element in; false if the ring is full
+static inline bool ring_push(ring_t *r, const void *elem){
+    size_t pos=atomic_load_explicit(&r->head,memory_order_relaxed);
+    for(;;){
+        ring_slot_t *s=ring_slot(r,pos);
+        size_t seq=atomic_load_explicit(&s->seq,memory_order_acquire);
+        intptr_t dif=(intptr_t)seq-(intptr_t)pos;
+        if(dif==0){ // slot free for this lap: claim it
+            if(atomic_compare_exchange_weak_explicit(&r->head,&pos,pos+1,memory_order_relaxed,memory_order_relaxed)){
+                memcpy(s+1,elem,r->elem_size);
+                atomic_store_explicit(&s->seq,pos+1,memory_order_release); // publish
+                return true;
+            }
+        } else if(dif<0) return false; // consumers haven't freed it yet: full
+        else pos=atomic_load_explicit(&r->head,memory_order_relaxed); // lost a race, retry
+    }
+}
+
+// Copy one element out; false if the ring is empty
+static inline bool ring_pop(ring_t *r, void *elem){
+    size_t pos=atomic_load_explicit(&r->tail,memory_order_relaxed);
+    for(;;){
+        ring_slot_t *s=ring_slot(r,pos);
+        size_t seq=atomic_load_explicit(&s->seq,memory_order_acquire);
+        intptr_t dif=(intptr_t)seq-(intptr_t)(pos+1);
+        if(dif==0){ // element published for this lap: claim it
+            if(atomic_compare_exchange_weak_explicit(&r->tail,&pos,pos+1,memory_order_relaxed,memory_order_relaxed)){
+                memcpy(elem,s+1,r->elem_size);
+                atomic_store_explicit(&s->seq,pos+r->mask+1,memory_order_release); // free for next lap
+                return true;
+            }
+        } else if(dif<0) return false; // nothing published: empty
+        else pos=atomic_load_explicit(&r->tail,memory_order_relaxed);
+    }
+}
+
+// Approximate number of queued elements (exact when quiescent)
+static inline size_t ring_count(ring_t *r){
+    size_t h=atomic_load_explicit(&r->head,memory_order_relaxed);
+    size_t t=atomic_load_explicit(&r->tail,memory_order_relaxed);
+    return h>=t ? h-t : 0;
+}
+
+#endif // ARITH_RING_H
@@ -1,12 +1,39 @@
 // server.c
 // CS5115 PA6 — FIFO-based client/server arithmetic service
 // This file implements a server that listens on a well-known named pipe
-// (`/tmp/arith_req_fifo`) for fixed-size request structs. For each request
-// it forks a child which computes the arithmetic result and writes a fixed
-// response struct to the client's response FIFO (path provided in request).
+// (`/tmp/arith_req_fifo`) for requests (proto.h: fixed v1 structs or compact
+// v2 frames on a registered session). The main process is the only reader of
+// that FIFO; it turns every request into a job_t and hands it to an executor:
+//   default        fork() a child per request which computes the result and
+//                  writes the response to the client's response FIFO;
+//   --workers N    N pre-forked long-lived worker processes draining a
+//                  dispatch ring in shared memory (the parent also respawns
+//                  crashed workers and stops them on SIGINT/TERM);
+//   --threads N    N threads draining the same lock-free MPMC ring (ring.h);
+//   --engine epoll the reader computes every request itself and answers
+//                  through non-blocking per-client channels, so no client
+//                  can stall it and one thread serves them all;
+//   --engine io_uring  the same, with the FIFO reads and response writes
+//                  completed by an io_uring (uring.h) instead of run on
+//                  readiness (falls back to epoll where it is unavailable).
+// The reader waits in an event loop (event.h: epoll + signalfd on Linux) on
+// the request FIFO, its signals and, with --engine epoll, writable clients.
+// With --transport shm a client can also attach a shared-memory segment
+// (shmchan.h); a server thread per attached client then serves its rings
+// directly, in any of the modes above. With --transport sock clients can
+// also connect a SOCK_SEQPACKET Unix socket (transport.h), which the reader
+// serves from the same event loop; array frames on it pass whole arrays as
+// memfds, computed in place by a pool of array threads.
+// With --shards N there are N more request FIFOs, each drained by a reader
+// thread of its own, so client writes no longer all contend on one pipe.
+// SIGHUP (or starting another server with --takeover) restarts the server in
+// place: the successor gets the FIFOs and client connections from this one
+// and nothing queued in them is lost.
+// Counters and per-stage latencies are published in a shared-memory segment
+// (metrics.h) that `server --stats` reads from another process.
 
 #define _GNU_SOURCE
-#include <stdio.h>      // fprintf, perror, FILE*, fopen, fclose
+#include <stdio.h>      // fprintf, perror, vsnprintf
 #include <stdlib.h>     // exit, atexit
 #include <stdint.h>     // int64_t, int32_t
 #include <stdbool.h>    // bool type
@@ -17,42 +44,154 @@
 #include <sys/stat.h>   // mkfifo
 #include <time.h>       // time, localtime_r, strftime
 #include <signal.h>     // sigaction
-#include <stdarg.h>     // va_list, va_start, vfprintf
+#include <stdarg.h>     // va_list, va_start
 #include <sys/wait.h>   // waitpid
+#include <sys/mman.h>   // mmap (memory shared with workers), mlockall
+#include <sys/uio.h>    // readv
+#include <sys/resource.h> // getrlimit, setrlimit (fd limit for --engine epoll)
+#include <sys/socket.h> // socket, accept4, SO_PEERCRED (--transport sock)
+#include <sys/un.h>     // struct sockaddr_un
+#include <poll.h>       // poll (shard readers)
+#include <pthread.h>    // pthread_create, pthread_join, pthread_sigmask
+#include <semaphore.h>  // sem_t (sleep/wake around the lock-free ring)
+#include <stdatomic.h>  // atomic_bool
+#ifdef __linux__
+#include <sys/prctl.h>  // prctl(PR_SET_PDEATHSIG)
+#include <sched.h>      // cpu_set_t, CPU_SET, sched_setaffinity, sched_setscheduler
+#include <sys/syscall.h> // SYS_close_range (a reload's successor)
+#endif
 
-// Path for the server's well-known request FIFO
-#define REQ_FIFO_PATH "/tmp/arith_req_fifo"
-// Maximum sizes used in request/response structures
-#define RESP_NAME_MAX 128
-#define OP_MAX 4
-
-// Request message the client writes into REQ_FIFO_PATH
-typedef struct __attribute__((packed)) {
-    char   operation[OP_MAX];         // "add","sub","mul","div" (not NUL-terminated necessarily)
-    int64_t operand1;                // first operand
-    int64_t operand2;                // second operand
-    pid_t  client_pid;               // client's PID (informational)
-    char   resp_fifo[RESP_NAME_MAX]; // path to client's response FIFO
-} request_msg_t;
-
-// Response message server writes back to client's FIFO
-typedef struct __attribute__((packed)) {
-    int64_t result;                  // arithmetic result
-    int32_t success;                 // 1 => ok, 0 => error
-    char    error[128];              // error message if success==0
-} response_msg_t;
+#include "proto.h"      // wire formats (v1 structs, v2 frames)
+#include "ring.h"       // lock-free MPMC ring for the dispatch queue
+#include "compute.h"    // compute(), compute_batch()
+#include "shmchan.h"    // shared-memory channels (--transport shm)
+#include "transport.h"  // transport names, socket path, recvmmsg/sendmmsg (--transport sock)
+#include "event.h"      // reader event loop and signal fd
+#include "uring.h"      // io_uring ring (--engine io_uring)
+#include "logger.h"     // log_line(): asynchronous server.log
+#include "metrics.h"    // metrics segment, admission counters (server --stats)
+#include "profile.h"    // stage timestamps (make profile)
+#include "journal.h"    // request journal (--journal)
+#include "busypoll.h"   // busy-poll budgets (--busy-poll)
+#include "bignum.h"     // big-integer arithmetic and its arena (ARITH_FRAME_BIG)
+#include "cache.h"      // shared result cache (--cache)
+#include "drr.h"        // per-client fair queue (--fair)
+#include "expr.h"       // expression programs and their cache (ARITH_FRAME_EXPR)
+
+// One decoded request as handed to executors, whatever protocol it came in
+typedef struct {
+    uint8_t  version;                  // 1 or 2: selects the response encoding
+    uint8_t  opcode;                   // enum arith_op (ARITH_OP_INVALID if unknown)
+    uint16_t session;                  // v2 session id (0 for v1)
+    uint32_t req_id;                   // v2 request id, echoed back
+    uint16_t batch_count;              // v2 batch: tuples in batch_slot (0 => single call)
+    int32_t  batch_slot;               // v2 batch, big-integer or expression call: index into the shared batch pool
+    bool     big;                      // v2 big-integer call: |a| and |b| limbs in batch_slot
+    uint8_t  big_sign;                 // ARITH_BIG_NEG_A | ARITH_BIG_NEG_B
+    uint16_t big_na, big_nb;           // limbs of |a| and |b|
+    uint8_t  expr_len, expr_nargs;     // v2 expression: instructions and arguments in batch_slot (0 => none)
+    int32_t  sock;                     // socket client: connection slot + 1 (0 => answer by FIFO)
+    uint32_t sock_gen;                 // socket client: generation of that slot
+    uint8_t  sched_class;              // enum arith_class its client declared (--fair)
+    int64_t  a, b;                     // operands
+    pid_t    client_pid;               // client's PID
+    uint64_t t_recv;                   // metrics_now() when its reader read it
+    char     op_name[8];               // operation as the client named it (for traces)
+    char     resp_fifo[RESP_NAME_MAX]; // client's response FIFO ("socket N" for socket clients)
+} job_t;
+
+// A request FIFO and its reader: the well-known one, plus one per shard
+// with --shards (see "Request FIFO shards")
+struct rx;
+typedef struct {
+    int        fd;            // read end of the FIFO (non-blocking)
+    int        dummy_w;       // write end kept open to avoid EOF on fd
+    char       path[32];
+    struct rx *rx;            // receive ring (request framing)
+    pthread_t  tid;           // shard reader thread (none in the event loop)
+    uint8_t   *carry;         // --takeover: partial frame the previous server had read (see "Takeover")
+    size_t     carry_len;
+} reader_t;
 
 // Global file descriptors and log handle
-static int   req_fd = -1;  // read end of the request FIFO
-static int   dummy_w = -1; // write end kept open to avoid EOF on req_fd
-static FILE *logf   = NULL; // server.log FILE*
+static reader_t main_rd = { .fd=-1, .dummy_w=-1, .path=REQ_FIFO_PATH };
+static int   sig_fd = -1;  // SIGINT/TERM/CHLD/HUP arrive here (ev_signal_open)
+static int   tk_listen = -1; // takeover socket: the next server connects here (see "Takeover")
+
+// Output verbosity: errors are always printed; LVL_INFO adds lifecycle
+// messages (start, hello, attach); LVL_TRACE adds the per-request lines on
+// stdout and in server.log. Building with -DARITH_NO_TRACE (make TRACE=0)
+// compiles the per-request lines out altogether.
+enum { LVL_ERROR = 0, LVL_INFO = 1, LVL_TRACE = 2 };
+#ifdef ARITH_NO_TRACE
+#define tracing() 0
+#else
+#define tracing() (log_level>=LVL_TRACE)
+#endif
+
+// Server configuration (set from the command line in main)
+static int   n_workers = 0;     // --workers N: size of the pre-forked pool (0 => fork per request)
+static int   n_threads = 0;     // --threads N: size of the thread pool (0 => processes)
+static bool  engine_epoll = false; // --engine epoll (or io_uring): serve everything from the event loop
+static bool  engine_uring = false; // --engine io_uring: event engine I/O through an io_uring
+static bool  uring_sqpoll = false; // --sqpoll: a kernel thread polls the io_uring submission queue
+static enum log_policy log_policy = LOG_BLOCK; // --log-policy: full log ring blocks or drops
+static bool  pin_threads = false; // --pin: bind pool thread i to CPU i % ncpu (of --cpus)
+static uint64_t busy_poll_ns = 0; // --busy-poll US: spin this long for work before blocking (0 => off)
+static const char *cpu_list = NULL; // --cpus LIST: CPUs the server runs on (NULL => all)
+static int   sched_fifo = 0;    // --sched-fifo PRIO: SCHED_FIFO priority of the serving threads (0 => off)
+static bool  mlock_all = false; // --mlock: lock every mapping in RAM (rings, queues, stacks)
+static int   resp_cache_cap = 64; // --fd-cache N: open response fds kept per worker/thread (0 => off)
+static int   coalesce_bytes = ARITH_PIPE_BUF; // --coalesce N: responses buffered per client before a write (0 => off)
+static int   coalesce_us = 50;  // --coalesce-window US: longest a busy worker/thread holds a response
+static bool  shm_transport = false; // --transport shm: accept shared-memory channel attaches
+static bool  sock_transport = false; // --transport sock: serve clients on ARITH_SOCK_PATH
+static int   n_array_threads = 0; // --array-threads N: threads computing array frames (0 => one per CPU)
+static const char *journal_path = NULL; // --journal FILE: record every received request there
+static int   journal_mb = 64;   // --journal-size MB: room preallocated for records
+static uint32_t cache_ops = 0;  // --cache OPS: opcodes whose results are cached (bit per enum arith_op)
+static size_t cache_size = 65536; // --cache-entries N: result cache capacity
+_Static_assert(ARITH_OP_COUNT<=32, "opcodes fit the cache_ops mask");
+static unsigned shm_spin_max = 0; // --spin N: poll budget before a shm channel sleeps (set in main)
+static int   log_level = LVL_TRACE; // --log-level / --quiet: output verbosity
+static int   n_shards = 0;      // --shards N: extra request FIFOs with a reader each
+static int   max_inflight = 256; // --max-inflight N: fork mode: children computing at once
+static int   queue_cap = 4096;  // --queue N: admitted requests waiting for a child/worker/thread
+static int   client_cap = 0;    // --client-cap N: admitted, unanswered requests per client (0 => no cap)
+static bool  fair = false;      // --fair: queued requests are served per client by deficit round-robin
+static int   fair_quantum = 32; // --fair-quantum N: tuples a client is served per turn
+static bool  takeover = false;  // --takeover: take the FIFOs and clients over from a running server
+static _Thread_local const char *role = "child"; // how request handlers label themselves in output (each thread its own)
+static _Thread_local int self_id; // label id printed next to `role` (pid or thread index)
+
+static reader_t *shards = NULL;  // n_shards readers
+static arith_metrics_t *met = NULL; // shared with every child, worker and thread (metrics.h)
+
+// Takeover (see "Takeover"): set while the readers are being handed to the
+// next server, and for good once it has taken them; from then on the FIFOs,
+// the sockets and the metrics segment are its own, not ours to remove
+static atomic_bool handed_over;
+static void takeover_unlink(void);
+
+// Close a reader's FIFO ends and remove the FIFO file from the filesystem
+static void reader_close(reader_t *r){
+    if (r->fd >= 0) close(r->fd);           // close request FIFO fd if open
+    if (r->dummy_w >= 0) close(r->dummy_w); // close dummy writer if opened
+    r->fd=r->dummy_w=-1;
+    if(!atomic_load(&handed_over)) unlink(r->path);
+}
 
-// cleanup: close fds and remove request FIFO and close log
+// cleanup: close fds, remove request FIFOs, the socket and the metrics segment, close log
 static void cleanup(void) {
-    if (req_fd >= 0) close(req_fd);     // close request FIFO fd if open
-    if (dummy_w >= 0) close(dummy_w);   // close dummy writer if opened
-    unlink(REQ_FIFO_PATH);               // remove the FIFO file from the filesystem
-    if (logf) { fclose(logf); logf = NULL; } // close the log file
+    reader_close(&main_rd);
+    for(int i=0;i<n_shards && shards;i++) reader_close(&shards[i]);
+    if(!atomic_load(&handed_over)){
+        if(sock_transport) unlink(ARITH_SOCK_PATH); // new clients get ENOENT/ECONNREFUSED at once
+        metrics_unlink();                    // the segment outlives us only in readers that mapped it
+        if(n_shards) unlink(REQ_SHARDS_PATH);   // clients stop picking shards
+        takeover_unlink();
+    }
+    log_close();                         // flush queued log lines and close the log file
 }
 
 // Convenience to print an error and exit
@@ -61,39 +200,21 @@ static void die(const char *msg) {
     exit(EXIT_FAILURE);
 }
 
-// Write a timestamped line to the server log (if opened)
-static void log_line(const char *fmt, ...) {
-    if (!logf) return;                  // no-op if log not available
-    time_t t = time(NULL);              // current time
-    struct tm tmv;
-    localtime_r(&t, &tmv);              // thread-safe localtime
-    char ts[32];
-    strftime(ts, sizeof(ts), "%Y-%m-%d %H:%M:%S", &tmv); // format timestamp
-
-    fprintf(logf, "[%s] ", ts);       // write timestamp prefix
-    va_list ap; va_start(ap, fmt);       // handle variable args
-    vfprintf(logf, fmt, ap);            // write formatted message
-    va_end(ap);
-    fputc('\n', logf);                 // newline and flush
-    fflush(logf);
-}
-
-// Signal handlers: SIGINT/TERM will trigger a clean shutdown via a flag
+// Signals: SIGINT/TERM/CHLD/HUP are read from sig_fd by the reader (handle_signals);
+// SIGINT/TERM trigger a clean shutdown via this flag, SIGHUP a reload via the other
 static volatile sig_atomic_t stop_requested = 0;
-static void on_sigint(int sig){ (void)sig; stop_requested = 1; }
-// Reap child processes to avoid zombies (safe to call waitpid in handler with WNOHANG)
-static void on_sigchld(int sig){ (void)sig; int st; while (waitpid(-1,&st,WNOHANG)>0){} }
+static volatile sig_atomic_t reload_requested = 0;
+static void handle_signals(void);
+static _Thread_local bool shard_reader = false; // this thread drains a shard (never reads sig_fd)
+// No-op handler: SIGUSR1 only exists to interrupt a blocking syscall in a pool thread
+static void on_sigusr1(int sig){ (void)sig; }
 
-// Helper to read exactly n bytes or return an error/short read
-static ssize_t read_full(int fd, void *buf, size_t n){
-    size_t off=0;
-    while(off<n){
-        ssize_t r=read(fd,(char*)buf+off,n-off); // attempt to read remaining bytes
-        if(r==0) return (ssize_t)off;            // EOF: return bytes read so far
-        if(r<0){ if(errno==EINTR) continue; return -1; } // retry on EINTR
-        off+=(size_t)r;                          // advance offset by bytes read
-    }
-    return (ssize_t)off;                         // success: n bytes read
+// Helper threads must not take SIGINT/TERM/CHLD/HUP: only the reader handles them.
+// Blocks them in the caller (threads created now inherit that); *old restores.
+static void block_reader_signals(sigset_t *old){
+    sigset_t block; sigemptyset(&block);
+    sigaddset(&block,SIGINT); sigaddset(&block,SIGTERM); sigaddset(&block,SIGCHLD); sigaddset(&block,SIGHUP);
+    pthread_sigmask(SIG_BLOCK,&block,old);
 }
 
 // Helper to write exactly n bytes or return error
@@ -107,119 +228,3426 @@ static ssize_t write_full(int fd, const void *buf, size_t n){
     return (ssize_t)off;                              // success: n bytes written
 }
 
-// Compute the arithmetic operation requested and fill response struct
-static void compute(const request_msg_t *rq, response_msg_t *rp){
-    rp->success = 1; rp->error[0]='\0';   // assume success until an error occurs
-    int64_t a=rq->operand1, b=rq->operand2;
-    if      (memcmp(rq->operation,"add",3)==0) rp->result=a+b; // add
-    else if (memcmp(rq->operation,"sub",3)==0) rp->result=a-b; // subtract
-    else if (memcmp(rq->operation,"mul",3)==0) rp->result=a*b; // multiply
-    else if (memcmp(rq->operation,"div",3)==0){                // divide
-        if(b==0){ rp->success=0; snprintf(rp->error,sizeof(rp->error),"Divide by zero");}
-        else rp->result=a/b;
-    } else { rp->success=0; snprintf(rp->error,sizeof(rp->error),"Invalid operation"); }
+// Trace output formats each line into a stack buffer and emits it with a
+// single write(2): nothing is shared between threads or buffered across
+// fork(), and pipe writes this small are atomic, so lines from concurrent
+// handlers never tear or duplicate and no global lock is taken. server.log
+// goes through the asynchronous logger (logger.h) instead.
+#define LINE_MAX_OUT 512
+
+// Print a trace line to stdout
+static void say(const char *fmt, ...){
+    PROF_BEGIN(t);
+    char buf[LINE_MAX_OUT];
+    va_list ap; va_start(ap, fmt);
+    int n=vsnprintf(buf,sizeof(buf),fmt,ap);
+    va_end(ap);
+    if(n<0) return;
+    if((size_t)n>=sizeof(buf)) n=(int)sizeof(buf)-1; // truncated
+    write_full(STDOUT_FILENO,buf,(size_t)n);
+    PROF_END(PROF_PRINT,t);
 }
 
-int main(void){
-    // Open server log for appending; die() if we can't open the log
-    logf=fopen("server.log","a"); if(!logf) die("fopen log");
-    atexit(cleanup); // ensure cleanup runs on normal exit
+// Map memory shared with every process fork()ed afterwards (workers, children)
+static void *shared_alloc(size_t bytes){
+    void *p=mmap(NULL,bytes,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_ANONYMOUS,-1,0);
+    return p==MAP_FAILED ? NULL : p;
+}
 
-    // Install signal handlers: request stop on SIGINT/SIGTERM; reap children on SIGCHLD
-    struct sigaction sa={0}; sa.sa_handler=on_sigint;  sigaction(SIGINT,&sa,NULL); sigaction(SIGTERM,&sa,NULL);
-    struct sigaction sc={0}; sc.sa_handler=on_sigchld; sc.sa_flags=SA_RESTART|SA_NOCLDSTOP; sigaction(SIGCHLD,&sc,NULL);
+// Wait on a semaphore from the reader while still acting on signals (every
+// 100 ms at most); false once a stop has been requested
+static bool reader_sem_wait(sem_t *sem){
+    for(;;){
+#ifdef __linux__
+        struct timespec ts; clock_gettime(CLOCK_REALTIME,&ts);
+        ts.tv_nsec+=100*1000*1000;
+        if(ts.tv_nsec>=1000000000L){ ts.tv_sec++; ts.tv_nsec-=1000000000L; }
+        if(sem_timedwait(sem,&ts)==0) return true;
+        if(errno!=ETIMEDOUT && errno!=EINTR) return false;
+#else
+        if(sem_wait(sem)==0) return true;
+        if(errno!=EINTR) return false;
+#endif
+        if(!shard_reader) handle_signals(); // shard readers only watch the flag the main reader sets
+        if(stop_requested) return false;
+    }
+}
 
-    // Create the request FIFO if it doesn't already exist
-    if (mkfifo(REQ_FIFO_PATH,0666)<0 && errno!=EEXIST) die("mkfifo request");
+// ---- v2 sessions ----
+// A hello frame registers (client_pid, response FIFO) and gets back an id;
+// later v2 calls only carry that id. The table lives in shared memory so the
+// reader (which registers) and workers/children (which look up) agree on it.
+// Slots of clients that no longer exist are reclaimed when the table fills up.
+#define MAX_SESSIONS 1024
+typedef struct {
+    pid_t   pid;                 // owner (0 => free)
+    uint8_t sched_class;         // enum arith_class from its hello
+    char    path[RESP_NAME_MAX]; // response FIFO
+} session_t;
+static session_t *sessions = NULL; // MAX_SESSIONS entries; id = index + 1
+static const char *const class_names[ARITH_CLASS_COUNT]={ [ARITH_CLASS_NORMAL]="normal", [ARITH_CLASS_HIGH]="high", [ARITH_CLASS_BULK]="bulk" };
 
-    // Open the request FIFO for reading; use a dummy writer to avoid EOF when no clients
-    req_fd=open(REQ_FIFO_PATH,O_RDONLY);
-    if(req_fd<0) die("open request fifo (read)");
-    dummy_w=open(REQ_FIFO_PATH,O_WRONLY);
-    if(dummy_w<0) die("open request fifo (dummy write)");
+// Find or allocate a session for (pid, path) in class cls; returns the id or 0 if full
+static uint16_t session_register(pid_t pid, const char *path, uint8_t cls){
+    int free_slot=-1;
+    for(int i=0;i<MAX_SESSIONS;i++){
+        if(sessions[i].pid==pid && !strcmp(sessions[i].path,path)){ sessions[i].sched_class=cls; return (uint16_t)(i+1); } // re-hello
+        if(free_slot<0 && sessions[i].pid==0) free_slot=i;
+    }
+    if(free_slot<0) // full: reclaim the slot of a client that has gone away
+        for(int i=0;i<MAX_SESSIONS && free_slot<0;i++)
+            if(kill(sessions[i].pid,0)<0 && errno==ESRCH) free_slot=i;
+    if(free_slot<0) return 0;
+    sessions[free_slot].pid=pid; sessions[free_slot].sched_class=cls;
+    snprintf(sessions[free_slot].path,RESP_NAME_MAX,"%s",path);
+    return (uint16_t)(free_slot+1);
+}
+
+// Session by id, or NULL if the id is not registered
+static const session_t *session_get(uint16_t id){
+    if(id==0 || id>MAX_SESSIONS || sessions[id-1].pid==0) return NULL;
+    return &sessions[id-1];
+}
+
+// ---- Batch buffers ----
+// A batch frame is unpacked by the reader straight into SoA arrays in one of
+// these shared slots; the job only carries the slot index, and whoever
+// handles the job (child, worker or thread) returns the slot to the free ring.
+// Big-integer calls keep their limbs in a slot too, and expressions their
+// program (codes in op[], values in a[]) and arguments (in b[]).
+#define BATCH_POOL 64
+typedef struct {
+    uint8_t  op[ARITH_BATCH_MAX];
+    int64_t  a[ARITH_BATCH_MAX];
+    int64_t  b[ARITH_BATCH_MAX];
+} batch_t;
+typedef struct {
+    sem_t  free_count; // free slots (the reader waits here when all are in use)
+    ring_t free_ring;  // must be last: indices of the free slots follow
+} batch_pool_t;
+static batch_t *batches = NULL;
+static batch_pool_t *bpool = NULL;
+
+static void batch_pool_init(void){
+    size_t cap=ring_capacity(BATCH_POOL);
+    batches=shared_alloc(BATCH_POOL*sizeof(batch_t));
+    bpool=shared_alloc(sizeof(batch_pool_t)+cap*ring_slot_size(sizeof(int32_t)));
+    if(!batches || !bpool) die("mmap batch pool");
+    ring_init(&bpool->free_ring,cap,sizeof(int32_t));
+    for(int32_t i=0;i<BATCH_POOL;i++) ring_push(&bpool->free_ring,&i);
+    if(sem_init(&bpool->free_count,1,BATCH_POOL)<0) die("sem_init batch pool");
+}
+
+// Take a free batch slot (waits while all are in flight); -1 if interrupted by a stop
+static int32_t batch_acquire(void){
+    if(!reader_sem_wait(&bpool->free_count)) return -1;
+    int32_t slot; while(!ring_pop(&bpool->free_ring,&slot)){} // count guarantees one is (about to be) there
+    return slot;
+}
+
+static void batch_release(int32_t slot){
+    ring_push(&bpool->free_ring,&slot);
+    sem_post(&bpool->free_count);
+}
+
+// ---- Response channel cache ----
+// Long-lived handlers (pool workers and pool threads) keep the response FIFOs
+// they opened, keyed by (client_pid, resp_fifo), so a client that keeps its
+// FIFO open (client --session) costs one write per response instead of a
+// blocking open rendezvous. Each worker/thread owns its cache: no locking.
+// An entry is evicted when a write reports EPIPE (the client closed or died)
+// or when it is the least recently used one and a slot is needed.
+//
+// Responses to a cached channel are coalesced (--coalesce N): they collect
+// in the entry's buffer of N bytes, which is written with one write() when
+// the next response would not fit. A handler flushes every buffer before it
+// parks on an empty queue, and while it stays busy once the oldest held
+// response is --coalesce-window microseconds old, so a pipelining client
+// gets its answers in a few writes while a lone call is never held back.
+typedef struct {
+    pid_t    pid;                 // client_pid of the owner (0 => free slot)
+    int      fd;                  // open O_WRONLY end of its FIFO
+    uint64_t used;                // LRU clock value of the last hit
+    char    *out;                 // coalesced responses not written yet (coalesce_bytes)
+    size_t   out_len;
+    char     path[RESP_NAME_MAX]; // resp_fifo path
+} resp_slot_t;
+static _Thread_local resp_slot_t *rcache = NULL; // NULL in fork()ed children: no caching
+static _Thread_local uint64_t rcache_clock = 0;
+static _Thread_local int rcache_pending = 0;     // entries holding coalesced responses
+static _Thread_local uint64_t rcache_since = 0;  // metrics_now() of the oldest of them
+
+// Give the calling worker/thread its cache (no-op when disabled)
+static void resp_cache_init(void){
+    if(resp_cache_cap>0) rcache=calloc((size_t)resp_cache_cap,sizeof(*rcache));
+}
+
+static int open_resp_retry(const char *path);
+
+// Write to an entry's channel. A stale channel (EPIPE: the client reopened
+// its FIFO) is reopened and written once more; if that fails too, the bytes
+// are dropped and the entry evicted.
+static ssize_t resp_slot_write(resp_slot_t *e, const void *buf, size_t len){
+    ssize_t w=write_full(e->fd,buf,len);
+    if(w<0 && errno==EPIPE){
+        close(e->fd);
+        e->fd=open_resp_retry(e->path);
+        w= e->fd<0 ? -1 : write_full(e->fd,buf,len);
+    }
+    if(w>=0) return w;
+    int err=errno;
+    metrics_inc(&met->write_failed);
+    log_line("%s(%d) write resp %s failed: %s (%zu bytes of responses dropped)",role,self_id,e->path,strerror(err),len);
+    if(e->fd>=0) close(e->fd);
+    if(e->out_len){ e->out_len=0; rcache_pending--; }
+    e->pid=0; errno=err;
+    return -1;
+}
+
+// Write out an entry's coalesced responses
+static int resp_slot_flush(resp_slot_t *e){
+    if(!e->out_len) return 0;
+    ssize_t w=resp_slot_write(e,e->out,e->out_len);
+    if(w>=0){ e->out_len=0; rcache_pending--; }
+    return w<0 ? -1 : 0;
+}
+
+// Write out every entry's coalesced responses
+static void resp_cache_flush(void){
+    for(int i=0;rcache_pending && i<resp_cache_cap;i++) if(rcache[i].pid) resp_slot_flush(&rcache[i]);
+}
+
+// Close every cached fd and release the cache
+static void resp_cache_free(void){
+    if(!rcache) return;
+    resp_cache_flush();
+    for(int i=0;i<resp_cache_cap;i++){ if(rcache[i].pid) close(rcache[i].fd); free(rcache[i].out); }
+    free(rcache); rcache=NULL;
+}
 
-    fprintf(stderr,"[server] Listening on %s …\n", REQ_FIFO_PATH);
-    log_line("Server started; listening on %s", REQ_FIFO_PATH);
+static resp_slot_t *resp_cache_find(const job_t *job){
+    for(int i=0;i<resp_cache_cap;i++)
+        if(rcache[i].pid==job->client_pid && !strcmp(rcache[i].path,job->resp_fifo)) return &rcache[i];
+    return NULL;
+}
+
+// Forget (and close) the cached channel for this job's client
+static void resp_cache_evict(const job_t *job){
+    resp_slot_t *e=rcache ? resp_cache_find(job) : NULL;
+    if(!e) return;
+    if(e->out_len){ e->out_len=0; rcache_pending--; }
+    close(e->fd); e->pid=0;
+}
+
+// Remember fd for this client, replacing a free or the least recently used slot
+static resp_slot_t *resp_cache_put(const job_t *job, int fd){
+    resp_slot_t *victim=&rcache[0];
+    for(int i=0;i<resp_cache_cap && victim->pid;i++)
+        if(!rcache[i].pid || rcache[i].used<victim->used) victim=&rcache[i];
+    if(victim->pid){ resp_slot_flush(victim); if(victim->pid) close(victim->fd); }
+    victim->pid=job->client_pid; victim->fd=fd; victim->used=++rcache_clock;
+    memcpy(victim->path,job->resp_fifo,RESP_NAME_MAX);
+    return victim;
+}
+
+// Coalesce one response into its entry, writing the held ones first when it
+// does not fit (a response of N bytes or more is written on its own)
+static ssize_t resp_coalesce(resp_slot_t *e, const void *buf, size_t len){
+    size_t cap=(size_t)coalesce_bytes;
+    if(e->out_len+len>cap && resp_slot_flush(e)<0) return -1;
+    if(len>=cap || (!e->out && !(e->out=malloc(cap)))) return resp_slot_write(e,buf,len); // no buffer: write through
+    if(!e->out_len && !rcache_pending++) rcache_since=metrics_now();
+    memcpy(e->out+e->out_len,buf,len); e->out_len+=len;
+    return (ssize_t)len;
+}
+
+// How long a handler keeps retrying the open of a response FIFO whose client
+// has not opened the read end yet; a dead or stuck client costs no more
+#define RESP_OPEN_TIMEOUT_MS 5000
 
+static int64_t now_ms(void){
+    struct timespec ts; clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (int64_t)ts.tv_sec*1000+ts.tv_nsec/1000000;
+}
+
+// Open a response FIFO for writing without ever blocking on the client: a
+// non-blocking open succeeds at once if the client holds the read end
+// (session clients always do) and fails with ENXIO until it does, so retry
+// with backoff up to RESP_OPEN_TIMEOUT_MS (then ETIMEDOUT). The fd returned
+// is blocking again for the handler's write.
+static int open_resp_retry(const char *path){
+    int64_t deadline=now_ms()+RESP_OPEN_TIMEOUT_MS;
+    long delay_us=50;
     for(;;){
-        // If a stop was requested by a signal handler, break out and exit cleanly
-        if (stop_requested) break;
+        int fd=open(path,O_WRONLY|O_NONBLOCK);
+        if(fd>=0){ fcntl(fd,F_SETFL,fcntl(fd,F_GETFL)&~O_NONBLOCK); return fd; }
+        if(errno!=ENXIO) return -1;
+        if(now_ms()>=deadline){ errno=ETIMEDOUT; return -1; }
+        struct timespec ts={0,delay_us*1000}; nanosleep(&ts,NULL);
+        if(delay_us<10000) delay_us*=2;
+    }
+}
+
+// Get a writable fd for the client's response FIFO; *slot is its cache
+// entry (the cache keeps the fd), NULL when the caller owns and closes it
+static int resp_open(const job_t *job, resp_slot_t **slot){
+    *slot=NULL;
+    if(!rcache) return open_resp_retry(job->resp_fifo);
+    resp_slot_t *e=resp_cache_find(job);
+    if(e){ e->used=++rcache_clock; *slot=e; return e->fd; }
+    int fd=open_resp_retry(job->resp_fifo); // miss
+    if(fd<0) return -1;
+    *slot=resp_cache_put(job,fd);
+    return fd;
+}
+
+// Encode the answer to `job` in the protocol version it arrived in; returns its size
+static size_t encode_response(const job_t *job, int status, int64_t result, void *buf){
+    if(job->version==1){
+        response_msg_t *rp=buf; memset(rp,0,sizeof(*rp));
+        rp->result=result; rp->success= status==ARITH_OK;
+        if(status!=ARITH_OK) snprintf(rp->error,sizeof(rp->error),"%s",arith_status_str(status));
+        return sizeof(*rp);
+    }
+    v2_response_t *rp=buf;
+    rp->req_id=job->req_id; rp->status=status; rp->result=result;
+    return sizeof(*rp);
+}
+
+// Name a v2 job's operation for traces (v2 frames carry only the opcode)
+static void set_op_name(job_t *job){
+    if(job->opcode<ARITH_OP_COUNT) snprintf(job->op_name,sizeof(job->op_name),"%s",arith_ops[job->opcode].name);
+    else snprintf(job->op_name,sizeof(job->op_name),"#%u",job->opcode);
+}
+
+// compute() through the result cache for the operations given to --cache.
+// Every other operation goes straight to compute(), and so does everything
+// when there is no cache.
+static int compute_call(uint8_t op, int64_t a, int64_t b, int64_t *res){
+    if(op>=ARITH_OP_COUNT || !(cache_ops>>op&1)) return compute(op,a,b,res);
+    int status;
+    if(cache_get(op,a,b,res,&status)){ metrics_inc(&met->cache_hits); return status; }
+    metrics_inc(&met->cache_misses);
+    status=compute(op,a,b,res);
+    if(cache_put(op,a,b,*res,status)>0) metrics_inc(&met->cache_evictions);
+    return status;
+}
+
+// Count a computed call by its opcode and the status of its answer
+static void count_answer(uint8_t op, int status){
+    metrics_inc(&met->requests[op<ARITH_OP_COUNT ? op : ARITH_OP_COUNT]);
+    if(status>=0 && status<ARITH_STATUS_COUNT) metrics_inc(&met->status[status]);
+}
+
+// Run a batch job through the vector kernels into one response frame; returns its size
+static size_t compute_batch_job(const job_t *job, void *buf, int *errors){
+    const batch_t *bt=&batches[job->batch_slot];
+    size_t n=job->batch_count;
+    int64_t res[ARITH_BATCH_MAX]; int32_t st[ARITH_BATCH_MAX];
+    compute_batch(bt->op,bt->a,bt->b,n,res,st,compute_call);
+
+    v2_batch_resp_hdr_t *h=buf; h->req_id=job->req_id; h->count=(uint16_t)n;
+    v2_batch_result_t *out=(v2_batch_result_t*)(h+1);
+    *errors=0;
+    for(size_t i=0;i<n;i++){
+        out[i].status=st[i]; out[i].result=res[i];
+        if(st[i]!=ARITH_OK) (*errors)++;
+        count_answer(bt->op[i],st[i]);
+    }
+    batch_release(job->batch_slot);
+    return sizeof(*h)+n*sizeof(*out);
+}
+
+// A big-integer job is computed in a bump arena of its handler's own (one
+// per thread: forked children and pool workers inherit an unused one) that
+// is reset as soon as the result has been copied into the response frame, so
+// no temporaries survive the request and none costs a malloc(). The worst
+// case (pow close to ARITH_BIG_RESULT_MAX limbs) needs about a quarter of it.
+#define BIG_ARENA_BYTES (1u<<20)
+static _Thread_local bn_arena_t big_arena;
+
+// Compute a big-integer job (limbs in its batch slot) into one response
+// frame; returns its size, with the status and the arena bytes it took
+static size_t compute_big_job(const job_t *job, void *buf, int *status, size_t *arena_used){
+    batch_t *bt=&batches[job->batch_slot];
+    bn_t a={ .d=(bn_limb_t*)bt->a, .n=job->big_na, .neg=job->big_sign&ARITH_BIG_NEG_A };
+    bn_t b={ .d=(bn_limb_t*)bt->b, .n=job->big_nb, .neg=job->big_sign&ARITH_BIG_NEG_B };
+    v2_big_resp_hdr_t *h=buf;
+    h->req_id=job->req_id; h->sign=0; h->flags=0; h->n=0;
+    *arena_used=0;
+    if(!big_arena.base && bn_arena_init(&big_arena,BIG_ARENA_BYTES)<0){
+        log_line("%s(%d) big-integer arena: %s", role, self_id, strerror(errno));
+        h->status=ARITH_EOVERFLOW;
+    } else {
+        bn_t r;
+        h->status=bn_compute(&big_arena,job->opcode,&a,&b,&r,ARITH_BIG_RESULT_MAX);
+        if(h->status==ARITH_OK){
+            h->sign= r.neg ? ARITH_BIG_NEG_A : 0; h->n=(uint16_t)r.n;
+            memcpy(h+1,r.d,r.n*sizeof(bn_limb_t)); // r may point at the operands: before the release
+        }
+        *arena_used=big_arena.used;
+        bn_arena_reset(&big_arena);
+    }
+    batch_release(job->batch_slot);
+    *status=h->status;
+    return sizeof(*h)+h->n*sizeof(bn_limb_t);
+}
+
+// Expressions are compiled through an expr_cache_t (expr.h) of their
+// handler's own, so a program sent again, typically with new arguments,
+// is only evaluated. Workers, pool threads and the event engine keep one
+// for their whole life; a fork()ed child compiles its one program on the
+// stack. Constants are folded with compute() rather than compute_call(),
+// so folding never fills the result cache.
+static _Thread_local expr_cache_t *xcache = NULL; // NULL in fork()ed children: no caching
+
+// Give the calling handler its program cache (without one it only compiles more)
+static void expr_cache_init(void){
+    if(!xcache && !(xcache=expr_cache_new())) log_line("%s(%d) expression cache: %s", role, self_id, strerror(errno));
+}
+
+// Compute an expression job (program and arguments in its batch slot): its
+// status with the value in *res, whether the compiled form was cached, and
+// the operations it evaluated and folded
+static int compute_expr_job(const job_t *job, int64_t *res, bool *hit, unsigned *ops, unsigned *folded){
+    const batch_t *bt=&batches[job->batch_slot];
+    expr_prog_t local;
+    const expr_prog_t *p=&local;
+    int status;
+    if(xcache) p=expr_cache_get(xcache,bt->op,bt->a,job->expr_len,job->expr_nargs,compute,hit,&status);
+    else { *hit=false; status=expr_compile(bt->op,bt->a,job->expr_len,job->expr_nargs,compute,&local); }
+    metrics_inc(&met->exprs);
+    if(!*hit) metrics_inc(&met->expr_compiles);
+    *res=0; *ops=*folded=0;
+    if(status==ARITH_OK){
+        *ops=p->ops; *folded=p->folded;
+        status=expr_eval(p,bt->b,compute_call,res);
+    }
+    batch_release(job->batch_slot);
+    return status;
+}
+
+// Print the "computed" trace line of a single call
+static void trace_computed(const job_t *job, int status, int64_t result){
+    if(!tracing()) return;
+    if(status==ARITH_OK){
+        say("[SERVER %s=%d] computed %s(%lld,%lld) = %lld\n",
+            role, self_id, job->op_name,
+            (long long)job->a, (long long)job->b,
+            (long long)result);
+    } else {
+        say("[SERVER %s=%d] computed %s(%lld,%lld) -> ERROR: %s\n",
+            role, self_id, job->op_name,
+            (long long)job->a, (long long)job->b,
+            arith_status_str(status));
+    }
+}
+
+// Any response frame
+typedef union { response_msg_t v1; v2_response_t v2; char batch[ARITH_PIPE_BUF]; } resp_buf_t;
+
+// Compute one job into its response frame; returns the frame size
+static size_t compute_job(const job_t *job, resp_buf_t *rbuf){
+    PROF_BEGIN(t);
+    size_t rlen;
+    // ---- PRINT: computed result ----
+    if(job->batch_count){
+        int errors; rlen=compute_batch_job(job,rbuf,&errors);
+        if(tracing()) say("[SERVER %s=%d] computed batch[%u] (%d errors)\n",
+            role, self_id, job->batch_count, errors);
+    } else if(job->big){
+        int status; size_t used;
+        rlen=compute_big_job(job,rbuf,&status,&used);
+        count_answer(job->opcode,status);
+        if(tracing()) say("[SERVER %s=%d] computed big %s(%u limbs, %u limbs) -> %s, %u limbs (arena %zu bytes)\n",
+            role, self_id, job->op_name, job->big_na, job->big_nb, arith_status_str(status),
+            ((v2_big_resp_hdr_t*)rbuf)->n, used);
+    } else if(job->expr_len){
+        int64_t result; bool hit; unsigned ops, folded;
+        int status=compute_expr_job(job,&result,&hit,&ops,&folded);
+        rlen=encode_response(job,status,result,rbuf);
+        if(status>=0 && status<ARITH_STATUS_COUNT) metrics_inc(&met->status[status]);
+        if(tracing()) say("[SERVER %s=%d] computed expr(%u insns, %u args) -> %s %lld (%s, %u ops, %u folded)\n",
+            role, self_id, job->expr_len, job->expr_nargs, arith_status_str(status), (long long)result,
+            hit ? "cached" : "compiled", ops, folded);
+    } else {
+        int64_t result; int status=compute_call(job->opcode,job->a,job->b,&result);
+        rlen=encode_response(job,status,result,rbuf);
+        count_answer(job->opcode,status);
+        trace_computed(job,status,result);
+    }
+    PROF_END(PROF_COMPUTE,t);
+    return rlen;
+}
+
+static void admit_answered(const job_t *job); // see "Admission control"
+static void sock_reply(const job_t *job, const void *buf, size_t len); // see "Socket transport"
+
+// Compute one job and deliver the response to the client's FIFO (or hand it
+// to the reader for a socket client). Used by fork()ed children, pool
+// workers and pool threads alike.
+static void handle_job(const job_t *job){
+    resp_buf_t rbuf;
+    PROF_BEGIN(tp);
+    uint64_t t0=metrics_now();
+    size_t rlen=compute_job(job,&rbuf);
+    admit_answered(job);
+    uint64_t t1=metrics_now();
 
-        request_msg_t rq; // buffer to read the next request
-        ssize_t r=read_full(req_fd,&rq,sizeof(rq)); // block until a full request struct arrives
-        if(r==0){ // reader got EOF because all writers closed
-            close(req_fd); // close and re-open to continue receiving future writers
-            req_fd=open(REQ_FIFO_PATH,O_RDONLY);
-            if(req_fd<0) die("reopen");
+    if(job->sock){ // nothing to open: the reader owns the connection
+        PROF_BEGIN(tw);
+        sock_reply(job,&rbuf,rlen);
+        PROF_END(PROF_WRITE,tw);
+        if(tracing()) say("[SERVER %s=%d] response queued for %s\n", role, self_id, job->resp_fifo);
+        uint64_t t2=metrics_now();
+        metrics_observe(&met->stage[STAGE_QUEUE],t0-job->t_recv);
+        metrics_observe(&met->stage[STAGE_COMPUTE],t1-t0);
+        metrics_observe(&met->stage[STAGE_WRITE],t2-t1);
+        metrics_observe(&met->stage[STAGE_TOTAL],t2-job->t_recv);
+        PROF_END(PROF_REQUEST,tp);
+        return;
+    }
+
+    // Open (or reuse) the client's response FIFO
+    resp_slot_t *slot;
+    PROF_BEGIN(to);
+    int resp_fd=resp_open(job,&slot);
+    PROF_END(PROF_OPEN,to);
+    uint64_t t2=metrics_now();
+    if(resp_fd<0){
+        metrics_inc(&met->open_failed);
+        log_line("%s(%d) open resp %s failed: %s",role,self_id,job->resp_fifo,strerror(errno));
+        say("[SERVER %s=%d] failed to open %s: %s\n",
+            role, self_id, job->resp_fifo, strerror(errno));
+        PROF_END(PROF_REQUEST,tp);
+        return;
+    }
+    PROF_BEGIN(tw);
+    ssize_t w;
+    bool held=false; // coalesced: written later with the others
+    if(slot && coalesce_bytes>0){
+        w=resp_coalesce(slot,&rbuf,rlen); // a failure has already been counted and the entry evicted
+        held= w>=0 && slot->out_len>0;
+    } else {
+        w=write_full(resp_fd,&rbuf,rlen);
+        if(w<0 && errno==EPIPE && slot){
+            // Stale cached channel (client reopened its FIFO or went away): drop it and retry once
+            resp_cache_evict(job);
+            resp_fd=resp_open(job,&slot);
+            w=resp_fd<0 ? -1 : write_full(resp_fd,&rbuf,rlen);
+        }
+        if(w<0){
+            metrics_inc(&met->write_failed);
+            log_line("%s(%d) write resp failed: %s",role,self_id,strerror(errno));
+            if(slot) resp_cache_evict(job);
+        }
+    }
+    PROF_END(PROF_WRITE,tw);
+    if(w<0){
+        say("[SERVER %s=%d] write to %s FAILED: %s\n",
+            role, self_id, job->resp_fifo, strerror(errno));
+    }else if(tracing()){
+        // ---- PRINT: sent response ----
+        if(held) say("[SERVER %s=%d] response queued for %s (coalescing)\n", role, self_id, job->resp_fifo);
+        else     say("[SERVER %s=%d] response sent to %s\n", role, self_id, job->resp_fifo);
+    }
+    if(resp_fd>=0 && !slot) close(resp_fd); // close the response FIFO writer fd
+    uint64_t t3=metrics_now();
+    metrics_observe(&met->stage[STAGE_QUEUE],t0-job->t_recv);
+    metrics_observe(&met->stage[STAGE_COMPUTE],t1-t0);
+    metrics_observe(&met->stage[STAGE_OPEN],t2-t1);
+    metrics_observe(&met->stage[STAGE_WRITE],t3-t2);
+    metrics_observe(&met->stage[STAGE_TOTAL],t3-job->t_recv);
+    PROF_END(PROF_REQUEST,tp);
+}
+
+// Print the common "received request" trace and log line
+static void trace_recv(const job_t *job){
+    if(!tracing()) return;
+    if(job->batch_count){
+        say("[SERVER] recv from PID=%d : batch[%u] -> resp=%s\n",
+            (int)job->client_pid, job->batch_count, job->resp_fifo);
+        log_line("Recv PID=%d batch=%u resp=%s",
+                 (int)job->client_pid, job->batch_count, job->resp_fifo);
+        return;
+    }
+    if(job->big){
+        say("[SERVER] recv from PID=%d : big %s(%u limbs, %u limbs) -> resp=%s\n",
+            (int)job->client_pid, job->op_name, job->big_na, job->big_nb, job->resp_fifo);
+        log_line("Recv PID=%d big op=%s na=%u nb=%u resp=%s",
+                 (int)job->client_pid, job->op_name, job->big_na, job->big_nb, job->resp_fifo);
+        return;
+    }
+    if(job->expr_len){
+        say("[SERVER] recv from PID=%d : expr(%u insns, %u args) -> resp=%s\n",
+            (int)job->client_pid, job->expr_len, job->expr_nargs, job->resp_fifo);
+        log_line("Recv PID=%d expr len=%u nargs=%u resp=%s",
+                 (int)job->client_pid, job->expr_len, job->expr_nargs, job->resp_fifo);
+        return;
+    }
+    say("[SERVER] recv from PID=%d : %s(%lld,%lld) -> resp=%s\n",
+        (int)job->client_pid, job->op_name,
+        (long long)job->a, (long long)job->b, job->resp_fifo);
+
+    log_line("Recv PID=%d op=%s a=%lld b=%lld resp=%s",
+             (int)job->client_pid, job->op_name,
+             (long long)job->a,(long long)job->b,job->resp_fifo);
+}
+
+// Record a received request in the journal (--journal): one record per
+// call, one per tuple of a batch frame, all with the read's timestamp
+// (big-integer operands and expressions do not fit a record and are not
+// recorded)
+static void journal_job(const job_t *job, uint8_t transport){
+    if(job->big || job->expr_len) return;
+    unsigned n= job->batch_count ? job->batch_count : 1;
+    journal_rec_t *r=journal_claim(n);
+    if(!r){
+        static atomic_bool warned;
+        if(journal_path && !atomic_exchange(&warned,true)) log_line("Journal %s is full: further requests are not recorded", journal_path);
+        return;
+    }
+    uint64_t t=journal_time(job->t_recv ? job->t_recv : metrics_now());
+    const batch_t *bt= job->batch_count ? &batches[job->batch_slot] : NULL;
+    for(unsigned i=0;i<n;i++,r++){
+        r->t_ns=t; r->client_pid=(int32_t)job->client_pid; r->req_id=job->req_id; r->transport=transport;
+        if(bt){ r->opcode=bt->op[i]; r->a=bt->a[i]; r->b=bt->b[i]; r->flags=JOURNAL_BATCH; r->batch=(uint16_t)n; r->index=(uint16_t)i; }
+        else  { r->opcode=job->opcode; r->a=job->a; r->b=job->b; }
+        journal_commit(r,job->version);
+    }
+}
+
+// ---- Shared-memory channels (--transport shm) ----
+// An attach frame names a segment a client created (shmchan.h). The reader
+// maps it and starts a channel thread that owns both rings: it pops requests,
+// computes them inline and pushes the responses, so a call costs no system
+// call while both sides are spinning and one futex wake when the peer sleeps.
+// The thread ends when the client detaches or dies, or the server stops. On
+// a takeover it ends between two calls without closing the channel, and the
+// next server maps the segment again and carries on from the ring positions.
+#define SHM_MAX_CHANNELS 64
+typedef struct {
+    shm_chan_t *ch;              // mapped segment (NULL => free slot)
+    int         fd;              // open on it: the client unlinks the name, a takeover passes this
+    pthread_t   tid;             // its channel thread
+    atomic_bool done;            // thread has exited: join and unmap
+    char        name[SHM_NAME_MAX];
+} shm_conn_t;
+static shm_conn_t shm_conns[SHM_MAX_CHANNELS];
+static atomic_bool shm_stopping; // server shutdown: channel threads exit
+
+static void *shm_chan_main(void *arg){
+    shm_conn_t *c=arg; shm_chan_t *ch=c->ch;
+    role="shm"; self_id=ch->client_pid;
+    unsigned spin=shm_spin_max;
+    job_t job; memset(&job,0,sizeof(job));
+    job.version=2; job.client_pid=ch->client_pid;
+    snprintf(job.resp_fifo,sizeof(job.resp_fifo),"%s",c->name);
+
+    unsigned tail=atomic_load(&ch->req.tail), rhead=atomic_load(&ch->resp.head);
+    while(!atomic_load(&shm_stopping) && atomic_load(&ch->state)!=SHM_CLOSED){
+        if(atomic_load(&handed_over)) goto handed; // the takeover joins us and passes the channel on
+        if(atomic_load_explicit(&ch->req.head,memory_order_acquire)==tail){
+            if(busy_poll_ns && busy_poll_word(&ch->req.head,tail,busy_poll_ns)) continue;
+            if(!shm_wait(&ch->req.head,&ch->req.head_waiters,tail,&spin,shm_spin_max,SHM_WAIT_MS)
+               && kill(ch->client_pid,0)<0 && errno==ESRCH) break; // client died without detaching
             continue;
         }
-        if(r<0){ if(errno==EINTR) continue; die("read request"); }
-        if((size_t)r<sizeof(rq)){ log_line("Partial request (%zd bytes) ignored", r); continue; }
-
-        // ---- PRINT: received request ----
-        char opbuf[OP_MAX+1]={0}; memcpy(opbuf,rq.operation,OP_MAX); // make operation NUL-terminated for printing
-        printf("[SERVER] recv from PID=%d : %s(%lld,%lld) -> resp=%s\n",
-               (int)rq.client_pid, opbuf,
-               (long long)rq.operand1, (long long)rq.operand2, rq.resp_fifo);
-        fflush(stdout);
-
-        log_line("Recv PID=%d op=%s a=%lld b=%lld resp=%s",
-                 (int)rq.client_pid, opbuf,
-                 (long long)rq.operand1,(long long)rq.operand2,rq.resp_fifo);
-
-        // Fork a child to handle this request concurrently
-        pid_t cpid=fork();
-        if(cpid<0){
-            // Fork failed: attempt to compute and send a response in the parent (best-effort)
-            log_line("fork() failed: %s", strerror(errno));
-            response_msg_t rp; compute(&rq,&rp);
-            int resp_fd=open(rq.resp_fifo,O_WRONLY); // blocking open
-            if(resp_fd>=0){ write_full(resp_fd,&rp,sizeof(rp)); close(resp_fd); }
+        const v2_request_t *rq=&ch->req_slot[tail&(SHM_CHAN_CAP-1)];
+        job.opcode=rq->opcode; job.req_id=rq->req_id; job.a=rq->a; job.b=rq->b;
+        shm_advance(&ch->req.tail,&ch->req.tail_waiters,++tail);
+        set_op_name(&job);
+
+        trace_recv(&job);
+        if(journal_path) journal_job(&job,ARITH_TRANSPORT_SHM);
+        PROF_BEGIN(t);
+        int64_t result; int status=compute_call(job.opcode,job.a,job.b,&result);
+        PROF_END(PROF_COMPUTE,t);
+        count_answer(job.opcode,status);
+        trace_computed(&job,status,result);
+
+        // The client keeps at most SHM_CHAN_CAP calls in flight, so this only
+        // waits if it stopped reading; give up once it is gone
+        while(rhead-atomic_load_explicit(&ch->resp.tail,memory_order_acquire)==SHM_CHAN_CAP){
+            if(atomic_load(&shm_stopping) || atomic_load(&ch->state)==SHM_CLOSED) goto out;
+            if(!shm_wait(&ch->resp.tail,&ch->resp.tail_waiters,rhead-SHM_CHAN_CAP,&spin,shm_spin_max,SHM_WAIT_MS)
+               && kill(ch->client_pid,0)<0 && errno==ESRCH) goto out;
+        }
+        v2_response_t *rp=&ch->resp_slot[rhead&(SHM_CHAN_CAP-1)];
+        rp->req_id=job.req_id; rp->status=status; rp->result=result;
+        shm_advance(&ch->resp.head,&ch->resp.head_waiters,++rhead);
+    }
+out:
+    atomic_store(&ch->state,SHM_CLOSED);
+    atomic_fetch_sub(&met->shm_channels,1);
+    shm_futex_wake(&ch->state); shm_futex_wake(&ch->resp.head); // a waiting client sees the close
+    log_line("shm channel %s (PID=%d) detached", c->name, (int)ch->client_pid);
+    atomic_store(&c->done,true);
+    return NULL;
+handed:
+    atomic_fetch_sub(&met->shm_channels,1); // counted again wherever it goes on
+    return NULL;
+}
+
+// Unmap a slot's segment (its thread joined) and free the slot
+static void shm_conn_free(shm_conn_t *c){
+    munmap(c->ch,sizeof(*c->ch)); close(c->fd);
+    c->ch=NULL; c->fd=-1;
+}
+
+// Free slots whose thread has exited; returns a free slot or NULL
+static shm_conn_t *shm_conn_slot(void){
+    shm_conn_t *free_slot=NULL;
+    for(int i=0;i<SHM_MAX_CHANNELS;i++){
+        shm_conn_t *c=&shm_conns[i];
+        if(c->ch && atomic_load(&c->done)){ pthread_join(c->tid,NULL); shm_conn_free(c); }
+        if(!c->ch && !free_slot) free_slot=c;
+    }
+    return free_slot;
+}
+
+// Map the channel segment `name` of client `pid`, open on fd; NULL (logged) if it is not one
+static shm_chan_t *shm_map(int fd, const char *name, pid_t pid){
+    struct stat st; shm_chan_t *ch=MAP_FAILED;
+    if(fstat(fd,&st)==0 && (size_t)st.st_size>=sizeof(*ch))
+        ch=mmap(NULL,sizeof(*ch),PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+    if(ch==MAP_FAILED){ log_line("Attach PID=%d: cannot map %s",(int)pid,name); return NULL; }
+    if(ch->magic!=SHM_CHAN_MAGIC || ch->version!=ARITH_PROTO_VERSION || ch->client_pid!=pid){
+        log_line("Attach PID=%d: %s is not a channel of this client", (int)pid, name);
+        munmap(ch,sizeof(*ch)); return NULL;
+    }
+    return ch;
+}
+
+// Start the channel thread of slot c (its segment mapped); false if it could not start
+static bool shm_conn_start(shm_conn_t *c){
+    atomic_store(&c->done,false);
+    c->ch->server_pid=(int32_t)getpid();
+    atomic_fetch_add(&met->shm_channels,1); // the thread takes it back when it ends
+    sigset_t old; block_reader_signals(&old);
+    int e=pthread_create(&c->tid,NULL,shm_chan_main,c);
+    pthread_sigmask(SIG_SETMASK,&old,NULL);
+    if(!e) return true;
+    log_line("shm channel %s: pthread_create: %s", c->name, strerror(e));
+    atomic_fetch_sub(&met->shm_channels,1);
+    return false;
+}
+
+// Serve a mapped segment in a free slot (which takes fd); the slot, or NULL if none is free
+static shm_conn_t *shm_serve(shm_chan_t *ch, int fd, const char *name){
+    shm_conn_t *c= shm_transport ? shm_conn_slot() : NULL;
+    if(!c) return NULL;
+    c->ch=ch; c->fd=fd;
+    snprintf(c->name,sizeof(c->name),"%s",name);
+    if(shm_conn_start(c)) return c;
+    c->ch=NULL;
+    return NULL;
+}
+
+// Answer an attach frame: map the client's segment and start serving it, or
+// mark it refused. Either way the answer is the segment's state word.
+static void handle_attach(const v2_hello_t *h){
+    char name[SHM_NAME_MAX];
+    if(h->path_len==0 || h->path_len>=SHM_NAME_MAX){ metrics_inc(&met->bad_frames); log_line("Attach from PID=%d with bad name length %u ignored",(int)h->client_pid,h->path_len); return; }
+    memcpy(name,h+1,h->path_len);
+    name[h->path_len]='\0';
+    if(strncmp(name,SHM_NAME_PREFIX,strlen(SHM_NAME_PREFIX))){ metrics_inc(&met->bad_frames); log_line("Attach to foreign segment %s ignored", name); return; }
+
+    int fd=shm_open(name,O_RDWR|O_CLOEXEC,0);
+    if(fd<0){ log_line("Attach PID=%d: shm_open %s failed: %s",(int)h->client_pid,name,strerror(errno)); return; }
+    shm_chan_t *ch=shm_map(fd,name,h->client_pid);
+    if(!ch){ close(fd); return; }
+    shm_conn_t *c=shm_serve(ch,fd,name);
+    if(c) metrics_inc(&met->attaches);
+    atomic_store(&ch->state, c ? SHM_ATTACHED : SHM_REFUSED);
+    shm_futex_wake(&ch->state);
+    log_line("Attach PID=%d shm=%s -> %s", (int)h->client_pid, name, c ? "attached" : "refused");
+    if(log_level>=LVL_INFO) say("[SERVER] attach from PID=%d -> %s\n", (int)h->client_pid, c ? name : "refused");
+    if(!c){ munmap(ch,sizeof(*ch)); close(fd); }
+}
+
+// Shutdown: stop every channel thread and unmap its segment
+static void shm_stop(void){
+    atomic_store(&shm_stopping,true);
+    for(int i=0;i<SHM_MAX_CHANNELS;i++){
+        shm_conn_t *c=&shm_conns[i];
+        if(!c->ch) continue;
+        shm_futex_wake(&c->ch->req.head); shm_futex_wake(&c->ch->resp.tail); // cut a sleep short
+        pthread_join(c->tid,NULL);
+        shm_conn_free(c);
+    }
+}
+
+// ---- Request framing (readers only) ----
+// A reader drains its request FIFO in bulk: one readv() pulls in everything
+// that is queued (up to RX_BUF bytes, many pipe buffers' worth of requests)
+// into a byte ring, then every whole frame in it is parsed in turn. A frame
+// whose tail has not arrived yet stays in the ring and is completed by the
+// next read instead of being dropped. Every reader has a ring of its own.
+#define RX_BUF (64*1024) // power of two, well above the largest frame
+struct rx {
+    uint8_t buf[RX_BUF];
+    size_t  head, tail;   // fill / parse positions (free-running)
+    // Batching factor: requests parsed per read() that returned data
+    unsigned long long reads, requests, max_per_read;
+};
+static struct rx main_rx;
+
+static size_t rx_avail(const struct rx *rx){ return rx->head-rx->tail; }
+
+// Copy n bytes starting `off` bytes past the parse position (handles the wrap)
+static void rx_peek(const struct rx *rx, size_t off, void *dst, size_t n){
+    size_t pos=(rx->tail+off)&(RX_BUF-1);
+    size_t first= RX_BUF-pos<n ? RX_BUF-pos : n;
+    memcpy(dst,rx->buf+pos,first);
+    memcpy((char*)dst+first,rx->buf,n-first);
+}
+
+// One readv() into all free space of the ring; returns bytes read, 0 on EOF, -1 on error
+static ssize_t rx_fill(struct rx *rx, int fd){
+    size_t pos=rx->head&(RX_BUF-1), room=RX_BUF-rx_avail(rx); // room > 0: only a partial frame is ever left over
+    struct iovec iov[2]; int cnt=1;
+    iov[0].iov_base=rx->buf+pos; iov[0].iov_len= RX_BUF-pos<room ? RX_BUF-pos : room;
+    if(iov[0].iov_len<room){ iov[1].iov_base=rx->buf; iov[1].iov_len=room-iov[0].iov_len; cnt=2; }
+    ssize_t r=readv(fd,iov,cnt);
+    if(r>0) rx->head+=(size_t)r;
+    return r;
+}
+
+// Append n bytes that a completed read delivered elsewhere (io_uring engine)
+static void rx_push(struct rx *rx, const void *src, size_t n){
+    size_t pos=rx->head&(RX_BUF-1);
+    size_t first= RX_BUF-pos<n ? RX_BUF-pos : n;
+    memcpy(rx->buf+pos,src,first);
+    memcpy(rx->buf,(const char*)src+first,n-first);
+    rx->head+=n;
+}
+
+// An expression header's counts are within the protocol's limits
+static bool expr_sizes_ok(const v2_expr_hdr_t *h){ return h->len && h->len<=ARITH_EXPR_MAX && h->nargs<=ARITH_EXPR_ARGS_MAX; }
+
+// Size of the frame at the parse position (0 while even its header is incomplete).
+// A header announcing a bad length only covers itself, like an unknown type byte.
+static size_t rx_frame_len(const struct rx *rx){
+    size_t avail=rx_avail(rx);
+    if(!avail) return 0;
+    uint8_t type; rx_peek(rx,0,&type,1);
+    if(type<0x80) return sizeof(request_msg_t);
+    switch(type){
+    case ARITH_FRAME_CALL: return sizeof(v2_request_t);
+    case ARITH_FRAME_HELLO:
+    case ARITH_FRAME_ATTACH: {
+        v2_hello_t h; if(avail<sizeof(h)) return 0;
+        rx_peek(rx,0,&h,sizeof(h));
+        return sizeof(h) + (h.path_len && h.path_len<RESP_NAME_MAX ? h.path_len : 0);
+    }
+    case ARITH_FRAME_BATCH: {
+        v2_batch_hdr_t h; if(avail<sizeof(h)) return 0;
+        rx_peek(rx,0,&h,sizeof(h));
+        return sizeof(h) + (h.count && h.count<=ARITH_BATCH_MAX ? h.count*sizeof(v2_batch_item_t) : 0);
+    }
+    case ARITH_FRAME_BIG: {
+        v2_big_hdr_t h; if(avail<sizeof(h)) return 0;
+        rx_peek(rx,0,&h,sizeof(h));
+        return sizeof(h) + (h.na<=ARITH_BIG_LIMBS_MAX && h.nb<=ARITH_BIG_LIMBS_MAX ? (h.na+h.nb)*sizeof(uint64_t) : 0);
+    }
+    case ARITH_FRAME_EXPR: {
+        v2_expr_hdr_t h; if(avail<sizeof(h)) return 0;
+        rx_peek(rx,0,&h,sizeof(h));
+        return sizeof(h) + (expr_sizes_ok(&h) ? h.len*sizeof(v2_expr_insn_t)+h.nargs*sizeof(int64_t) : 0);
+    }
+    default: return 1; // resync byte by byte
+    }
+}
+
+// Any whole frame, copied out of the ring
+typedef union {
+    uint8_t        type;
+    request_msg_t  v1;
+    v2_request_t   v2;
+    v2_hello_t     hello;
+    v2_batch_hdr_t batch;
+    v2_big_hdr_t   big;
+    v2_expr_hdr_t  expr;
+    char           raw[ARITH_PIPE_BUF];
+} frame_t;
+
+// Answer a v2 hello: register the session and ack with its id. The client
+// holds its FIFO open (v2 requires it), so a non-blocking open suffices and
+// the reader never waits on a client.
+static void handle_hello(const frame_t *f){
+    const v2_hello_t *h=&f->hello;
+    char path[RESP_NAME_MAX];
+    if(h->path_len==0 || h->path_len>=RESP_NAME_MAX){ metrics_inc(&met->bad_frames); log_line("Hello from PID=%d with bad path length %u ignored",(int)h->client_pid,h->path_len); return; }
+    memcpy(path,h+1,h->path_len);
+    path[h->path_len]='\0';
+
+    uint8_t cls= h->sched_class<ARITH_CLASS_COUNT ? h->sched_class : ARITH_CLASS_NORMAL;
+    uint16_t id = h->version==ARITH_PROTO_VERSION ? session_register(h->client_pid,path,cls) : 0;
+    v2_response_t ack={ .req_id=h->req_id, .status= id ? ARITH_OK : ARITH_ENOSESSION, .result=id };
+    int afd=open(path,O_WRONLY|O_NONBLOCK);
+    if(afd<0 || write_full(afd,&ack,sizeof(ack))<0)
+        log_line("Hello ack to %s failed: %s", path, strerror(errno));
+    if(afd>=0) close(afd);
+    if(id) metrics_inc(&met->hellos);
+    log_line("Hello PID=%d resp=%s class %s -> session %u", (int)h->client_pid, path, class_names[cls], id);
+    if(log_level>=LVL_INFO) say("[SERVER] hello from PID=%d -> session %u\n", (int)h->client_pid, id);
+}
+
+// Unpack the tuples of a v2 batch frame (header followed by its tuples, the
+// count already checked) into a batch slot; 0 if shutting down
+static int batch_unpack(const v2_batch_hdr_t *h, job_t *job){
+    int32_t slot=batch_acquire();
+    if(slot<0) return 0;
+    batch_t *bt=&batches[slot];
+    const v2_batch_item_t *items=(const v2_batch_item_t*)(h+1);
+    for(size_t i=0;i<h->count;i++){ bt->op[i]=items[i].opcode; bt->a[i]=items[i].a; bt->b[i]=items[i].b; }
+    job->version=2; job->session=h->session; job->req_id=h->req_id;
+    job->batch_count=h->count; job->batch_slot=slot;
+    metrics_inc(&met->batches);
+    snprintf(job->op_name,sizeof(job->op_name),"batch");
+    return 1;
+}
+
+// A batch frame from a request FIFO: answered on its session's FIFO
+static int parse_batch(const frame_t *f, job_t *job){
+    const v2_batch_hdr_t *h=&f->batch;
+    if(h->count==0 || h->count>ARITH_BATCH_MAX){ metrics_inc(&met->bad_frames); log_line("Batch with bad count %u ignored", h->count); return 0; } // cannot resync on the tuples
+    const session_t *s=session_get(h->session);
+    if(!s){ metrics_inc(&met->bad_frames); log_line("Batch for unknown session %u ignored", h->session); return 0; }
+    if(!batch_unpack(h,job)) return 0;
+    job->client_pid=s->pid; job->sched_class=s->sched_class;
+    memcpy(job->resp_fifo,s->path,RESP_NAME_MAX);
+    return 1;
+}
+
+_Static_assert(ARITH_BIG_LIMBS_MAX<=ARITH_BATCH_MAX, "big-integer operands fit a batch slot");
+
+// Unpack the operands of a big-integer frame (header followed by its limbs,
+// the sizes already checked) into a batch slot, without leading zero limbs;
+// 0 if shutting down
+static int big_unpack(const v2_big_hdr_t *h, job_t *job){
+    int32_t slot=batch_acquire();
+    if(slot<0) return 0;
+    batch_t *bt=&batches[slot];
+    const char *limbs=(const char*)(h+1); // unaligned in the frame
+    size_t na=h->na, nb=h->nb;
+    memcpy(bt->a,limbs,na*sizeof(uint64_t));
+    memcpy(bt->b,limbs+na*sizeof(uint64_t),nb*sizeof(uint64_t));
+    while(na && !bt->a[na-1]) na--;
+    while(nb && !bt->b[nb-1]) nb--;
+    job->version=2; job->opcode=h->opcode; job->session=h->session; job->req_id=h->req_id;
+    job->big=true; job->batch_slot=slot;
+    job->big_na=(uint16_t)na; job->big_nb=(uint16_t)nb;
+    job->big_sign=(uint8_t)((na && (h->sign&ARITH_BIG_NEG_A) ? ARITH_BIG_NEG_A : 0) | (nb && (h->sign&ARITH_BIG_NEG_B) ? ARITH_BIG_NEG_B : 0));
+    set_op_name(job);
+    return 1;
+}
+
+// A big-integer frame from a request FIFO: answered on its session's FIFO
+static int parse_big(const frame_t *f, job_t *job){
+    const v2_big_hdr_t *h=&f->big;
+    if(h->na>ARITH_BIG_LIMBS_MAX || h->nb>ARITH_BIG_LIMBS_MAX){ metrics_inc(&met->bad_frames); log_line("Big-integer frame with %u+%u limbs ignored", h->na, h->nb); return 0; }
+    const session_t *s=session_get(h->session);
+    if(!s){ metrics_inc(&met->bad_frames); log_line("Big-integer frame for unknown session %u ignored", h->session); return 0; }
+    if(!big_unpack(h,job)) return 0;
+    job->client_pid=s->pid; job->sched_class=s->sched_class;
+    memcpy(job->resp_fifo,s->path,RESP_NAME_MAX);
+    return 1;
+}
+
+_Static_assert(ARITH_EXPR_MAX<=ARITH_BATCH_MAX && ARITH_EXPR_ARGS_MAX<=ARITH_BATCH_MAX, "expressions fit a batch slot");
+
+// Unpack the program and arguments of an expression frame (header followed
+// by them, the counts already checked) into a batch slot; 0 if shutting down
+static int expr_unpack(const v2_expr_hdr_t *h, job_t *job){
+    int32_t slot=batch_acquire();
+    if(slot<0) return 0;
+    batch_t *bt=&batches[slot];
+    const v2_expr_insn_t *insn=(const v2_expr_insn_t*)(h+1);
+    for(size_t i=0;i<h->len;i++){ bt->op[i]=insn[i].code; bt->a[i]=insn[i].val; }
+    memcpy(bt->b,insn+h->len,h->nargs*sizeof(int64_t)); // unaligned in the frame
+    job->version=2; job->session=h->session; job->req_id=h->req_id;
+    job->expr_len=h->len; job->expr_nargs=h->nargs; job->batch_slot=slot;
+    snprintf(job->op_name,sizeof(job->op_name),"expr");
+    return 1;
+}
+
+// An expression frame from a request FIFO: answered on its session's FIFO
+static int parse_expr(const frame_t *f, job_t *job){
+    const v2_expr_hdr_t *h=&f->expr;
+    if(!expr_sizes_ok(h)){ metrics_inc(&met->bad_frames); log_line("Expression with %u instructions, %u arguments ignored", h->len, h->nargs); return 0; }
+    const session_t *s=session_get(h->session);
+    if(!s){ metrics_inc(&met->bad_frames); log_line("Expression for unknown session %u ignored", h->session); return 0; }
+    if(!expr_unpack(h,job)) return 0;
+    job->client_pid=s->pid; job->sched_class=s->sched_class;
+    memcpy(job->resp_fifo,s->path,RESP_NAME_MAX);
+    return 1;
+}
+
+// Serializes session registration and shm attaches (not the hot path)
+// between the main reader and shard readers
+static pthread_mutex_t control_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Take the next whole frame out of the ring. Returns 1 with *job filled for a
+// request, 0 for a frame consumed without producing a job (hello, bad frame)
+// and -1 when the ring holds no complete frame (wait for the next read).
+static int rx_next(struct rx *rx, job_t *job){
+    size_t len=rx_frame_len(rx);
+    if(len==0 || len>rx_avail(rx)) return -1;
+    frame_t f;
+    rx_peek(rx,0,&f,len);
+    rx->tail+=len;
+    memset(job,0,sizeof(*job));
+
+    if(f.type<0x80){ // ---- v1 request ----
+        job->version=1;
+        memcpy(job->op_name,f.v1.operation,OP_MAX); // make operation NUL-terminated for printing
+        job->opcode=arith_op_from_name(job->op_name);
+        job->a=f.v1.operand1; job->b=f.v1.operand2; job->client_pid=f.v1.client_pid;
+        memcpy(job->resp_fifo,f.v1.resp_fifo,RESP_NAME_MAX); job->resp_fifo[RESP_NAME_MAX-1]='\0';
+        return 1;
+    }
+    if(f.type==ARITH_FRAME_HELLO || f.type==ARITH_FRAME_ATTACH){
+        pthread_mutex_lock(&control_lock);
+        if(f.type==ARITH_FRAME_HELLO) handle_hello(&f); else handle_attach(&f.hello);
+        pthread_mutex_unlock(&control_lock);
+        return 0;
+    }
+    if(f.type==ARITH_FRAME_BATCH) return parse_batch(&f,job);
+    if(f.type==ARITH_FRAME_BIG) return parse_big(&f,job);
+    if(f.type==ARITH_FRAME_EXPR) return parse_expr(&f,job);
+    if(f.type!=ARITH_FRAME_CALL){ metrics_inc(&met->bad_frames); log_line("Unknown frame type 0x%02x ignored", f.type); return 0; }
+
+    // ---- v2 call ----
+    const session_t *s=session_get(f.v2.session);
+    if(!s){ metrics_inc(&met->bad_frames); log_line("Request for unknown session %u ignored", f.v2.session); return 0; } // no channel to answer on
+    job->version=2; job->opcode=f.v2.opcode; job->session=f.v2.session; job->req_id=f.v2.req_id;
+    job->a=f.v2.a; job->b=f.v2.b; job->client_pid=s->pid; job->sched_class=s->sched_class;
+    set_op_name(job);
+    memcpy(job->resp_fifo,s->path,RESP_NAME_MAX);
+    return 1;
+}
+
+// ---- Admission control ----
+// Every request a reader decodes is admitted or turned away before it reaches
+// an executor. Fork mode runs at most --max-inflight children at once; the
+// requests beyond that wait in a bounded queue of --queue jobs and start as
+// children exit. For --workers and --threads the dispatch ring is that queue.
+// --client-cap N bounds what one client has admitted and not yet answered,
+// so a noisy PID cannot fill the queue for everyone else. A request that does
+// not fit (or whose fork() fails) is answered at once with ARITH_EBUSY
+// through the event loop's non-blocking connections, so the reader never
+// blocks on a client and the client can back off. --engine epoll computes
+// each request as it reads it and admits everything. The counters (admit_t)
+// live in the metrics segment: workers update them too.
+static admit_t *adm = NULL; // &met->admit
+
+static void busy_reject(const job_t *job); // answer ARITH_EBUSY (see "Busy answers")
+
+static unsigned admit_bucket(pid_t pid){ return ((uint32_t)pid*2654435761u)>>20; }
+
+// Charge a request to its client; false (counted) if the client is at its cap
+static bool admit_client(const job_t *job){
+    if(!client_cap) return true;
+    atomic_ushort *n=&adm->client[admit_bucket(job->client_pid)];
+    if(atomic_fetch_add(n,1)<client_cap) return true;
+    atomic_fetch_sub(n,1);
+    atomic_fetch_add(&adm->busy_client,1);
+    return false;
+}
+
+// A request of this client has been answered (or will never be)
+static void admit_release(pid_t client){
+    if(client_cap) atomic_fetch_sub(&adm->client[admit_bucket(client)],1);
+}
+
+static void admit_queued(int delta){
+    int q=atomic_fetch_add(&adm->queued,delta)+delta;
+    int m=atomic_load(&adm->queued_max);
+    while(q>m && !atomic_compare_exchange_weak(&adm->queued_max,&m,q)){}
+}
+
+// No room for an admitted-by-client request: undo its charge and turn it away
+static void admit_full(const job_t *job){
+    admit_release(job->client_pid);
+    atomic_fetch_add(&adm->busy_full,1);
+    busy_reject(job);
+}
+
+// ---- Fair queueing (--fair) ----
+// By default admitted requests wait for an executor in arrival order, so one
+// client's backlog of batch frames delays every call behind it by all of
+// them. With --fair they wait in a drr_t (drr.h) instead: one FIFO per
+// client PID, served by deficit round-robin with --fair-quantum tuples per
+// turn, high clients before normal ones before bulk ones (the class each
+// declared in its hello). It replaces the fork queue in fork mode and the
+// dispatch ring for --workers/--threads; --engine epoll computes every
+// request as it reads it and has nothing waiting to reorder.
+static const unsigned class_rank[ARITH_CLASS_COUNT]={ [ARITH_CLASS_HIGH]=0, [ARITH_CLASS_NORMAL]=1, [ARITH_CLASS_BULK]=2 };
+_Static_assert(ARITH_CLASS_COUNT==DRR_CLASSES, "one round per class");
+
+// What a request costs its client's turn: its tuples (a big-integer call:
+// its limbs, an expression: its instructions)
+static unsigned job_cost(const job_t *job){
+    if(job->batch_count) return job->batch_count;
+    if(job->big) return 1u+job->big_na+job->big_nb;
+    if(job->expr_len) return job->expr_len;
+    return 1;
+}
+
+// Queue a job in q (the caller holds q's lock and has checked there is room)
+static void fair_push(drr_t *q, const job_t *job){
+    drr_push(q,job->client_pid,class_rank[job->sched_class],job_cost(job),job);
+}
+
+// A fair queue for queue_cap jobs, in memory from alloc
+static drr_t *fair_create(void *(*alloc)(size_t)){
+    size_t cap=(size_t)queue_cap;
+    drr_t *q=alloc(drr_bytes(cap,sizeof(job_t)));
+    if(!q) die("alloc fair queue");
+    drr_init(q,cap,sizeof(job_t),(unsigned)fair_quantum);
+    return q;
+}
+
+// ---- Dispatch queue (--workers / --threads) ----
+// The reader is the only producer: it pushes jobs into the ring. Pool workers
+// or threads pop, compute and respond. The ring itself is lock-free; the
+// semaphores only park consumers when it is empty and the reader when it is
+// full (glibc's sem_post/sem_wait stay in user space when nobody is parked).
+// Everything lives in one shared mapping so worker processes can use it too.
+// With --fair the jobs go to dq_fair instead, under a process-shared mutex
+// (robust: a worker killed inside it must not wedge the others).
+typedef struct {
+    sem_t items;       // counts queued jobs
+    sem_t slots;       // counts free ring slots
+    atomic_bool stop;  // set once the reader is done; consumers drain and exit
+    pthread_mutex_t fair_lock; // --fair: guards dq_fair
+    ring_t ring;       // must be last: ring slots follow it
+} dispatch_t;
+static dispatch_t *dq = NULL;
+static drr_t *dq_fair = NULL; // --fair: the queue, shared like dq
+
+static void dispatch_init(void){
+    size_t cap=ring_capacity((size_t)queue_cap);
+    dq=shared_alloc(sizeof(dispatch_t)+cap*ring_slot_size(sizeof(job_t)));
+    if(!dq) die("mmap dispatch ring");
+    ring_init(&dq->ring,cap,sizeof(job_t));
+    if(sem_init(&dq->items,1,0)<0 || sem_init(&dq->slots,1,(unsigned)queue_cap)<0) die("sem_init"); // --queue, exactly
+    atomic_init(&dq->stop,false);
+    if(!fair) return;
+    dq_fair=fair_create(shared_alloc);
+    pthread_mutexattr_t ma; pthread_mutexattr_init(&ma);
+    pthread_mutexattr_setpshared(&ma,PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&ma,PTHREAD_MUTEX_ROBUST);
+    if(pthread_mutex_init(&dq->fair_lock,&ma)) die("pthread_mutex_init");
+    pthread_mutexattr_destroy(&ma);
+}
+
+static void fair_lock(void){
+    if(pthread_mutex_lock(&dq->fair_lock)==EOWNERDEAD) // its holder died between two stores: take the queue as it is
+        pthread_mutex_consistent(&dq->fair_lock);
+}
+
+// Take the next job out of the ring or the fair queue; false if there is none
+static bool dispatch_pop(job_t *job){
+    if(!dq_fair) return ring_pop(&dq->ring,job);
+    fair_lock();
+    bool got=drr_pop(dq_fair,job);
+    pthread_mutex_unlock(&dq->fair_lock);
+    return got;
+}
+
+// Consumer body shared by pool workers and pool threads
+static void consume_jobs(void){
+    resp_cache_init();
+    expr_cache_init();
+    uint64_t window_ns=(uint64_t)coalesce_us*1000;
+    for(;;){
+        // Coalesced responses wait only while more jobs are queued: flush
+        // before parking, and once the oldest has waited out the window
+        bool got=false;
+        if(rcache_pending){
+            got= sem_trywait(&dq->items)==0;
+            if(!got || metrics_now()-rcache_since>=window_ns) resp_cache_flush();
+        }
+        if(!got && busy_poll_ns){ // --busy-poll: keep trying before parking
+            uint64_t end=metrics_now()+busy_poll_ns; unsigned polls=0;
+            while(!(got= sem_trywait(&dq->items)==0) && metrics_now()<end) busy_poll_pause(&polls);
+        }
+        if(!got && sem_wait(&dq->items)<0){ if(errno==EINTR && !stop_requested) continue; break; }
+        job_t job;
+        if(!dispatch_pop(&job)){
+            if(atomic_load(&dq->stop)) break; // wake-up without a job: shutdown
             continue;
         }
-        if(cpid==0){
-            // Child: compute and respond, then exit
-            response_msg_t rp; memset(&rp,0,sizeof(rp));
-            compute(&rq,&rp);
-
-            // ---- PRINT: computed result ----
-            char cop[OP_MAX+1]={0}; memcpy(cop,rq.operation,OP_MAX);
-            if(rp.success){
-                printf("[SERVER child=%d] computed %s(%lld,%lld) = %lld\n",
-                       (int)getpid(), cop,
-                       (long long)rq.operand1, (long long)rq.operand2,
-                       (long long)rp.result);
-            } else {
-                printf("[SERVER child=%d] computed %s(%lld,%lld) -> ERROR: %s\n",
-                       (int)getpid(), cop,
-                       (long long)rq.operand1, (long long)rq.operand2,
-                       rp.error);
-            }
-            fflush(stdout);
-
-            // Open client's response FIFO for writing (blocks until client opens read end)
-            int resp_fd=open(rq.resp_fifo,O_WRONLY); // BLOCKS until client opens read end
-            if(resp_fd<0){
-                log_line("child(%d) open resp %s failed: %s",(int)getpid(),rq.resp_fifo,strerror(errno));
-                printf("[SERVER child=%d] failed to open %s: %s\n",
-                       (int)getpid(), rq.resp_fifo, strerror(errno));
-                fflush(stdout);
-                _exit(0);
-            }
-            if(write_full(resp_fd,&rp,sizeof(rp))<0){
-                log_line("child(%d) write resp failed: %s",(int)getpid(),strerror(errno));
-                printf("[SERVER child=%d] write to %s FAILED: %s\n",
-                       (int)getpid(), rq.resp_fifo, strerror(errno));
-            }else{
-                // ---- PRINT: sent response ----
-                printf("[SERVER child=%d] response sent to %s\n",
-                       (int)getpid(), rq.resp_fifo);
-            }
-            fflush(stdout);
-            close(resp_fd); // close the response FIFO writer fd
-            _exit(0); // child exits without running parent's atexit handlers
+        sem_post(&dq->slots);
+        admit_queued(-1); atomic_fetch_add(&adm->running,1);
+        handle_job(&job);
+        atomic_fetch_sub(&adm->running,1);
+    }
+    resp_cache_free();
+    expr_cache_free(xcache); xcache=NULL;
+}
+
+static void sock_forget(void); // see "Socket transport"
+
+// ---- Pre-forked worker pool (--workers N) ----
+static pid_t *workers = NULL;    // worker PIDs indexed by slot
+static time_t *worker_born = NULL; // spawn time per slot (crash-loop throttle)
+
+// Fork one worker into `slot`; returns its PID or -1
+static pid_t spawn_worker(int slot){
+    pid_t p=fork();
+    if(p<0){ log_line("fork() worker %d failed: %s", slot, strerror(errno)); workers[slot]=-1; return -1; }
+    if(p==0){
+        ev_signal_reset(sig_fd);          // SIGTERM (pool_stop, parent death) ends a worker
+#ifdef __linux__
+        prctl(PR_SET_PDEATHSIG, SIGTERM); // don't outlive a parent killed with SIGKILL
+        if(getppid()==1) _exit(0);        // parent already gone
+#endif
+        role="worker"; self_id=(int)getpid();
+        close(main_rd.fd); close(main_rd.dummy_w); // only the parent reads the request FIFOs
+        for(int i=0;i<n_shards && shards;i++){ close(shards[i].fd); close(shards[i].dummy_w); } // --takeover: not taken over yet
+        sock_forget();                    // socket clients are answered through the reader
+        if(tk_listen>=0) close(tk_listen); // only the reader hands over
+        consume_jobs();
+        PROF_FLUSH();
+        _exit(0); // never run the parent's atexit cleanup (it unlinks the FIFO)
+    }
+    workers[slot]=p; worker_born[slot]=time(NULL);
+    return p;
+}
+
+// Reap exited workers and respawn them (called by the reader after SIGCHLD)
+static void reap_workers(void){
+    int st; pid_t p;
+    while((p=waitpid(-1,&st,WNOHANG))>0){
+        for(int i=0;i<n_workers;i++){
+            if(workers[i]!=p) continue;
+            if(WIFSIGNALED(st)) log_line("worker %d (pid %d) killed by signal %d; respawning", i, (int)p, WTERMSIG(st));
+            else                log_line("worker %d (pid %d) exited with status %d; respawning", i, (int)p, WEXITSTATUS(st));
+            workers[i]=-1;
+            if(stop_requested) break;
+            if(time(NULL)-worker_born[i]<1) sleep(1); // crash loop: don't fork-bomb
+            spawn_worker(i);
+            break;
+        }
+    }
+    for(int i=0;i<n_workers && !stop_requested;i++) if(workers[i]<0) spawn_worker(i); // earlier fork failures
+}
+
+static void pool_start(void){
+    workers=calloc((size_t)n_workers,sizeof(*workers));
+    worker_born=calloc((size_t)n_workers,sizeof(*worker_born));
+    if(!workers || !worker_born) die("calloc workers");
+    for(int i=0;i<n_workers;i++) spawn_worker(i);
+    log_line("Worker pool started with %d workers", n_workers);
+}
+
+// Shutdown: let workers drain the queue, then stop stragglers and reap them all
+static void pool_stop(void){
+    atomic_store(&dq->stop,true);
+    for(int i=0;i<n_workers;i++) sem_post(&dq->items);
+    for(int waited=0; waited<200; waited++){ // up to ~2s for a graceful drain
+        int alive=0;
+        for(int i=0;i<n_workers;i++){
+            if(workers[i]<=0) continue;
+            if(waitpid(workers[i],NULL,WNOHANG)==workers[i]) workers[i]=-1; else alive++;
+        }
+        if(!alive) break;
+        struct timespec ts={0,10*1000*1000}; nanosleep(&ts,NULL);
+    }
+    for(int i=0;i<n_workers;i++) if(workers[i]>0) kill(workers[i],SIGTERM);
+    for(int i=0;i<n_workers;i++) if(workers[i]>0) while(waitpid(workers[i],NULL,0)<0 && errno==EINTR){}
+    log_line("Worker pool stopped");
+    free(workers); free(worker_born); workers=NULL; worker_born=NULL;
+}
+
+// ---- Thread pool (--threads N) ----
+static pthread_t *tids = NULL;
+
+static void *thread_main(void *arg){
+    role="thread"; self_id=(int)(intptr_t)arg;
+    consume_jobs();
+    return NULL;
+}
+
+// Bind `t` to one CPU: the idx-th (modulo their count) of those the
+// process may run on, i.e. of --cpus when given (best effort, Linux only)
+static void pin_thread(pthread_t t, int idx){
+#ifdef __linux__
+    cpu_set_t allowed; CPU_ZERO(&allowed);
+    int ncpu= sched_getaffinity(0,sizeof(allowed),&allowed)==0 ? CPU_COUNT(&allowed) : 0;
+    int cpu=idx;
+    if(ncpu>0) for(int i=0, k=idx%ncpu; i<CPU_SETSIZE; i++) if(CPU_ISSET(i,&allowed) && k--==0){ cpu=i; break; }
+    cpu_set_t set; CPU_ZERO(&set); CPU_SET(cpu,&set);
+    int e=pthread_setaffinity_np(t,sizeof(set),&set);
+    if(e) log_line("pin thread %d: %s", idx, strerror(e));
+#else
+    (void)t; (void)idx;
+#endif
+}
+
+static void threads_start(void){
+    tids=calloc((size_t)n_threads,sizeof(*tids));
+    if(!tids) die("calloc threads");
+    sigset_t old; block_reader_signals(&old);
+    for(int i=0;i<n_threads;i++){
+        int e=pthread_create(&tids[i],NULL,thread_main,(void*)(intptr_t)i);
+        if(e){ errno=e; die("pthread_create"); }
+        if(pin_threads) pin_thread(tids[i],i);
+    }
+    pthread_sigmask(SIG_SETMASK,&old,NULL);
+    log_line("Thread pool started with %d threads%s", n_threads, pin_threads?" (pinned)":"");
+}
+
+// Shutdown: let threads drain what is queued, then wake each one to exit
+// (a thread stuck in a blocking response open() for a vanished client is
+// kicked out of it with SIGUSR1 until it exits)
+static void threads_stop(void){
+    atomic_store(&dq->stop,true);
+    for(int i=0;i<n_threads;i++) sem_post(&dq->items);
+    for(int i=0;i<n_threads;i++){
+#ifdef __linux__
+        struct timespec ts;
+        for(;;){
+            clock_gettime(CLOCK_REALTIME,&ts); ts.tv_nsec+=100*1000*1000;
+            if(ts.tv_nsec>=1000000000L){ ts.tv_sec++; ts.tv_nsec-=1000000000L; }
+            if(pthread_timedjoin_np(tids[i],NULL,&ts)==0) break;
+            pthread_kill(tids[i],SIGUSR1);
+        }
+#else
+        pthread_join(tids[i],NULL);
+#endif
+    }
+    log_line("Thread pool stopped");
+    free(tids); tids=NULL;
+}
+
+// ---- Executors: what the reader does with each job ----
+
+// Fork mode bookkeeping, shared by every reader and the SIGCHLD reaper:
+// the live children (with the client each one serves, released on reap, so
+// a crashed child gives its slot back too) and the queue of admitted
+// requests waiting for one of them to exit
+typedef struct {
+    pid_t       pid, client;  // child (0 => free slot) and the client it serves
+    atomic_bool released;     // the child released the client's charge itself
+} child_t;
+static child_t *children = NULL;      // max_inflight slots, shared with the children
+static int      child_slot = -1;      // in a fork()ed child: its slot
+static job_t   *fork_q = NULL;        // queue_cap jobs, FIFO order
+static drr_t   *fork_fair = NULL;     // --fair: queue_cap jobs, fair order (instead of fork_q)
+static size_t   fork_q_head = 0, fork_q_len = 0;
+static pthread_mutex_t fork_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void fork_init(void){
+    children=shared_alloc((size_t)max_inflight*sizeof(*children));
+    if(fair) fork_fair=fair_create(malloc);
+    else     fork_q=malloc((size_t)queue_cap*sizeof(*fork_q));
+    if(!children || (!fork_q && !fork_fair)) die("calloc fork queue");
+}
+
+// A handler has computed the answer: the request stops counting against its
+// client before the answer is written, so a client that sends its next call
+// the moment it reads one is never charged for a call already answered
+static void admit_answered(const job_t *job){
+    admit_release(job->client_pid);
+    if(child_slot>=0) atomic_store(&children[child_slot].released,true);
+}
+
+// Fork a child to handle this request concurrently (caller holds fork_lock
+// and has checked running < max_inflight); false if fork() failed
+static bool fork_start(const job_t *job){
+    int i=0; while(children[i].pid) i++;
+    atomic_store(&children[i].released,false);
+    PROF_BEGIN(t);
+    pid_t cpid=fork();
+    if(cpid<0){ log_line("fork() failed: %s", strerror(errno)); return false; }
+    if(cpid==0){
+        // Child: compute and respond, then exit
+        ev_signal_reset(sig_fd);
+        self_id=(int)getpid(); child_slot=i;
+        handle_job(job);
+        PROF_FLUSH();
+        _exit(0); // child exits without running parent's atexit handlers
+    }
+    PROF_END(PROF_FORK,t);
+    // parent continues; children are reaped on SIGCHLD (fork_reap)
+    children[i].pid=cpid; children[i].client=job->client_pid;
+    atomic_fetch_add(&adm->running,1);
+    return true;
+}
+
+// Reap exited children and start queued requests in the slots they freed
+static void fork_reap(void){
+    pthread_mutex_lock(&fork_lock);
+    pid_t p;
+    while((p=waitpid(-1,NULL,WNOHANG))>0){
+        for(int i=0;i<max_inflight;i++){
+            if(children[i].pid!=p) continue;
+            children[i].pid=0; atomic_fetch_sub(&adm->running,1);
+            if(!atomic_load(&children[i].released)) admit_release(children[i].client); // it died first
+            break;
         }
-        // parent continues; children are reaped by SIGCHLD handler
     }
+    while(fork_q_len && atomic_load(&adm->running)<max_inflight){
+        job_t job;
+        if(fork_fair) drr_pop(fork_fair,&job);
+        else { job=fork_q[fork_q_head]; fork_q_head=(fork_q_head+1)%(size_t)queue_cap; }
+        fork_q_len--; admit_queued(-1);
+        if(!fork_start(&job)) admit_full(&job); // with no child left, waiting longer could wait forever
+    }
+    pthread_mutex_unlock(&fork_lock);
+}
+
+// Default: fork a child per request, up to --max-inflight at once; later
+// requests queue for a free slot, and past the queue they are turned away
+static void dispatch_fork(const job_t *job){
+    if(!admit_client(job)){ busy_reject(job); return; }
+    pthread_mutex_lock(&fork_lock);
+    bool ok=true;
+    if(atomic_load(&adm->running)<max_inflight && !fork_q_len) ok=fork_start(job);
+    else if(fork_q_len<(size_t)queue_cap){
+        if(fork_fair) fair_push(fork_fair,job);
+        else fork_q[(fork_q_head+fork_q_len)%(size_t)queue_cap]=*job;
+        fork_q_len++; admit_queued(1);
+    } else ok=false;
+    pthread_mutex_unlock(&fork_lock);
+    if(ok) atomic_fetch_add(&adm->admitted,1);
+    else   admit_full(job);
+}
+
+// Pools: queue the job, or turn it away when the ring holds --queue jobs
+static void dispatch_queue(const job_t *job){
+    if(!admit_client(job)){ busy_reject(job); return; }
+    if(sem_trywait(&dq->slots)<0){ admit_full(job); return; }
+    admit_queued(1); atomic_fetch_add(&adm->admitted,1);
+    if(dq_fair){ fair_lock(); fair_push(dq_fair,job); pthread_mutex_unlock(&dq->fair_lock); }
+    else ring_push(&dq->ring,job);  // cannot fail: we hold a free slot
+    sem_post(&dq->items);
+}
+
+// ---- Event engine (--engine epoll) ----
+// The reader computes each request itself and answers through a table of
+// per-client connections whose FIFOs are opened O_NONBLOCK, so no client can
+// stall it. A response is queued in its connection's output buffer when the
+// FIFO is full (flushed on EV_OUT, resuming mid-record) or when the client has
+// not opened it yet: that open is retried on ENXIO with backoff, and the
+// output is dropped after RESP_OPEN_TIMEOUT_MS. With --coalesce, output is
+// written once per batch of events (or as soon as a connection holds N
+// bytes), so the answers to one read of a pipelining client go out together. A client that closes its read
+// end shows up as EV_ERR and its connection is closed (a legacy client
+// reopens per call; the next response simply opens it again).
+typedef struct conn {
+    struct conn *next;           // hash chain
+    struct conn *retry_next;     // retry list (waiting for the client to open)
+    pid_t    pid;                // client_pid
+    int      fd;                 // O_WRONLY|O_NONBLOCK end, -1 while not open
+    bool     retrying;           // on the retry list
+    bool     want_out;           // registered for EV_OUT
+    bool     dead;               // dropped; freed after the current event batch
+    bool     dirty;              // on the dirty list: output to write after this batch
+    struct conn *dirty_next;
+    char    *out;                // pending bytes [out_off, out_len)
+    size_t   out_off, out_len, out_cap;
+    int64_t  retry_at, give_up_at; // ms (now_ms) for the next open attempt / the deadline
+    int      retry_delay;        // ms, doubles up to 64
+    uint64_t used;               // LRU clock (closing idle fds at the fd limit)
+    int      slot;               // io_uring: registered file slot (-1 => none yet)
+    unsigned tx_inflight;        // io_uring: chunks of the write chain in flight
+    uint32_t tx_epoch;           // io_uring: bumped when fd closes (late write results are stale)
+    bool     tx_waiting;         // io_uring: on the tx_wait list (no free chunk)
+    struct conn *tx_next;        // tx_wait list
+    char     path[RESP_NAME_MAX];
+} conn_t;
+#define CONN_BUCKETS 4096
+static conn_t  *conn_tab[CONN_BUCKETS];
+static conn_t  *conn_retry = NULL;  // connections with output waiting for an open
+static conn_t  *conn_graves = NULL; // dropped connections (linked through next)
+static conn_t  *conn_dirty = NULL;  // connections with output held for coalescing
+static ev_loop_t *loop = NULL;
+static uring_t  *ring = NULL;       // --engine io_uring (NULL: epoll, also after a fallback)
+static size_t   conns_open = 0, conns_open_max = 1000;
+static uint64_t conn_clock = 0;
+
+// io_uring engine hooks (see "io_uring engine")
+static bool tx_attach(conn_t *c, int fd);
+static void tx_detach(conn_t *c);
+static void tx_flush(conn_t *c);
+static void tx_release(conn_t *c);
+
+static unsigned conn_hash(pid_t pid, const char *path){
+    unsigned h=2166136261u^(unsigned)pid;                // FNV-1a over pid and path
+    for(const char *c=path;*c;c++) h=(h^(unsigned char)*c)*16777619u;
+    return h&(CONN_BUCKETS-1);
+}
+
+static conn_t *conn_get(const job_t *job){
+    unsigned h=conn_hash(job->client_pid,job->resp_fifo);
+    for(conn_t *c=conn_tab[h];c;c=c->next)
+        if(c->pid==job->client_pid && !strcmp(c->path,job->resp_fifo)) return c;
+    conn_t *c=calloc(1,sizeof(*c));
+    if(!c) return NULL;
+    c->pid=job->client_pid; c->fd=-1; c->slot=-1;
+    memcpy(c->path,job->resp_fifo,RESP_NAME_MAX);
+    c->next=conn_tab[h]; conn_tab[h]=c;
+    return c;
+}
+
+static void conn_close_fd(conn_t *c){
+    if(c->fd<0) return;
+    ev_del(loop,c->fd); close(c->fd);
+    c->fd=-1; c->want_out=false; conns_open--;
+    if(ring) tx_detach(c);
+}
+
+// Drop a connection and whatever it still had to send
+static void conn_drop(conn_t *c){
+    conn_close_fd(c);
+    conn_t **pp=&conn_tab[conn_hash(c->pid,c->path)];
+    while(*pp!=c) pp=&(*pp)->next;
+    *pp=c->next;
+    if(c->retrying){
+        for(pp=&conn_retry;*pp!=c;pp=&(*pp)->retry_next){}
+        *pp=c->retry_next;
+    }
+    if(c->tx_waiting) tx_release(c);
+    c->dead=true; c->next=conn_graves; conn_graves=c; // an event for it may still be queued
+}
+
+// Free dropped connections (after a batch of events has been handled)
+// whose io_uring writes, if any, have all completed
+static void conn_bury(void){
+    for(conn_t **pp=&conn_graves;*pp;){
+        conn_t *c=*pp;
+        if(c->tx_inflight){ pp=&c->next; continue; } // its chunks still point at it
+        *pp=c->next;
+        if(ring) tx_release(c);
+        free(c->out); free(c);
+    }
+}
+
+// At the fd limit: close the least recently used idle connection
+static void conn_evict_idle(void){
+    conn_t *victim=NULL;
+    for(int i=0;i<CONN_BUCKETS;i++)
+        for(conn_t *c=conn_tab[i];c;c=c->next)
+            if(c->fd>=0 && c->out_len==c->out_off && (!victim || c->used<victim->used)) victim=c;
+    if(victim) conn_drop(victim);
+}
+
+// Take a freshly opened client FIFO into the connection: watched for
+// errors/hangup only until output blocks, and under io_uring put in the
+// connection's registered file slot
+static bool conn_attach(conn_t *c, int fd){
+    if(ev_add(loop,fd,0,c)<0) return false;
+    if(ring && !tx_attach(c,fd)){ ev_del(loop,fd); return false; }
+    c->fd=fd; conns_open++;
+    return true;
+}
+
+// Try to open the client's FIFO; on ENXIO (no reader yet) schedule a retry
+static void conn_open(conn_t *c){
+    if(conns_open>=conns_open_max) conn_evict_idle();
+    int fd=open(c->path,O_WRONLY|O_NONBLOCK);
+    if(fd>=0 && !conn_attach(c,fd)){ close(fd); fd=-1; errno=EMFILE; }
+    if(fd>=0 || c->retrying) return;
+    if(errno!=ENXIO){
+        metrics_inc(&met->open_failed);
+        log_line("event: open resp %s failed: %s", c->path, strerror(errno));
+        conn_drop(c); return;
+    }
+    c->retrying=true; c->retry_delay=1; c->retry_at=now_ms()+1; c->give_up_at=now_ms()+RESP_OPEN_TIMEOUT_MS;
+    c->retry_next=conn_retry; conn_retry=c;
+}
+
+// Write out pending output; EV_OUT is watched only while the FIFO is full
+static void conn_flush(conn_t *c){
+    if(ring){ tx_flush(c); return; }
+    while(c->out_off<c->out_len){
+        ssize_t w=write(c->fd,c->out+c->out_off,c->out_len-c->out_off);
+        if(w>0){ c->out_off+=(size_t)w; continue; }
+        if(w<0 && errno==EINTR) continue;
+        if(w<0 && errno==EAGAIN){
+            if(!c->want_out){ ev_mod(loop,c->fd,EV_OUT,c); c->want_out=true; }
+            return;
+        }
+        // EPIPE: the client closed its end with our answer still pending
+        metrics_inc(&met->write_failed);
+        log_line("event: write resp %s failed: %s (%zu bytes dropped)", c->path, strerror(errno), c->out_len-c->out_off);
+        conn_drop(c); return;
+    }
+    c->out_off=c->out_len=0;
+    if(c->want_out){ ev_mod(loop,c->fd,0,c); c->want_out=false; }
+}
+
+// Queue a response for the job's client and send as much as the FIFO takes;
+// returns the connection, NULL if it was dropped or out of memory
+static conn_t *conn_queue(const job_t *job, const void *buf, size_t len){
+    conn_t *c=conn_get(job);
+    if(!c){ log_line("event: out of memory for %s", job->resp_fifo); return NULL; }
+    if(c->out_len+len>c->out_cap){
+        if(c->out_off){ memmove(c->out,c->out+c->out_off,c->out_len-c->out_off); c->out_len-=c->out_off; c->out_off=0; }
+        size_t cap=c->out_cap ? c->out_cap : ARITH_PIPE_BUF;
+        while(cap<c->out_len+len) cap*=2;
+        char *o= cap>c->out_cap ? realloc(c->out,cap) : c->out;
+        if(!o){ log_line("event: out of memory for %s", c->path); return NULL; }
+        c->out=o; c->out_cap=cap;
+    }
+    memcpy(c->out+c->out_len,buf,len); c->out_len+=len;
+    c->used=++conn_clock;
+    if(c->fd<0 && !c->retrying) conn_open(c);
+    if(c->dead || c->fd<0) return c->dead ? NULL : c;
+    if(coalesce_bytes>0 && c->out_len-c->out_off<(size_t)coalesce_bytes){
+        if(!c->dirty){ c->dirty=true; c->dirty_next=conn_dirty; conn_dirty=c; }
+    } else conn_flush(c);
+    return c->dead ? NULL : c;
+}
+
+// After a batch of events: write the output held for coalescing (before
+// conn_bury: dropped connections may still be on the list)
+static void conn_flush_dirty(void){
+    while(conn_dirty){
+        conn_t *c=conn_dirty; conn_dirty=c->dirty_next; c->dirty=false;
+        if(!c->dead && c->fd>=0) conn_flush(c);
+    }
+}
+
+// conn_queue() plus the trace of what became of the response
+static void conn_send(const job_t *job, const void *buf, size_t len){
+    conn_t *c=conn_queue(job,buf,len);
+    if(!c || !tracing()) return;
+    if(c->fd<0){ say("[SERVER %s=%d] response queued for %s (client not listening yet)\n", role, self_id, c->path); return; }
+    if(c->dirty)   say("[SERVER %s=%d] response queued for %s (coalescing)\n", role, self_id, c->path);
+    else if(c->out_len) say("[SERVER %s=%d] response queued for %s (%zu bytes pending)\n", role, self_id, c->path, c->out_len-c->out_off);
+    else           say("[SERVER %s=%d] response sent to %s\n", role, self_id, c->path);
+}
+
+// Readiness on a client FIFO
+static void conn_ready(conn_t *c, uint32_t events){
+    if(c->dead) return;
+    if(events&EV_ERR){ // no reader left: close; output still pending waits for a reopen
+        conn_close_fd(c);
+        if(c->out_len==c->out_off) conn_drop(c);
+        else conn_open(c);
+        return;
+    }
+    if(events&EV_OUT) conn_flush(c);
+}
+
+// Retry due opens; returns the ev_wait timeout until the next one (-1 => none)
+static int conn_retry_due(void){
+    int64_t now=now_ms(), next=-1;
+    for(conn_t **pp=&conn_retry;*pp;){
+        conn_t *c=*pp;
+        if(c->retry_at>now){ if(next<0 || c->retry_at<next) next=c->retry_at; pp=&c->retry_next; continue; }
+        int fd=open(c->path,O_WRONLY|O_NONBLOCK);
+        if(fd>=0 && conn_attach(c,fd)){
+            *pp=c->retry_next; c->retrying=false;
+            conn_flush(c);
+            continue;
+        }
+        if(fd>=0) close(fd);
+        if(now>=c->give_up_at || (fd<0 && errno!=ENXIO)){
+            *pp=c->retry_next; c->retrying=false;
+            metrics_inc(&met->open_failed);
+            log_line("event: client %s never opened its FIFO; %zu bytes dropped", c->path, c->out_len-c->out_off);
+            conn_drop(c);
+            continue;
+        }
+        if(c->retry_delay<64) c->retry_delay*=2;
+        c->retry_at=now+c->retry_delay;
+        if(next<0 || c->retry_at<next) next=c->retry_at;
+        pp=&c->retry_next;
+    }
+    return next<0 ? -1 : (int)(next-now);
+}
+
+static void sock_queue_job(const job_t *job, const void *buf, size_t len); // see "Socket transport"
+
+// Executor: compute here and hand the response to the client's connection
+// (the open stage is not timed: connections open asynchronously)
+static void dispatch_inline(const job_t *job){
+    resp_buf_t rbuf;
+    PROF_BEGIN(tp);
+    uint64_t t0=metrics_now();
+    size_t rlen=compute_job(job,&rbuf);
+    uint64_t t1=metrics_now();
+    PROF_BEGIN(tw);
+    if(!job->sock) conn_send(job,&rbuf,rlen);
+    else {
+        sock_queue_job(job,&rbuf,rlen); // sent after this batch of events
+        if(tracing()) say("[SERVER %s=%d] response queued for %s\n", role, self_id, job->resp_fifo);
+    }
+    PROF_END(PROF_WRITE,tw);
+    uint64_t t2=metrics_now();
+    metrics_observe(&met->stage[STAGE_QUEUE],t0-job->t_recv);
+    metrics_observe(&met->stage[STAGE_COMPUTE],t1-t0);
+    metrics_observe(&met->stage[STAGE_WRITE],t2-t1);
+    metrics_observe(&met->stage[STAGE_TOTAL],t2-job->t_recv);
+    PROF_END(PROF_REQUEST,tp);
+}
+
+// Let the event engine hold thousands of client FIFOs open
+static void engine_epoll_init(void){
+    struct rlimit rl;
+    if(getrlimit(RLIMIT_NOFILE,&rl)==0){
+        if(rl.rlim_cur<rl.rlim_max){ rl.rlim_cur=rl.rlim_max; setrlimit(RLIMIT_NOFILE,&rl); getrlimit(RLIMIT_NOFILE,&rl); }
+        if(rl.rlim_cur!=RLIM_INFINITY && rl.rlim_cur>128) conns_open_max=(size_t)rl.rlim_cur-64; // headroom for our own fds
+    }
+    role="event"; self_id=(int)getpid();
+    expr_cache_init();
+    log_line("Event engine: up to %zu client FIFOs open", conns_open_max);
+}
+
+// ---- io_uring engine (--engine io_uring) ----
+// The event engine with its FIFO I/O completed by an io_uring instead of run
+// on readiness. Each request FIFO keeps a multishot read posted that fills
+// buffers of a provided-buffer ring (see "io_uring engine: the loop"). A
+// response is copied into TX_CHUNK pieces of one registered buffer and
+// written with WRITE_FIXED to the client FIFO through its registered file
+// slot. The FIFOs are blocking for the ring: a write waits in the kernel
+// for room, and a write of at most PIPE_BUF is all or nothing, so a chunk
+// never comes back short. A connection has one chain of linked writes in
+// flight (the links keep its chunks in order); what is queued meanwhile goes
+// out when the chain completes. Everything a loop pass queues is submitted
+// by the one io_uring_enter() that also waits for completions, and --sqpoll
+// leaves submission to a kernel thread. Signals, sockets, the wake pipe and
+// client hangups stay in the epoll set, which the ring watches with a
+// multishot poll. Without a usable io_uring (no kernel support, disabled by
+// sysctl or seccomp, no multishot read) the server logs why and runs the
+// epoll engine.
+#define URING_ENTRIES  4096
+#define URING_FILES_MAX 65536     // registered client FIFOs at most
+#define URING_RX_BUFS  8          // provided buffers per request FIFO
+#define URING_RX_BUF   (16*1024)
+#define TX_CHUNK       ARITH_PIPE_BUF // one FIFO write: atomic, never short
+#define TX_CHUNKS      1024           // registered response buffer: 4 MiB
+#define TX_LINK_MAX    16             // chunks per chain: the default FIFO capacity
+_Static_assert(URING_RX_BUF*2<=RX_BUF, "a read always fits next to a partial frame");
+
+enum { UD_EPOLL, UD_READ, UD_WRITE, UD_CANCEL }; // completion kinds
+#define UD(kind,idx) (((uint64_t)(idx)<<2)|(kind))
+
+typedef struct { conn_t *c; uint32_t len, epoch; } tx_chunk_t;
+static char      *tx_buf = NULL;          // TX_CHUNKS * TX_CHUNK, registered
+static tx_chunk_t tx_chunks[TX_CHUNKS];
+static uint32_t   tx_free[TX_CHUNKS];     // free chunk stack
+static unsigned   n_tx_free = 0;
+static conn_t    *tx_wait = NULL;         // connections waiting for a free chunk
+static uint32_t  *tx_slots = NULL;        // free registered file slots (stack)
+static unsigned   n_tx_slots = 0;
+
+// Put a newly opened FIFO into the connection's slot. The ring waits for
+// room itself, so the fd goes back to blocking: O_NONBLOCK would turn a
+// full FIFO into -EAGAIN completions.
+static bool tx_attach(conn_t *c, int fd){
+    if(c->slot<0){
+        if(!n_tx_slots){ errno=EMFILE; return false; }
+        c->slot=(int)tx_slots[--n_tx_slots];
+    }
+    if(fcntl(fd,F_SETFL,fcntl(fd,F_GETFL)&~O_NONBLOCK)<0 || uring_file_set(ring,(unsigned)c->slot,fd)<0) return false;
+    return true;
+}
+
+// The fd was closed: results of writes still in flight are stale, and the
+// slot is emptied once they complete (a write chain looks its file up per link)
+static void tx_detach(conn_t *c){
+    c->tx_epoch++;
+    if(!c->tx_inflight && c->slot>=0) uring_file_set(ring,(unsigned)c->slot,-1);
+}
+
+// Dropped or freed connection: leave the wait list; once freed, give back the slot
+static void tx_release(conn_t *c){
+    if(c->tx_waiting){
+        conn_t **pp=&tx_wait;
+        while(*pp!=c) pp=&(*pp)->tx_next;
+        *pp=c->tx_next; c->tx_waiting=false;
+    }
+    if(c->dead && !c->tx_inflight && c->slot>=0){ tx_slots[n_tx_slots++]=(uint32_t)c->slot; c->slot=-1; }
+}
+
+// Queue the connection's pending output as one chain of linked writes
+static void tx_flush(conn_t *c){
+    if(c->dead || c->fd<0 || c->tx_inflight) return; // the open or the chain's completion flushes it
+    uint32_t idx[TX_LINK_MAX]; unsigned k=0;
+    while(c->out_off<c->out_len && k<TX_LINK_MAX && n_tx_free){
+        uint32_t i=tx_free[--n_tx_free];
+        size_t n=c->out_len-c->out_off; if(n>TX_CHUNK) n=TX_CHUNK;
+        memcpy(tx_buf+(size_t)i*TX_CHUNK,c->out+c->out_off,n); c->out_off+=n;
+        tx_chunks[i]=(tx_chunk_t){ c, (uint32_t)n, c->tx_epoch };
+        idx[k++]=i;
+    }
+    if(c->out_off==c->out_len) c->out_off=c->out_len=0;
+    else if(!k && !c->tx_waiting){ c->tx_waiting=true; c->tx_next=tx_wait; tx_wait=c; } // all chunks busy
+    for(unsigned j=0;j<k;j++)
+        if(uring_write(ring,(unsigned)c->slot,tx_buf+(size_t)idx[j]*TX_CHUNK,tx_chunks[idx[j]].len,j+1<k,UD(UD_WRITE,idx[j]))<0)
+            die("io_uring write");
+    c->tx_inflight=k;
+}
+
+// A chunk's write completed (res: bytes, or -errno; -ECANCELED after an
+// earlier link of its chain failed)
+static void tx_done(uint32_t i, int res){
+    tx_chunk_t *t=&tx_chunks[i];
+    conn_t *c=t->c;
+    tx_free[n_tx_free++]=i; c->tx_inflight--;
+    if(res!=(int)t->len && res!=-ECANCELED && !c->dead && t->epoch==c->tx_epoch){
+        // EPIPE: the client closed its end with our answer still pending
+        metrics_inc(&met->write_failed);
+        log_line("event: write resp %s failed: %s", c->path, res<0 ? strerror(-res) : "short write");
+        conn_drop(c);
+    }
+    if(!c->tx_inflight){
+        if(c->fd<0 && c->slot>=0) uring_file_set(ring,(unsigned)c->slot,-1);
+        if(c->dead) tx_release(c);
+        else tx_flush(c);
+    }
+    while(tx_wait && n_tx_free){ conn_t *w=tx_wait; tx_wait=w->tx_next; w->tx_waiting=false; tx_flush(w); }
+}
+
+// Set up the ring and its registered files, buffers and provided buffers;
+// on any failure fall back to epoll (ring stays NULL)
+static void engine_uring_init(void){
+    char why[96]="";
+    ring=uring_create(URING_ENTRIES,uring_sqpoll ? URING_SQPOLL : 0);
+    if(!ring && uring_sqpoll){
+        log_line("io_uring SQPOLL unavailable (%s): submitting from the reader", strerror(errno));
+        ring=uring_create(URING_ENTRIES,0); uring_sqpoll=false;
+    }
+    if(conns_open_max>URING_FILES_MAX) conns_open_max=URING_FILES_MAX;
+    if(!ring) snprintf(why,sizeof(why),"%s",strerror(errno));
+    else if(!uring_supports(ring,URING_OP_READ_MULTISHOT)) snprintf(why,sizeof(why),"no multishot read (Linux 6.7+)");
+    else if(uring_files_init(ring,(unsigned)conns_open_max)<0) snprintf(why,sizeof(why),"registered files: %s",strerror(errno));
+    for(int g=0;!why[0] && g<=n_shards;g++) // group 0: the main FIFO, g: shard g-1
+        if(uring_group_init(ring,(uint16_t)g,URING_RX_BUFS,URING_RX_BUF)<0) snprintf(why,sizeof(why),"provided buffers: %s",strerror(errno));
+    if(!why[0]){
+        tx_buf=aligned_alloc(4096,(size_t)TX_CHUNKS*TX_CHUNK);
+        tx_slots=malloc(conns_open_max*sizeof(*tx_slots));
+        if(!tx_buf || !tx_slots) snprintf(why,sizeof(why),"out of memory");
+    }
+    if(why[0]){
+        log_line("io_uring unavailable (%s): using epoll", why);
+        if(log_level>=LVL_INFO) fprintf(stderr,"[server] io_uring unavailable (%s): using epoll\n", why);
+        uring_destroy(ring); ring=NULL;
+        free(tx_buf); tx_buf=NULL; free(tx_slots); tx_slots=NULL;
+        return;
+    }
+    for(unsigned i=0;i<TX_CHUNKS;i++) tx_free[n_tx_free++]=TX_CHUNKS-1-i;
+    for(size_t i=0;i<conns_open_max;i++) tx_slots[n_tx_slots++]=(uint32_t)(conns_open_max-1-i);
+    bool fixed= uring_buffer_init(ring,tx_buf,(size_t)TX_CHUNKS*TX_CHUNK)==0; // counts against RLIMIT_MEMLOCK
+    if(!fixed) log_line("io_uring: response buffer not registered (%s): plain writes", strerror(errno));
+    log_line("io_uring engine: up to %zu registered client FIFOs, %s response buffer%s", conns_open_max,
+             fixed ? "registered" : "unregistered", uring_sqpoll ? ", SQPOLL" : "");
+}
+
+// ---- Busy answers ----
+// A request turned away by admission control is answered with ARITH_EBUSY
+// through the connections above, in every mode: their non-blocking open
+// and retry list keep the reader from waiting for a one-shot client that
+// has not opened its FIFO yet (socket clients get theirs on their socket).
+// Only the main reader owns them, so rejections
+// are queued here (shard readers wake it through wake_fd) and sent after each
+// batch of events.
+typedef struct busy_msg {
+    struct busy_msg *next;
+    job_t       job;
+    size_t      len;
+    resp_buf_t  buf;
+} busy_msg_t;
+static busy_msg_t *busy_first = NULL, *busy_last = NULL;
+static pthread_mutex_t busy_lock = PTHREAD_MUTEX_INITIALIZER;
+static int wake_fd[2] = { -1, -1 }; // self-pipe: shard readers -> main reader
+
+static void busy_reject(const job_t *job){
+    if(job->batch_count || job->big || job->expr_len) batch_release(job->batch_slot); // the tuples are never computed
+    if(tracing()) say("[SERVER] busy: %s from PID=%d turned away\n", job->op_name, (int)job->client_pid);
+    busy_msg_t *m=malloc(sizeof(*m));
+    if(!m){ log_line("busy answer to %s lost: out of memory", job->resp_fifo); return; }
+    m->next=NULL; m->job=*job;
+    atomic_fetch_add_explicit(&met->status[ARITH_EBUSY], job->batch_count ? job->batch_count : 1, memory_order_relaxed);
+    if(job->batch_count){ // every tuple reports the status
+        v2_batch_resp_hdr_t *h=(v2_batch_resp_hdr_t*)&m->buf; h->req_id=job->req_id; h->count=job->batch_count;
+        v2_batch_result_t *out=(v2_batch_result_t*)(h+1);
+        for(size_t i=0;i<job->batch_count;i++){ out[i].status=ARITH_EBUSY; out[i].result=0; }
+        m->len=sizeof(*h)+job->batch_count*sizeof(*out);
+    } else if(job->big){
+        v2_big_resp_hdr_t *h=(v2_big_resp_hdr_t*)&m->buf;
+        h->req_id=job->req_id; h->status=ARITH_EBUSY; h->sign=0; h->flags=0; h->n=0;
+        m->len=sizeof(*h);
+    } else m->len=encode_response(job,ARITH_EBUSY,0,&m->buf);
+
+    pthread_mutex_lock(&busy_lock);
+    bool was_empty= !busy_first;
+    if(busy_last) busy_last->next=m; else busy_first=m;
+    busy_last=m;
+    pthread_mutex_unlock(&busy_lock);
+    if(was_empty && shard_reader && write(wake_fd[1],"",1)<0){} // full pipe: a wake-up is pending anyway
+}
+
+// Main reader: send the queued busy answers; mention rejections once a second
+static void busy_flush(void){
+    pthread_mutex_lock(&busy_lock);
+    busy_msg_t *m=busy_first; busy_first=busy_last=NULL;
+    pthread_mutex_unlock(&busy_lock);
+    while(m){
+        busy_msg_t *next=m->next;
+        if(m->job.sock) sock_queue_job(&m->job,&m->buf,m->len);
+        else conn_queue(&m->job,&m->buf,m->len);
+        free(m); m=next;
+    }
+    static unsigned long long reported = 0;
+    static int64_t reported_at = 0;
+    unsigned long long busy=atomic_load(&adm->busy_full)+atomic_load(&adm->busy_client);
+    if(busy!=reported && log_level>=LVL_INFO && now_ms()-reported_at>=1000){
+        say("[SERVER] busy: %llu requests turned away so far (queue %d/%d, %d computing)\n",
+            busy, atomic_load(&adm->queued), queue_cap, atomic_load(&adm->running));
+        reported=busy; reported_at=now_ms();
+    }
+}
+
+// ---- Socket transport (--transport sock) ----
+// Clients can connect a SOCK_SEQPACKET socket at ARITH_SOCK_PATH instead of
+// registering a response FIFO: one full-duplex connection per client whose
+// messages keep their boundaries, so each message is exactly one v2 call or
+// batch frame (session 0), nothing ever needs a rendezvous or a resync, and
+// no FIFO file is left in /tmp. The main reader accepts every connection,
+// reads each with recvmmsg() (up to TP_BATCH frames per system call) and is
+// the only one to own the fds; pre-forked workers close their copies.
+// Handlers elsewhere (children, workers, pool threads) push their answer into
+// a reply ring in shared memory and wake the reader through wake_fd; after
+// each batch of events the reader moves those answers into per-connection
+// output queues and sends each queue with sendmmsg(). What a socket cannot
+// take yet waits for EV_OUT. A slot's generation number changes with every
+// connection it holds, so an answer for a client that has hung up is dropped
+// instead of reaching the next client in that slot.
+#define SOCK_MAX_CONNS 4096
+#define SOCK_RING      4096 // single answers on their way to the reader
+#define SOCK_BIG_RING  128  // batch answers on their way to the reader
+
+typedef struct {
+    int      fd;               // -1 => free slot
+    uint32_t gen;              // bumped whenever the slot takes a new connection
+    pid_t    pid;              // the client (SO_PEERCRED)
+    uint8_t  sched_class;      // enum arith_class from its hello (normal without one)
+    bool     want_out;         // registered for EV_OUT
+    bool     dirty;            // listed in sock_dirty (output to send)
+    char    *out;              // queued messages [out_off, out_len), each [uint32_t len][bytes]
+    size_t   out_off, out_len, out_cap;
+} sock_conn_t;
+static sock_conn_t *sock_conns = NULL; // SOCK_MAX_CONNS slots, main reader only
+static int      sock_listen = -1;
+static int      sock_dirty[SOCK_MAX_CONNS]; // slots with output queued since the last send
+static int      n_sock_dirty = 0;
+static int64_t  sock_paused_until = 0; // at the fd limit: listener muted until then (now_ms)
+static uint32_t sock_in = EV_IN;       // watched on every connection (0 once handed over: we only answer)
+
+// An answer on its way from a handler to the reader
+typedef struct {
+    int32_t  sock;             // job->sock
+    uint32_t gen;              // job->sock_gen
+    uint32_t len;
+    char     buf[ARITH_PIPE_BUF];
+} sock_reply_t;
+#define SOCK_REPLY_SMALL (offsetof(sock_reply_t,buf)+sizeof(v2_response_t)) // element of sock_ring
+static ring_t      *sock_ring = NULL, *sock_big_ring = NULL; // shared with children and workers
+static atomic_bool *sock_wake = NULL;  // a wake-up for them is pending on wake_fd
+
+static void sock_listen_open(void);
+
+// Create the reply rings and the listening socket (before workers are forked)
+static void sock_open(void){
+    sock_conns=calloc(SOCK_MAX_CONNS,sizeof(*sock_conns));
+    sock_ring=shared_alloc(ring_bytes(ring_capacity(SOCK_RING),SOCK_REPLY_SMALL));
+    sock_big_ring=shared_alloc(ring_bytes(ring_capacity(SOCK_BIG_RING),sizeof(sock_reply_t)));
+    sock_wake=shared_alloc(sizeof(*sock_wake));
+    if(!sock_conns || !sock_ring || !sock_big_ring || !sock_wake) die("alloc socket transport");
+    for(int i=0;i<SOCK_MAX_CONNS;i++) sock_conns[i].fd=-1;
+    ring_init(sock_ring,ring_capacity(SOCK_RING),SOCK_REPLY_SMALL);
+    ring_init(sock_big_ring,ring_capacity(SOCK_BIG_RING),sizeof(sock_reply_t));
+    if(!takeover) sock_listen_open(); // --takeover: the previous server's listener (see "Takeover")
+}
+
+// Bind and listen on ARITH_SOCK_PATH
+static void sock_listen_open(void){
+    struct sockaddr_un sa; memset(&sa,0,sizeof(sa));
+    sa.sun_family=AF_UNIX;
+    snprintf(sa.sun_path,sizeof(sa.sun_path),"%s",ARITH_SOCK_PATH);
+    unlink(ARITH_SOCK_PATH); // left behind by a server that was killed
+    sock_listen=socket(AF_UNIX,SOCK_SEQPACKET|SOCK_NONBLOCK|SOCK_CLOEXEC,0);
+    if(sock_listen<0 || bind(sock_listen,(const struct sockaddr*)&sa,sizeof(sa))<0
+       || chmod(ARITH_SOCK_PATH,0666)<0 || listen(sock_listen,SOMAXCONN)<0) die("socket " ARITH_SOCK_PATH);
+}
+
+// In a pre-forked worker: drop the listener and connections inherited from the reader
+static void sock_forget(void){
+    if(sock_listen<0) return;
+    close(sock_listen);
+    for(int i=0;i<SOCK_MAX_CONNS;i++) if(sock_conns[i].fd>=0) close(sock_conns[i].fd);
+}
+
+static bool is_sock(const void *ptr){
+    return sock_conns && (const sock_conn_t*)ptr>=sock_conns && (const sock_conn_t*)ptr<sock_conns+SOCK_MAX_CONNS;
+}
+
+static void sock_close(sock_conn_t *c, const char *why){
+    int idx=(int)(c-sock_conns);
+    ev_del(loop,c->fd); close(c->fd);
+    c->fd=-1; c->want_out=false;
+    if(c->out_len>c->out_off) log_line("socket %d: %zu bytes of answers dropped", idx, c->out_len-c->out_off);
+    c->out_off=c->out_len=0;
+    atomic_fetch_sub(&met->sock_conns,1);
+    log_line("Socket %d (PID=%d) closed: %s", idx, (int)c->pid, why);
+}
+
+// The listener is readable: take every pending connection
+static void sock_accept(void){
+    for(;;){
+        int fd=accept4(sock_listen,NULL,NULL,SOCK_NONBLOCK|SOCK_CLOEXEC);
+        if(fd<0){
+            if(errno==EINTR || errno==ECONNABORTED) continue;
+            if(errno==EMFILE || errno==ENFILE){ // retry in a while instead of spinning on the listener
+                log_line("socket: accept: %s; not accepting for 100 ms", strerror(errno));
+                ev_mod(loop,sock_listen,0,&sock_listen); sock_paused_until=now_ms()+100;
+            } else if(errno!=EAGAIN) log_line("socket: accept: %s", strerror(errno));
+            return;
+        }
+        int i=0; while(i<SOCK_MAX_CONNS && sock_conns[i].fd>=0) i++;
+        if(i==SOCK_MAX_CONNS){ log_line("socket: %d connections open, new one refused", SOCK_MAX_CONNS); close(fd); continue; }
+        sock_conn_t *c=&sock_conns[i];
+        if(ev_add(loop,fd,EV_IN,c)<0){ log_line("socket: event loop add: %s", strerror(errno)); close(fd); continue; }
+        struct ucred cr; socklen_t cl=sizeof(cr);
+        c->fd=fd; c->gen++; c->want_out=false; c->sched_class=ARITH_CLASS_NORMAL;
+        c->pid= getsockopt(fd,SOL_SOCKET,SO_PEERCRED,&cr,&cl)==0 ? cr.pid : 0;
+        metrics_inc(&met->accepts); atomic_fetch_add(&met->sock_conns,1);
+        log_line("Connect PID=%d -> socket %d", (int)c->pid, i);
+        if(log_level>=LVL_INFO) say("[SERVER] connect from PID=%d -> socket %d\n", (int)c->pid, i);
+    }
+}
+
+// Decode one message of a socket client (a v2 call, batch, big-integer or
+// expression frame); 0 if it is none of them
+static int sock_frame(const sock_conn_t *c, const uint8_t *msg, size_t len, job_t *job){
+    int idx=(int)(c-sock_conns);
+    const v2_batch_hdr_t *h=(const v2_batch_hdr_t*)msg;
+    const v2_big_hdr_t *bh=(const v2_big_hdr_t*)msg;
+    const v2_expr_hdr_t *eh=(const v2_expr_hdr_t*)msg;
+    memset(job,0,sizeof(*job));
+    if(msg[0]==ARITH_FRAME_CALL && len==sizeof(v2_request_t)){
+        v2_request_t rq; memcpy(&rq,msg,sizeof(rq));
+        job->version=2; job->opcode=rq.opcode; job->req_id=rq.req_id; job->a=rq.a; job->b=rq.b;
+        set_op_name(job);
+    } else if(msg[0]==ARITH_FRAME_BATCH && len>=sizeof(*h) && h->count && h->count<=ARITH_BATCH_MAX
+              && len==sizeof(*h)+h->count*sizeof(v2_batch_item_t)){
+        if(!batch_unpack(h,job)) return 0;
+    } else if(msg[0]==ARITH_FRAME_BIG && len>=sizeof(*bh) && bh->na<=ARITH_BIG_LIMBS_MAX && bh->nb<=ARITH_BIG_LIMBS_MAX
+              && len==sizeof(*bh)+(bh->na+bh->nb)*sizeof(uint64_t)){
+        if(!big_unpack(bh,job)) return 0;
+    } else if(msg[0]==ARITH_FRAME_EXPR && len>=sizeof(*eh) && expr_sizes_ok(eh)
+              && len==sizeof(*eh)+eh->len*sizeof(v2_expr_insn_t)+eh->nargs*sizeof(int64_t)){
+        if(!expr_unpack(eh,job)) return 0;
+    } else {
+        metrics_inc(&met->bad_frames);
+        log_line("Socket %d: message of %zu bytes (type 0x%02x) ignored", idx, len, msg[0]);
+        return 0;
+    }
+    job->client_pid=c->pid; job->sched_class=c->sched_class; job->sock=idx+1; job->sock_gen=c->gen;
+    snprintf(job->resp_fifo,sizeof(job->resp_fifo),"socket %d",idx);
+    return 1;
+}
+
+static void array_submit(const sock_conn_t *c, const uint8_t *msg, size_t len, tp_msg_t *m, uint64_t t_recv); // see "Array operations"
+
+// A hello on a socket only declares the client's class (it is not answered)
+static void sock_hello(sock_conn_t *c, const uint8_t *msg){
+    v2_hello_t h; memcpy(&h,msg,sizeof(h));
+    c->sched_class= h.sched_class<ARITH_CLASS_COUNT ? h.sched_class : ARITH_CLASS_NORMAL;
+    log_line("Socket %d (PID=%d): class %s", (int)(c-sock_conns), (int)c->pid, class_names[c->sched_class]);
+}
+
+// A connection is readable: take up to TP_BATCH frames with one recvmmsg()
+// and dispatch them (array frames go to the array threads instead)
+static void sock_read(sock_conn_t *c, void (*dispatch)(const job_t*)){
+    static uint8_t bufs[TP_BATCH][ARITH_PIPE_BUF];
+    tp_msg_t m[TP_BATCH];
+    for(int i=0;i<TP_BATCH;i++){ m[i].buf=bufs[i]; m[i].len=sizeof(bufs[i]); }
+    PROF_BEGIN(t);
+    int got=tp_recv_many(c->fd,m,TP_BATCH);
+    PROF_END(PROF_READ,t);
+    if(got<0){
+        if(errno!=EAGAIN && errno!=EINTR) sock_close(c,strerror(errno));
+        return;
+    }
+    uint64_t t_recv=metrics_now(); // one timestamp for every request of this read
+    for(int i=0;i<got;i++){
+        if(m[i].len==0){ // EOF
+            for(int j=i;j<got;j++) tp_close_fds(&m[j]);
+            sock_close(c,"hung up"); return;
+        }
+        if(bufs[i][0]==ARITH_FRAME_ARRAY){ array_submit(c,bufs[i],m[i].len,&m[i],t_recv); continue; }
+        tp_close_fds(&m[i]); // only array frames carry descriptors
+        if(bufs[i][0]==ARITH_FRAME_HELLO && m[i].len==sizeof(v2_hello_t)){ sock_hello(c,bufs[i]); continue; }
+        job_t job;
+        if(!sock_frame(c,bufs[i],m[i].len,&job)) continue;
+        job.t_recv=t_recv;
+        PROF_BEGIN(td);
+        trace_recv(&job);
+        if(journal_path) journal_job(&job,ARITH_TRANSPORT_SOCK);
+        dispatch(&job);
+        PROF_END(PROF_DISPATCH,td);
+    }
+}
+
+// Send queued output, up to TP_BATCH messages per sendmmsg(); EV_OUT is
+// watched only while the socket is full
+static void sock_flush(sock_conn_t *c){
+    while(c->out_off<c->out_len){
+        tp_msg_t m[TP_BATCH]; unsigned k=0;
+        for(size_t off=c->out_off; k<TP_BATCH && off<c->out_len; k++){
+            uint32_t n; memcpy(&n,c->out+off,sizeof(n));
+            m[k].buf=c->out+off+sizeof(n); m[k].len=n; off+=sizeof(n)+n;
+        }
+        int sent=tp_send_many(c->fd,m,k);
+        if(sent<0 && errno==EINTR) continue;
+        if(sent<0 && errno==EAGAIN){
+            if(!c->want_out){ ev_mod(loop,c->fd,sock_in|EV_OUT,c); c->want_out=true; }
+            return;
+        }
+        if(sent<0){ metrics_inc(&met->write_failed); sock_close(c,strerror(errno)); return; } // EPIPE, ECONNRESET
+        for(int i=0;i<sent;i++) c->out_off+=sizeof(uint32_t)+m[i].len;
+    }
+    c->out_off=c->out_len=0;
+    if(c->want_out){ ev_mod(loop,c->fd,sock_in,c); c->want_out=false; }
+}
+
+// Readiness on a connection
+static void sock_ready(sock_conn_t *c, uint32_t events, void (*dispatch)(const job_t*)){
+    if(c->fd<0) return;
+    if(!sock_in && (events&EV_ERR)){ sock_close(c,"hung up"); return; } // handed over: what it sent is the next server's to read
+    if(events&(EV_IN|EV_ERR)) sock_read(c,dispatch); // a hangup reads as EOF
+    if(c->fd>=0 && (events&EV_OUT)) sock_flush(c);
+}
+
+// Reader: queue an answer for connection slot `sock`-1 if that still holds
+// the connection the request came from (sent by sock_pump)
+static void sock_queue(int32_t sock, uint32_t gen, const void *buf, size_t len){
+    sock_conn_t *c=&sock_conns[sock-1];
+    if(c->fd<0 || c->gen!=gen) return; // the client hung up: nobody to answer
+    uint32_t n=(uint32_t)len;
+    if(c->out_len+sizeof(n)+len>c->out_cap){
+        if(c->out_off){ memmove(c->out,c->out+c->out_off,c->out_len-c->out_off); c->out_len-=c->out_off; c->out_off=0; }
+        size_t cap=c->out_cap ? c->out_cap : ARITH_PIPE_BUF;
+        while(cap<c->out_len+sizeof(n)+len) cap*=2;
+        char *o= cap>c->out_cap ? realloc(c->out,cap) : c->out;
+        if(!o){ log_line("socket %d: out of memory, answer dropped", sock-1); return; }
+        c->out=o; c->out_cap=cap;
+    }
+    memcpy(c->out+c->out_len,&n,sizeof(n)); memcpy(c->out+c->out_len+sizeof(n),buf,len);
+    c->out_len+=sizeof(n)+len;
+    if(!c->dirty){ c->dirty=true; sock_dirty[n_sock_dirty++]=sock-1; }
+}
+
+static void sock_queue_job(const job_t *job, const void *buf, size_t len){
+    sock_queue(job->sock,job->sock_gen,buf,len);
+}
+
+static void sock_wake_reader(void){
+    if(!atomic_exchange(sock_wake,true) && write(wake_fd[1],"",1)<0){} // full pipe: a wake-up is pending anyway
+}
+
+// Handler (any process or thread): pass an answer to the reader
+static void sock_reply(const job_t *job, const void *buf, size_t len){
+    sock_reply_t r; r.sock=job->sock; r.gen=job->sock_gen; r.len=(uint32_t)len;
+    memcpy(r.buf,buf,len);
+    ring_t *q= len<=sizeof(v2_response_t) ? sock_ring : sock_big_ring;
+    while(!ring_push(q,&r)){ // the reader is behind: let it catch up
+        if(stop_requested){ log_line("%s(%d) answer to %s dropped at shutdown", role, self_id, job->resp_fifo); return; }
+        sock_wake_reader();
+        struct timespec ts={0,100*1000}; nanosleep(&ts,NULL);
+    }
+    sock_wake_reader();
+}
+
+// Main reader, after each batch of events: queue what handlers answered and
+// send every connection's output. Returns the ev_wait timeout it needs (-1 => none).
+static int sock_pump(void){
+    atomic_store(sock_wake,false);
+    sock_reply_t r;
+    while(ring_pop(sock_ring,&r)) sock_queue(r.sock,r.gen,r.buf,r.len);
+    while(ring_pop(sock_big_ring,&r)) sock_queue(r.sock,r.gen,r.buf,r.len);
+    for(int i=0;i<n_sock_dirty;i++){
+        sock_conn_t *c=&sock_conns[sock_dirty[i]];
+        c->dirty=false;
+        if(c->fd>=0 && !c->want_out) sock_flush(c);
+    }
+    n_sock_dirty=0;
+    if(!sock_paused_until) return -1;
+    int64_t left=sock_paused_until-now_ms();
+    if(left>0) return (int)left;
+    if(!atomic_load(&handed_over)) ev_mod(loop,sock_listen,EV_IN,&sock_listen);
+    sock_paused_until=0;
+    return -1;
+}
+
+// Shutdown, once the executors have stopped: send what they answered, then close everything
+static void sock_stop(void){
+    if(sock_listen<0) return;
+    sock_pump();
+    for(int i=0;i<SOCK_MAX_CONNS;i++){
+        if(sock_conns[i].fd>=0) sock_close(&sock_conns[i],"server stopping");
+        free(sock_conns[i].out);
+    }
+    close(sock_listen); sock_listen=-1;
+}
+
+// ---- Array operations (array frames, --transport sock) ----
+// An array frame (proto.h) brings its arrays as memfds. The reader checks
+// and maps them (inputs read-only, the output read-write), closes the
+// descriptors and queues the operation for the array threads. Those split it
+// into slices of ARRAY_SLICE elements and always take slices of the oldest
+// queued operation, so a large one runs on every thread at once and later
+// ones wait their turn instead of sharing the caches with it. The thread
+// that finishes the last slice combines the partial results, unmaps the
+// arrays and answers through the socket reply ring. Operands and results
+// never pass through a system call: the server works on the client's pages.
+#define ARRAY_SLICE  (1u<<16) // elements per slice (512 KiB of each array)
+#define ARRAY_QUEUE  64       // operations accepted and unanswered; more are answered busy
+
+typedef struct { int64_t val; int32_t status; } array_part_t; // outcome of one slice
+
+typedef struct array_op {
+    job_t    job;              // whom to answer (socket, generation, request id)
+    uint8_t  kind, opcode;     // enum arith_array_kind, map's enum arith_op
+    size_t   n;                // elements per array
+    const int64_t *a, *b;      // inputs (b: dot, map)
+    int64_t *out;              // map's output
+    void    *map[3];           // mappings to undo
+    size_t   map_len[3];
+    size_t   slices, next;     // slices in all and handed out so far (next: under array_mu)
+    atomic_size_t done;        // slices finished
+    struct array_op *q_next;   // queue of operations with slices left
+    array_part_t part[];       // per slice
+} array_op_t;
+
+static pthread_t      *array_tids = NULL;
+static int             array_started = 0;
+static pthread_mutex_t array_mu = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  array_cv = PTHREAD_COND_INITIALIZER;
+static array_op_t     *array_head = NULL, *array_tail = NULL;
+static bool            array_stopping = false;
+static atomic_int      array_inflight; // accepted, not answered yet (reader checks it against ARRAY_QUEUE)
+
+// Whether fd is a memfd that can no longer shrink (else a client could cut
+// it short and have the server fault on the missing pages)
+static bool array_sealed(int fd){
+#ifdef F_GET_SEALS
+    int seals=fcntl(fd,F_GET_SEALS);
+    return seals>=0 && (seals&F_SEAL_SHRINK);
+#else
+    (void)fd; return false;
+#endif
+}
+
+// Map op->n int64s at byte `off` of fd as array k; NULL if fd does not hold them
+static int64_t *array_map(array_op_t *op, int k, int fd, uint64_t off, int prot){
+    static int64_t none[1]; // n == 0: nothing is mapped or touched
+    size_t bytes=op->n*sizeof(int64_t);
+    struct stat st;
+    if(off%sizeof(int64_t) || !array_sealed(fd) || fstat(fd,&st)<0
+       || off>(uint64_t)st.st_size || bytes>(uint64_t)st.st_size-off) return NULL;
+    if(!bytes) return none;
+    size_t skip=(size_t)(off%(uint64_t)sysconf(_SC_PAGESIZE));
+    void *p=mmap(NULL,skip+bytes,prot,MAP_SHARED,fd,(off_t)(off-skip));
+    if(p==MAP_FAILED) return NULL; // EACCES: the output is not writable
+    op->map[k]=p; op->map_len[k]=skip+bytes;
+    return (int64_t*)((char*)p+skip);
+}
+
+static void array_unmap(array_op_t *op){
+    for(int k=0;k<3;k++) if(op->map[k]) munmap(op->map[k],op->map_len[k]);
+}
+
+// Compute slice s of an operation
+static void array_slice(array_op_t *op, size_t s){
+    size_t lo=s*ARRAY_SLICE, m= op->n-lo<ARRAY_SLICE ? op->n-lo : ARRAY_SLICE;
+    array_part_t *p=&op->part[s];
+    p->status=ARITH_OK;
+    switch(op->kind){
+    case ARITH_ARRAY_SUM: p->val=compute_sum(op->a+lo,m); break;
+    case ARITH_ARRAY_DOT: p->val=compute_dot(op->a+lo,op->b+lo,m); break;
+    default: {
+        int st; size_t f=compute_map(op->opcode,op->a+lo,op->b+lo,op->out+lo,m,&st);
+        p->status=st; p->val=(int64_t)(lo+f);
+    }
+    }
+}
+
+// Last slice done: combine, unmap and answer
+static void array_finish(array_op_t *op){
+    int status=ARITH_OK; uint64_t result=0;
+    if(op->kind==ARITH_ARRAY_MAP){
+        result=op->n;
+        for(size_t s=0;s<op->slices;s++)
+            if(op->part[s].status!=ARITH_OK){ status=op->part[s].status; result=(uint64_t)op->part[s].val; break; }
+    } else {
+        for(size_t s=0;s<op->slices;s++) result+=(uint64_t)op->part[s].val; // wraps like the kernels
+    }
+    array_unmap(op);
+    v2_response_t rp;
+    encode_response(&op->job,status,(int64_t)result,&rp);
+    sock_reply(&op->job,&rp,sizeof(rp));
+    metrics_inc(&met->arrays);
+    atomic_fetch_add_explicit(&met->array_elems,op->n,memory_order_relaxed);
+    metrics_inc(&met->status[status]);
+    if(tracing()){
+        if(status==ARITH_OK) say("[SERVER array=%d] computed %s[%zu] = %lld in %zu slices\n", self_id, op->job.op_name, op->n, (long long)result, op->slices);
+        else say("[SERVER array=%d] computed %s[%zu] -> ERROR: %s at element %lld\n", self_id, op->job.op_name, op->n, arith_status_str(status), (long long)result);
+    }
+    atomic_fetch_sub(&array_inflight,1);
+    free(op);
+}
+
+static void *array_main(void *arg){
+    self_id=(int)(intptr_t)arg;
+    pthread_mutex_lock(&array_mu);
+    for(;;){
+        while(!array_head && !array_stopping) pthread_cond_wait(&array_cv,&array_mu);
+        array_op_t *op=array_head;
+        if(!op) break; // stopping, and every slice has been handed out
+        size_t s=op->next++;
+        if(op->next==op->slices){ array_head=op->q_next; if(!array_head) array_tail=NULL; }
+        pthread_mutex_unlock(&array_mu);
+        array_slice(op,s);
+        if(atomic_fetch_add(&op->done,1)+1==op->slices) array_finish(op);
+        pthread_mutex_lock(&array_mu);
+    }
+    pthread_mutex_unlock(&array_mu);
+    return NULL;
+}
+
+// Reader: take an array frame of connection c with its descriptors (closed
+// here), map its arrays and queue it; what cannot run is answered at once
+static void array_submit(const sock_conn_t *c, const uint8_t *msg, size_t len, tp_msg_t *m, uint64_t t_recv){
+    static const char *const kind_names[ARITH_ARRAY_KINDS]={ "sum", "dot", "map" };
+    int idx=(int)(c-sock_conns);
+    if(len!=sizeof(v2_array_t)){
+        tp_close_fds(m);
+        metrics_inc(&met->bad_frames);
+        log_line("Socket %d: array frame of %zu bytes ignored", idx, len);
+        return;
+    }
+    v2_array_t f; memcpy(&f,msg,sizeof(f));
+    job_t job; memset(&job,0,sizeof(job));
+    job.version=2; job.req_id=f.req_id; job.client_pid=c->pid; job.sock=idx+1; job.sock_gen=c->gen; job.t_recv=t_recv;
+    snprintf(job.resp_fifo,sizeof(job.resp_fifo),"socket %d",idx);
+    snprintf(job.op_name,sizeof(job.op_name),"%s", f.kind==ARITH_ARRAY_MAP && f.opcode<ARITH_OP_COUNT ? arith_ops[f.opcode].name
+             : f.kind<ARITH_ARRAY_KINDS ? kind_names[f.kind] : "?");
+    if(tracing()){
+        say("[SERVER] recv from PID=%d : %s[%llu] -> resp=%s\n", (int)job.client_pid, job.op_name, (unsigned long long)f.n, job.resp_fifo);
+        log_line("Recv PID=%d array=%s n=%llu resp=%s", (int)job.client_pid, job.op_name, (unsigned long long)f.n, job.resp_fifo);
+    }
+
+    int status=ARITH_OK;
+    array_op_t *op=NULL;
+    if(f.kind>=ARITH_ARRAY_KINDS || (f.kind==ARITH_ARRAY_MAP && f.opcode>=ARITH_OP_COUNT)) status=ARITH_EINVALOP;
+    else if(m->nfd!=arith_array_count(f.kind) || f.n>SIZE_MAX/sizeof(int64_t)) status=ARITH_EBADARRAY;
+    else if(atomic_load(&array_inflight)>=ARRAY_QUEUE){ status=ARITH_EBUSY; metrics_inc(&adm->busy_full); }
+    else {
+        size_t slices= f.n ? (size_t)((f.n+ARRAY_SLICE-1)/ARRAY_SLICE) : 1;
+        op=calloc(1,sizeof(*op)+slices*sizeof(op->part[0]));
+        if(!op) status=ARITH_EBUSY;
+        else {
+            op->job=job; op->kind=f.kind; op->opcode=f.opcode; op->n=(size_t)f.n; op->slices=slices;
+            unsigned k=arith_array_count(f.kind);
+            op->a=array_map(op,0,m->fd[0],f.off[0],PROT_READ);
+            if(k>1) op->b=array_map(op,1,m->fd[1],f.off[1],PROT_READ);
+            if(k>2) op->out=array_map(op,2,m->fd[2],f.off[2],PROT_READ|PROT_WRITE);
+            if(!op->a || (k>1 && !op->b) || (k>2 && !op->out)) status=ARITH_EBADARRAY;
+        }
+    }
+    tp_close_fds(m); // the mappings keep the memory
+    if(status!=ARITH_OK){
+        if(op){ array_unmap(op); free(op); }
+        v2_response_t rp;
+        encode_response(&job,status,0,&rp);
+        sock_queue_job(&job,&rp,sizeof(rp));
+        metrics_inc(&met->status[status]);
+        log_line("Socket %d: array %s[%llu] refused: %s", idx, job.op_name, (unsigned long long)f.n, arith_status_str(status));
+        return;
+    }
+    atomic_fetch_add(&array_inflight,1);
+    pthread_mutex_lock(&array_mu);
+    if(array_tail) array_tail->q_next=op; else array_head=op;
+    array_tail=op;
+    if(op->slices>1) pthread_cond_broadcast(&array_cv); else pthread_cond_signal(&array_cv);
+    pthread_mutex_unlock(&array_mu);
+}
+
+// Start the array threads (with the socket transport, after any fork()ed workers)
+static void array_start(void){
+    long ncpu=sysconf(_SC_NPROCESSORS_ONLN);
+    int n= n_array_threads ? n_array_threads : ncpu<1 ? 1 : ncpu>64 ? 64 : (int)ncpu;
+    array_tids=calloc((size_t)n,sizeof(*array_tids));
+    if(!array_tids) die("alloc array threads");
+    for(; array_started<n; array_started++)
+        if(pthread_create(&array_tids[array_started],NULL,array_main,(void*)(intptr_t)array_started)!=0) die("pthread_create array thread");
+    log_line("Array operations: %d threads, slices of %u elements", n, ARRAY_SLICE);
+}
+
+// Shutdown: finish what is queued, then stop the threads
+static void array_stop(void){
+    if(!array_started) return;
+    pthread_mutex_lock(&array_mu);
+    array_stopping=true;
+    pthread_cond_broadcast(&array_cv);
+    pthread_mutex_unlock(&array_mu);
+    for(int i=0;i<array_started;i++) pthread_join(array_tids[i],NULL);
+    free(array_tids); array_started=0;
+}
+
+// ---- Reader: signals and request intake ----
+
+// Act on the signals queued on sig_fd: SIGINT/TERM request a stop, SIGHUP a
+// reload (see "Takeover"), SIGCHLD reaps exited children (and respawns pool workers)
+static void handle_signals(void){
+    int sig;
+    while((sig=ev_signal_next(sig_fd))>0){
+        if(sig==SIGHUP){ reload_requested=1; continue; }
+        if(sig!=SIGCHLD){ stop_requested=1; continue; }
+        if(n_workers>0) reap_workers();
+        else if(children) fork_reap();
+        else while(waitpid(-1,NULL,WNOHANG)>0){}
+    }
+}
+
+// Dispatch every whole request a read brought into the ring
+static void rx_dispatch(struct rx *rx, void (*dispatch)(const job_t*)){
+    unsigned long long n=0;
+    uint64_t t_recv=metrics_now(); // one timestamp for every request of this read
+    job_t job; // next decoded request
+    int got;
+    while((got=rx_next(rx,&job))>=0){
+        if(!got) continue; // control frame or dropped request
+        n++; job.t_recv=t_recv;
+        PROF_BEGIN(td);
+        trace_recv(&job);
+        if(journal_path) journal_job(&job,ARITH_TRANSPORT_FIFO);
+        dispatch(&job);
+        PROF_END(PROF_DISPATCH,td);
+    }
+    rx->reads++; rx->requests+=n;
+    if(n>rx->max_per_read) rx->max_per_read=n;
+}
+
+// EOF on a request FIFO (all writers closed): drop a partial frame, whose
+// writer is gone, and reopen the FIFO to receive future writers
+static void reader_reopen(reader_t *rd){
+    struct rx *rx=rd->rx;
+    if(rx_avail(rx)){ metrics_inc(&met->partial); log_line("Partial request (%zu bytes) ignored", rx_avail(rx)); }
+    rx->tail=rx->head;
+    close(rd->fd);
+    rd->fd=open(rd->path,O_RDONLY|O_NONBLOCK);
+    if(rd->fd<0) die("reopen");
+}
+
+// A request FIFO is readable: take in everything queued and dispatch it.
+// `in_loop`: the FIFO is watched by the event loop (re-register on reopen).
+static void read_requests(reader_t *rd, bool in_loop, void (*dispatch)(const job_t*)){
+    if(rd->fd<0) return; // handed over (see "Takeover"): the FIFO is the successor's
+    PROF_BEGIN(t);
+    ssize_t r=rx_fill(rd->rx,rd->fd);
+    PROF_END(PROF_READ,t);
+    if(r==0){
+        reader_reopen(rd);
+        if(in_loop && ev_add(loop,rd->fd,EV_IN,rd)<0) die("reopen");
+        return;
+    }
+    if(r<0){ if(errno==EAGAIN || errno==EINTR) return; die("read request"); }
+    rx_dispatch(rd->rx,dispatch);
+}
+
+
+// Put a partial frame handed over by the previous server (--takeover) in
+// front of whatever the FIFO brings next
+static void reader_carry(reader_t *rd){
+    if(!rd->carry) return;
+    rx_push(rd->rx,rd->carry,rd->carry_len);
+    free(rd->carry); rd->carry=NULL; rd->carry_len=0;
+}
+
+// Create a request FIFO and open both of its ends
+static void reader_open(reader_t *rd){
+    if (mkfifo(rd->path,0666)<0 && errno!=EEXIST) die("mkfifo request");
+    // Open the request FIFO for reading; use a dummy writer to avoid EOF when no clients
+    rd->fd=open(rd->path,O_RDONLY|O_NONBLOCK); // non-blocking: the reader waits for it in poll/epoll
+    if(rd->fd<0) die("open request fifo (read)");
+    rd->dummy_w=open(rd->path,O_WRONLY);
+    if(rd->dummy_w<0) die("open request fifo (dummy write)");
+}
+
+static void log_reader_stats(const char *name, const struct rx *rx){
+    log_line("%s: %llu requests in %llu reads (%.2f per read, max %llu)", name,
+             rx->requests, rx->reads, rx->reads ? (double)rx->requests/(double)rx->reads : 0.0, rx->max_per_read);
+}
+
+// ---- Request FIFO shards (--shards N) ----
+// All clients writing into one FIFO contend on its inode lock, and one reader
+// drains everything. With --shards N the server also serves REQ_SHARD_FMT
+// FIFOs .0 to .N-1 and publishes N in REQ_SHARDS_PATH; clients pick a shard by
+// hashing their PID (libarith does it on connect) and use it for every frame,
+// hello and attach included. Each shard has a reader thread of its own,
+// pinned to CPU i % ncpu, that decodes and dispatches exactly like the main
+// reader into the same executor; it allocates its receive ring after
+// pinning, so first touch places that memory on the CPU's NUMA node. With
+// --engine epoll the shards are watched by the one event loop instead: its
+// connection table has a single owner (under io_uring each keeps a read
+// posted in the ring).
+static void (*shard_dispatch)(const job_t*) = NULL;
+
+static void *shard_main(void *arg){
+    reader_t *rd=arg;
+    int idx=(int)(rd-shards);
+    shard_reader=true; self_id=idx;
+    pin_thread(pthread_self(),idx);
+    if(!rd->rx){ // kept across a takeover that failed (see "Takeover")
+        rd->rx=calloc(1,sizeof(*rd->rx));
+        if(!rd->rx) die("calloc shard ring");
+        reader_carry(rd);
+    }
+    struct pollfd pf={ .fd=rd->fd, .events=POLLIN };
+    while(!stop_requested && !atomic_load(&handed_over)){
+        int n= busy_poll_ns ? busy_poll_fd(rd->fd,busy_poll_ns) : 0;
+        if(!n) n=poll(&pf,1,100); // wakes up every 100 ms to notice a stop
+        if(n<0 && errno!=EINTR) die("poll shard");
+        if(n>0){ read_requests(rd,false,shard_dispatch); pf.fd=rd->fd; }
+    }
+    return NULL;
+}
+
+// The shard readers, no FIFO open yet
+static void shards_alloc(void){
+    shards=calloc((size_t)n_shards,sizeof(*shards));
+    if(!shards) die("calloc shards");
+    for(int i=0;i<n_shards;i++){
+        shards[i].fd=shards[i].dummy_w=-1;
+        snprintf(shards[i].path,sizeof(shards[i].path),REQ_SHARD_FMT,i);
+    }
+}
+
+// Create the shard FIFOs (before workers are forked, so they can close them)
+static void shards_open(void){
+    if(!shards) shards_alloc();
+    for(int i=0;i<n_shards;i++) if(shards[i].fd<0) reader_open(&shards[i]); // --takeover: handed over already
+}
+
+static void uring_read_post(unsigned idx); // see "io_uring engine: the loop"
+static void shard_threads_start(void);     // see "Takeover"
+
+// Start serving the shards and publish their count (written to a temporary
+// name first, so a client never reads a partial file)
+static void shards_start(void (*dispatch)(const job_t*)){
+    shard_dispatch=dispatch;
+    for(int i=0;i<n_shards;i++){
+        if(engine_epoll){
+            shards[i].rx=calloc(1,sizeof(*shards[i].rx));
+            if(!shards[i].rx) die("calloc shard ring");
+            reader_carry(&shards[i]);
+            if(ring) uring_read_post((unsigned)i+1);
+            else if(ev_add(loop,shards[i].fd,EV_IN,&shards[i])<0) die("shard event loop add");
+        }
+    }
+    if(!engine_epoll) shard_threads_start();
+    char tmp[64]; snprintf(tmp,sizeof(tmp),"%s.tmp",REQ_SHARDS_PATH);
+    FILE *f=fopen(tmp,"w");
+    if(!f || fprintf(f,"%d\n",n_shards)<0 || fclose(f)!=0 || rename(tmp,REQ_SHARDS_PATH)<0) die("publish shard count");
+    log_line("Serving %d request FIFO shards (%s)", n_shards, ring ? "io_uring" : engine_epoll ? "event loop" : "reader thread each, pinned");
+}
+
+// Shutdown: unpublish the count, then let every shard reader see the stop
+// (after a takeover the count is the next server's, and the readers are gone)
+static void shards_stop(void){
+    bool handed=atomic_load(&handed_over);
+    if(!handed) unlink(REQ_SHARDS_PATH);
+    for(int i=0;i<n_shards;i++){
+        char name[24]; snprintf(name,sizeof(name),"Shard %d",i);
+        if(!engine_epoll && !handed) pthread_join(shards[i].tid,NULL);
+        if(shards[i].rx) log_reader_stats(name,shards[i].rx);
+        free(shards[i].rx); shards[i].rx=NULL;
+    }
+}
+
+static void takeover_give(void (*dispatch)(const job_t*)); // see "Takeover"
+static bool tk_draining;                                   // see "Takeover"
+
+// Whether an event loop pointer is a request FIFO reader
+static bool is_reader(const void *ptr){
+    return ptr==&main_rd || (n_shards && (const reader_t*)ptr>=shards && (const reader_t*)ptr<shards+n_shards);
+}
+
+// Handle a batch of readiness events of the loop
+static void serve_events(const ev_event_t *evs, int n, void (*dispatch)(const job_t*)){
+    for(int i=0;i<n;i++){
+        if(evs[i].ptr==&sig_fd) handle_signals();
+        else if(evs[i].ptr==wake_fd){ char b[64]; while(read(wake_fd[0],b,sizeof(b))>0){} }
+        else if(is_reader(evs[i].ptr)){ // EV_ERR too: read sees the EOF
+            // skipped once handed over, maybe earlier in this very batch
+            if(!tk_draining) read_requests(evs[i].ptr,true,dispatch);
+        }
+        else if(evs[i].ptr==&sock_listen) sock_accept();
+        else if(evs[i].ptr==&tk_listen) takeover_give(dispatch);
+        else if(is_sock(evs[i].ptr)) sock_ready(evs[i].ptr,evs[i].events,dispatch);
+        else conn_ready(evs[i].ptr,evs[i].events);
+    }
+}
+
+// ---- io_uring engine: the loop ----
+// One uring_wait() per pass submits the writes the last pass queued and
+// waits for completions: request FIFO reads (idx: 0 the main FIFO, i+1 shard
+// i, also its provided-buffer group), response chunk writes, and readiness
+// of the epoll set. A multishot poll reports the epoll fd only when
+// something new becomes ready, so after events the set is checked once more
+// without waiting until it comes back empty.
+
+static reader_t *uring_reader(unsigned idx){ return idx ? &shards[idx-1] : &main_rd; }
+static unsigned uring_reads_live = 0; // request FIFO reads still posted while a takeover cancels them
+
+// (Re)arm the multishot read of a request FIFO. It goes back to blocking so
+// the ring waits for data; O_NONBLOCK would end the read with -EAGAIN.
+static void uring_read_post(unsigned idx){
+    reader_t *rd=uring_reader(idx);
+    if(fcntl(rd->fd,F_SETFL,fcntl(rd->fd,F_GETFL)&~O_NONBLOCK)<0
+       || uring_read_multishot(ring,rd->fd,(uint16_t)idx,UD(UD_READ,idx))<0) die("io_uring read");
+}
+
+static void uring_read_done(unsigned idx, const uring_cqe_t *cqe, void (*dispatch)(const job_t*)){
+    reader_t *rd=uring_reader(idx);
+    int bid=uring_cqe_buffer(cqe);
+    if(bid>=0){
+        if(cqe->res>0){
+            PROF_BEGIN(t);
+            rx_push(rd->rx,uring_group_buf(ring,(uint16_t)idx,(unsigned)bid),(size_t)cqe->res);
+            PROF_END(PROF_READ,t);
+        }
+        uring_group_recycle(ring,(uint16_t)idx,(unsigned)bid);
+        if(cqe->res>0) rx_dispatch(rd->rx,dispatch);
+    }
+    if(cqe->res==0) reader_reopen(rd); // all writers closed (the read is over)
+    else if(cqe->res<0 && cqe->res!=-ENOBUFS && cqe->res!=-EINTR && cqe->res!=-ECANCELED){ errno=-cqe->res; die("read request"); } // ENOBUFS: re-armed below
+    if(uring_cqe_more(cqe)) return;
+    if(atomic_load(&handed_over)) uring_reads_live--; // cancelled for a takeover: stays off
+    else uring_read_post(idx);
+}
+
+static bool uring_ep_again = false; // the epoll set had events last time: look again
+
+// One pass of the io_uring engine; whether it had anything to serve
+static bool uring_serve(int timeout, void (*dispatch)(const job_t*)){
+    if(uring_wait(ring,uring_ep_again ? 0 : timeout)<0) die("io_uring wait");
+    bool ep=uring_ep_again, any=false;
+    uring_cqe_t cqe;
+    while(uring_next(ring,&cqe)){
+        any=true;
+        unsigned idx=(unsigned)(cqe.data>>2);
+        switch(cqe.data&3){
+        case UD_EPOLL:
+            ep=true;
+            if(!uring_cqe_more(&cqe) && uring_poll_multishot(ring,ev_fd(loop),UD(UD_EPOLL,0))<0) die("io_uring poll");
+            break;
+        case UD_READ:  uring_read_done(idx,&cqe,dispatch); break;
+        case UD_WRITE: tx_done(idx,cqe.res); break;
+        }
+    }
+    if(!ep) return any;
+    ev_event_t evs[64];
+    int n=ev_wait(loop,evs,64,0);
+    if(n<0) die("event wait");
+    serve_events(evs,n,dispatch);
+    uring_ep_again= n>0;
+    return any || n>0;
+}
+
+// Shutdown: give the writes in flight up to 100 ms, then close the ring
+static void engine_uring_stop(void){
+    int64_t until=now_ms()+100;
+    while(n_tx_free<TX_CHUNKS && now_ms()<until){
+        if(uring_wait(ring,10)<0) break;
+        uring_cqe_t cqe;
+        while(uring_next(ring,&cqe)) if((cqe.data&3)==UD_WRITE) tx_done((uint32_t)(cqe.data>>2),cqe.res);
+    }
+    uring_destroy(ring); ring=NULL;
+}
+
+// ---- Takeover (SIGHUP, --takeover) ----
+// A server started with --takeover connects to the running one on
+// TAKEOVER_PATH; SIGHUP makes the running server start that successor
+// itself (the same binary and command line plus --takeover). The successor
+// gets everything ready first, executors included, and only then asks. The
+// old server stops reading, dispatches what it has read, and passes over
+// that socket (SCM_RIGHTS):
+//   - both ends of every request FIFO, with the partial frame it had read;
+//   - the socket listener and every client connection;
+//   - the session table;
+//   - the names of the shm channels, whose threads stopped between calls.
+// Nobody closes or unlinks a FIFO in between, so clients never see ENOENT
+// or block in open(), and what they write meanwhile waits in the pipe for
+// the successor's first read. Once the successor acknowledges, the old server
+// only answers what it had already taken in (queued jobs, children, pool
+// workers, pending output) for at most TAKEOVER_DRAIN_MS, then exits without
+// removing anything. A handover that fails before the acknowledgement
+// resumes reading where it stopped. Both servers need the same --shards, and
+// the successor must serve sock and shm if the old server does. Response
+// FIFOs are not passed: the successor opens each one again, which never
+// waits because every client keeps its own open.
+#define TAKEOVER_PATH     "/tmp/arith_takeover.sock"
+#define TAKEOVER_MAGIC    0x41544b4fu // "ATKO"
+#define TAKEOVER_FDS      64          // descriptors per message
+#define TAKEOVER_SESSIONS 64          // session table entries per message
+#define TAKEOVER_DRAIN_MS 10000       // longest the old server keeps answering afterwards
+_Static_assert(MAX_SESSIONS%TAKEOVER_SESSIONS==0, "the session table goes in whole messages");
+
+// Messages on the takeover socket (SOCK_SEQPACKET): a tk_hdr_t, then
+enum {
+    TK_HELLO = 1, // successor -> old: arg its --shards, count TK_SOCK|TK_SHM it serves
+    TK_REFUSE,    // old -> successor: why not (text)
+    TK_READER,    // reader `count` (0 main FIFO, i+1 shard i): its partial frame; fds read end, dummy writer
+    TK_LISTENER,  // fd: the socket listener
+    TK_SESSIONS,  // `count` session_t from index `arg`
+    TK_SOCKS,     // `count` tk_sock_t; fds: their connections
+    TK_SHM,       // name of a channel of client `arg`; fd: its segment
+    TK_DONE,      // old -> successor: that was all; successor -> old: taken
+};
+enum { TK_SOCK = 1, TK_SHM_TRANSPORT = 2 };
+typedef struct {
+    uint32_t magic;  // TAKEOVER_MAGIC
+    uint16_t type;   // TK_*
+    uint16_t count;
+    int32_t  arg;
+} tk_hdr_t;
+typedef struct { int32_t pid, sched_class; } tk_sock_t; // a socket client besides its connection
+typedef union { struct cmsghdr h; char buf[CMSG_SPACE(TAKEOVER_FDS*sizeof(int))]; } tk_ctl_t;
+
+static bool    tk_draining = false;  // handed over: answer what is left, then exit
+static int64_t tk_drain_until = 0;   // now_ms() deadline for that
+static char  **tk_argv = NULL;       // our command line (the SIGHUP successor's, plus --takeover)
+
+// Send one message and its descriptors, blocking; 0, or -1 with errno
+static int tk_send(int s, uint16_t type, uint16_t count, int32_t arg, const void *body, size_t len, const int *fds, unsigned nfd){
+    tk_hdr_t h={ .magic=TAKEOVER_MAGIC, .type=type, .count=count, .arg=arg };
+    struct iovec iov[2]={ { &h, sizeof(h) }, { (void*)body, len } };
+    struct msghdr mh; memset(&mh,0,sizeof(mh));
+    mh.msg_iov=iov; mh.msg_iovlen= len ? 2 : 1;
+    tk_ctl_t ctl;
+    if(nfd){
+        memset(&ctl,0,sizeof(ctl));
+        mh.msg_control=ctl.buf; mh.msg_controllen=CMSG_SPACE(nfd*sizeof(int));
+        struct cmsghdr *ch=CMSG_FIRSTHDR(&mh);
+        ch->cmsg_level=SOL_SOCKET; ch->cmsg_type=SCM_RIGHTS; ch->cmsg_len=CMSG_LEN(nfd*sizeof(int));
+        memcpy(CMSG_DATA(ch),fds,nfd*sizeof(int));
+    }
+    ssize_t w;
+    while((w=sendmsg(s,&mh,MSG_NOSIGNAL))<0 && errno==EINTR){}
+    return w<0 ? -1 : 0;
+}
+
+// Receive one message (waiting up to the socket's timeout) and its
+// descriptors, close-on-exec, into fds (NULL: close them). Returns the length
+// of the body, or -1 with errno (ECONNRESET: the peer is gone, EPROTO: not
+// one of ours).
+static ssize_t tk_recv(int s, tk_hdr_t *h, void *body, size_t cap, int *fds, unsigned *nfd){
+    struct iovec iov[2]={ { h, sizeof(*h) }, { body, cap } };
+    tk_ctl_t ctl;
+    struct msghdr mh; memset(&mh,0,sizeof(mh));
+    mh.msg_iov=iov; mh.msg_iovlen=2; mh.msg_control=ctl.buf; mh.msg_controllen=sizeof(ctl.buf);
+    ssize_t r;
+    while((r=recvmsg(s,&mh,MSG_CMSG_CLOEXEC))<0 && errno==EINTR){}
+    if(nfd) *nfd=0;
+    if(r>0)
+        for(struct cmsghdr *ch=CMSG_FIRSTHDR(&mh); ch; ch=CMSG_NXTHDR(&mh,ch)){
+            if(ch->cmsg_level!=SOL_SOCKET || ch->cmsg_type!=SCM_RIGHTS) continue;
+            size_t k=(ch->cmsg_len-CMSG_LEN(0))/sizeof(int);
+            for(size_t j=0;j<k;j++){
+                int fd; memcpy(&fd,CMSG_DATA(ch)+j*sizeof(int),sizeof(fd));
+                if(fds && *nfd<TAKEOVER_FDS) fds[(*nfd)++]=fd; else close(fd);
+            }
+        }
+    if(r<0) return -1;
+    if(r==0){ errno=ECONNRESET; return -1; }
+    if((size_t)r<sizeof(*h) || h->magic!=TAKEOVER_MAGIC || (mh.msg_flags&(MSG_TRUNC|MSG_CTRUNC))){ errno=EPROTO; return -1; }
+    return r-(ssize_t)sizeof(*h);
+}
+
+// Bind the takeover socket and watch it in the loop (best effort: without it
+// there is no reload, and SIGHUP only says so)
+static void takeover_listen(void){
+    struct sockaddr_un sa; memset(&sa,0,sizeof(sa));
+    sa.sun_family=AF_UNIX;
+    snprintf(sa.sun_path,sizeof(sa.sun_path),"%s",TAKEOVER_PATH);
+    unlink(TAKEOVER_PATH); // a predecessor's (it no longer listens) or a killed server's
+    tk_listen=socket(AF_UNIX,SOCK_SEQPACKET|SOCK_NONBLOCK|SOCK_CLOEXEC,0);
+    if(tk_listen>=0 && bind(tk_listen,(const struct sockaddr*)&sa,sizeof(sa))==0 && chmod(TAKEOVER_PATH,0600)==0
+       && listen(tk_listen,4)==0 && ev_add(loop,tk_listen,EV_IN,&tk_listen)==0) return;
+    log_line("Takeover socket %s unavailable (%s): no reload", TAKEOVER_PATH, strerror(errno));
+    if(tk_listen>=0) close(tk_listen);
+    tk_listen=-1;
+}
+
+static void takeover_unlink(void){ if(tk_listen>=0) unlink(TAKEOVER_PATH); }
+
+// Start the shard reader threads (they get their dispatch from shard_dispatch)
+static void shard_threads_start(void){
+    for(int i=0;i<n_shards;i++){
+        sigset_t old; block_reader_signals(&old);
+        int e=pthread_create(&shards[i].tid,NULL,shard_main,&shards[i]);
+        pthread_sigmask(SIG_SETMASK,&old,NULL);
+        if(e){ errno=e; die("pthread_create shard"); }
+    }
+}
+
+// Stop taking anything in: join the shard reader threads, cancel the FIFO
+// reads posted in the ring (dispatching what they still bring) or drop the
+// FIFOs from the loop, watch the socket connections for nothing but room for
+// answers, and let the shm channel threads return between two calls. Only
+// partial frames are left in the receive rings.
+static void readers_stop(void (*dispatch)(const job_t*)){
+    atomic_store(&handed_over,true);
+    if(!engine_epoll) for(int i=0;i<n_shards;i++) pthread_join(shards[i].tid,NULL);
+    if(ring){
+        uring_reads_live=1+(unsigned)n_shards;
+        for(unsigned i=0;i<uring_reads_live;i++) if(uring_cancel(ring,UD(UD_READ,i),UD(UD_CANCEL,i))<0) die("io_uring cancel");
+        while(uring_reads_live){
+            if(uring_wait(ring,100)<0) die("io_uring wait");
+            uring_cqe_t cqe;
+            while(uring_next(ring,&cqe)){
+                unsigned idx=(unsigned)(cqe.data>>2);
+                switch(cqe.data&3){
+                case UD_EPOLL: // the loop looks at the epoll set once we are done
+                    uring_ep_again=true;
+                    if(!uring_cqe_more(&cqe) && uring_poll_multishot(ring,ev_fd(loop),UD(UD_EPOLL,0))<0) die("io_uring poll");
+                    break;
+                case UD_READ:  uring_read_done(idx,&cqe,dispatch); break;
+                case UD_WRITE: tx_done(idx,cqe.res); break;
+                }
+            }
+        }
+    } else {
+        ev_del(loop,main_rd.fd);
+        if(engine_epoll) for(int i=0;i<n_shards;i++) ev_del(loop,shards[i].fd);
+    }
+    if(sock_listen>=0){
+        ev_del(loop,sock_listen);
+        sock_in=0;
+        for(int i=0;i<SOCK_MAX_CONNS;i++){
+            sock_conn_t *c=&sock_conns[i];
+            if(c->fd>=0) ev_mod(loop,c->fd,c->want_out ? EV_OUT : 0,c);
+        }
+    }
+    for(int i=0;i<SHM_MAX_CHANNELS;i++){
+        shm_conn_t *c=&shm_conns[i];
+        if(!c->ch) continue;
+        shm_futex_wake(&c->ch->req.head); // cut a sleep short
+        pthread_join(c->tid,NULL);
+        if(atomic_load(&c->done)) shm_conn_free(c); // detached meanwhile
+    }
+}
+
+// The handover failed before the successor took anything: read on
+static void readers_resume(void){
+    atomic_store(&handed_over,false);
+    if(ring) for(unsigned i=0;i<=(unsigned)n_shards;i++) uring_read_post(i);
+    else {
+        if(ev_add(loop,main_rd.fd,EV_IN,&main_rd)<0) die("event loop add");
+        if(engine_epoll) for(int i=0;i<n_shards;i++) if(ev_add(loop,shards[i].fd,EV_IN,&shards[i])<0) die("shard event loop add");
+    }
+    if(!engine_epoll) shard_threads_start();
+    if(sock_listen>=0){
+        sock_in=EV_IN;
+        if(ev_add(loop,sock_listen,EV_IN,&sock_listen)<0) die("event loop add socket");
+        for(int i=0;i<SOCK_MAX_CONNS;i++){
+            sock_conn_t *c=&sock_conns[i];
+            if(c->fd>=0) ev_mod(loop,c->fd,EV_IN|(c->want_out ? EV_OUT : 0),c);
+        }
+    }
+    for(int i=0;i<SHM_MAX_CHANNELS;i++){
+        shm_conn_t *c=&shm_conns[i];
+        if(c->ch && !shm_conn_start(c)){ atomic_store(&c->ch->state,SHM_CLOSED); shm_futex_wake(&c->ch->state); shm_conn_free(c); }
+    }
+}
+
+// Pass what readers_stop() left to the successor; false if that failed
+static bool takeover_send_state(int s){
+    for(int i=0;i<=n_shards;i++){
+        reader_t *rd= i ? &shards[i-1] : &main_rd;
+        frame_t carry; // a partial frame is shorter than a whole one
+        size_t n=rx_avail(rd->rx);
+        rx_peek(rd->rx,0,&carry,n);
+        int fds[2]={ rd->fd, rd->dummy_w };
+        if(tk_send(s,TK_READER,(uint16_t)i,0,&carry,n,fds,2)<0) return false;
+    }
+    if(sock_listen>=0 && tk_send(s,TK_LISTENER,0,0,NULL,0,&sock_listen,1)<0) return false;
+    for(int i=0;i<MAX_SESSIONS;i+=TAKEOVER_SESSIONS)
+        if(tk_send(s,TK_SESSIONS,TAKEOVER_SESSIONS,i,&sessions[i],TAKEOVER_SESSIONS*sizeof(session_t),NULL,0)<0) return false;
+    int fds[TAKEOVER_FDS]; tk_sock_t socks[TAKEOVER_FDS]; unsigned k=0;
+    for(int i=0;sock_conns && i<SOCK_MAX_CONNS;i++){
+        if(sock_conns[i].fd<0) continue;
+        fds[k]=sock_conns[i].fd; socks[k]=(tk_sock_t){ (int32_t)sock_conns[i].pid, sock_conns[i].sched_class };
+        if(++k==TAKEOVER_FDS){ if(tk_send(s,TK_SOCKS,(uint16_t)k,0,socks,k*sizeof(*socks),fds,k)<0) return false; k=0; }
+    }
+    if(k && tk_send(s,TK_SOCKS,(uint16_t)k,0,socks,k*sizeof(*socks),fds,k)<0) return false;
+    for(int i=0;i<SHM_MAX_CHANNELS;i++){
+        const shm_conn_t *c=&shm_conns[i];
+        if(c->ch && tk_send(s,TK_SHM,0,c->ch->client_pid,c->name,strlen(c->name),&c->fd,1)<0) return false;
+    }
+    return tk_send(s,TK_DONE,0,0,NULL,0,NULL,0)==0;
+}
+
+// The takeover socket is readable: a successor asks for everything
+static void takeover_give(void (*dispatch)(const job_t*)){
+    int s=accept4(tk_listen,NULL,NULL,SOCK_CLOEXEC);
+    if(s<0) return;
+    struct timeval tv={ .tv_sec=5 };
+    setsockopt(s,SOL_SOCKET,SO_RCVTIMEO,&tv,sizeof(tv)); setsockopt(s,SOL_SOCKET,SO_SNDTIMEO,&tv,sizeof(tv));
+    struct ucred cr; socklen_t cl=sizeof(cr);
+    pid_t peer= getsockopt(s,SOL_SOCKET,SO_PEERCRED,&cr,&cl)==0 ? cr.pid : 0;
+    tk_hdr_t h; char why[128]="";
+    if(tk_recv(s,&h,NULL,0,NULL,NULL)<0) snprintf(why,sizeof(why),"no hello: %s",strerror(errno));
+    else if(h.type!=TK_HELLO) snprintf(why,sizeof(why),"no hello");
+    else if(h.arg!=n_shards) snprintf(why,sizeof(why),"this server has %d shards, the new one %d",n_shards,(int)h.arg);
+    else if(sock_transport && !(h.count&TK_SOCK)) snprintf(why,sizeof(why),"this server serves sock, the new one does not");
+    else if(shm_transport && !(h.count&TK_SHM_TRANSPORT)) snprintf(why,sizeof(why),"this server serves shm, the new one does not");
+    if(*why){
+        tk_send(s,TK_REFUSE,0,0,why,strlen(why),NULL,0);
+        close(s);
+        log_line("Takeover by PID=%d refused: %s", (int)peer, why);
+        return;
+    }
+    uint64_t t0=metrics_now();
+    readers_stop(dispatch);
+    if(!takeover_send_state(s) || tk_recv(s,&h,NULL,0,NULL,NULL)<0 || h.type!=TK_DONE){
+        log_line("Takeover by PID=%d failed (%s); serving on", (int)peer, strerror(errno));
+        close(s);
+        readers_resume();
+        return;
+    }
+    close(s);
+    // Everything is the successor's now; what we hold still answers the jobs in flight
+    reader_close(&main_rd);
+    for(int i=0;i<n_shards;i++) reader_close(&shards[i]);
+    ev_del(loop,tk_listen); close(tk_listen); tk_listen=-1;
+    for(int i=0;i<SHM_MAX_CHANNELS;i++){
+        shm_conn_t *c=&shm_conns[i];
+        if(c->ch) shm_conn_free(c);
+    }
+    tk_draining=true; tk_drain_until=now_ms()+TAKEOVER_DRAIN_MS;
+    log_line("Handed over to PID=%d in %.2f ms; answering what is left", (int)peer, (double)(metrics_now()-t0)/1e6);
+    if(log_level>=LVL_INFO) say("[SERVER] handed over to PID=%d\n", (int)peer);
+}
+
+// Whether every job this server took in before the handover has been answered
+static bool takeover_drained(void){
+    if(atomic_load(&adm->queued) || atomic_load(&adm->running) || atomic_load(&array_inflight)) return false;
+    if(sock_listen>=0){
+        sock_pump(); // the last answers may have arrived since the loop pumped
+        for(int i=0;i<SOCK_MAX_CONNS;i++) if(sock_conns[i].fd>=0 && sock_conns[i].out_len>sock_conns[i].out_off) return false;
+    }
+    if(conn_retry || conn_dirty) return false;
+    for(int i=0;i<CONN_BUCKETS;i++)
+        for(const conn_t *c=conn_tab[i];c;c=c->next) if(c->out_len>c->out_off || c->tx_inflight) return false;
+    return true;
+}
+
+// SIGHUP: start a successor. It is forked twice so that it is nobody's child
+// here (it outlives us), and it gets no descriptor of ours but stdio.
+static void takeover_spawn(void){
+    if(tk_listen<0){ log_line("SIGHUP ignored: no takeover socket"); return; }
+    pid_t p=fork();
+    if(p<0){ log_line("Reload: fork() failed: %s", strerror(errno)); return; }
+    if(p==0){
+        if(fork()!=0) _exit(0);
+        ev_signal_reset(sig_fd); // the successor blocks what it needs itself
+#ifdef SYS_close_range
+        if(syscall(SYS_close_range,3u,~0u,0u)<0)
+#endif
+            for(int fd=3;fd<1024;fd++) close(fd);
+        int argc=0; while(tk_argv[argc]) argc++;
+        char **av=calloc((size_t)argc+2,sizeof(*av));
+        if(!av) _exit(127);
+        bool again=false; // we took over ourselves
+        for(int i=0;i<argc;i++){ av[i]=tk_argv[i]; again|=!strcmp(av[i],"--takeover"); }
+        if(!again) av[argc]=(char*)"--takeover";
+        // The file our binary was run from, not /proc/self/exe itself: exec
+        // names the process after the path, and pgrep/pkill look for
+        // "server". A binary rebuilt since then reads "<path> (deleted)".
+        char exe[4096];
+        ssize_t n=readlink("/proc/self/exe",exe,sizeof(exe)-1);
+        if(n>0){
+            exe[n]='\0';
+            size_t dl=strlen(" (deleted)");
+            if((size_t)n>dl && !strcmp(exe+n-dl," (deleted)")) exe[n-dl]='\0';
+            execv(exe,av);
+        }
+        execvp(av[0],av);
+        execv("/proc/self/exe",av); // last resort: the same binary, named "exe"
+        _exit(127);
+    }
+    while(waitpid(p,NULL,0)<0 && errno==EINTR){}
+    log_line("Reload (SIGHUP): successor starting");
+}
+
+// --takeover, as the successor: the connections the previous server passed
+// with the FIFOs, kept for takeover_adopt() (they need the event loop)
+typedef struct { char name[SHM_NAME_MAX]; pid_t pid; int fd; } tk_shm_t;
+static int     *tk_socks = NULL;
+static tk_sock_t *tk_sock_info = NULL;
+static size_t   n_tk_socks = 0;
+static tk_shm_t tk_shms[SHM_MAX_CHANNELS];
+static int      n_tk_shms = 0;
+
+// --takeover: ask the running server for its FIFOs, sockets, sessions and
+// channels; dies if there is none or it refuses
+static void takeover_take(void){
+    struct sockaddr_un sa; memset(&sa,0,sizeof(sa));
+    sa.sun_family=AF_UNIX;
+    snprintf(sa.sun_path,sizeof(sa.sun_path),"%s",TAKEOVER_PATH);
+    int s=socket(AF_UNIX,SOCK_SEQPACKET|SOCK_CLOEXEC,0);
+    if(s<0 || connect(s,(const struct sockaddr*)&sa,sizeof(sa))<0) die("takeover: connect " TAKEOVER_PATH);
+    struct timeval tv={ .tv_sec=30 }; // it joins its shard and channel threads first
+    setsockopt(s,SOL_SOCKET,SO_RCVTIMEO,&tv,sizeof(tv));
+    uint16_t serves=(uint16_t)((sock_transport ? TK_SOCK : 0)|(shm_transport ? TK_SHM_TRANSPORT : 0));
+    if(tk_send(s,TK_HELLO,serves,n_shards,NULL,0,NULL,0)<0) die("takeover: hello");
+    if(n_shards) shards_alloc();
+    static union { char text[128]; frame_t carry; session_t sessions[TAKEOVER_SESSIONS]; tk_sock_t socks[TAKEOVER_FDS]; char name[SHM_NAME_MAX]; } body;
+    for(bool done=false;!done;){
+        tk_hdr_t h; int fds[TAKEOVER_FDS]; unsigned nfd;
+        ssize_t n=tk_recv(s,&h,&body,sizeof(body),fds,&nfd);
+        if(n<0) die("takeover: receive");
+        bool ok=true;
+        switch(h.type){
+        case TK_REFUSE:
+            fprintf(stderr,"takeover refused: %.*s\n",(int)n,body.text);
+            exit(2);
+        case TK_READER: {
+            if(h.count>n_shards || nfd!=2){ ok=false; break; }
+            reader_t *rd= h.count ? &shards[h.count-1] : &main_rd;
+            rd->fd=fds[0]; rd->dummy_w=fds[1];
+            if(fcntl(rd->fd,F_SETFL,fcntl(rd->fd,F_GETFL)|O_NONBLOCK)<0) die("takeover: fcntl"); // the ring engine clears it
+            if(n){
+                rd->carry=malloc((size_t)n);
+                if(!rd->carry) die("takeover: malloc");
+                memcpy(rd->carry,&body.carry,(size_t)n); rd->carry_len=(size_t)n;
+            }
+            break; }
+        case TK_LISTENER:
+            if(nfd!=1 || !sock_transport){ ok=false; break; }
+            sock_listen=fds[0];
+            break;
+        case TK_SESSIONS:
+            if(h.arg<0 || h.arg+h.count>MAX_SESSIONS || (size_t)n!=h.count*sizeof(session_t)){ ok=false; break; }
+            memcpy(&sessions[h.arg],body.sessions,(size_t)n);
+            break;
+        case TK_SOCKS: {
+            if(nfd!=h.count || (size_t)n!=nfd*sizeof(tk_sock_t) || !sock_transport){ ok=false; break; }
+            int *f=realloc(tk_socks,(n_tk_socks+nfd)*sizeof(*f));
+            tk_sock_t *p=f ? realloc(tk_sock_info,(n_tk_socks+nfd)*sizeof(*p)) : NULL;
+            if(f) tk_socks=f;
+            if(!p) die("takeover: realloc");
+            tk_sock_info=p;
+            memcpy(tk_socks+n_tk_socks,fds,nfd*sizeof(*fds)); memcpy(tk_sock_info+n_tk_socks,body.socks,(size_t)n);
+            n_tk_socks+=nfd; nfd=0;
+            break; }
+        case TK_SHM:
+            if(n_tk_shms==SHM_MAX_CHANNELS || n<=0 || n>=SHM_NAME_MAX || nfd!=1){ ok=false; break; }
+            memcpy(tk_shms[n_tk_shms].name,body.name,(size_t)n); tk_shms[n_tk_shms].name[n]='\0';
+            tk_shms[n_tk_shms].pid=h.arg; tk_shms[n_tk_shms++].fd=fds[0];
+            break;
+        case TK_DONE:
+            done=true;
+            break;
+        default:
+            ok=false;
+        }
+        if(!ok){ for(unsigned i=0;i<nfd;i++) close(fds[i]); errno=EPROTO; die("takeover: unexpected message"); }
+    }
+    if(main_rd.fd<0) { errno=EPROTO; die("takeover: no request FIFO"); }
+    for(int i=0;i<n_shards;i++) if(shards[i].fd<0){ errno=EPROTO; die("takeover: shard FIFO missing"); }
+    if(tk_send(s,TK_DONE,0,0,NULL,0,NULL,0)<0) die("takeover: acknowledge");
+    struct ucred cr; socklen_t cl=sizeof(cr);
+    pid_t peer= getsockopt(s,SOL_SOCKET,SO_PEERCRED,&cr,&cl)==0 ? cr.pid : 0;
+    close(s);
+    if(sock_transport && sock_listen<0) sock_listen_open(); // the previous server did not serve sock
+    reader_carry(&main_rd);
+    log_line("Took over from PID=%d: %d request FIFOs, %zu socket clients, %d shm channels", (int)peer, 1+n_shards, n_tk_socks, n_tk_shms);
+    if(log_level>=LVL_INFO) fprintf(stderr,"[server] Took over from PID=%d\n", (int)peer);
+}
+
+// --takeover, once the loop exists: serve the connections and channels taken over
+static void takeover_adopt(void){
+    for(size_t i=0;i<n_tk_socks;i++){
+        int j=0; while(j<SOCK_MAX_CONNS && sock_conns[j].fd>=0) j++;
+        sock_conn_t *c= j<SOCK_MAX_CONNS ? &sock_conns[j] : NULL;
+        if(!c || ev_add(loop,tk_socks[i],EV_IN,c)<0){ log_line("Takeover: socket client PID=%d dropped", (int)tk_sock_info[i].pid); close(tk_socks[i]); continue; }
+        c->fd=tk_socks[i]; c->gen++; c->want_out=false; c->pid=tk_sock_info[i].pid;
+        c->sched_class= tk_sock_info[i].sched_class>=0 && tk_sock_info[i].sched_class<ARITH_CLASS_COUNT ? (uint8_t)tk_sock_info[i].sched_class : ARITH_CLASS_NORMAL;
+        atomic_fetch_add(&met->sock_conns,1);
+    }
+    free(tk_socks); free(tk_sock_info); tk_socks=NULL; tk_sock_info=NULL;
+    for(int i=0;i<n_tk_shms;i++){
+        tk_shm_t *t=&tk_shms[i];
+        shm_chan_t *ch=shm_map(t->fd,t->name,t->pid);
+        if(!ch){ close(t->fd); continue; }
+        if(shm_serve(ch,t->fd,t->name)) continue;
+        log_line("Takeover: shm channel %s closed (no free channel)", t->name);
+        atomic_store(&ch->state,SHM_CLOSED); shm_futex_wake(&ch->state);
+        munmap(ch,sizeof(*ch)); close(t->fd);
+    }
+}
+
+// ---- CPU isolation (--cpus, --sched-fifo, --mlock) ----
+// Applied to the main thread after the logger started, so every serving
+// thread created later inherits them while the log flusher keeps the default
+// CPUs and policy. Only a bad --cpus list is fatal: the others are hints and
+// are logged when the kernel refuses them (EPERM without CAP_SYS_NICE or
+// CAP_IPC_LOCK, or over the memlock limit).
+
+#ifdef __linux__
+// "2-5,8" -> set; -1 if malformed or naming no CPU
+static int parse_cpus(const char *list, cpu_set_t *set){
+    CPU_ZERO(set);
+    for(const char *p=list; *p; ){
+        char *end; long lo=strtol(p,&end,10), hi=lo;
+        if(end==p || lo<0) return -1;
+        if(*end=='-'){ p=end+1; hi=strtol(p,&end,10); if(end==p || hi<lo) return -1; }
+        if(hi>=CPU_SETSIZE) return -1;
+        for(long c=lo;c<=hi;c++) CPU_SET((int)c,set);
+        if(*end==',') end++;
+        else if(*end) return -1;
+        p=end;
+    }
+    return CPU_COUNT(set) ? 0 : -1;
+}
+#endif
+
+static int cpu_hints(void){
+#ifdef __linux__
+    if(cpu_list){
+        cpu_set_t set;
+        if(parse_cpus(cpu_list,&set)<0){ fprintf(stderr,"--cpus takes a list like 0-3,6\n"); return -1; }
+        if(sched_setaffinity(0,sizeof(set),&set)<0){ perror("--cpus"); return -1; }
+        log_line("Serving on CPUs %s", cpu_list);
+    }
+    if(sched_fifo){
+        struct sched_param sp={ .sched_priority=sched_fifo };
+        if(sched_setscheduler(0,SCHED_FIFO,&sp)<0) log_line("SCHED_FIFO %d refused: %s", sched_fifo, strerror(errno));
+        else log_line("Serving with SCHED_FIFO priority %d", sched_fifo);
+    }
+    if(mlock_all){
+        if(mlockall(MCL_CURRENT|MCL_FUTURE)<0) log_line("mlockall refused: %s", strerror(errno));
+        else log_line("Memory locked (mlockall)");
+    }
+#else
+    if(cpu_list || sched_fifo || mlock_all) log_line("--cpus, --sched-fifo and --mlock are Linux-only: ignored");
+#endif
+    if(busy_poll_ns) log_line("Busy-poll: %llu us before blocking", (unsigned long long)(busy_poll_ns/1000));
+    return 0;
+}
+
+// Print command line help
+static void usage(const char *prog){
+    fprintf(stderr,"usage: %s [--workers N | --threads N [--pin] | --engine epoll|io_uring [--sqpoll]] [--shards N] [--max-inflight N] [--queue N] [--client-cap N] [--fair [--fair-quantum N]] [--fd-cache N] [--coalesce N|off [--coalesce-window US]] [--transport fifo|shm|sock[,...] [--spin N] [--array-threads N]] [--journal FILE [--journal-size MB]] [--cache OPS [--cache-entries N]] [--busy-poll US] [--cpus LIST] [--sched-fifo PRIO] [--mlock] [--log-policy block|drop] [--quiet | --log-level error|info|trace] [--takeover]\n", prog);
+    fprintf(stderr,"       %s --stats [--watch [SEC]] [--prometheus]\n", prog);
+    fprintf(stderr,"  --workers N   pre-fork N long-lived workers instead of fork() per request\n");
+    fprintf(stderr,"  --threads N   serve requests from a pool of N threads fed by a lock-free ring\n");
+    fprintf(stderr,"  --engine epoll  serve every request from the event loop with non-blocking responses\n");
+    fprintf(stderr,"  --engine io_uring  the same with reads and writes completed by io_uring (else epoll)\n");
+    fprintf(stderr,"  --sqpoll      with io_uring: a kernel thread polls the submission queue\n");
+    fprintf(stderr,"  --pin         pin pool thread i to CPU i (with --threads)\n");
+    fprintf(stderr,"  --max-inflight N  fork mode: children computing at once (default 256)\n");
+    fprintf(stderr,"  --queue N     requests waiting for a child/worker/thread before 'Server busy' (default 4096)\n");
+    fprintf(stderr,"  --client-cap N  unanswered requests one client may have admitted (default 0 = no cap)\n");
+    fprintf(stderr,"  --fair        queued requests wait per client and are served round-robin, by declared class\n");
+    fprintf(stderr,"  --fair-quantum N  tuples a client is served per turn with --fair (default 32)\n");
+    fprintf(stderr,"  --shards N    also serve request FIFOs %s.0..N-1, a pinned reader thread each\n", REQ_FIFO_PATH);
+    fprintf(stderr,"  --fd-cache N  response FIFOs each worker/thread keeps open (default 64, 0 = off)\n");
+    fprintf(stderr,"  --coalesce N  hold up to N bytes of responses per client for one write (default %d, off = 0)\n", ARITH_PIPE_BUF);
+    fprintf(stderr,"  --coalesce-window US  longest a busy worker/thread holds a response (default 50)\n");
+    fprintf(stderr,"  --transport L also serve clients over shm (shared-memory rings, attached via the FIFO)\n");
+    fprintf(stderr,"                and/or sock (SOCK_SEQPACKET socket %s); the FIFOs are always served\n", ARITH_SOCK_PATH);
+    fprintf(stderr,"  --array-threads N  with sock: threads computing array frames (default one per CPU)\n");
+    fprintf(stderr,"  --journal FILE  record every received request in FILE (binary, see replay)\n");
+    fprintf(stderr,"  --journal-size MB  room preallocated for the journal (default 64)\n");
+    fprintf(stderr,"  --cache OPS   cache the results of these operations (e.g. pow,mod), shared by all handlers\n");
+    fprintf(stderr,"  --cache-entries N  result cache capacity (default 65536, 64 bytes per 2 entries)\n");
+    fprintf(stderr,"  --busy-poll US  readers, pool threads and shm channels spin US for work before blocking\n");
+    fprintf(stderr,"  --cpus LIST   run on these CPUs only (e.g. 2-5,8); --pin spreads pool threads over them\n");
+    fprintf(stderr,"  --sched-fifo PRIO  serve with SCHED_FIFO priority PRIO (1..99; needs CAP_SYS_NICE)\n");
+    fprintf(stderr,"  --mlock       lock all memory, rings included, so a wake-up never page-faults\n");
+    fprintf(stderr,"  --log-policy P  block (default) or drop log lines while the log ring is full\n");
+    fprintf(stderr,"  --log-level L error, info (lifecycle) or trace (per request, default)\n");
+    fprintf(stderr,"  --quiet       same as --log-level info\n");
+    fprintf(stderr,"  --spin N      max polls before a shm channel sleeps (default %d, 0 on one CPU)\n", SHM_SPIN_DEFAULT);
+    fprintf(stderr,"  --takeover    take the FIFOs and clients over from the running server (SIGHUP to it does the same)\n");
+    fprintf(stderr,"  --stats       print the running server's metrics (%s) and exit\n", METRICS_SHM_NAME);
+    fprintf(stderr,"  --watch [SEC] with --stats: print them again every SEC seconds (default 1)\n");
+    fprintf(stderr,"  --prometheus  with --stats: Prometheus text format\n");
+}
+
+int main(int argc, char **argv){
+    // Parse command line options
+    int spin=-1; // --spin (-1 => pick from the CPU count)
+    bool quantum_set=false; // --fair-quantum given
+    bool stats=false, watch=false, prometheus=false; int interval=1; // --stats [--watch [SEC]] [--prometheus]
+    for(int i=1;i<argc;i++){
+        if(!strcmp(argv[i],"--workers") && i+1<argc){
+            n_workers=atoi(argv[++i]);
+            if(n_workers<1){ fprintf(stderr,"--workers needs a positive count\n"); return 2; }
+        } else if(!strcmp(argv[i],"--threads") && i+1<argc){
+            n_threads=atoi(argv[++i]);
+            if(n_threads<1){ fprintf(stderr,"--threads needs a positive count\n"); return 2; }
+        } else if(!strcmp(argv[i],"--pin")){
+            pin_threads=true;
+        } else if(!strcmp(argv[i],"--engine") && i+1<argc){
+            const char *e=argv[++i];
+            if(!strcmp(e,"epoll")) engine_epoll=true;
+            else if(!strcmp(e,"io_uring")) engine_epoll=engine_uring=true;
+            else { fprintf(stderr,"--engine is epoll or io_uring\n"); return 2; }
+        } else if(!strcmp(argv[i],"--sqpoll")){
+            uring_sqpoll=true;
+        } else if(!strcmp(argv[i],"--shards") && i+1<argc){
+            n_shards=atoi(argv[++i]);
+            if(n_shards<1 || n_shards>REQ_SHARDS_MAX){ fprintf(stderr,"--shards needs 1..%d\n",REQ_SHARDS_MAX); return 2; }
+        } else if(!strcmp(argv[i],"--max-inflight") && i+1<argc){
+            max_inflight=atoi(argv[++i]);
+            if(max_inflight<1){ fprintf(stderr,"--max-inflight needs a positive count\n"); return 2; }
+        } else if(!strcmp(argv[i],"--queue") && i+1<argc){
+            queue_cap=atoi(argv[++i]);
+            if(queue_cap<1 || queue_cap>(1<<20)){ fprintf(stderr,"--queue needs 1..%d\n",1<<20); return 2; }
+        } else if(!strcmp(argv[i],"--takeover")){
+            takeover=true;
+        } else if(!strcmp(argv[i],"--fair")){
+            fair=true;
+        } else if(!strcmp(argv[i],"--fair-quantum") && i+1<argc){
+            fair_quantum=atoi(argv[++i]); quantum_set=true;
+            if(fair_quantum<1 || fair_quantum>65536){ fprintf(stderr,"--fair-quantum needs 1..65536 tuples\n"); return 2; }
+        } else if(!strcmp(argv[i],"--client-cap") && i+1<argc){
+            client_cap=atoi(argv[++i]);
+            if(client_cap<0 || client_cap>65535){ fprintf(stderr,"--client-cap needs 0..65535\n"); return 2; }
+        } else if(!strcmp(argv[i],"--coalesce") && i+1<argc){
+            const char *v=argv[++i];
+            coalesce_bytes= !strcmp(v,"off") ? 0 : atoi(v);
+            if(coalesce_bytes<0 || coalesce_bytes>65536){ fprintf(stderr,"--coalesce needs off or 0..65536 bytes\n"); return 2; }
+        } else if(!strcmp(argv[i],"--coalesce-window") && i+1<argc){
+            coalesce_us=atoi(argv[++i]);
+            if(coalesce_us<0 || coalesce_us>1000000){ fprintf(stderr,"--coalesce-window needs 0..1000000 us\n"); return 2; }
+        } else if(!strcmp(argv[i],"--fd-cache") && i+1<argc){
+            resp_cache_cap=atoi(argv[++i]);
+            if(resp_cache_cap<0){ fprintf(stderr,"--fd-cache needs a count >= 0\n"); return 2; }
+        } else if(!strcmp(argv[i],"--transport") && i+1<argc){
+            char list[64]; snprintf(list,sizeof(list),"%s",argv[++i]);
+            char *save=NULL;
+            for(char *t=strtok_r(list,",",&save);t;t=strtok_r(NULL,",",&save)){
+                int tp=arith_transport_from_name(t);
+                if(tp<0){ fprintf(stderr,"--transport takes fifo, shm and sock, comma-separated\n"); return 2; }
+                if(tp==ARITH_TRANSPORT_SHM) shm_transport=true;
+                if(tp==ARITH_TRANSPORT_SOCK) sock_transport=true;
+            }
+        } else if(!strcmp(argv[i],"--array-threads") && i+1<argc){
+            n_array_threads=atoi(argv[++i]);
+            if(n_array_threads<1 || n_array_threads>256){ fprintf(stderr,"--array-threads needs 1..256\n"); return 2; }
+        } else if(!strcmp(argv[i],"--journal") && i+1<argc){
+            journal_path=argv[++i];
+        } else if(!strcmp(argv[i],"--journal-size") && i+1<argc){
+            journal_mb=atoi(argv[++i]);
+            if(journal_mb<1 || journal_mb>65536){ fprintf(stderr,"--journal-size needs 1..65536 MB\n"); return 2; }
+        } else if(!strcmp(argv[i],"--cache") && i+1<argc){
+            char list[128]; snprintf(list,sizeof(list),"%s",argv[++i]);
+            char *save=NULL;
+            for(char *name=strtok_r(list,",",&save); name; name=strtok_r(NULL,",",&save)){
+                uint8_t op=arith_op_from_name(name);
+                if(op==ARITH_OP_INVALID){ fprintf(stderr,"--cache: unknown operation '%s'\n",name); return 2; }
+                cache_ops|=1u<<op;
+            }
+            if(!cache_ops){ fprintf(stderr,"--cache needs a list of operations\n"); return 2; }
+        } else if(!strcmp(argv[i],"--cache-entries") && i+1<argc){
+            long long n=atoll(argv[++i]);
+            if(n<2 || n>(1LL<<30)){ fprintf(stderr,"--cache-entries needs 2..%lld\n",1LL<<30); return 2; }
+            cache_size=(size_t)n;
+        } else if(!strcmp(argv[i],"--busy-poll") && i+1<argc){
+            int us=atoi(argv[++i]);
+            if(us<1 || us>1000000){ fprintf(stderr,"--busy-poll needs 1..1000000 us\n"); return 2; }
+            busy_poll_ns=(uint64_t)us*1000;
+        } else if(!strcmp(argv[i],"--cpus") && i+1<argc){
+            cpu_list=argv[++i];
+        } else if(!strcmp(argv[i],"--sched-fifo") && i+1<argc){
+            sched_fifo=atoi(argv[++i]);
+            if(sched_fifo<1 || sched_fifo>99){ fprintf(stderr,"--sched-fifo needs a priority 1..99\n"); return 2; }
+        } else if(!strcmp(argv[i],"--mlock")){
+            mlock_all=true;
+        } else if(!strcmp(argv[i],"--log-policy") && i+1<argc){
+            const char *lp=argv[++i];
+            if(!strcmp(lp,"drop")) log_policy=LOG_DROP;
+            else if(strcmp(lp,"block")){ fprintf(stderr,"--log-policy is block or drop\n"); return 2; }
+        } else if(!strcmp(argv[i],"--log-level") && i+1<argc){
+            const char *l=argv[++i];
+            if(!strcmp(l,"error")) log_level=LVL_ERROR;
+            else if(!strcmp(l,"info")) log_level=LVL_INFO;
+            else if(!strcmp(l,"trace")) log_level=LVL_TRACE;
+            else { fprintf(stderr,"--log-level is error, info or trace\n"); return 2; }
+        } else if(!strcmp(argv[i],"--quiet")){
+            log_level=LVL_INFO;
+        } else if(!strcmp(argv[i],"--stats")){
+            stats=true;
+        } else if(!strcmp(argv[i],"--watch")){
+            watch=true;
+            if(i+1<argc && argv[i+1][0]>='0' && argv[i+1][0]<='9'){
+                interval=atoi(argv[++i]);
+                if(interval<1){ fprintf(stderr,"--watch needs a positive interval\n"); return 2; }
+            }
+        } else if(!strcmp(argv[i],"--prometheus")){
+            prometheus=true;
+        } else if(!strcmp(argv[i],"--spin") && i+1<argc){
+            spin=atoi(argv[++i]);
+            if(spin<0){ fprintf(stderr,"--spin needs a count >= 0\n"); return 2; }
+        } else { usage(argv[0]); return 2; }
+    }
+    // Reading another server's metrics: nothing else to start
+    if(stats) return metrics_report(watch,interval,prometheus);
+    if(watch || prometheus){ fprintf(stderr,"--watch and --prometheus go with --stats\n"); return 2; }
+
+    // Spinning only pays when the peer runs on another CPU at the same time
+    shm_spin_max= spin>=0 ? (unsigned)spin : sysconf(_SC_NPROCESSORS_ONLN)>1 ? SHM_SPIN_DEFAULT : 0;
+    if((n_workers>0)+(n_threads>0)+engine_epoll>1){ fprintf(stderr,"--workers, --threads and --engine are mutually exclusive\n"); return 2; }
+    if(n_array_threads && !sock_transport){ fprintf(stderr,"--array-threads goes with --transport sock\n"); return 2; }
+    if(uring_sqpoll && !engine_uring){ fprintf(stderr,"--sqpoll goes with --engine io_uring\n"); return 2; }
+    if(fair && engine_epoll){ fprintf(stderr,"--fair goes with fork mode, --workers or --threads (--engine queues nothing)\n"); return 2; }
+    if(quantum_set && !fair){ fprintf(stderr,"--fair-quantum goes with --fair\n"); return 2; }
+
+    // SIGINT/SIGTERM (stop), SIGHUP (reload) and SIGCHLD (reap) become events
+    // on sig_fd; done before any thread exists so they all inherit the blocked mask
+    const int sigs[]={ SIGINT, SIGTERM, SIGCHLD, SIGHUP };
+    sig_fd=ev_signal_open(sigs,4); if(sig_fd<0) die("signal fd");
+    tk_argv=argv;
+
+    // Open server log for appending (and start its flusher); die() if we can't open the log
+    if(log_open("server.log",log_policy)<0) die("open log");
+    atexit(cleanup); // ensure cleanup runs on normal exit
+
+    if(cpu_hints()<0) return 2;
+
+    // A client that vanished must surface as EPIPE on write, not kill the server (or a pool thread)
+    signal(SIGPIPE,SIG_IGN);
+    struct sigaction su={0}; su.sa_handler=on_sigusr1; sigaction(SIGUSR1,&su,NULL);
+
+    sessions=shared_alloc(MAX_SESSIONS*sizeof(session_t));
+    if(!sessions) die("mmap sessions");
+    if(engine_epoll){ engine_epoll_init(); if(engine_uring) engine_uring_init(); } // before naming the executor: io_uring may fall back
+    char executor[24];
+    if(n_workers>0)      snprintf(executor,sizeof(executor),"workers %d",n_workers);
+    else if(n_threads>0) snprintf(executor,sizeof(executor),"threads %d",n_threads);
+    else                 snprintf(executor,sizeof(executor),"%s",ring ? "engine io_uring" : engine_epoll ? "engine epoll" : "fork");
+    bool published;
+    met=metrics_create(executor,n_shards,&published);
+    if(!met) die("mmap metrics");
+    if(!published) log_line("Metrics segment %s unavailable (%s): server --stats will not see this server", METRICS_SHM_NAME, strerror(errno));
+    adm=&met->admit;
+    if(journal_path){
+        if(journal_open(journal_path,(size_t)journal_mb<<20)<0) die("open journal");
+        log_line("Journal %s: room for %zu requests", journal_path, (((size_t)journal_mb<<20)-sizeof(journal_hdr_t))/sizeof(journal_rec_t));
+    }
+    if(pipe(wake_fd)<0 || fcntl(wake_fd[0],F_SETFL,O_NONBLOCK)<0 || fcntl(wake_fd[1],F_SETFL,O_NONBLOCK)<0) die("wake pipe");
+    batch_pool_init();
+    if(cache_ops){ // shared with everything forked from here on
+        if(cache_init(cache_size)<0) die("mmap result cache");
+        met->cache_entries=cache_capacity(); met->cache_ops=cache_ops;
+        log_line("Result cache: %zu entries", cache_capacity());
+    }
+    if(sock_transport) sock_open();
+
+    // Create the request FIFOs if they don't already exist (--takeover: they
+    // come from the previous server once everything else is ready)
+    main_rd.rx=&main_rx;
+    if(!takeover){
+        reader_open(&main_rd);
+        if(n_shards) shards_open();
+    }
+
+    if(log_level>=LVL_INFO){
+        if(n_shards) fprintf(stderr,"[server] Listening on %s and %d shards %s.0..%d", REQ_FIFO_PATH, n_shards, REQ_FIFO_PATH, n_shards-1);
+        else         fprintf(stderr,"[server] Listening on %s", REQ_FIFO_PATH);
+        fprintf(stderr,"%s …\n", sock_transport ? " and " ARITH_SOCK_PATH : "");
+    }
+    log_line("Server started; listening on %s, %d shards (batch kernels: %s%s%s)", REQ_FIFO_PATH, n_shards, compute_simd_name(),
+             shm_transport ? ", shm transport" : "", sock_transport ? ", socket transport" : "");
+
+    if(coalesce_bytes) log_line("Response coalescing: up to %d bytes per client, %d us window", coalesce_bytes, coalesce_us);
+    if(fair) log_line("Fair queueing: deficit round-robin per client, %d tuples per turn", fair_quantum);
+
+    void (*dispatch)(const job_t*)=dispatch_fork;
+    if(!n_workers && !n_threads && !engine_epoll) fork_init();
+    if(n_workers>0 || n_threads>0){ dispatch_init(); dispatch=dispatch_queue; }
+    if(n_workers>0) pool_start();
+    if(n_threads>0) threads_start();
+    if(sock_transport) array_start();
+    if(engine_epoll) dispatch=dispatch_inline;
+
+    if(takeover) takeover_take(); // the previous server has stopped reading: start right away
+    loop=ev_create(); if(!loop) die("event loop");
+    if((!ring && ev_add(loop,main_rd.fd,EV_IN,&main_rd)<0) || ev_add(loop,sig_fd,EV_IN,&sig_fd)<0
+       || ev_add(loop,wake_fd[0],EV_IN,wake_fd)<0) die("event loop add");
+    if(sock_listen>=0 && ev_add(loop,sock_listen,EV_IN,&sock_listen)<0) die("event loop add socket");
+    if(ring){ // the main FIFO is read through the ring, everything else waits in the epoll set it polls
+        if(uring_poll_multishot(ring,ev_fd(loop),UD(UD_EPOLL,0))<0) die("io_uring poll");
+        uring_read_post(0);
+    }
+    if(n_shards) shards_start(dispatch);
+    if(takeover) takeover_adopt();
+    takeover_listen();
+    int timeout=-1; // ms until the next response open retry
+    uint64_t spin_until=0; // --busy-poll: look for events without blocking until then
+    for(;;){
+        // If a stop was requested by a signal, break out and exit cleanly
+        if (stop_requested) break;
+        if(tk_draining && (takeover_drained() || now_ms()>=tk_drain_until)) break;
+        if(reload_requested){ reload_requested=0; if(!tk_draining) takeover_spawn(); }
+
+        int wait= busy_poll_ns && metrics_now()<spin_until ? 0 : timeout;
+        if(tk_draining && (wait<0 || wait>10)) wait=10; // a job finishing elsewhere wakes nobody
+        bool served;
+        if(ring) served=uring_serve(wait,dispatch);
+        else {
+            ev_event_t evs[64];
+            int n=ev_wait(loop,evs,64,wait);
+            if(n<0) die("event wait");
+            serve_events(evs,n,dispatch);
+            served= n>0;
+        }
+        if(served && busy_poll_ns) spin_until=metrics_now()+busy_poll_ns; // out of work: spin from here
+        else if(!wait && !served) sched_yield(); // spinning: a client on this CPU gets to run
+        busy_flush();
+        conn_flush_dirty();
+        int sock_timeout= sock_listen>=0 ? sock_pump() : -1;
+        timeout=conn_retry_due(); conn_bury();
+        if(sock_timeout>=0 && (timeout<0 || sock_timeout<timeout)) timeout=sock_timeout;
+    }
+
+    if(tk_draining && !stop_requested)
+        log_line("After the handover: %s", takeover_drained() ? "every request answered" : "drain timed out, stopping with requests in flight");
+    if(ring) engine_uring_stop();
+    if(n_shards) shards_stop(); // no more jobs or attaches after this
+    log_reader_stats("Reader",&main_rx);
+    log_line("Admission: %llu admitted, %llu busy (queue full), %llu busy (client cap), queue depth max %d",
+             (unsigned long long)atomic_load(&adm->admitted), (unsigned long long)atomic_load(&adm->busy_full),
+             (unsigned long long)atomic_load(&adm->busy_client), atomic_load(&adm->queued_max));
+    if(fork_q_len) log_line("%zu queued requests dropped at shutdown", fork_q_len);
+    shm_stop();
+    if(n_workers>0) pool_stop();
+    if(n_threads>0) threads_stop();
+    array_stop();
+    sock_stop(); // after the executors: their last answers go out first
+    if(journal_path){
+        uint64_t written=0, dropped=0; journal_close(&written,&dropped);
+        log_line("Journal %s: %llu requests recorded, %llu not recorded (full)", journal_path, (unsigned long long)written, (unsigned long long)dropped);
+    }
+    if(log_dropped()) log_line("Logger dropped %llu lines in total", (unsigned long long)log_dropped());
     return 0;
 }
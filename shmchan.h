@@ -0,0 +1,126 @@
+// shmchan.h
+// Shared-memory channel between one client and the server (--transport shm).
+// The client creates a POSIX shm segment holding two single-producer/
+// single-consumer rings: v2_request_t records from the client to the server
+// and v2_response_t records back. The well-known FIFO only carries the attach
+// frame naming the segment; after that a call is a store into the request ring
+// plus a wake-up, and no system call at all while the other side is spinning.
+// A side that runs out of work spins for an adaptive budget, then sleeps on a
+// futex on the ring position (Linux; short naps elsewhere). Sleeps time out so
+// each side notices a peer that went away without saying so.
+
+#ifndef ARITH_SHMCHAN_H
+#define ARITH_SHMCHAN_H
+
+#include <stdint.h>     // int32_t, uint32_t
+#include <stdbool.h>    // bool
+#include <stdatomic.h>  // atomic_uint
+#include <time.h>       // struct timespec, nanosleep
+#ifdef __linux__
+#include <linux/futex.h> // FUTEX_WAIT, FUTEX_WAKE
+#include <sys/syscall.h> // SYS_futex
+#include <unistd.h>      // syscall
+#endif
+
+#include "proto.h"      // v2_request_t, v2_response_t
+
+#define SHM_CHAN_MAGIC   0x41534843u  // "ASHC"
+#define SHM_CHAN_CAP     256          // records per ring (power of two)
+#define SHM_NAME_PREFIX  "/arith_shm_" // segment names: prefix + client PID + handle
+#define SHM_NAME_MAX     64
+#define SHM_SPIN_DEFAULT 4096         // max poll iterations before sleeping
+#define SHM_WAIT_MS      100          // sleep slice between liveness checks
+
+// Attach handshake, in shm_chan_t.state (also a futex word)
+enum shm_chan_state {
+    SHM_PENDING = 0, // created by the client, attach frame sent
+    SHM_ATTACHED,    // a server thread is serving the rings
+    SHM_REFUSED,     // server has no shm transport or no free channel
+    SHM_CLOSED,      // either side has detached
+};
+
+// One SPSC ring's positions; slots live in shm_chan_t. Positions run freely
+// and wrap modulo 2^32, slot = pos & (SHM_CHAN_CAP-1).
+typedef struct {
+    _Alignas(64) atomic_uint head;         // records published (producer only)
+    atomic_uint head_waiters;              // consumers sleeping on head
+    _Alignas(64) atomic_uint tail;         // records consumed (consumer only)
+    atomic_uint tail_waiters;              // producers sleeping on tail (ring full)
+} shm_spsc_t;
+
+typedef struct {
+    uint32_t    magic;                     // SHM_CHAN_MAGIC
+    uint32_t    version;                   // ARITH_PROTO_VERSION
+    int32_t     client_pid;                // creator
+    int32_t     server_pid;                // set by the server on attach
+    _Alignas(64) atomic_uint state;        // enum shm_chan_state
+    shm_spsc_t  req;                       // client -> server
+    shm_spsc_t  resp;                      // server -> client
+    v2_request_t  req_slot[SHM_CHAN_CAP];
+    v2_response_t resp_slot[SHM_CHAN_CAP];
+} shm_chan_t;
+
+static inline void shm_cpu_relax(void){
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ volatile("yield");
+#endif
+}
+
+// Sleep while *w == seen, at most ms milliseconds (spurious returns are fine)
+static inline void shm_futex_wait(atomic_uint *w, unsigned seen, int ms){
+#ifdef __linux__
+    struct timespec ts={ ms/1000, (long)(ms%1000)*1000000L };
+    syscall(SYS_futex,(unsigned*)w,FUTEX_WAIT,seen,&ts,NULL,0); // shared mapping: no FUTEX_PRIVATE_FLAG
+#else
+    (void)w; (void)seen; (void)ms;
+    struct timespec ts={0,50*1000}; nanosleep(&ts,NULL);
+#endif
+}
+
+static inline void shm_futex_wake(atomic_uint *w){
+#ifdef __linux__
+    syscall(SYS_futex,(unsigned*)w,FUTEX_WAKE,1,NULL,NULL,0);
+#else
+    (void)w;
+#endif
+}
+
+// Wait until *w != seen. Spins for up to *spin polls first; a spin that pays
+// off grows the budget (up to max_spin), one that ends in a sleep halves it
+// (down to max_spin/64), so a busy peer is met by spinning and an idle one
+// costs almost no CPU. max_spin 0 never spins (single CPU). Returns
+// false if the wait timed out with *w unchanged.
+static inline bool shm_wait(atomic_uint *w, atomic_uint *waiters, unsigned seen,
+                            unsigned *spin, unsigned max_spin, int ms){
+    for(unsigned i=0;i<*spin;i++){
+        if(atomic_load_explicit(w,memory_order_acquire)!=seen){
+            unsigned grown=*spin+*spin/8+1;
+            *spin= grown<max_spin ? grown : max_spin;
+            return true;
+        }
+        shm_cpu_relax();
+    }
+    *spin= *spin/2>max_spin/64 ? *spin/2 : max_spin/64;
+    atomic_fetch_add(waiters,1);              // seq_cst: pairs with the waker's check
+    if(atomic_load(w)==seen) shm_futex_wait(w,seen,ms);
+    atomic_fetch_sub(waiters,1);
+    return atomic_load_explicit(w,memory_order_acquire)!=seen;
+}
+
+// Store a new ring position and wake the other side if it sleeps on it
+static inline void shm_advance(atomic_uint *w, atomic_uint *waiters, unsigned pos){
+    atomic_store(w,pos);                      // seq_cst: ordered before the waiter check
+    if(atomic_load(waiters)) shm_futex_wake(w);
+}
+
+// Records ready for the consumer / free slots for the producer
+static inline unsigned shm_spsc_ready(shm_spsc_t *q){
+    return atomic_load_explicit(&q->head,memory_order_acquire)-atomic_load_explicit(&q->tail,memory_order_relaxed);
+}
+static inline unsigned shm_spsc_room(shm_spsc_t *q){
+    return SHM_CHAN_CAP-(atomic_load_explicit(&q->head,memory_order_relaxed)-atomic_load_explicit(&q->tail,memory_order_acquire));
+}
+
+#endif // ARITH_SHMCHAN_H
@@ -0,0 +1,136 @@
+// transport.h
+// The transports clients and the server talk over (--transport on both
+// sides), and the batched message I/O of the socket transport:
+//   fifo  the well-known request FIFO plus a response FIFO per client
+//         (v1 structs, or v2 frames on a session registered by hello);
+//   shm   v2 records through shared-memory rings (shmchan.h), attached
+//         with a frame on the request FIFO;
+//   sock  one connected SOCK_SEQPACKET Unix socket per client at
+//         ARITH_SOCK_PATH. It is full duplex and keeps message boundaries:
+//         every message is one v2 call or batch frame (or its answer), with
+//         no session id and no per-client FIFO file (a hello only declares
+//         a scheduling class and is not answered), and either
+//         side can move many messages per system call with
+//         recvmmsg()/sendmmsg(). An array frame carries its arrays as
+//         memfds attached to the message (SCM_RIGHTS).
+
+#ifndef ARITH_TRANSPORT_H
+#define ARITH_TRANSPORT_H
+
+#include <string.h>     // strcmp, memcpy
+#include <unistd.h>     // close
+#include <sys/types.h>  // ssize_t
+#include <errno.h>      // EINTR
+#include <sys/socket.h> // recvmmsg, sendmmsg, recvmsg, sendmsg, SCM_RIGHTS
+#include <sys/uio.h>    // struct iovec
+
+#define ARITH_SOCK_PATH "/tmp/arith.sock"
+
+enum arith_transport { ARITH_TRANSPORT_FIFO, ARITH_TRANSPORT_SHM, ARITH_TRANSPORT_SOCK, ARITH_TRANSPORT_COUNT };
+static const char *const arith_transport_names[ARITH_TRANSPORT_COUNT] = { "fifo", "shm", "sock" };
+
+// enum arith_transport of a name, -1 if unknown
+static inline int arith_transport_from_name(const char *name){
+    for(int i=0;i<ARITH_TRANSPORT_COUNT;i++) if(!strcmp(name,arith_transport_names[i])) return i;
+    return -1;
+}
+
+#define TP_BATCH 64 // messages per recvmmsg()/sendmmsg()
+#define TP_MAX_FDS 3 // descriptors one message can carry (array frames)
+
+// One message: its buffer and length (receive: room in, length out), and
+// on receive the descriptors that came with it (the caller owns them)
+typedef struct { void *buf; size_t len; int fd[TP_MAX_FDS]; unsigned nfd; } tp_msg_t;
+
+// Control buffer of a message with up to TP_MAX_FDS descriptors
+typedef union { struct cmsghdr h; char buf[CMSG_SPACE(TP_MAX_FDS*sizeof(int))]; } tp_ctl_t;
+
+// Take the descriptors of a received message into m (closing any beyond TP_MAX_FDS)
+static inline void tp_take_fds(const struct msghdr *mh, tp_msg_t *m){
+    m->nfd=0;
+    for(struct cmsghdr *ch=CMSG_FIRSTHDR(mh); ch; ch=CMSG_NXTHDR((struct msghdr*)mh,ch)){
+        if(ch->cmsg_level!=SOL_SOCKET || ch->cmsg_type!=SCM_RIGHTS) continue;
+        size_t k=(ch->cmsg_len-CMSG_LEN(0))/sizeof(int);
+        for(size_t j=0;j<k;j++){
+            int fd; memcpy(&fd,CMSG_DATA(ch)+j*sizeof(int),sizeof(fd));
+            if(m->nfd<TP_MAX_FDS) m->fd[m->nfd++]=fd;
+            else close(fd);
+        }
+    }
+}
+
+static inline void tp_close_fds(tp_msg_t *m){
+    for(unsigned i=0;i<m->nfd;i++) close(m->fd[i]);
+    m->nfd=0;
+}
+
+// Receive up to n (<= TP_BATCH) queued messages without blocking. Returns
+// how many arrived (a zero-length message marks EOF: the peer closed), or
+// -1 with errno (EAGAIN: nothing queued). Descriptors arrive close-on-exec.
+static inline int tp_recv_many(int fd, tp_msg_t *msg, unsigned n){
+#ifdef __linux__
+    struct mmsghdr mh[TP_BATCH]; struct iovec iov[TP_BATCH]; tp_ctl_t ctl[TP_BATCH];
+    memset(mh,0,n*sizeof(mh[0]));
+    for(unsigned i=0;i<n;i++){
+        iov[i].iov_base=msg[i].buf; iov[i].iov_len=msg[i].len;
+        mh[i].msg_hdr.msg_iov=&iov[i]; mh[i].msg_hdr.msg_iovlen=1;
+        mh[i].msg_hdr.msg_control=ctl[i].buf; mh[i].msg_hdr.msg_controllen=sizeof(ctl[i].buf);
+    }
+    int got=recvmmsg(fd,mh,n,MSG_DONTWAIT|MSG_CMSG_CLOEXEC,NULL);
+    for(int i=0;i<got;i++){ msg[i].len=mh[i].msg_len; tp_take_fds(&mh[i].msg_hdr,&msg[i]); }
+    return got;
+#else
+    unsigned got=0;
+    for(;got<n;got++){
+        struct iovec iov={ msg[got].buf, msg[got].len }; tp_ctl_t ctl;
+        struct msghdr mh; memset(&mh,0,sizeof(mh));
+        mh.msg_iov=&iov; mh.msg_iovlen=1; mh.msg_control=ctl.buf; mh.msg_controllen=sizeof(ctl.buf);
+        ssize_t r=recvmsg(fd,&mh,MSG_DONTWAIT);
+        if(r<0) return got ? (int)got : -1;
+        msg[got].len=(size_t)r;
+        tp_take_fds(&mh,&msg[got]);
+        if(r==0){ got++; break; }
+    }
+    return (int)got;
+#endif
+}
+
+// Send one message with descriptors attached, blocking while the socket is
+// full; 0, or -1 with errno
+static inline int tp_send_fds(int fd, const void *buf, size_t len, const int *fds, unsigned nfd){
+    struct iovec iov={ (void*)buf, len }; tp_ctl_t ctl;
+    struct msghdr mh; memset(&mh,0,sizeof(mh));
+    mh.msg_iov=&iov; mh.msg_iovlen=1;
+    if(nfd){
+        memset(&ctl,0,sizeof(ctl));
+        mh.msg_control=ctl.buf; mh.msg_controllen=CMSG_SPACE(nfd*sizeof(int));
+        struct cmsghdr *ch=CMSG_FIRSTHDR(&mh);
+        ch->cmsg_level=SOL_SOCKET; ch->cmsg_type=SCM_RIGHTS; ch->cmsg_len=CMSG_LEN(nfd*sizeof(int));
+        memcpy(CMSG_DATA(ch),fds,nfd*sizeof(int));
+    }
+    ssize_t w;
+    while((w=sendmsg(fd,&mh,MSG_NOSIGNAL))<0 && errno==EINTR){}
+    return w<0 ? -1 : 0;
+}
+
+// Send up to n (<= TP_BATCH) messages without blocking. Returns how many
+// went out (fewer than n once the socket buffer is full), or -1 with errno
+// (EAGAIN: none fit; EPIPE/ECONNRESET: the peer is gone).
+static inline int tp_send_many(int fd, const tp_msg_t *msg, unsigned n){
+#ifdef __linux__
+    struct mmsghdr mh[TP_BATCH]; struct iovec iov[TP_BATCH];
+    memset(mh,0,n*sizeof(mh[0]));
+    for(unsigned i=0;i<n;i++){
+        iov[i].iov_base=msg[i].buf; iov[i].iov_len=msg[i].len;
+        mh[i].msg_hdr.msg_iov=&iov[i]; mh[i].msg_hdr.msg_iovlen=1;
+    }
+    return sendmmsg(fd,mh,n,MSG_DONTWAIT|MSG_NOSIGNAL);
+#else
+    unsigned sent=0;
+    for(;sent<n;sent++)
+        if(send(fd,msg[sent].buf,msg[sent].len,MSG_DONTWAIT|MSG_NOSIGNAL)<0) return sent ? (int)sent : -1;
+    return (int)sent;
+#endif
+}
+
+#endif // ARITH_TRANSPORT_H
@@ -0,0 +1,283 @@
+// uring.c
+// io_uring ring behind uring.h.
+
+#define _GNU_SOURCE
+#include <stdlib.h>     // calloc, free, realloc
+#include <string.h>     // memset
+#include <errno.h>      // errno
+
+#include "uring.h"
+
+#ifdef __linux__
+#include <unistd.h>       // close, syscall
+#include <poll.h>         // POLLIN
+#include <stdatomic.h>    // atomic_uint, atomic_load_explicit, ...
+#include <sys/mman.h>     // mmap, munmap
+#include <sys/uio.h>      // struct iovec
+#include <sys/syscall.h>  // __NR_io_uring_setup, __NR_io_uring_enter, __NR_io_uring_register
+#include <linux/io_uring.h>
+
+// A provided-buffer ring and the buffers it hands out
+typedef struct {
+    struct io_uring_buf_ring *br; // shared with the kernel
+    char    *mem;                 // n buffers of len bytes
+    unsigned n;
+    size_t   len;
+    uint16_t tail;                // local copy of br->tail
+} group_t;
+
+struct uring {
+    int      fd;
+    bool     sqpoll;
+    void    *sq_map, *cq_map; size_t sq_map_len, cq_map_len; // cq_map == sq_map with IORING_FEAT_SINGLE_MMAP
+    struct io_uring_sqe *sqes; size_t sqes_len;
+    atomic_uint *sq_head, *sq_tail, *sq_flags;
+    unsigned sq_mask, sq_entries;
+    unsigned sqe_tail;            // submissions prepared (published to *sq_tail by uring_wait)
+    atomic_uint *cq_head, *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+    char    *buf; size_t buf_len; // fixed buffer 0 (NULL: none)
+    group_t *groups; unsigned n_groups;
+};
+
+static int sys_setup(unsigned entries, struct io_uring_params *p){ return (int)syscall(__NR_io_uring_setup,entries,p); }
+static int sys_enter(int fd, unsigned submit, unsigned wait, unsigned flags, void *arg, size_t argsz){
+    return (int)syscall(__NR_io_uring_enter,fd,submit,wait,flags,arg,argsz);
+}
+static int sys_register(int fd, unsigned op, void *arg, unsigned n){ return (int)syscall(__NR_io_uring_register,fd,op,arg,n); }
+
+uring_t *uring_create(unsigned entries, unsigned flags){
+    uring_t *u=calloc(1,sizeof(*u));
+    if(!u) return NULL;
+    struct io_uring_params p; memset(&p,0,sizeof(p));
+    if(flags&URING_SQPOLL){ p.flags=IORING_SETUP_SQPOLL; p.sq_thread_idle=1000; } // ms of idleness before it sleeps
+    else p.flags=IORING_SETUP_COOP_TASKRUN; // completions are run when we enter, not by interrupting us
+    u->fd=sys_setup(entries,&p);
+    if(u->fd<0 && errno==EINVAL && !(flags&URING_SQPOLL)){ p.flags=0; u->fd=sys_setup(entries,&p); } // before Linux 5.19
+    if(u->fd<0){ free(u); return NULL; }
+    u->sqpoll=(flags&URING_SQPOLL)!=0;
+    if(!(p.features&IORING_FEAT_EXT_ARG)){ close(u->fd); free(u); errno=EOPNOTSUPP; return NULL; } // timed waits: Linux 5.11
+
+    u->sq_map_len=p.sq_off.array+p.sq_entries*sizeof(unsigned);
+    u->cq_map_len=p.cq_off.cqes+p.cq_entries*sizeof(struct io_uring_cqe);
+    bool single=(p.features&IORING_FEAT_SINGLE_MMAP)!=0;
+    if(single && u->cq_map_len>u->sq_map_len) u->sq_map_len=u->cq_map_len;
+    u->sq_map=mmap(NULL,u->sq_map_len,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,u->fd,IORING_OFF_SQ_RING);
+    u->cq_map= single ? u->sq_map : mmap(NULL,u->cq_map_len,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,u->fd,IORING_OFF_CQ_RING);
+    u->sqes_len=p.sq_entries*sizeof(struct io_uring_sqe);
+    u->sqes=mmap(NULL,u->sqes_len,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,u->fd,IORING_OFF_SQES);
+    if(u->sq_map==MAP_FAILED || u->cq_map==MAP_FAILED || u->sqes==MAP_FAILED){
+        int e=errno;
+        if(u->sqes!=MAP_FAILED) munmap(u->sqes,u->sqes_len);
+        if(!single && u->cq_map!=MAP_FAILED) munmap(u->cq_map,u->cq_map_len);
+        if(u->sq_map!=MAP_FAILED) munmap(u->sq_map,u->sq_map_len);
+        close(u->fd); free(u); errno=e; return NULL;
+    }
+    char *sq=u->sq_map, *cq=u->cq_map;
+    u->sq_head=(atomic_uint*)(sq+p.sq_off.head); u->sq_tail=(atomic_uint*)(sq+p.sq_off.tail);
+    u->sq_flags=(atomic_uint*)(sq+p.sq_off.flags);
+    u->sq_mask=*(unsigned*)(sq+p.sq_off.ring_mask); u->sq_entries=p.sq_entries;
+    unsigned *array=(unsigned*)(sq+p.sq_off.array);
+    for(unsigned i=0;i<p.sq_entries;i++) array[i]=i; // SQE i always sits in slot i
+    u->sqe_tail=atomic_load_explicit(u->sq_tail,memory_order_relaxed);
+    u->cq_head=(atomic_uint*)(cq+p.cq_off.head); u->cq_tail=(atomic_uint*)(cq+p.cq_off.tail);
+    u->cq_mask=*(unsigned*)(cq+p.cq_off.ring_mask);
+    u->cqes=(struct io_uring_cqe*)(cq+p.cq_off.cqes);
+    return u;
+}
+
+void uring_destroy(uring_t *u){
+    if(!u) return;
+    for(unsigned g=0;g<u->n_groups;g++){
+        if(!u->groups[g].br) continue;
+        munmap(u->groups[g].br,u->groups[g].n*sizeof(struct io_uring_buf));
+        free(u->groups[g].mem);
+    }
+    free(u->groups);
+    munmap(u->sqes,u->sqes_len);
+    if(u->cq_map!=u->sq_map) munmap(u->cq_map,u->cq_map_len);
+    munmap(u->sq_map,u->sq_map_len);
+    close(u->fd); free(u); // closing the ring cancels whatever is still in flight
+}
+
+bool uring_supports(uring_t *u, unsigned op){
+    struct io_uring_probe *p=calloc(1,sizeof(*p)+256*sizeof(struct io_uring_probe_op));
+    if(!p) return false;
+    bool ok= sys_register(u->fd,IORING_REGISTER_PROBE,p,256)==0 && op<=p->last_op && op<p->ops_len
+             && (p->ops[op].flags&IO_URING_OP_SUPPORTED);
+    free(p);
+    return ok;
+}
+
+int uring_files_init(uring_t *u, unsigned n){
+    struct io_uring_rsrc_register r; memset(&r,0,sizeof(r));
+    r.nr=n; r.flags=IORING_RSRC_REGISTER_SPARSE;
+    return sys_register(u->fd,IORING_REGISTER_FILES2,&r,sizeof(r))<0 ? -1 : 0;
+}
+
+int uring_file_set(uring_t *u, unsigned slot, int fd){
+    struct io_uring_files_update up; memset(&up,0,sizeof(up));
+    up.offset=slot; up.fds=(uint64_t)(uintptr_t)&fd;
+    return sys_register(u->fd,IORING_REGISTER_FILES_UPDATE,&up,1)<0 ? -1 : 0;
+}
+
+int uring_buffer_init(uring_t *u, void *base, size_t len){
+    struct iovec iov={ .iov_base=base, .iov_len=len };
+    if(sys_register(u->fd,IORING_REGISTER_BUFFERS,&iov,1)<0) return -1;
+    u->buf=base; u->buf_len=len;
+    return 0;
+}
+
+int uring_group_init(uring_t *u, uint16_t group, unsigned n, size_t len){
+    if(group>=u->n_groups){
+        group_t *g=realloc(u->groups,(group+1u)*sizeof(*g));
+        if(!g) return -1;
+        memset(g+u->n_groups,0,(group+1u-u->n_groups)*sizeof(*g));
+        u->groups=g; u->n_groups=group+1u;
+    }
+    group_t *g=&u->groups[group];
+    g->br=mmap(NULL,n*sizeof(struct io_uring_buf),PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0); // page aligned
+    g->mem=malloc(n*len);
+    if(g->br==MAP_FAILED || !g->mem){
+        if(g->br!=MAP_FAILED) munmap(g->br,n*sizeof(struct io_uring_buf));
+        free(g->mem); memset(g,0,sizeof(*g)); errno=ENOMEM; return -1;
+    }
+    g->n=n; g->len=len; g->tail=0;
+    struct io_uring_buf_reg reg; memset(&reg,0,sizeof(reg));
+    reg.ring_addr=(uint64_t)(uintptr_t)g->br; reg.ring_entries=n; reg.bgid=group;
+    if(sys_register(u->fd,IORING_REGISTER_PBUF_RING,&reg,1)<0){
+        int e=errno;
+        munmap(g->br,n*sizeof(struct io_uring_buf)); free(g->mem); memset(g,0,sizeof(*g));
+        errno=e; return -1;
+    }
+    for(unsigned i=0;i<n;i++) uring_group_recycle(u,group,i);
+    return 0;
+}
+
+void *uring_group_buf(uring_t *u, uint16_t group, unsigned bid){
+    return u->groups[group].mem+(size_t)bid*u->groups[group].len;
+}
+
+// Hand buffer bid back to the kernel
+void uring_group_recycle(uring_t *u, uint16_t group, unsigned bid){
+    group_t *g=&u->groups[group];
+    struct io_uring_buf *b=&g->br->bufs[g->tail&(g->n-1)];
+    b->addr=(uint64_t)(uintptr_t)uring_group_buf(u,group,bid); b->len=(uint32_t)g->len; b->bid=(uint16_t)bid;
+    g->tail++;
+    atomic_store_explicit((_Atomic uint16_t*)&g->br->tail,g->tail,memory_order_release);
+}
+
+// Tell the kernel about the prepared submissions (without SQPOLL it only
+// reads them on io_uring_enter); returns the count it has not consumed yet
+static unsigned publish(uring_t *u){
+    atomic_store_explicit(u->sq_tail,u->sqe_tail,memory_order_release);
+    return u->sqe_tail-atomic_load_explicit(u->sq_head,memory_order_acquire);
+}
+
+static int enter(uring_t *u, unsigned wait, int timeout_ms){
+    unsigned submit=publish(u), flags=0;
+    if(u->sqpoll){
+        atomic_thread_fence(memory_order_seq_cst); // the tail store before the flag load
+        if(atomic_load_explicit(u->sq_flags,memory_order_relaxed)&IORING_SQ_NEED_WAKEUP) flags|=IORING_ENTER_SQ_WAKEUP;
+        submit=0;
+    }
+    if(!wait && !submit && !flags) return 0;
+    struct __kernel_timespec ts; struct io_uring_getevents_arg arg; memset(&arg,0,sizeof(arg));
+    void *argp=NULL; size_t argsz=0;
+    if(wait){
+        flags|=IORING_ENTER_GETEVENTS;
+        if(timeout_ms>=0){
+            ts.tv_sec=timeout_ms/1000; ts.tv_nsec=(long long)(timeout_ms%1000)*1000000;
+            arg.ts=(uint64_t)(uintptr_t)&ts; argp=&arg; argsz=sizeof(arg);
+            flags|=IORING_ENTER_EXT_ARG;
+        }
+    }
+    int r=sys_enter(u->fd,submit,wait,flags,argp,argsz);
+    if(r<0 && (errno==ETIME || errno==EINTR || errno==EBUSY || errno==EAGAIN)) return 0; // EBUSY/EAGAIN: reap first
+    return r<0 ? -1 : 0;
+}
+
+static struct io_uring_sqe *sqe_get(uring_t *u){
+    while(u->sqe_tail-atomic_load_explicit(u->sq_head,memory_order_acquire)>=u->sq_entries)
+        if(enter(u,0,0)<0) return NULL; // full: hand the queued ones over first
+    struct io_uring_sqe *s=&u->sqes[u->sqe_tail&u->sq_mask];
+    memset(s,0,sizeof(*s));
+    u->sqe_tail++;
+    return s;
+}
+
+int uring_read_multishot(uring_t *u, int fd, uint16_t group, uint64_t data){
+    struct io_uring_sqe *s=sqe_get(u);
+    if(!s) return -1;
+    s->opcode=URING_OP_READ_MULTISHOT; s->fd=fd; s->flags=IOSQE_BUFFER_SELECT;
+    s->buf_group=group; s->user_data=data; // len 0: the whole buffer
+    return 0;
+}
+
+int uring_write(uring_t *u, unsigned slot, const void *buf, unsigned len, bool link, uint64_t data){
+    struct io_uring_sqe *s=sqe_get(u);
+    if(!s) return -1;
+    const char *p=buf;
+    bool fixed= u->buf && p>=u->buf && p+len<=u->buf+u->buf_len;
+    s->opcode= fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+    s->fd=(int)slot; s->flags=IOSQE_FIXED_FILE|(link ? IOSQE_IO_LINK : 0);
+    s->addr=(uint64_t)(uintptr_t)buf; s->len=len; s->off=(uint64_t)-1; // a FIFO has no offset
+    s->buf_index=0; s->user_data=data;
+    return 0;
+}
+
+int uring_poll_multishot(uring_t *u, int fd, uint64_t data){
+    struct io_uring_sqe *s=sqe_get(u);
+    if(!s) return -1;
+    s->opcode=IORING_OP_POLL_ADD; s->fd=fd; s->len=IORING_POLL_ADD_MULTI;
+    s->poll32_events=POLLIN; s->user_data=data;
+    return 0;
+}
+
+int uring_cancel(uring_t *u, uint64_t target, uint64_t data){
+    struct io_uring_sqe *s=sqe_get(u);
+    if(!s) return -1;
+    s->opcode=IORING_OP_ASYNC_CANCEL; s->fd=-1; s->addr=target; s->user_data=data;
+    return 0;
+}
+
+int uring_wait(uring_t *u, int timeout_ms){
+    bool ready= atomic_load_explicit(u->cq_tail,memory_order_acquire)!=atomic_load_explicit(u->cq_head,memory_order_relaxed);
+    return enter(u, ready || timeout_ms==0 ? 0 : 1, timeout_ms);
+}
+
+bool uring_next(uring_t *u, uring_cqe_t *out){
+    unsigned head=atomic_load_explicit(u->cq_head,memory_order_relaxed);
+    if(head==atomic_load_explicit(u->cq_tail,memory_order_acquire)) return false;
+    const struct io_uring_cqe *c=&u->cqes[head&u->cq_mask];
+    out->data=c->user_data; out->res=c->res; out->flags=c->flags;
+    atomic_store_explicit(u->cq_head,head+1,memory_order_release);
+    return true;
+}
+
+bool uring_cqe_more(const uring_cqe_t *c){ return (c->flags&IORING_CQE_F_MORE)!=0; }
+int uring_cqe_buffer(const uring_cqe_t *c){ return c->flags&IORING_CQE_F_BUFFER ? (int)(c->flags>>IORING_CQE_BUFFER_SHIFT) : -1; }
+
+#else // ---- no io_uring outside Linux ----
+
+uring_t *uring_create(unsigned entries, unsigned flags){ (void)entries; (void)flags; errno=ENOSYS; return NULL; }
+void uring_destroy(uring_t *u){ (void)u; }
+bool uring_supports(uring_t *u, unsigned op){ (void)u; (void)op; return false; }
+int uring_files_init(uring_t *u, unsigned n){ (void)u; (void)n; errno=ENOSYS; return -1; }
+int uring_file_set(uring_t *u, unsigned slot, int fd){ (void)u; (void)slot; (void)fd; errno=ENOSYS; return -1; }
+int uring_buffer_init(uring_t *u, void *base, size_t len){ (void)u; (void)base; (void)len; errno=ENOSYS; return -1; }
+int uring_group_init(uring_t *u, uint16_t group, unsigned n, size_t len){ (void)u; (void)group; (void)n; (void)len; errno=ENOSYS; return -1; }
+void *uring_group_buf(uring_t *u, uint16_t group, unsigned bid){ (void)u; (void)group; (void)bid; return NULL; }
+void uring_group_recycle(uring_t *u, uint16_t group, unsigned bid){ (void)u; (void)group; (void)bid; }
+int uring_read_multishot(uring_t *u, int fd, uint16_t group, uint64_t data){ (void)u; (void)fd; (void)group; (void)data; errno=ENOSYS; return -1; }
+int uring_write(uring_t *u, unsigned slot, const void *buf, unsigned len, bool link, uint64_t data){
+    (void)u; (void)slot; (void)buf; (void)len; (void)link; (void)data; errno=ENOSYS; return -1;
+}
+int uring_poll_multishot(uring_t *u, int fd, uint64_t data){ (void)u; (void)fd; (void)data; errno=ENOSYS; return -1; }
+int uring_cancel(uring_t *u, uint64_t target, uint64_t data){ (void)u; (void)target; (void)data; errno=ENOSYS; return -1; }
+int uring_wait(uring_t *u, int timeout_ms){ (void)u; (void)timeout_ms; errno=ENOSYS; return -1; }
+bool uring_next(uring_t *u, uring_cqe_t *out){ (void)u; (void)out; return false; }
+bool uring_cqe_more(const uring_cqe_t *c){ (void)c; return false; }
+int uring_cqe_buffer(const uring_cqe_t *c){ (void)c; return -1; }
+#endif
@@ -0,0 +1,71 @@
+// uring.h
+// Minimal io_uring ring used by the server's io_uring engine, on the raw
+// system calls (no liburing). Submissions are queued in the ring and go to
+// the kernel with the next uring_wait(), so one io_uring_enter() both submits
+// everything a loop pass queued and waits for completions. With
+// URING_SQPOLL a kernel thread picks submissions up by itself and
+// uring_wait() only enters the kernel to wait. Linux only: elsewhere
+// uring_create() fails with ENOSYS.
+
+#ifndef ARITH_URING_H
+#define ARITH_URING_H
+
+#include <stdbool.h>    // bool
+#include <stddef.h>     // size_t
+#include <stdint.h>     // uint64_t, int32_t, uint32_t, uint16_t
+
+// IORING_OP_READ_MULTISHOT (Linux 6.7); older uapi headers lack the name
+#define URING_OP_READ_MULTISHOT 49
+
+#define URING_SQPOLL 0x1u // uring_create(): kernel thread polls the submission queue
+
+typedef struct uring uring_t;
+
+typedef struct {
+    uint64_t data;    // as submitted
+    int32_t  res;     // result, -errno on failure
+    uint32_t flags;   // IORING_CQE_F_* (see uring_cqe_more, uring_cqe_buffer)
+} uring_cqe_t;
+
+// Create a ring for `entries` submissions; NULL on failure (errno set: ENOSYS
+// without io_uring, EPERM when disabled by policy, EOPNOTSUPP when the kernel
+// lacks the timed wait this wrapper needs)
+uring_t *uring_create(unsigned entries, unsigned flags);
+void uring_destroy(uring_t *u);
+// Whether the kernel implements opcode `op` (IORING_OP_*)
+bool uring_supports(uring_t *u, unsigned op);
+
+// Registered files: a table of n empty slots, then set a slot to fd (-1 => empty)
+int uring_files_init(uring_t *u, unsigned n);
+int uring_file_set(uring_t *u, unsigned slot, int fd);
+// Register [base, base+len) as fixed buffer 0 (writes from it skip the page pinning)
+int uring_buffer_init(uring_t *u, void *base, size_t len);
+// Provided-buffer ring `group`: n (power of two) buffers of len bytes each,
+// handed to multishot reads one per completion
+int uring_group_init(uring_t *u, uint16_t group, unsigned n, size_t len);
+void *uring_group_buf(uring_t *u, uint16_t group, unsigned bid);
+void uring_group_recycle(uring_t *u, uint16_t group, unsigned bid);
+
+// Queue a submission (-1 only if the ring failed)
+int uring_read_multishot(uring_t *u, int fd, uint16_t group, uint64_t data);
+// Write to registered file `slot`; `link`: the next submission starts only
+// after this one succeeded in full (fails with -ECANCELED otherwise)
+int uring_write(uring_t *u, unsigned slot, const void *buf, unsigned len, bool link, uint64_t data);
+// Multishot POLLIN watch on fd
+int uring_poll_multishot(uring_t *u, int fd, uint64_t data);
+// Cancel the submission tagged `target` (its last completion comes with
+// -ECANCELED unless it was over already); the cancel completes as `data`
+int uring_cancel(uring_t *u, uint64_t target, uint64_t data);
+
+// Submit what is queued and wait up to timeout_ms (-1 => forever, 0 => no
+// wait) for a completion; 0 on success, timeout or signal, -1 on error
+int uring_wait(uring_t *u, int timeout_ms);
+// Take the next completion; false when none is left
+bool uring_next(uring_t *u, uring_cqe_t *out);
+
+// The submission stays armed and will complete again
+bool uring_cqe_more(const uring_cqe_t *c);
+// Provided buffer a completion filled, -1 if none
+int uring_cqe_buffer(const uring_cqe_t *c);
+
+#endif // ARITH_URING_H